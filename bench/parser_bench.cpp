@@ -0,0 +1,172 @@
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "http/request.hpp"
+#include "http/scan.hpp"
+#include "support.hpp"
+
+#define ROUNDS 200000
+
+// clang-format off
+static const std::string request =
+    "GET /docs/index.html?lang=en&page=2 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Referer: https://www.example.com/docs/\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=8f2a6c1e9b7d4e3f; theme=dark; consent=1\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "If-Modified-Since: Tue, 15 Oct 2024 08:12:31 GMT\r\n"
+    "If-None-Match: \"5f3a-61c2b9e4d1f80\"\r\n"
+    "Priority: u=0, i\r\n"
+    "\r\n";
+// clang-format on
+
+/* Keeps the compiler from dropping the measured loops. */
+static volatile size_t g_sink;
+
+static void report(const char *name, uint64_t elapsed)
+{
+    std::printf("    %-32s %6.2f cycles/byte\n", name, (double)elapsed / ROUNDS / request.size());
+}
+
+int main()
+{
+    init_tables();
+
+    const char *data = request.data();
+    size_t size = request.size();
+    size_t sink = 0;
+
+    CHECK(scan_header_end(data, size, 0) == request.find("\r\n\r\n"));
+    CHECK(scan_crlf(data, size, 0) == request.find("\r\n"));
+    CHECK(scan_byte(data, size, 0, ':') == request.find(':'));
+    CHECK(scan_byte(data, size, 0, '\0') == (size_t)-1);
+    CHECK(scan_crlf(data, size, size - 3) == size - 2);
+    CHECK(scan_header_end(data, size - 1, 0) == (size_t)-1);
+
+    std::printf("parser_bench: %zu byte request, %d rounds\n", size, ROUNDS);
+
+    uint64_t start = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        Request req;
+        sink += req.parse(data, size).is_ok();
+    }
+    report("Request::parse", cycles() - start);
+
+    start = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+        sink += scan_header_end(data, size, i & 1);
+    report("scan_header_end", cycles() - start);
+
+    start = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+        sink += request.find("\r\n\r\n", i & 1);
+    report("std::string::find(\"\\r\\n\\r\\n\")", cycles() - start);
+
+    // Every line of the request, the way the parser walks the headers.
+    start = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        size_t pos = 0;
+        size_t end;
+        while ((end = scan_crlf(data, size, pos)) != (size_t)-1)
+        {
+            sink += end;
+            pos = end + 2;
+        }
+    }
+    report("scan_crlf, every line", cycles() - start);
+
+    start = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        size_t pos = 0;
+        size_t end;
+        while ((end = request.find("\r\n", pos)) != std::string::npos)
+        {
+            sink += end;
+            pos = end + 2;
+        }
+    }
+    report("std::string::find(\"\\r\\n\")", cycles() - start);
+
+    // The colon of every header, the short searches the parser does.
+    start = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        size_t pos = 0;
+        size_t end;
+        while ((end = scan_byte(data, size, pos, ':')) != (size_t)-1)
+        {
+            sink += end;
+            pos = end + 1;
+        }
+    }
+    report("scan_byte, every colon", cycles() - start);
+
+    start = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        const char *p = data;
+        while ((p = (const char *)std::memchr(p, ':', data + size - p)) != NULL)
+        {
+            sink += p - data;
+            p++;
+        }
+    }
+    report("memchr, every colon", cycles() - start);
+
+    // The whole request for a byte it does not contain, which is the longest a search can be.
+    start = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+        sink += scan_byte(data, size, i & 1, '\0');
+    report("scan_byte, not found", cycles() - start);
+
+    start = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+        sink += std::memchr(data + (i & 1), '\0', size - (i & 1)) != NULL;
+    report("memchr, not found", cycles() - start);
+
+    // Every header name, the way the parser checks them.
+    std::vector<StringView> names;
+    for (size_t pos = request.find("\r\n") + 2; pos < size - 2; pos = request.find("\r\n", pos) + 2)
+        names.push_back(StringView(data + pos, request.find(':', pos) - pos));
+
+    start = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+        for (size_t j = 0; j < names.size(); j++)
+            sink += scan_is_token(names[j].data(), names[j].size());
+    report("scan_is_token, every name", cycles() - start);
+
+    bool tokens[256];
+    for (int c = 0; c < 256; c++)
+        tokens[c] = std::isalnum(c) || (c != 0 && std::strchr("!#$%&'*+-.^_`|~", c) != NULL);
+
+    start = cycles();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        for (size_t j = 0; j < names.size(); j++)
+        {
+            size_t k = 0;
+            while (k < names[j].size() && tokens[(unsigned char)names[j][k]])
+                k++;
+            sink += k == names[j].size();
+        }
+    }
+    report("lookup table, every name", cycles() - start);
+
+    g_sink = sink;
+    return g_failures != 0;
+}
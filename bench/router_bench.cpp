@@ -0,0 +1,121 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#include "router.hpp"
+#include "support.hpp"
+
+#define LOCATIONS 1000
+#define LOOKUPS 200000
+
+/*
+    What routing did before the trie: every location is compared with the path and the longest one matching on a
+    segment boundary wins.
+ */
+static Location *linear_match(std::vector<Location>& locations, StringView path)
+{
+    Location *best = NULL;
+
+    for (size_t i = 0; i < locations.size(); i++)
+    {
+        const std::string& route = locations[i].route();
+        if (route.size() > path.size() || path.substr(0, route.size()) != route)
+            continue;
+        if (path.size() != route.size() && route[route.size() - 1] != '/' && path[route.size()] != '/')
+            continue;
+        if (!best || route.size() > best->route().size())
+            best = &locations[i];
+    }
+    return best;
+}
+
+/*
+    A server with `LOCATIONS` locations, ten groups of services with a few versions each.
+ */
+static std::string write_config()
+{
+    char path[] = "/tmp/webserv-router-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return "";
+    close(fd);
+
+    std::ofstream file(path);
+    file << "server {\n    server_name \"bench\"\n    listen \"127.0.0.1:9999\"\n";
+    file << "    location \"/\" {\n        root \"sites\"\n    }\n";
+    for (int i = 1; i < LOCATIONS; i++)
+    {
+        file << "    location \"/group" << i % 10 << "/service" << i / 10;
+        if (i % 3)
+            file << "/v" << i % 3;
+        file << "\" {\n        root \"sites\"\n    }\n";
+    }
+    file << "}\n";
+    return path;
+}
+
+static std::vector<std::string> make_paths()
+{
+    std::vector<std::string> paths;
+
+    for (int i = 0; i < 1024; i++)
+    {
+        std::ostringstream ss;
+        int n = (i * 7919) % (LOCATIONS + 100);
+        ss << "/group" << n % 10 << "/service" << n / 10 << "/v" << n % 4 << "/items/" << i;
+        paths.push_back(ss.str());
+    }
+    paths.push_back("/");
+    paths.push_back("/group1");
+    paths.push_back("/group1/service12");
+    paths.push_back("/group1/service123");
+    return paths;
+}
+
+int main()
+{
+    init_tables();
+
+    std::string path = write_config();
+    Config config;
+    Result<int, ConfigError> res = config.load_from_file(path);
+    unlink(path.c_str());
+    if (res.is_err() || config.servers().empty())
+    {
+        std::cerr << "router_bench: cannot load the configuration\n";
+        return 1;
+    }
+
+    ServerConfig& server = config.servers()[0];
+    std::vector<Location>& locations = server.locations();
+    Router router(server);
+    std::vector<std::string> paths = make_paths();
+
+    // The router owns a copy of the locations, results are compared by route.
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        Location *trie = router.match(paths[i]);
+        Location *linear = linear_match(locations, paths[i]);
+        CHECK(trie && linear);
+        if (trie && linear)
+            CHECK(trie->route() == linear->route());
+    }
+
+    size_t found = 0;
+    double start = seconds();
+    for (size_t i = 0; i < LOOKUPS; i++)
+        found += router.match(paths[i % paths.size()]) != NULL;
+    double trie_time = seconds() - start;
+
+    start = seconds();
+    for (size_t i = 0; i < LOOKUPS; i++)
+        found += linear_match(locations, paths[i % paths.size()]) != NULL;
+    double linear_time = seconds() - start;
+
+    std::printf("router_bench: %zu locations, %d lookups (%zu found)\n", locations.size(), LOOKUPS, found);
+    std::printf("    trie:   %8.1f ns/lookup\n", trie_time / LOOKUPS * 1e9);
+    std::printf("    linear: %8.1f ns/lookup (%.1fx)\n", linear_time / LOOKUPS * 1e9, linear_time / trie_time);
+
+    return g_failures != 0;
+}
@@ -0,0 +1,129 @@
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "arena.hpp"
+
+#define ARENA_ALIGN sizeof(void *)
+
+Arena::Arena() : m_first(NULL), m_current(NULL), m_block_allocations(0)
+{
+}
+
+Arena::~Arena()
+{
+    _free(m_first);
+}
+
+/*
+    A block with room for at least `size` bytes.
+ */
+Arena::Block *Arena::_new_block(size_t size)
+{
+    bool pooled = size <= BUFFER_CHUNK_SIZE - sizeof(Block);
+    Block *block;
+
+    if (pooled)
+    {
+        block = (Block *)g_buffer_pool.acquire();
+        size = BUFFER_CHUNK_SIZE - sizeof(Block);
+    }
+    else
+        block = (Block *)std::malloc(sizeof(Block) + size);
+    if (!block)
+        throw std::bad_alloc();
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    block->pooled = pooled;
+    m_block_allocations++;
+    return block;
+}
+
+/*
+    Free `block` and the ones after it.
+ */
+void Arena::_free(Block *block)
+{
+    while (block)
+    {
+        Block *next = block->next;
+        if (block->pooled)
+            g_buffer_pool.release((char *)block);
+        else
+            std::free(block);
+        block = next;
+    }
+}
+
+void *Arena::alloc(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (m_current == NULL)
+    {
+        m_first = _new_block(size);
+        m_current = m_first;
+    }
+
+    // Allocations which do not fit in a chunk get a block of their own.
+    while (m_current->used + size > m_current->size)
+    {
+        if (m_current->next == NULL)
+            m_current->next = _new_block(size);
+        m_current = m_current->next;
+    }
+
+    void *ptr = _data(m_current) + m_current->used;
+    m_current->used += size;
+    return ptr;
+}
+
+StringView Arena::dup(StringView s)
+{
+    char *ptr = (char *)alloc(s.size() + 1);
+
+    std::memcpy(ptr, s.data(), s.size());
+    ptr[s.size()] = '\0';
+    return StringView(ptr, s.size());
+}
+
+StringView Arena::concat(StringView a, StringView b, StringView c, StringView d)
+{
+    size_t size = a.size() + b.size() + c.size() + d.size();
+    char *ptr = (char *)alloc(size + 1);
+    char *p = ptr;
+
+    std::memcpy(p, a.data(), a.size());
+    p += a.size();
+    std::memcpy(p, b.data(), b.size());
+    p += b.size();
+    std::memcpy(p, c.data(), c.size());
+    p += c.size();
+    std::memcpy(p, d.data(), d.size());
+    ptr[size] = '\0';
+
+    return StringView(ptr, size);
+}
+
+void Arena::reset()
+{
+    if (m_first == NULL)
+        return;
+
+    // Keep the first block and release the others, a request which needed a lot of memory should
+    // not keep it for the whole life of the connection.
+    _free(m_first->next);
+
+    m_first->next = NULL;
+    m_first->used = 0;
+    m_current = m_first;
+}
+
+void Arena::release()
+{
+    _free(m_first);
+    m_first = NULL;
+    m_current = NULL;
+}
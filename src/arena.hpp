@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+
+#include "buffer_pool.hpp"
+#include "string.hpp"
+
+/*
+    Bump-pointer allocator for objects which live as long as a request. Allocations are never freed
+    individually, everything is released at once by `reset` or `release`.
+
+    Blocks are chunks of the buffer pool, only allocations which do not fit in a chunk get a block from
+    `malloc`. `reset` keeps the first block for the next request, `release` gives it back too, so an idle
+    connection does not hold any memory.
+ */
+class Arena
+{
+public:
+    Arena();
+    ~Arena();
+
+    void *alloc(size_t size);
+
+    /*
+        Copy `s` in the arena, the copy is followed by a NUL byte.
+     */
+    StringView dup(StringView s);
+
+    /*
+        Concatenate up to 4 strings in the arena, the result is followed by a NUL byte.
+     */
+    StringView concat(StringView a, StringView b, StringView c = StringView(), StringView d = StringView());
+
+    void reset();
+    void release();
+
+    /*
+        Number of blocks taken from the pool or `malloc` since the arena was created.
+     */
+    size_t block_allocations() const
+    {
+        return m_block_allocations;
+    }
+
+private:
+    struct Block
+    {
+        Block *next;
+        size_t size;
+        size_t used;
+        /* Whether the block is a chunk of the buffer pool. */
+        bool pooled;
+    };
+
+    Block *m_first;
+    Block *m_current;
+    size_t m_block_allocations;
+
+    Block *_new_block(size_t size);
+    static void _free(Block *block);
+
+    char *_data(Block *block)
+    {
+        return (char *)block + sizeof(Block);
+    }
+
+    Arena(const Arena& other);
+    Arena& operator=(const Arena& other);
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/*
+    Immutable reference counted byte buffer. Copying a `SharedBuffer` only copies a pointer, which
+    lets the same content be referenced by many responses without duplicating it.
+ */
+class SharedBuffer
+{
+public:
+    SharedBuffer() : m_block(NULL)
+    {
+    }
+
+    SharedBuffer(const std::string& content) : m_block(new Block)
+    {
+        m_block->content = content;
+        m_block->refs = 1;
+    }
+
+    SharedBuffer(const SharedBuffer& other) : m_block(other.m_block)
+    {
+        if (m_block)
+            m_block->refs++;
+    }
+
+    ~SharedBuffer()
+    {
+        _release();
+    }
+
+    SharedBuffer& operator=(const SharedBuffer& other)
+    {
+        if (other.m_block)
+            other.m_block->refs++;
+        _release();
+        m_block = other.m_block;
+        return *this;
+    }
+
+    bool is_null() const
+    {
+        return m_block == NULL;
+    }
+
+    const char *data() const
+    {
+        return m_block ? m_block->content.data() : "";
+    }
+
+    size_t size() const
+    {
+        return m_block ? m_block->content.size() : 0;
+    }
+
+    const std::string& str() const
+    {
+        static const std::string empty;
+        return m_block ? m_block->content : empty;
+    }
+
+private:
+    struct Block
+    {
+        std::string content;
+        size_t refs;
+    };
+
+    Block *m_block;
+
+    void _release()
+    {
+        if (m_block && --m_block->refs == 0)
+            delete m_block;
+        m_block = NULL;
+    }
+};
@@ -0,0 +1,115 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "buffer_pool.hpp"
+
+BufferPool g_buffer_pool;
+
+BufferPool::BufferPool() : m_in_use(0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    for (size_t i = 0; i < m_free.size(); i++)
+        std::free(m_free[i]);
+}
+
+char *BufferPool::acquire()
+{
+    char *chunk;
+
+    if (m_free.empty())
+        chunk = (char *)std::malloc(BUFFER_CHUNK_SIZE);
+    else
+    {
+        chunk = m_free.back();
+        m_free.pop_back();
+    }
+
+    if (chunk)
+        m_in_use++;
+    return chunk;
+}
+
+void BufferPool::release(char *chunk)
+{
+    m_in_use--;
+
+    if (m_free.size() < BUFFER_POOL_MAX_FREE)
+        m_free.push_back(chunk);
+    else
+        std::free(chunk);
+}
+
+RecvBuffer::RecvBuffer() : m_data(NULL), m_size(0), m_capacity(0), m_pooled(false)
+{
+}
+
+RecvBuffer::~RecvBuffer()
+{
+    clear();
+}
+
+char *RecvBuffer::reserve(size_t n)
+{
+    if (m_size + n <= m_capacity)
+        return m_data + m_size;
+
+    if (m_data == NULL && n <= BUFFER_CHUNK_SIZE)
+    {
+        m_data = g_buffer_pool.acquire();
+        if (!m_data)
+            return NULL;
+
+        m_capacity = BUFFER_CHUNK_SIZE;
+        m_pooled = true;
+        return m_data;
+    }
+
+    size_t capacity = m_capacity * 2;
+    if (capacity < m_size + n)
+        capacity = m_size + n;
+
+    char *data;
+
+    if (m_pooled)
+    {
+        data = (char *)std::malloc(capacity);
+        if (!data)
+            return NULL;
+
+        std::memcpy(data, m_data, m_size);
+        g_buffer_pool.release(m_data);
+        m_pooled = false;
+    }
+    else
+    {
+        data = (char *)std::realloc(m_data, capacity);
+        if (!data)
+            return NULL;
+    }
+
+    m_data = data;
+    m_capacity = capacity;
+    return m_data + m_size;
+}
+
+void RecvBuffer::erase(size_t offset, size_t n)
+{
+    std::memmove(m_data + offset, m_data + offset + n, m_size - offset - n);
+    m_size -= n;
+}
+
+void RecvBuffer::clear()
+{
+    if (m_pooled)
+        g_buffer_pool.release(m_data);
+    else
+        std::free(m_data);
+
+    m_data = NULL;
+    m_size = 0;
+    m_capacity = 0;
+    m_pooled = false;
+}
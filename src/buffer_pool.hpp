@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/* Size of the chunks handed out by the pool. */
+#define BUFFER_CHUNK_SIZE 16384
+/* Maximum number of free chunks kept by the pool, the others are returned to the system. */
+#define BUFFER_POOL_MAX_FREE 1024
+
+/*
+    Global pool of fixed-size chunks used as receive buffers and arena blocks.
+ */
+class BufferPool
+{
+public:
+    BufferPool();
+    ~BufferPool();
+
+    char *acquire();
+    void release(char *chunk);
+
+    /*
+        Number of chunks currently borrowed by connections and arenas.
+     */
+    size_t in_use() const
+    {
+        return m_in_use;
+    }
+
+private:
+    std::vector<char *> m_free;
+    size_t m_in_use;
+
+    BufferPool(const BufferPool& other);
+    BufferPool& operator=(const BufferPool& other);
+};
+
+extern BufferPool g_buffer_pool;
+
+/*
+    Contiguous receive buffer of a connection.
+
+    The buffer starts empty and borrows a chunk from the pool when data arrives. If a request does
+    not fit in one chunk (e.g. an upload), the content moves to a heap allocation which grows
+    geometrically. `clear` gives the memory back, so idle connections do not hold any buffer.
+ */
+class RecvBuffer
+{
+public:
+    RecvBuffer();
+    ~RecvBuffer();
+
+    const char *data() const
+    {
+        return m_data;
+    }
+
+    char *data()
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    /*
+        Make room for at least `n` more bytes and returns where to write them. Returns `NULL` if the
+        memory cannot be allocated.
+     */
+    char *reserve(size_t n);
+
+    /*
+        Mark `n` bytes written after a call to `reserve` as part of the buffer.
+     */
+    void commit(size_t n)
+    {
+        m_size += n;
+    }
+
+    /*
+        Drop everything after the first `n` bytes, the memory is kept.
+     */
+    void truncate(size_t n)
+    {
+        if (n < m_size)
+            m_size = n;
+    }
+
+    /*
+        Remove `n` bytes starting at `offset`, the bytes after them are moved back.
+     */
+    void erase(size_t offset, size_t n);
+
+    /*
+        Empty the buffer and release its memory.
+     */
+    void clear();
+
+private:
+    char *m_data;
+    size_t m_size;
+    size_t m_capacity;
+    bool m_pooled;
+
+    RecvBuffer(const RecvBuffer& other);
+    RecvBuffer& operator=(const RecvBuffer& other);
+};
@@ -21,13 +21,23 @@ CGI::CGI(std::string path) : m_path(path), m_pid(-1)
 
 // https://stackoverflow.com/questions/7047426/call-php-from-virtual-custom-web-server
 
-Result<Response, HttpStatus> CGI::process(std::string filepath, Request& req, int timeout, std::string& req_str)
+Result<Response, HttpStatus> CGI::process(std::string filepath, Request& req, int timeout, StringView body)
 {
     if (pipe(m_stdout) == -1)
         return HttpStatus(500);
     if (pipe(m_stdin) == -1)
         return HttpStatus(500);
 
+    // A body stored in a file is given to the script as its standard input directly.
+    if (req.body_in_file() && lseek(req.body_fd(), 0, SEEK_SET) == -1)
+    {
+        close(m_stdout[0]);
+        close(m_stdout[1]);
+        close(m_stdin[0]);
+        close(m_stdin[1]);
+        return HttpStatus(500);
+    }
+
     m_start_time = time();
 
     m_pid = fork();
@@ -51,7 +61,7 @@ Result<Response, HttpStatus> CGI::process(std::string filepath, Request& req, in
             exit(1);
         }
 
-        if (dup2(m_stdin[0], STDIN_FILENO) == -1)
+        if (dup2(req.body_in_file() ? req.body_fd() : m_stdin[0], STDIN_FILENO) == -1)
         {
             close(m_stdout[0]);
             close(m_stdout[1]);
@@ -83,17 +93,18 @@ Result<Response, HttpStatus> CGI::process(std::string filepath, Request& req, in
         envp.push_back("SCRIPT_FILENAME=" + filename);
 
         envp.push_back("REQUEST_METHOD=" + std::string(strmethod(req.method())));
-        envp.push_back("HTTP_COOKIE=" + req.cookies());
-        envp.push_back("HTTP_USER_AGENT=" + req.user_agent());
+        envp.push_back("HTTP_COOKIE=" + req.cookies().str());
+        envp.push_back("HTTP_USER_AGENT=" + req.user_agent().str());
 
         if (req.method() == POST)
         {
-            envp.push_back("CONTENT_LENGTH=" + req.get_param("Content-Length"));
-            envp.push_back("CONTENT_TYPE=" + req.get_param("Content-Type"));
+            // The size of the decoded body, a chunked request has no `Content-Length`.
+            envp.push_back("CONTENT_LENGTH=" + to_string(req.body_size()));
+            envp.push_back("CONTENT_TYPE=" + req.content_type().str());
         }
         else
         {
-            envp.push_back("QUERY_STRING=" + req.args_str().substr(1));
+            envp.push_back("QUERY_STRING=" + req.query().str());
         }
         // clang-format on
 
@@ -147,9 +158,9 @@ Result<Response, HttpStatus> CGI::process(std::string filepath, Request& req, in
         int stat_loc;
         ssize_t n;
 
-        if (req.method() == POST && !req_str.empty())
+        if (req.method() == POST && !body.empty())
         {
-            n = write(m_stdin[1], req_str.c_str(), req_str.size());
+            n = write(m_stdin[1], body.data(), body.size());
 
             if (n == 0 || n == -1)
             {
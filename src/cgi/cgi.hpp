@@ -14,7 +14,7 @@ public:
     CGI();
     CGI(std::string path);
 
-    Result<Response, HttpStatus> process(std::string filepath, Request& req, int timeout, std::string& req_str);
+    Result<Response, HttpStatus> process(std::string filepath, Request& req, int timeout, StringView body);
 
 private:
     /* The CGI to execute. */
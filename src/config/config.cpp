@@ -2,8 +2,10 @@
 #include "config/parser.hpp"
 #include "result.hpp"
 #include "string.hpp"
+#include <arpa/inet.h>
 #include <cstdlib>
 #include <iostream>
+#include <netdb.h>
 #include <unistd.h>
 #include <vector>
 
@@ -21,7 +23,58 @@ static std::vector<T> _array_to_vec(T array[], size_t size)
     return vec;
 }
 
-Location::Location() : m_enable_indexing(true)
+/*
+    Resolve a server address such as `127.0.0.1:8080` or `backend.local`, the port defaults to `80`. Host
+    names are resolved once, when the configuration is loaded.
+ */
+static bool _resolve(const std::string& authority, struct sockaddr_in& addr)
+{
+    size_t colon = authority.rfind(':');
+    std::string host = authority.substr(0, colon);
+    int port = 80;
+
+    if (colon != std::string::npos)
+    {
+        std::string digits = authority.substr(colon + 1);
+        if (digits.empty() || digits.size() > 5 || digits.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        port = std::atoi(digits.c_str());
+    }
+    if (host.empty() || port == 0 || port > 65535)
+        return false;
+
+    struct addrinfo hints = {};
+    struct addrinfo *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), NULL, &hints, &res) != 0)
+        return false;
+
+    addr = *(struct sockaddr_in *)res->ai_addr;
+    addr.sin_port = htons(port);
+    freeaddrinfo(res);
+    return true;
+}
+
+/*
+    Parse a `proxy_pass` URL such as `http://127.0.0.1:8080/app` or `http://backend`, the server is only
+    looked up once all `upstream` groups are known.
+ */
+static bool _parse_proxy_target(const std::string& url, ProxyTarget& target)
+{
+    static const std::string scheme = "http://";
+
+    if (url.compare(0, scheme.size(), scheme) != 0)
+        return false;
+
+    size_t slash = url.find('/', scheme.size());
+    target.upstream = url.substr(scheme.size(), slash == std::string::npos ? slash : slash - scheme.size());
+    target.path = slash == std::string::npos ? "" : url.substr(slash);
+    return !target.upstream.empty();
+}
+
+Location::Location() : m_enable_indexing(true), m_sse_max_queue(1024 * 1024)
 {
 }
 
@@ -48,6 +101,8 @@ Result<int, ConfigError> Location::deserialize(ConfigEntry& from)
                     m_methods.push_back(POST);
                 else if (*it == "DELETE")
                     m_methods.push_back(DELETE);
+                else if (*it == "PUT")
+                    m_methods.push_back(PUT);
                 else
                     return ConfigError::invalid_method(entry.source(), entry.args()[1]);
             }
@@ -84,17 +139,201 @@ Result<int, ConfigError> Location::deserialize(ConfigEntry& from)
         {
             m_redirect = Some(entry.args()[1].str());
         }
+        else if (name == "proxy_pass" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_STRING)
+        {
+            ProxyTarget target;
+            if (!_parse_proxy_target(entry.args()[1].str(), target))
+                return ConfigError::address(entry.source(), entry.args()[1]);
+            m_proxy_pass = target;
+        }
+        else if (name == "proxy_cache" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_STRING)
+        {
+            m_proxy_cache = entry.args()[1].str();
+        }
+        else if (name == "sse_channel" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_STRING)
+        {
+            m_sse_channel = entry.args()[1].str();
+        }
+        else if (name == "sse_max_queue" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_sse_max_queue = entry.args()[1].number();
+        }
+        else
+        {
+            std::string entries[] = {"methods",     "root",       "index",      "default",
+                                     "cgi",         "upload_dir", "redirect",   "proxy_pass",
+                                     "proxy_cache", "sse_channel", "sse_max_queue"};
+            return ConfigError::unknown_entry(entry.source(), token_name,
+                                              _array_to_vec(entries, sizeof(entries) / sizeof(std::string)));
+        }
+    }
+    return 0;
+}
+
+UpstreamConfig::UpstreamConfig()
+    : m_balance(BALANCE_ROUND_ROBIN), m_hash_key(HASH_CLIENT_IP), m_max_fails(1), m_fail_timeout(10000),
+      m_connect_timeout(5000), m_read_timeout(60000)
+{
+}
+
+UpstreamConfig UpstreamConfig::single(const UpstreamServer& server)
+{
+    UpstreamConfig upstream;
+    upstream.m_name = server.name;
+    upstream.m_servers.push_back(server);
+    return upstream;
+}
+
+Result<int, ConfigError> UpstreamConfig::deserialize(ConfigEntry& from)
+{
+    m_name = from.args()[1].str();
+
+    for (size_t i = 0; i < from.children().size(); i++)
+    {
+        ConfigEntry& entry = from.children()[i];
+        Token& token_name = entry.args()[0];
+        std::string name = token_name.content();
+
+        if (name == "server" && entry.is_inline() && entry.args().size() == 2 &&
+            entry.args()[1].type() == TOKEN_STRING)
+        {
+            UpstreamServer server;
+            server.name = entry.args()[1].str();
+            if (!_resolve(server.name, server.addr))
+                return ConfigError::address(entry.source(), entry.args()[1]);
+            m_servers.push_back(server);
+        }
+        else if (name == "balance" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_IDENTIFIER)
+        {
+            std::string balance = entry.args()[1].content();
+            if (balance == "round_robin")
+                m_balance = BALANCE_ROUND_ROBIN;
+            else if (balance == "least_conn")
+                m_balance = BALANCE_LEAST_CONN;
+            else if (balance == "hash")
+            {
+                std::vector<Arg> args;
+                args.push_back(Arg("method", TOKEN_IDENTIFIER, NULL));
+                args.push_back(Arg("key", TOKEN_IDENTIFIER, NULL));
+                return ConfigError::mismatch_entry(entry.source(), token_name, "balance", args);
+            }
+            else
+            {
+                std::string methods[] = {"round_robin", "least_conn", "hash"};
+                return ConfigError::unknown_entry(entry.source(), entry.args()[1],
+                                                  _array_to_vec(methods, sizeof(methods) / sizeof(std::string)));
+            }
+        }
+        else if (name == "balance" && entry.is_inline() && entry.args().size() == 3 &&
+                 entry.args()[1].content() == "hash")
+        {
+            Token& key = entry.args()[2];
+            m_balance = BALANCE_HASH;
+
+            // A string names a header, e.g. `balance hash "X-User"`.
+            if (key.type() == TOKEN_STRING && !key.str().empty())
+            {
+                m_hash_key = HASH_HEADER;
+                m_hash_header = key.str();
+            }
+            else if (key.type() == TOKEN_IDENTIFIER && key.content() == "client_ip")
+                m_hash_key = HASH_CLIENT_IP;
+            else if (key.type() == TOKEN_IDENTIFIER && key.content() == "path")
+                m_hash_key = HASH_PATH;
+            else
+            {
+                std::string keys[] = {"client_ip", "path", "\"<header>\""};
+                return ConfigError::unknown_entry(entry.source(), key,
+                                                  _array_to_vec(keys, sizeof(keys) / sizeof(std::string)));
+            }
+        }
+        else if (name == "max_fails" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_max_fails = entry.args()[1].number();
+        }
+        else if (name == "fail_timeout" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_fail_timeout = entry.args()[1].number();
+        }
+        else if (name == "connect_timeout" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_connect_timeout = entry.args()[1].number();
+        }
+        else if (name == "read_timeout" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_read_timeout = entry.args()[1].number();
+        }
         else
         {
-            std::string entries[] = {"methods", "root", "index", "default", "cgi", "upload_dir", "redirect"};
+            std::string entries[] = {"server",          "balance",     "max_fails", "fail_timeout",
+                                     "connect_timeout", "read_timeout"};
             return ConfigError::unknown_entry(entry.source(), token_name,
                                               _array_to_vec(entries, sizeof(entries) / sizeof(std::string)));
         }
     }
+
+    if (m_servers.empty())
+    {
+        std::vector<Arg> args;
+        args.push_back(Arg("address", TOKEN_STRING, NULL));
+        return ConfigError::mismatch_entry(from.source(), from.args()[1], "server", args);
+    }
     return 0;
 }
 
-ServerConfig::ServerConfig() : m_cgi_timeout(1000)
+CacheZoneConfig::CacheZoneConfig() : m_max_size(100 * 1024 * 1024)
+{
+}
+
+Result<int, ConfigError> CacheZoneConfig::deserialize(ConfigEntry& from)
+{
+    m_name = from.args()[1].str();
+
+    for (size_t i = 0; i < from.children().size(); i++)
+    {
+        ConfigEntry& entry = from.children()[i];
+        Token& token_name = entry.args()[0];
+        std::string name = token_name.content();
+
+        if (name == "path" && entry.is_inline() && entry.args().size() == 2 && entry.args()[1].type() == TOKEN_STRING)
+        {
+            m_path = entry.args()[1].str();
+        }
+        else if (name == "max_size" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_max_size = entry.args()[1].number();
+        }
+        else
+        {
+            std::string entries[] = {"path", "max_size"};
+            return ConfigError::unknown_entry(entry.source(), token_name,
+                                              _array_to_vec(entries, sizeof(entries) / sizeof(std::string)));
+        }
+    }
+
+    if (m_path.empty())
+    {
+        std::vector<Arg> args;
+        args.push_back(Arg("directory", TOKEN_STRING, NULL));
+        return ConfigError::mismatch_entry(from.source(), from.args()[1], "path", args);
+    }
+    return 0;
+}
+
+ServerConfig::ServerConfig()
+    : m_default_server(false), m_ssl(false), m_max_content_length(1024 * 1024), m_max_header_size(16384), m_max_headers(100),
+      m_keepalive_requests(1000), m_keepalive_timeout(75000), m_client_timeout(60000), m_cgi_timeout(1000),
+      m_client_body_buffer_size(16384), m_client_body_temp_path("/tmp")
 {
 }
 
@@ -109,9 +348,25 @@ Result<int, ConfigError> ServerConfig::deserialize(ConfigEntry& from)
         if (name == "server_name" && entry.is_inline() && entry.args().size() == 2 &&
             entry.args()[1].type() == TOKEN_STRING)
             m_server_name = entry.args()[1].str();
-        else if (name == "listen" && entry.is_inline() && entry.args().size() == 2 &&
+        else if (name == "listen" && entry.is_inline() && entry.args().size() >= 2 && entry.args().size() <= 4 &&
                  entry.args()[1].type() == TOKEN_STRING)
         {
+            for (size_t j = 2; j < entry.args().size(); j++)
+            {
+                Token& flag = entry.args()[j];
+
+                if (flag.type() == TOKEN_IDENTIFIER && flag.content() == "default_server")
+                    m_default_server = true;
+                else if (flag.type() == TOKEN_IDENTIFIER && flag.content() == "ssl")
+                    m_ssl = true;
+                else
+                {
+                    std::string flags[] = {"default_server", "ssl"};
+                    return ConfigError::unknown_entry(entry.source(), flag,
+                                                      _array_to_vec(flags, sizeof(flags) / sizeof(std::string)));
+                }
+            }
+
             if (entry.args()[1].str().empty())
                 return ConfigError::address(entry.source(), entry.args()[1]);
 
@@ -144,6 +399,31 @@ Result<int, ConfigError> ServerConfig::deserialize(ConfigEntry& from)
         {
             m_max_content_length = entry.args()[1].number();
         }
+        else if (name == "max_header_size" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_max_header_size = entry.args()[1].number();
+        }
+        else if (name == "max_headers" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_max_headers = entry.args()[1].number();
+        }
+        else if (name == "keepalive_requests" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_keepalive_requests = entry.args()[1].number();
+        }
+        else if (name == "keepalive_timeout" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_keepalive_timeout = entry.args()[1].number();
+        }
+        else if (name == "client_timeout" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_client_timeout = entry.args()[1].number();
+        }
         else if (name == "location" /*&& !entry.is_inline()*/ && entry.args().size() == 2 &&
                  entry.args()[1].type() == TOKEN_STRING)
         {
@@ -152,6 +432,13 @@ Result<int, ConfigError> ServerConfig::deserialize(ConfigEntry& from)
             EXPECT_OK(int, ConfigError, res);
             m_locations.push_back(location);
         }
+        else if (name == "upstream" && entry.args().size() == 2 && entry.args()[1].type() == TOKEN_STRING)
+        {
+            UpstreamConfig upstream;
+            Result<int, ConfigError> res = upstream.deserialize(entry);
+            EXPECT_OK(int, ConfigError, res);
+            m_upstreams.push_back(upstream);
+        }
         else if (name == "cgi_timeout" && entry.args().size() == 2 && entry.args()[1].type() == TOKEN_NUMBER)
         {
             m_cgi_timeout = entry.args()[1].number();
@@ -160,10 +447,34 @@ Result<int, ConfigError> ServerConfig::deserialize(ConfigEntry& from)
         {
             m_error_theme = entry.args()[1].str();
         }
+        else if (name == "client_body_buffer_size" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_NUMBER)
+        {
+            m_client_body_buffer_size = entry.args()[1].number();
+        }
+        else if (name == "client_body_temp_path" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_STRING)
+        {
+            m_client_body_temp_path = entry.args()[1].str();
+        }
+        else if (name == "ssl_certificate" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_STRING)
+        {
+            m_ssl_certificate = entry.args()[1].str();
+        }
+        else if (name == "ssl_key" && entry.is_inline() && entry.args().size() == 2 &&
+                 entry.args()[1].type() == TOKEN_STRING)
+        {
+            m_ssl_key = entry.args()[1].str();
+        }
         else
         {
-            std::string entries[] = {"server_name",        "listen",   "error_page",
-                                     "max_content_length", "location", "cgi_timeout"};
+            std::string entries[] = {"server_name",        "listen",            "error_page",
+                                     "max_content_length", "max_header_size",   "max_headers",
+                                     "keepalive_requests", "keepalive_timeout", "client_timeout",
+                                     "location",           "cgi_timeout",       "error_theme",
+                                     "client_body_buffer_size", "client_body_temp_path",
+                                     "ssl_certificate",    "ssl_key",           "upstream"};
             return ConfigError::unknown_entry(entry.source(), token_name,
                                               _array_to_vec(entries, sizeof(entries) / sizeof(std::string)));
         }
@@ -171,7 +482,59 @@ Result<int, ConfigError> ServerConfig::deserialize(ConfigEntry& from)
     return 0;
 }
 
-Config::Config()
+Result<int, ConfigError> ServerConfig::link_upstreams(ConfigEntry& from,
+                                                     std::map<std::string, UpstreamConfig>& upstreams)
+{
+    size_t location = 0;
+
+    for (size_t i = 0; i < from.children().size(); i++)
+    {
+        ConfigEntry& entry = from.children()[i];
+        if (entry.args()[0].content() != "location")
+            continue;
+
+        Location& loc = m_locations[location++];
+        if (loc.proxy_pass().is_none() || upstreams.count(loc.proxy_pass().unwrap().upstream))
+            continue;
+
+        UpstreamServer server;
+        server.name = loc.proxy_pass().unwrap().upstream;
+
+        if (!_resolve(server.name, server.addr))
+        {
+            for (size_t j = 0; j < entry.children().size(); j++)
+            {
+                if (entry.children()[j].args()[0].content() == "proxy_pass")
+                    return ConfigError::address(entry.source(), entry.children()[j].args()[1]);
+            }
+        }
+        upstreams[server.name] = UpstreamConfig::single(server);
+    }
+    return 0;
+}
+
+/*
+    Check that the `proxy_cache` entries of the locations of the server `from` name a declared zone.
+ */
+static Result<int, ConfigError> _check_cache_zones(ConfigEntry& from, std::map<std::string, CacheZoneConfig>& zones)
+{
+    for (size_t i = 0; i < from.children().size(); i++)
+    {
+        ConfigEntry& location = from.children()[i];
+        if (location.args()[0].content() != "location")
+            continue;
+
+        for (size_t j = 0; j < location.children().size(); j++)
+        {
+            ConfigEntry& entry = location.children()[j];
+            if (entry.args()[0].content() == "proxy_cache" && !zones.count(entry.args()[1].str()))
+                return ConfigError::undefined(entry.source(), entry.args()[1]);
+        }
+    }
+    return 0;
+}
+
+Config::Config() : m_event_backend(EVENT_BACKEND_EPOLL), m_log_overflow(LOG_OVERFLOW_BLOCK)
 {
 }
 
@@ -179,7 +542,9 @@ Result<int, ConfigError> Config::load_from_file(std::string filepath)
 {
     ConfigParser parser;
     EXPECT_OK(int, ConfigError, parser.parse(filepath));
-    EXPECT_OK(int, ConfigError, deserialize(parser.root()));
+
+    Result<int, ConfigError> res = deserialize(parser.root());
+    EXPECT_OK(int, ConfigError, res);
     return 0;
 }
 
@@ -190,6 +555,53 @@ Result<int, ConfigError> Config::deserialize(ConfigEntry& from)
         ConfigEntry& entry = from.children()[i];
         Token& entry_name = entry.args()[0];
 
+        if (entry_name.content() == "event_backend" && entry.is_inline() && entry.args().size() == 2 &&
+            entry.args()[1].type() == TOKEN_IDENTIFIER)
+        {
+            std::string backend = entry.args()[1].content();
+            if (backend == "epoll")
+                m_event_backend = EVENT_BACKEND_EPOLL;
+            else if (backend == "io_uring")
+                m_event_backend = EVENT_BACKEND_IO_URING;
+            else
+            {
+                std::string backends[] = {"epoll", "io_uring"};
+                return ConfigError::unknown_entry(entry.source(), entry.args()[1],
+                                                  _array_to_vec(backends, sizeof(backends) / sizeof(std::string)));
+            }
+            continue;
+        }
+
+        if (entry_name.content() == "log_overflow" && entry.is_inline() && entry.args().size() == 2 &&
+            entry.args()[1].type() == TOKEN_IDENTIFIER)
+        {
+            std::string policy = entry.args()[1].content();
+            if (policy == "block")
+                m_log_overflow = LOG_OVERFLOW_BLOCK;
+            else if (policy == "drop")
+                m_log_overflow = LOG_OVERFLOW_DROP;
+            else
+            {
+                std::string policies[] = {"block", "drop"};
+                return ConfigError::unknown_entry(entry.source(), entry.args()[1],
+                                                  _array_to_vec(policies, sizeof(policies) / sizeof(std::string)));
+            }
+            continue;
+        }
+
+        if (entry_name.content() == "proxy_cache_zone" && entry.args().size() == 2 &&
+            entry.args()[1].type() == TOKEN_STRING)
+        {
+            CacheZoneConfig zone;
+            Result<int, ConfigError> res = zone.deserialize(entry);
+            EXPECT_OK(int, ConfigError, res);
+
+            if (m_cache_zones.count(zone.name()))
+                return ConfigError::duplicate(entry.source(), entry.args()[1]);
+            m_cache_zones[zone.name()] = zone;
+            continue;
+        }
+
         if (entry_name.content() != "server")
             return ConfigError::mismatch_entry(entry.source(), entry_name, "server", std::vector<Arg>());
 
@@ -197,8 +609,34 @@ Result<int, ConfigError> Config::deserialize(ConfigEntry& from)
         Result<int, ConfigError> res = server.deserialize(entry);
         EXPECT_OK(int, ConfigError, res);
 
+        for (size_t j = 0, k = 0; j < entry.children().size(); j++)
+        {
+            ConfigEntry& child = entry.children()[j];
+            if (child.args()[0].content() != "upstream")
+                continue;
+
+            UpstreamConfig& upstream = server.upstreams()[k++];
+            if (m_upstreams.count(upstream.name()))
+                return ConfigError::duplicate(child.source(), child.args()[1]);
+            m_upstreams[upstream.name()] = upstream;
+        }
+
         m_servers.push_back(server);
     }
 
+    // Groups can be used by any server, including the ones declared before them.
+    for (size_t i = 0, j = 0; i < from.children().size(); i++)
+    {
+        ConfigEntry& entry = from.children()[i];
+        if (entry.args()[0].content() != "server")
+            continue;
+
+        Result<int, ConfigError> res = m_servers[j++].link_upstreams(entry, m_upstreams);
+        EXPECT_OK(int, ConfigError, res);
+
+        res = _check_cache_zones(entry, m_cache_zones);
+        EXPECT_OK(int, ConfigError, res);
+    }
+
     return 0;
 }
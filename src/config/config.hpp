@@ -9,6 +9,206 @@
 #include "http/request.hpp"
 #include "option.hpp"
 
+/*
+    Implementation of the event loop, see `Poller`.
+ */
+enum EventBackend
+{
+    EVENT_BACKEND_EPOLL,
+    EVENT_BACKEND_IO_URING,
+};
+
+/*
+    What a thread does when its log ring buffer is full, see `ws::Logger`.
+ */
+enum LogOverflow
+{
+    /* Wait for the background thread to write what the ring holds. */
+    LOG_OVERFLOW_BLOCK,
+    /* Drop the record, and count it. */
+    LOG_OVERFLOW_DROP,
+};
+
+/*
+    Where a `proxy_pass` location forwards its requests.
+ */
+struct ProxyTarget
+{
+    /* Name of the `upstream` group, or address of the server if it does not name one. */
+    std::string upstream;
+    /* Replaces the route of the location in the path sent upstream, the path is sent unchanged if it
+       is empty. */
+    std::string path;
+};
+
+/*
+    How an `upstream` group picks the server of a request.
+ */
+enum BalanceMethod
+{
+    BALANCE_ROUND_ROBIN,
+    /* The server with the fewest exchanges in progress. */
+    BALANCE_LEAST_CONN,
+    /* Consistent hashing of `HashKey`, requests with the same key go to the same server. */
+    BALANCE_HASH,
+};
+
+enum HashKey
+{
+    HASH_CLIENT_IP,
+    HASH_PATH,
+    /* Value of the request header named by `hash_header`. */
+    HASH_HEADER,
+};
+
+struct UpstreamServer
+{
+    /* Address as written in the configuration. */
+    std::string name;
+    struct sockaddr_in addr;
+};
+
+/*
+    Servers sharing the requests of `proxy_pass` locations:
+
+        upstream "backend" {
+            server "10.0.0.1:8080"
+            server "10.0.0.2:8080"
+            balance hash "X-User"
+        }
+
+    Groups are declared in a server block but their names are global. A `proxy_pass` to an address which
+    does not name a group gets a group of its own with that single server.
+ */
+class UpstreamConfig
+{
+public:
+    UpstreamConfig();
+
+    virtual ~UpstreamConfig()
+    {
+    }
+
+    virtual Result<int, ConfigError> deserialize(ConfigEntry& from);
+
+    /*
+        Group holding the single server `server`, named by its address.
+     */
+    static UpstreamConfig single(const UpstreamServer& server);
+
+    const std::string& name() const
+    {
+        return m_name;
+    }
+
+    const std::vector<UpstreamServer>& servers() const
+    {
+        return m_servers;
+    }
+
+    BalanceMethod balance() const
+    {
+        return m_balance;
+    }
+
+    HashKey hash_key() const
+    {
+        return m_hash_key;
+    }
+
+    const std::string& hash_header() const
+    {
+        return m_hash_header;
+    }
+
+    /*
+        Number of failures in a row after which a server is not used for `fail_timeout` milliseconds, `0`
+        means servers are never ejected.
+     */
+    size_t max_fails() const
+    {
+        return m_max_fails;
+    }
+
+    int fail_timeout() const
+    {
+        return m_fail_timeout;
+    }
+
+    /*
+        Time allowed to establish a connection, and to wait for each read once the request was sent, in
+        milliseconds.
+     */
+    int connect_timeout() const
+    {
+        return m_connect_timeout;
+    }
+
+    int read_timeout() const
+    {
+        return m_read_timeout;
+    }
+
+private:
+    std::string m_name;
+    std::vector<UpstreamServer> m_servers;
+
+    BalanceMethod m_balance;
+    HashKey m_hash_key;
+    std::string m_hash_header;
+
+    size_t m_max_fails;
+    int m_fail_timeout;
+    int m_connect_timeout;
+    int m_read_timeout;
+};
+
+/*
+    Storage of the responses cached by `proxy_cache` locations, declared at the top level:
+
+        proxy_cache_zone "pages" {
+            path "/var/cache/webserv"
+            max_size 104857600
+        }
+ */
+class CacheZoneConfig
+{
+public:
+    CacheZoneConfig();
+
+    virtual ~CacheZoneConfig()
+    {
+    }
+
+    virtual Result<int, ConfigError> deserialize(ConfigEntry& from);
+
+    const std::string& name() const
+    {
+        return m_name;
+    }
+
+    /*
+        Directory holding the bodies of the responses, one file each.
+     */
+    const std::string& path() const
+    {
+        return m_path;
+    }
+
+    /*
+        Total size of the stored responses, the least recently used ones are removed past it.
+     */
+    size_t max_size() const
+    {
+        return m_max_size;
+    }
+
+private:
+    std::string m_name;
+    std::string m_path;
+    size_t m_max_size;
+};
+
 class Location
 {
 public:
@@ -25,6 +225,16 @@ public:
         return m_methods;
     }
 
+    bool allows(Method method)
+    {
+        for (size_t i = 0; i < m_methods.size(); i++)
+        {
+            if (m_methods[i] == method)
+                return true;
+        }
+        return false;
+    }
+
     std::string& route()
     {
         return m_route;
@@ -60,6 +270,39 @@ public:
         return m_redirect;
     }
 
+    /*
+        Upstream servers answering the requests of this location instead of the filesystem.
+     */
+    Option<ProxyTarget>& proxy_pass()
+    {
+        return m_proxy_pass;
+    }
+
+    /*
+        Zone where the responses of the upstream servers or CGI scripts of this location are cached.
+     */
+    Option<std::string>& proxy_cache()
+    {
+        return m_proxy_cache;
+    }
+
+    /*
+        Channel of Server-Sent Events served by this location: `GET` subscribes to it and `POST` publishes
+        its body as an event. Locations naming the same channel share it.
+     */
+    Option<std::string>& sse_channel()
+    {
+        return m_sse_channel;
+    }
+
+    /*
+        Events waiting to be written to a subscriber, in bytes, past which it is dropped.
+     */
+    size_t sse_max_queue()
+    {
+        return m_sse_max_queue;
+    }
+
 private:
     std::string m_route;
 
@@ -72,6 +315,10 @@ private:
     Option<std::string> m_upload_directory;
 
     Option<std::string> m_redirect;
+    Option<ProxyTarget> m_proxy_pass;
+    Option<std::string> m_proxy_cache;
+    Option<std::string> m_sse_channel;
+    size_t m_sse_max_queue;
 };
 
 class ServerConfig
@@ -95,21 +342,132 @@ public:
         return m_listen_addr;
     }
 
+    /*
+        Whether this server is used for requests whose `Host` matches no other server on the same
+        address.
+     */
+    bool default_server()
+    {
+        return m_default_server;
+    }
+
+    /*
+        Whether connections to this address use TLS, with `ssl_certificate` and `ssl_key`.
+     */
+    bool ssl()
+    {
+        return m_ssl;
+    }
+
+    Option<std::string>& ssl_certificate()
+    {
+        return m_ssl_certificate;
+    }
+
+    Option<std::string>& ssl_key()
+    {
+        return m_ssl_key;
+    }
+
     std::map<int, std::string>& error_pages()
     {
         return m_error_pages;
     }
 
+    /*
+        Maximum accepted `Content-Length`, `0` means unlimited.
+     */
     size_t max_content_length()
     {
         return m_max_content_length;
     }
 
+    /*
+        Maximum size of the request line and headers. Like `max_headers` it is read from the default
+        server of the address, since the `Host` is not known yet when it applies.
+     */
+    size_t max_header_size()
+    {
+        return m_max_header_size;
+    }
+
+    /*
+        Maximum number of header lines in a request.
+     */
+    size_t max_headers()
+    {
+        return m_max_headers;
+    }
+
+    /*
+        Size above which a request body is moved from memory to a temporary file.
+     */
+    size_t client_body_buffer_size()
+    {
+        return m_client_body_buffer_size;
+    }
+
+    /*
+        Directory where request bodies larger than `client_body_buffer_size` are stored.
+     */
+    const std::string& client_body_temp_path()
+    {
+        return m_client_body_temp_path;
+    }
+
+    /*
+        Maximum number of requests served on a connection before it is closed, `0` means unlimited.
+     */
+    size_t keepalive_requests()
+    {
+        return m_keepalive_requests;
+    }
+
+    /*
+        Milliseconds an idle connection is kept open between requests, `0` means unlimited.
+     */
+    size_t keepalive_timeout()
+    {
+        return m_keepalive_timeout;
+    }
+
+    /*
+        Milliseconds a client may stay silent while its request is received or its response is written,
+        `0` means unlimited.
+     */
+    size_t client_timeout()
+    {
+        return m_client_timeout;
+    }
+
     std::vector<Location>& locations()
     {
         return m_locations;
     }
 
+    std::vector<UpstreamConfig>& upstreams()
+    {
+        return m_upstreams;
+    }
+
+    /*
+        Point the `proxy_pass` locations of the server, parsed from `from`, to their group in `upstreams`.
+        Addresses which do not name a group are resolved and added to `upstreams`.
+     */
+    Result<int, ConfigError> link_upstreams(ConfigEntry& from, std::map<std::string, UpstreamConfig>& upstreams);
+
+    /*
+        Whether a location forwards its requests with `proxy_pass` or serves an `sse_channel`, which is only
+        done over HTTP/1.1.
+     */
+    bool http1_only()
+    {
+        for (size_t i = 0; i < m_locations.size(); i++)
+            if (m_locations[i].proxy_pass().is_some() || m_locations[i].sse_channel().is_some())
+                return true;
+        return false;
+    }
+
     int cgi_timeout()
     {
         return m_cgi_timeout;
@@ -123,13 +481,26 @@ public:
 private:
     Option<std::string> m_server_name;
     Option<struct sockaddr_in> m_listen_addr;
+    bool m_default_server;
+    bool m_ssl;
+    Option<std::string> m_ssl_certificate;
+    Option<std::string> m_ssl_key;
     std::map<int, std::string> m_error_pages;
 
     /* Maximum accepted `Content-Length` */
     size_t m_max_content_length;
+    size_t m_max_header_size;
+    size_t m_max_headers;
+    size_t m_keepalive_requests;
+    size_t m_keepalive_timeout;
+    size_t m_client_timeout;
     int m_cgi_timeout;
 
+    size_t m_client_body_buffer_size;
+    std::string m_client_body_temp_path;
+
     std::vector<Location> m_locations;
+    std::vector<UpstreamConfig> m_upstreams;
     std::string m_error_theme;
 };
 
@@ -150,6 +521,39 @@ public:
         return m_servers;
     }
 
+    EventBackend event_backend()
+    {
+        return m_event_backend;
+    }
+
+    /*
+        What a thread does when its log ring buffer is full (`log_overflow`).
+     */
+    LogOverflow log_overflow()
+    {
+        return m_log_overflow;
+    }
+
+    /*
+        `upstream` groups of all servers, by name.
+     */
+    std::map<std::string, UpstreamConfig>& upstreams()
+    {
+        return m_upstreams;
+    }
+
+    /*
+        `proxy_cache_zone` declarations, by name.
+     */
+    std::map<std::string, CacheZoneConfig>& cache_zones()
+    {
+        return m_cache_zones;
+    }
+
 private:
     std::vector<ServerConfig> m_servers;
+    std::map<std::string, UpstreamConfig> m_upstreams;
+    std::map<std::string, CacheZoneConfig> m_cache_zones;
+    EventBackend m_event_backend;
+    LogOverflow m_log_overflow;
 };
@@ -513,6 +513,18 @@ ConfigError ConfigError::not_in_range(std::string source, Token tok, int min, in
     return err;
 }
 
+ConfigError ConfigError::duplicate(std::string source, Token tok)
+{
+    ConfigError err(ConfigError::DUPLICATE, tok, source);
+    return err;
+}
+
+ConfigError ConfigError::undefined(std::string source, Token tok)
+{
+    ConfigError err(ConfigError::UNDEFINED, tok, source);
+    return err;
+}
+
 std::string ConfigError::_spaces(size_t n)
 {
     std::string s;
@@ -564,6 +576,10 @@ std::string ConfigError::_strerror()
     case NOT_IN_RANGE:
         return "Value " + m_token.content() + " is not in range " + to_string(m_range.min) + ".." +
                to_string(m_range.max);
+    case DUPLICATE:
+        return "`" + m_token.content() + "` is already defined";
+    case UNDEFINED:
+        return "`" + m_token.content() + "` is not defined";
     }
 }
 
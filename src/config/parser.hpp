@@ -186,7 +186,9 @@ public:
         UNKNOWN_ENTRY,
         ADDR,
         INVALID_METHOD,
-        NOT_IN_RANGE
+        NOT_IN_RANGE,
+        DUPLICATE,
+        UNDEFINED
     };
 
     static ConfigError not_found(std::string filename);
@@ -198,6 +200,8 @@ public:
     static ConfigError address(std::string source, Token addr);
     static ConfigError invalid_method(std::string source, Token tok);
     static ConfigError not_in_range(std::string source, Token tok, int min, int max);
+    static ConfigError duplicate(std::string source, Token tok);
+    static ConfigError undefined(std::string source, Token tok);
 
     ConfigError();
 
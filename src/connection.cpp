@@ -1,47 +1,312 @@
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <stdlib.h>
+#include <sys/socket.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "connection.hpp"
+#include "http2/session.hpp"
 #include "logger.hpp"
+#include "sse.hpp"
+#include "tunnel.hpp"
 
 Connection::Connection()
+    : m_has_req(false), m_requests(0), m_body_fd(-1), m_body_size(0), m_chunked(NULL), m_upload(NULL), m_put(NULL),
+      m_keep_alive(true), m_events(EPOLLIN), m_h2(NULL), m_tls(NULL), m_proxy(NULL), m_tunnel(NULL), m_channel(NULL),
+      m_max_queue(0)
 {
 }
 
 Connection::Connection(int conn, int sock_fd, struct sockaddr_in addr)
-    : m_addr(addr), m_fd(conn), m_sock_fd(sock_fd), m_last_event(0)
+    : m_addr(addr), m_fd(conn), m_sock_fd(sock_fd), m_last_event(0), m_has_req(false), m_requests(0), m_body_fd(-1),
+      m_body_size(0), m_chunked(NULL), m_upload(NULL), m_put(NULL), m_keep_alive(true), m_events(EPOLLIN),
+      m_h2(NULL), m_tls(NULL), m_proxy(NULL), m_tunnel(NULL), m_channel(NULL), m_max_queue(0)
 {
 }
 
-int Connection::fd() const
+Connection::~Connection()
 {
-    return m_fd;
+    clearReq();
+    delete m_h2;
+    delete m_tls;
+    delete m_proxy;
+    delete m_tunnel;
+    if (m_channel)
+        m_channel->unsubscribe(*this);
+}
+
+ssize_t Connection::receive(char *data, size_t size)
+{
+    if (m_tls)
+        return m_tls->read(data, size);
+    return recv(m_fd, data, size, 0);
+}
+
+FlushStatus Connection::flush()
+{
+    if (m_tls)
+        return m_output.flush(*m_tls);
+    return m_output.flush(m_fd);
 }
 
-bool Connection::set_epollin(int epoll_fd)
+Http2Session& Connection::start_h2(Server& server)
 {
-    struct epoll_event event;
-    event.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
-    event.data.fd = m_fd;
+    m_h2 = new Http2Session(server);
+    m_h2->start();
+    return *m_h2;
+}
 
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, m_fd, &event) == -1)
+Proxy& Connection::start_proxy(Upstream& upstream, const ProxyTarget& target)
+{
+    m_proxy = new Proxy(upstream, target);
+    return *m_proxy;
+}
+
+void Connection::end_proxy()
+{
+    delete m_proxy;
+    m_proxy = NULL;
+}
+
+void Connection::end_tunnel()
+{
+    delete m_tunnel;
+    m_tunnel = NULL;
+}
+
+void Connection::subscribe(SseChannel& channel, size_t max_queue)
+{
+    m_channel = &channel;
+    m_max_queue = max_queue;
+    channel.subscribe(*this);
+}
+
+void Connection::clearReq()
+{
+    m_has_req = false;
+
+    if (m_body_fd != -1)
     {
-        ws::log << ws::err << "epoll_ctrl() failed: " << strerror(errno) << "\n";
-        return false;
+        close(m_body_fd);
+        m_body_fd = -1;
     }
+    m_body_size = 0;
+
+    delete m_chunked;
+    m_chunked = NULL;
+
+    delete m_upload;
+    m_upload = NULL;
+
+    delete m_put;
+    m_put = NULL;
+
+    m_pipelined.clear();
+}
+
+bool Connection::finish_request()
+{
+    std::string pipelined;
+    pipelined.swap(m_pipelined);
+
+    m_recv.clear();
+    clearReq();
+
+    // The header of the response may still be waiting in the arena, `Webserv::_flush` releases it once sent.
+    if (m_output.empty())
+        m_arena.release();
+
+    if (pipelined.empty())
+        return true;
+
+    char *data = m_recv.reserve(pipelined.size());
+    if (!data)
+        return false;
+    std::memcpy(data, pipelined.data(), pipelined.size());
+    m_recv.commit(pipelined.size());
     return true;
 }
 
-bool Connection::set_epollout(int epoll_fd)
+void Connection::keep_pipelined()
+{
+    if (m_chunked)
+        return;
+
+    // Requests without a length have no body, except the `POST` and `PUT` ones which are refused with `411`.
+    size_t length = 0;
+    if (m_req.has_header(HEADER_CONTENT_LENGTH))
+        length = m_req.content_length();
+    else if (m_req.method() == POST || m_req.method() == PUT)
+        return;
+
+    // Part of the body may already be in a file, only its end can be in the buffer with what follows.
+    m_req.rebase(m_recv.data(), m_recv.size());
+    if (m_req.body_size() <= length)
+        return;
+
+    size_t end = m_recv.size() - (m_req.body_size() - length);
+    m_pipelined.append(m_recv.data() + end, m_recv.size() - end);
+    m_recv.truncate(end);
+    m_req.rebase(m_recv.data(), m_recv.size());
+}
+
+bool Connection::body_received()
 {
-    struct epoll_event event;
-    event.events = EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
-    event.data.fd = m_fd;
+    if (m_chunked)
+        return m_chunked->done();
+    return !m_req.has_header(HEADER_CONTENT_LENGTH) || m_req.body_size() >= m_req.content_length();
+}
 
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, m_fd, &event) == -1)
+bool Connection::at_request_end()
+{
+    if (m_chunked)
+        return m_chunked->done();
+    return m_req.body_size() == (m_req.has_header(HEADER_CONTENT_LENGTH) ? m_req.content_length() : 0);
+}
+
+bool Connection::store_body(size_t buffer_size, const std::string& temp_path)
+{
+    size_t header_size = m_req.header_size();
+    size_t size = m_recv.size() - header_size;
+
+    if (m_body_fd == -1)
     {
-        ws::log << ws::err << "epoll_ctrl() failed: " << strerror(errno) << "\n";
-        return false;
+        if (size <= buffer_size)
+            return true;
+
+        std::string name = temp_path + "/webserv-body-XXXXXX";
+        m_body_fd = mkstemp(&name[0]);
+        if (m_body_fd == -1)
+        {
+            ws::log << ws::err << "cannot create a temporary file in `" << temp_path << "`: " << strerror(errno)
+                    << "\n";
+            return false;
+        }
+
+        // The file is only reachable through its descriptor and goes away when it is closed.
+        unlink(name.c_str());
+        fcntl(m_body_fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    const char *data = m_recv.data() + header_size;
+    while (size > 0)
+    {
+        ssize_t n = write(m_body_fd, data, size);
+        if (n == -1)
+        {
+            ws::log << ws::err << "cannot write a request body to `" << temp_path << "`: " << strerror(errno)
+                    << "\n";
+            return false;
+        }
+        data += n;
+        size -= n;
+        m_body_size += n;
     }
+
+    m_recv.truncate(header_size);
+    m_req.rebase(m_recv.data(), m_recv.size());
+    m_req.set_body_file(m_body_fd);
+    m_req.set_body_stored(m_body_size);
     return true;
 }
+
+void Connection::start_chunked(size_t max_body_size)
+{
+    m_chunked = new ChunkedDecoder(CHUNKED_MAX_CHUNK_SIZE, max_body_size);
+}
+
+bool Connection::decode_body(size_t from)
+{
+    size_t start = std::max(from, m_req.header_size());
+    size_t n = m_chunked->decode(m_recv.data() + start, m_recv.size() - start);
+
+    // A pipelined request may follow the last chunk.
+    size_t end = start + m_chunked->consumed();
+    if (m_chunked->done() && end < m_recv.size())
+        m_pipelined.append(m_recv.data() + end, m_recv.size() - end);
+
+    m_recv.truncate(start + n);
+    m_req.rebase(m_recv.data(), m_recv.size());
+    return !m_chunked->failed();
+}
+
+void Connection::start_upload(StringView content_type, const std::string& upload_dir)
+{
+    m_upload = new MultipartParser(content_type, upload_dir);
+}
+
+void Connection::upload_body()
+{
+    size_t header_size = m_req.header_size();
+    size_t n = m_upload->feed(m_recv.data() + header_size, m_recv.size() - header_size);
+
+    m_recv.erase(header_size, n);
+    m_body_size += n;
+    m_req.rebase(m_recv.data(), m_recv.size());
+    m_req.set_body_stored(m_body_size);
+}
+
+int Connection::fd() const
+{
+    return m_fd;
+}
+
+bool Connection::set_epollin(Poller& poller)
+{
+    return watch(poller, EPOLLIN);
+}
+
+bool Connection::set_epollout(Poller& poller)
+{
+    return watch(poller, EPOLLOUT);
+}
+
+bool Connection::set_idle(Poller& poller)
+{
+    return watch(poller, 0);
+}
+
+bool Connection::watch(Poller& poller, uint32_t events)
+{
+    if (m_events == events)
+        return true;
+
+    if (!poller.modify(m_fd, events | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+        return false;
+    m_events = events;
+    return true;
+}
+
+void Connection::start_put(const std::string& upload_dir, StringView name)
+{
+    m_put = new PutUpload(upload_dir, name);
+}
+
+bool Connection::put_body()
+{
+    size_t header_size = m_req.header_size();
+
+    if (!m_put->write(m_recv.data() + header_size, m_recv.size() - header_size))
+        return false;
+
+    m_body_size += m_recv.size() - header_size;
+    m_recv.truncate(header_size);
+    m_req.rebase(m_recv.data(), m_recv.size());
+    m_req.set_body_stored(m_body_size);
+    return true;
+}
+
+ssize_t Connection::splice_body(size_t size)
+{
+    ssize_t n = m_put->splice_from(m_fd, size);
+
+    if (n > 0)
+    {
+        m_body_size += n;
+        m_req.set_body_stored(m_body_size);
+    }
+    return n;
+}
@@ -1,10 +1,23 @@
 #pragma once
 
 #include <netinet/in.h>
-#include <sys/epoll.h>
 
+#include "arena.hpp"
+#include "buffer_pool.hpp"
+#include "http/chunked.hpp"
+#include "http/multipart.hpp"
+#include "http/put_upload.hpp"
 #include "http/request.hpp"
-#include "option.hpp"
+#include "output_queue.hpp"
+#include "poller.hpp"
+#include "proxy.hpp"
+#include "result.hpp"
+#include "tls.hpp"
+
+class Http2Session;
+class Server;
+class SseChannel;
+class Tunnel;
 
 class Connection
 {
@@ -13,6 +26,8 @@ public:
 
     Connection(int fd, int sock_fd, struct sockaddr_in addr);
 
+    ~Connection();
+
     struct sockaddr_in& addr()
     {
         return m_addr;
@@ -25,14 +40,12 @@ public:
         return m_sock_fd;
     }
 
-    std::string& req_str()
-    {
-        return m_reqStr;
-    }
-
-    void set_req_str(std::string s)
+    /*
+        Bytes received for the current request. The buffer is empty between requests.
+     */
+    RecvBuffer& recv_buffer()
     {
-        m_reqStr = s;
+        return m_recv;
     }
 
     void set_last_event(int64_t i)
@@ -45,31 +58,303 @@ public:
         return m_last_event;
     }
 
-    void setReq(Request req)
+    /*
+        Parse the request line and headers received so far, the request keeps pointing into
+        the receive buffer.
+     */
+    Result<int, HttpStatus> parse_req()
     {
-        m_req = req;
+        Result<int, HttpStatus> res = m_req.parse(m_recv.data(), m_recv.size());
+        m_has_req = res.is_ok();
+        return res;
     }
 
-    Option<Request>& req()
+    bool has_req() const
     {
+        return m_has_req;
+    }
+
+    /*
+        Returns the request being received. The receive buffer may have been reallocated since it was parsed
+        so the request is updated to point at its current content.
+     */
+    Request& req()
+    {
+        m_req.rebase(m_recv.data(), m_recv.size());
         return m_req;
     }
 
-    void clearReq()
+    void clearReq();
+
+    /*
+        Forget the current request once its response is queued. The bytes received after it are put back
+        in the receive buffer, they start the next request, otherwise the buffer goes back to the pool while
+        the connection is idle. The arena is only released once the output is written. Returns `false` if the
+        buffer cannot be allocated.
+     */
+    bool finish_request();
+
+    /*
+        Set aside the bytes received after the end of the current request, so they are not taken for its
+        body: `store_body`, `upload_body` and `put_body` only see the `Content-Length` bytes. Pipelined
+        requests are only answered once the current one is.
+     */
+    void keep_pipelined();
+
+    /*
+        Whether the whole body of the current request was received.
+     */
+    bool body_received();
+
+    /*
+        Whether exactly the current request was read from the socket, so the next bytes start a new
+        request and the connection can be reused.
+     */
+    bool at_request_end();
+
+    /*
+        Number of responses sent on this connection.
+     */
+    size_t requests() const
+    {
+        return m_requests;
+    }
+
+    void count_request()
     {
-        m_req = Option<Request>();
+        m_requests++;
     }
 
-    bool set_epollin(int epoll_fd);
-    bool set_epollout(int epoll_fd);
+    /*
+        Move the body received so far to an unlinked file in `temp_path` once it is larger than
+        `buffer_size`. From then on each call appends the newly received part of the body to the file,
+        so the receive buffer only holds the headers and the last read.
+     */
+    bool store_body(size_t buffer_size, const std::string& temp_path);
+
+    /*
+        Decode the body of the current request as it is received, see `ChunkedDecoder`.
+     */
+    void start_chunked(size_t max_body_size);
+
+    /*
+        The decoder of a chunked body, `NULL` if the body has a `Content-Length`.
+     */
+    ChunkedDecoder *chunked()
+    {
+        return m_chunked;
+    }
+
+    /*
+        Decode the part of the body received from offset `from` of the receive buffer. Returns `false`
+        if the body is invalid.
+     */
+    bool decode_body(size_t from);
+
+    /*
+        Write the files of a `multipart/form-data` body to `upload_dir` while it is received, instead
+        of storing the body.
+     */
+    void start_upload(StringView content_type, const std::string& upload_dir);
+
+    bool is_uploading() const
+    {
+        return m_upload != NULL;
+    }
+
+    /*
+        Give the part of the body received since the last call to the upload.
+     */
+    void upload_body();
+
+    /*
+        Called once the whole body was received, returns whether the upload succeeded.
+     */
+    Result<int, HttpStatus> finish_upload()
+    {
+        return m_upload->finish();
+    }
+
+    /*
+        Write the body of a `PUT` request to `name` in `upload_dir` while it is received.
+     */
+    void start_put(const std::string& upload_dir, StringView name);
+
+    /*
+        The `PUT` upload of the current request, `NULL` if there is none.
+     */
+    PutUpload *put()
+    {
+        return m_put;
+    }
+
+    /*
+        Write the part of the body held in the receive buffer to the `PUT` upload.
+     */
+    bool put_body();
+
+    /*
+        Move at most `size` bytes of the body from the socket to the `PUT` upload.
+     */
+    ssize_t splice_body(size_t size);
+
+    /*
+        Scratch memory for the current request, reset once its response is sent.
+     */
+    Arena& arena()
+    {
+        return m_arena;
+    }
+
+    /*
+        Responses not fully written to the socket yet.
+     */
+    OutputQueue& output()
+    {
+        return m_output;
+    }
+
+    /*
+        Whether the connection stays open once the pending output is written.
+     */
+    bool keep_alive() const
+    {
+        return m_keep_alive;
+    }
+
+    void set_keep_alive(bool keep_alive)
+    {
+        m_keep_alive = keep_alive;
+    }
+
+    /*
+        Wait for the socket to be readable or writable, nothing is done if the connection already
+        waits for it.
+     */
+    bool set_epollin(Poller& poller);
+    bool set_epollout(Poller& poller);
+
+    /*
+        Only watch for the client going away, while the response is waited for from somewhere else.
+     */
+    bool set_idle(Poller& poller);
+
+    /*
+        Wait for any of `events`, for a connection which can both be read and written.
+     */
+    bool watch(Poller& poller, uint32_t events);
+
+    /*
+        TLS state of the connection, `NULL` on plain connections. The connection takes ownership.
+     */
+    Tls *tls()
+    {
+        return m_tls;
+    }
+
+    void set_tls(Tls *tls)
+    {
+        m_tls = tls;
+    }
+
+    /*
+        Read from the socket, through TLS if the connection uses it. Behaves like `recv`.
+     */
+    ssize_t receive(char *data, size_t size);
+
+    /*
+        Write as much of the pending output as the socket accepts.
+     */
+    FlushStatus flush();
+
+    /*
+        The HTTP/2 session once the connection switched to HTTP/2, `NULL` while it speaks HTTP/1.x.
+     */
+    Http2Session *h2()
+    {
+        return m_h2;
+    }
+
+    Http2Session& start_h2(Server& server);
+
+    /*
+        The exchange with an upstream server answering the current request, `NULL` if there is none.
+     */
+    Proxy *proxy()
+    {
+        return m_proxy;
+    }
+
+    Proxy& start_proxy(Upstream& upstream, const ProxyTarget& target);
+    void end_proxy();
+
+    /*
+        The relay to an upstream server once the connection switched protocols, `NULL` if it did not. The
+        connection takes ownership.
+     */
+    Tunnel *tunnel()
+    {
+        return m_tunnel;
+    }
+
+    void start_tunnel(Tunnel *tunnel)
+    {
+        m_tunnel = tunnel;
+    }
+
+    void end_tunnel();
+
+    /*
+        The channel whose events are sent on the connection, `NULL` if it did not subscribe to one. The
+        subscriber is dropped once more than `max_queue` bytes wait to be written.
+     */
+    SseChannel *channel()
+    {
+        return m_channel;
+    }
+
+    size_t max_queue() const
+    {
+        return m_max_queue;
+    }
+
+    void subscribe(SseChannel& channel, size_t max_queue);
 
 private:
     struct sockaddr_in m_addr;
     int m_fd;
     int m_sock_fd;
 
-    std::string m_reqStr;
+    RecvBuffer m_recv;
+    /* Bytes received after the current request, see `keep_pipelined`. */
+    std::string m_pipelined;
 
     int64_t m_last_event;
-    Option<Request> m_req;
+    Request m_req;
+    bool m_has_req;
+    size_t m_requests;
+
+    /* File holding the body of the current request, or `-1` if it fits in memory. */
+    int m_body_fd;
+    size_t m_body_size;
+    ChunkedDecoder *m_chunked;
+    MultipartParser *m_upload;
+    PutUpload *m_put;
+
+    Arena m_arena;
+
+    OutputQueue m_output;
+    bool m_keep_alive;
+    /* Events the connection is registered for, besides the errors and hangups. */
+    uint32_t m_events;
+
+    Http2Session *m_h2;
+    Tls *m_tls;
+    Proxy *m_proxy;
+    Tunnel *m_tunnel;
+    SseChannel *m_channel;
+    size_t m_max_queue;
+
+    Connection(const Connection& other);
+    Connection& operator=(const Connection& other);
 };
@@ -5,11 +5,12 @@
 #include <iostream>
 #include <map>
 #include <string>
-#include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-#define FILE_BUFFER_SIZE 8192
+#include "buffer.hpp"
+#include "output_queue.hpp"
+#include "string.hpp"
 
 class File
 {
@@ -22,6 +23,19 @@ public:
         return m_path;
     }
 
+    /*
+        Whether the content is held in memory rather than read from `file_name()`.
+     */
+    bool in_memory() const
+    {
+        return m_in_memory;
+    }
+
+    SharedBuffer& content()
+    {
+        return m_content;
+    }
+
     /*
         Returns `true` if the file exists.
      */
@@ -53,7 +67,7 @@ public:
     /*
         Return the mime of the file (e.g. `text/html`, `application/json`).
      */
-    std::string mime()
+    const std::string& mime()
     {
         if (m_in_memory)
         {
@@ -64,52 +78,41 @@ public:
     }
 
     /*
-        Send the file through a connection fd with `send`.
+        Queue the content of the file to be sent on a connection. Files on disk are not read, they are
+        sent from the page cache with `sendfile`.
      */
-    bool send(int conn)
+    bool enqueue(OutputQueue& out)
     {
-        if (!m_in_memory)
+        if (m_in_memory)
         {
-            if (!exists())
-                return false;
-
-            char buf[FILE_BUFFER_SIZE];
-            int fd = open(m_path.c_str(), O_RDONLY);
-
-            if (fd == -1)
-                return false;
-
-            ssize_t n;
-
-            while ((n = read(fd, buf, FILE_BUFFER_SIZE)) > 0)
-            {
-                int n2 = ::send(conn, buf, n, 0);
-                if (n2 == -1 || n2 == 0)
-                {
-                    close(fd);
-                    return false;
-                }
-            }
-
-            close(fd);
-
-            if (n <= 0)
-                return false;
+            out.push(m_content);
+            return true;
         }
-        else
-        {
-            ssize_t n;
 
-            n = ::send(conn, m_content.c_str(), file_size(), 0);
+        int fd = open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return false;
 
-            if (n == -1 || n == 0)
-                return false;
+        struct stat sb;
+        if (fstat(fd, &sb) == -1)
+        {
+            close(fd);
+            return false;
         }
 
+        out.push_file(fd, sb.st_size);
         return true;
     }
 
     static File memory(std::string content, std::string mime)
+    {
+        return shared(SharedBuffer(content), mime);
+    }
+
+    /*
+        Same as `memory` but reference an existing buffer instead of copying it.
+     */
+    static File shared(SharedBuffer content, std::string mime)
     {
         File file;
         file.m_in_memory = true;
@@ -118,20 +121,35 @@ public:
         return file;
     }
 
-    static File stream(std::string path)
+    static File stream(StringView path)
     {
         File file;
         file.m_in_memory = false;
-        file.m_path = path;
+        file.m_path.assign(path.data(), path.size());
         return file;
     }
 
+    /*
+        Exchange two files without copying their path.
+     */
+    void swap(File& other)
+    {
+        SharedBuffer content = m_content;
+        bool in_memory = m_in_memory;
+
+        m_path.swap(other.m_path);
+        m_content = other.m_content;
+        m_in_memory = other.m_in_memory;
+        other.m_content = content;
+        other.m_in_memory = in_memory;
+    }
+
     static std::string& mime_from_ext(std::string ext);
     static void _build_mime_table();
 
 private:
     std::string m_path;
-    std::string m_content;
+    SharedBuffer m_content;
     bool m_in_memory;
 
     static std::map<std::string, std::string> mimes;
@@ -0,0 +1,124 @@
+#include <cctype>
+
+#include "host_table.hpp"
+
+#define HOST_TABLE_MIN_CAPACITY 16
+
+HostTable::HostTable() : m_exact_count(0), m_wildcards_count(0)
+{
+}
+
+static char _lower(char c)
+{
+    return (char)std::tolower((unsigned char)c);
+}
+
+/*
+    FNV-1a over the lowercased name.
+ */
+uint32_t HostTable::_hash(const char *name, size_t size)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)_lower(name[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool HostTable::_insert(std::vector<Slot>& slots, size_t& count, const std::string& name, size_t index)
+{
+    if (_find(slots, name.data(), name.size()) != -1)
+        return false;
+
+    // Keep the load factor under 1/2 so probe sequences stay short.
+    if ((count + 1) * 2 > slots.size())
+    {
+        std::vector<Slot> old = slots;
+        size_t capacity = slots.empty() ? HOST_TABLE_MIN_CAPACITY : slots.size() * 2;
+
+        slots.clear();
+        slots.resize(capacity);
+        for (size_t i = 0; i < capacity; i++)
+            slots[i].index = -1;
+
+        for (size_t i = 0; i < old.size(); i++)
+        {
+            if (old[i].index == -1)
+                continue;
+
+            size_t j = old[i].hash & (capacity - 1);
+            while (slots[j].index != -1)
+                j = (j + 1) & (capacity - 1);
+            slots[j] = old[i];
+        }
+    }
+
+    Slot slot;
+    slot.hash = _hash(name.data(), name.size());
+    slot.index = index;
+    for (size_t i = 0; i < name.size(); i++)
+        slot.name += _lower(name[i]);
+
+    size_t mask = slots.size() - 1;
+    size_t j = slot.hash & mask;
+    while (slots[j].index != -1)
+        j = (j + 1) & mask;
+    slots[j] = slot;
+    count++;
+
+    return true;
+}
+
+long HostTable::_find(const std::vector<Slot>& slots, const char *name, size_t size)
+{
+    if (slots.empty())
+        return -1;
+
+    uint32_t hash = _hash(name, size);
+    size_t mask = slots.size() - 1;
+
+    for (size_t j = hash & mask; slots[j].index != -1; j = (j + 1) & mask)
+    {
+        const Slot& slot = slots[j];
+
+        if (slot.hash != hash || slot.name.size() != size)
+            continue;
+
+        size_t i = 0;
+        while (i < size && slot.name[i] == _lower(name[i]))
+            i++;
+        if (i == size)
+            return slot.index;
+    }
+    return -1;
+}
+
+bool HostTable::insert(const std::string& name, size_t index)
+{
+    if (name.size() > 2 && name[0] == '*' && name[1] == '.')
+        return _insert(m_wildcards, m_wildcards_count, name.substr(1), index);
+    return _insert(m_exact, m_exact_count, name, index);
+}
+
+long HostTable::find(const char *name, size_t size) const
+{
+    long index = _find(m_exact, name, size);
+    if (index != -1 || m_wildcards_count == 0)
+        return index;
+
+    // Try every suffix starting at a dot, from the longest to the shortest. The first character is
+    // skipped so that `*.example.com` does not match `.example.com`.
+    for (size_t i = 1; i < size; i++)
+    {
+        if (name[i] != '.')
+            continue;
+
+        index = _find(m_wildcards, name + i, size - i);
+        if (index != -1)
+            return index;
+    }
+    return -1;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+    Open-addressing hash table mapping host names to host indices.
+
+    Names are stored lowercased and looked up case-insensitively. A name starting with `*.` is a
+    suffix wildcard: `*.example.com` matches `www.example.com` and `a.b.example.com` but not
+    `example.com` itself. Exact names take priority over wildcards, then the longest suffix wins.
+ */
+class HostTable
+{
+public:
+    HostTable();
+
+    /*
+        Register `name`, returns `false` if it is already present.
+     */
+    bool insert(const std::string& name, size_t index);
+
+    /*
+        Returns the index registered for the host `name` of length `size`, or `-1`. This does not
+        allocate.
+     */
+    long find(const char *name, size_t size) const;
+
+private:
+    struct Slot
+    {
+        std::string name;
+        uint32_t hash;
+        long index;
+    };
+
+    /* Exact names. */
+    std::vector<Slot> m_exact;
+    size_t m_exact_count;
+
+    /* Wildcards, stored without their leading `*` (e.g. `.example.com`). */
+    std::vector<Slot> m_wildcards;
+    size_t m_wildcards_count;
+
+    static uint32_t _hash(const char *name, size_t size);
+    static bool _insert(std::vector<Slot>& slots, size_t& count, const std::string& name, size_t index);
+    static long _find(const std::vector<Slot>& slots, const char *name, size_t size);
+};
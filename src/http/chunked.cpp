@@ -0,0 +1,168 @@
+#include <cstring>
+
+#include "http/chunked.hpp"
+
+ChunkedDecoder::ChunkedDecoder(size_t max_chunk_size, size_t max_body_size)
+    : m_state(STATE_SIZE), m_max_chunk_size(max_chunk_size), m_max_body_size(max_body_size), m_chunk_left(0),
+      m_body_size(0), m_consumed(0)
+{
+}
+
+size_t ChunkedDecoder::decode(char *data, size_t size)
+{
+    size_t pos = 0;
+    size_t out = 0;
+
+    while (pos < size)
+    {
+        switch (m_state)
+        {
+        case STATE_SIZE:
+            if (!_line_received(data, size, pos))
+                break;
+            if (!_parse_size())
+            {
+                m_consumed = pos;
+                return out;
+            }
+            break;
+
+        case STATE_DATA: {
+            size_t n = size - pos < m_chunk_left ? size - pos : m_chunk_left;
+
+            // The output never gets ahead of the input, so the data can be moved in place.
+            std::memmove(data + out, data + pos, n);
+            out += n;
+            pos += n;
+            m_chunk_left -= n;
+
+            if (m_chunk_left == 0)
+                m_state = STATE_DATA_END;
+            break;
+        }
+
+        case STATE_DATA_END:
+            if (!_line_received(data, size, pos))
+                break;
+            if (!m_line.empty())
+            {
+                _fail(400);
+                m_consumed = pos;
+                return out;
+            }
+            m_state = STATE_SIZE;
+            break;
+
+        case STATE_TRAILER:
+            // Trailer fields are not used, the body ends with an empty line.
+            if (!_line_received(data, size, pos))
+                break;
+            if (m_line.empty())
+                m_state = STATE_DONE;
+            m_line.clear();
+            break;
+
+        case STATE_DONE:
+        case STATE_ERROR:
+            m_consumed = pos;
+            return out;
+        }
+
+        if (m_state == STATE_ERROR)
+            break;
+    }
+
+    m_consumed = pos;
+    return out;
+}
+
+/*
+    Append the bytes of the current line to `m_line` and returns `true` once its `\r\n` was found.
+    `pos` is moved after what was consumed.
+ */
+bool ChunkedDecoder::_line_received(const char *data, size_t size, size_t& pos)
+{
+    const char *end = (const char *)std::memchr(data + pos, '\n', size - pos);
+    size_t line_end = end ? end - data : size;
+
+    if (m_line.size() + line_end - pos > CHUNKED_MAX_LINE_SIZE)
+    {
+        _fail(400);
+        pos = size;
+        return false;
+    }
+
+    m_line.append(data + pos, line_end - pos);
+
+    if (!end)
+    {
+        pos = size;
+        return false;
+    }
+
+    pos = line_end + 1;
+
+    if (m_line.empty() || m_line[m_line.size() - 1] != '\r')
+    {
+        _fail(400);
+        return false;
+    }
+    m_line.erase(m_line.size() - 1);
+    return true;
+}
+
+/*
+    Parse the chunk size in `m_line`, chunk extensions after a `;` are ignored.
+ */
+bool ChunkedDecoder::_parse_size()
+{
+    size_t chunk_size = 0;
+    bool too_large = false;
+    size_t i = 0;
+
+    for (; i < m_line.size(); i++)
+    {
+        char c = m_line[i];
+        size_t digit;
+
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            break;
+
+        // Stop accumulating once over the limit so the size cannot overflow.
+        if (!too_large)
+        {
+            chunk_size = chunk_size * 16 + digit;
+            too_large = chunk_size > m_max_chunk_size;
+        }
+    }
+
+    if (i == 0 || (i < m_line.size() && m_line[i] != ';' && m_line[i] != ' ' && m_line[i] != '\t'))
+    {
+        _fail(400);
+        return false;
+    }
+
+    if (too_large || (m_max_body_size > 0 && chunk_size > m_max_body_size - m_body_size))
+    {
+        _fail(413); // Payload Too Large
+        return false;
+    }
+
+    m_line.clear();
+    m_body_size += chunk_size;
+    m_chunk_left = chunk_size;
+    m_state = chunk_size == 0 ? STATE_TRAILER : STATE_DATA;
+    return true;
+}
+
+void ChunkedDecoder::_fail(HttpStatus status)
+{
+    m_state = STATE_ERROR;
+    m_error = status;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "http/status.hpp"
+
+/* Largest chunk accepted in a chunked request body. */
+#define CHUNKED_MAX_CHUNK_SIZE (16 * 1024 * 1024)
+/* Longest chunk size or trailer line, extensions included. */
+#define CHUNKED_MAX_LINE_SIZE 4096
+
+/*
+    Incremental decoder for request bodies sent with `Transfer-Encoding: chunked` (RFC 9112 section
+    7.1).
+
+    Data is decoded in place as it is received: the content of the chunks is moved to the start of
+    the buffer and the chunk sizes, extensions and trailers are dropped. An unfinished size or trailer
+    line is kept by the decoder until the rest of it arrives, so the buffer only ever holds decoded
+    data.
+ */
+class ChunkedDecoder
+{
+public:
+    /*
+        Fails with `413` if a chunk is larger than `max_chunk_size` or the body is larger than
+        `max_body_size`, `0` means no limit for the body.
+     */
+    ChunkedDecoder(size_t max_chunk_size, size_t max_body_size);
+
+    /*
+        Decode `data[0..size)` and returns the size of the decoded data written at the start of
+        `data`. Bytes after the end of the body are left where they are, see `consumed`.
+     */
+    size_t decode(char *data, size_t size);
+
+    /*
+        Bytes of the input read by the last call to `decode`. Once the body is done, what follows them
+        belongs to the next message.
+     */
+    size_t consumed() const
+    {
+        return m_consumed;
+    }
+
+    /*
+        Whether the last chunk and the trailers were received.
+     */
+    bool done() const
+    {
+        return m_state == STATE_DONE;
+    }
+
+    bool failed() const
+    {
+        return m_state == STATE_ERROR;
+    }
+
+    HttpStatus error() const
+    {
+        return m_error;
+    }
+
+private:
+    enum State
+    {
+        STATE_SIZE,
+        STATE_DATA,
+        STATE_DATA_END,
+        STATE_TRAILER,
+        STATE_DONE,
+        STATE_ERROR,
+    };
+
+    State m_state;
+    HttpStatus m_error;
+
+    size_t m_max_chunk_size;
+    size_t m_max_body_size;
+
+    /* Bytes left in the current chunk. */
+    size_t m_chunk_left;
+    size_t m_body_size;
+    size_t m_consumed;
+
+    /* Line being received, without its `\r\n`. */
+    std::string m_line;
+
+    bool _line_received(const char *data, size_t size, size_t& pos);
+    bool _parse_size();
+    void _fail(HttpStatus status);
+};
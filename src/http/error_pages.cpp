@@ -0,0 +1,236 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+
+#include "http/error_pages.hpp"
+#include "http/request.hpp"
+#include "logger.hpp"
+#include "string.hpp"
+
+// clang-format off
+static const std::string source =
+"<!DOCTYPE html>" SEP
+"<html lang='en'>" SEP
+"    <head>" SEP
+"        <meta charset='UTF-8'>" SEP
+"        <meta name='viewport' content='width=device-width, initial-scale=1.0'>" SEP
+"        <title>Error %{error}</title>" SEP
+"        <style>" SEP
+"            * {" SEP
+"                background-color: black;" SEP
+"            }" SEP
+"" SEP
+"            h1, h2, h3 {" SEP
+"                color: white;" SEP
+"                font-family: Verdana, Geneva, Tahoma, sans-serif;" SEP
+"            }" SEP
+"" SEP
+"            body {" SEP
+"                text-align: center;" SEP
+"            }" SEP
+"        </style>" SEP
+"    </head>" SEP
+"    <body>" SEP
+"        <h1>Oops, there seems to be an error !</h1>" SEP
+"        <h2>Here's a %{error_theme} to make you feel better</h3>" SEP
+#ifdef ERROR_PAGE_CALLSITE
+"%{callsite}"
+"        <img src='%{error_url}/%{error}.jpg' style='width: 45%;'>" SEP
+#else
+"        <img src='%{error_url}/%{error}.jpg' style='height: 70%'>" SEP
+#endif
+"    </body>" SEP
+"</html>" SEP;
+// clang-format on
+
+ErrorPages g_error_pages;
+
+ErrorPages::ErrorPages()
+{
+}
+
+void ErrorPages::build(Config& config, Watcher& watcher)
+{
+    m_themes["cat"] = "https://http.cat";
+    m_themes["dog"] = "https://http.dog";
+    m_themes["duck"] = "https://httpducks.com";
+    m_themes["goat"] = "https://httpgoats.com";
+    m_themes["garden"] = "https://http.garden";
+    m_themes["pizza"] = "https://http.pizza";
+    m_themes["fish"] = "https://http.fish";
+
+#ifdef ERROR_PAGE_CALLSITE
+    char buf[1024];
+    if (getcwd(buf, sizeof(buf)) != NULL)
+        m_cwd = buf;
+#endif
+
+    for (std::map<std::string, std::string>::iterator it = m_themes.begin(); it != m_themes.end(); it++)
+    {
+        std::map<int, Page>& pages = m_pages[it->first];
+
+        // Every status the server emits, see `page` for the others.
+        for (int code = 100; code < 600; code++)
+        {
+            if (HttpStatus(code).is_known())
+                _render(it->first, code, pages[code]);
+        }
+    }
+
+    for (size_t i = 0; i < config.servers().size(); i++)
+    {
+        std::map<int, std::string>& error_pages = config.servers()[i].error_pages();
+
+        for (std::map<int, std::string>::iterator it = error_pages.begin(); it != error_pages.end(); it++)
+        {
+            const std::string& path = it->second;
+            bool known = m_custom.count(path) > 0;
+            CustomPage& page = m_custom[path];
+
+            page.encoded[it->first] = Encoded();
+            if (known)
+                continue;
+
+            size_t slash = path.rfind('/');
+
+            page.dir = slash == std::string::npos ? "." : path.substr(0, slash == 0 ? 1 : slash);
+            page.name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+            watcher.watch_file(path, this);
+        }
+    }
+
+    // A page is read once every code it is used for is known, the responses are encoded for each.
+    for (std::map<std::string, CustomPage>::iterator it = m_custom.begin(); it != m_custom.end(); it++)
+        _load(it->first, it->second);
+}
+
+void ErrorPages::_render(const std::string& theme, int code, Page& page)
+{
+    std::string content = source;
+
+    replace_all(content, "%{error_url}", m_themes[theme]);
+    replace_all(content, "%{error_theme}", theme);
+    replace_all(content, "%{error}", to_string(code));
+
+    page.callsite = content.find("%{callsite}");
+
+    if (page.callsite != std::string::npos)
+        content.erase(page.callsite, sizeof("%{callsite}") - 1);
+
+    page.content = SharedBuffer(content);
+    _encode(code, page.content, page.encoded);
+}
+
+void ErrorPages::_load(const std::string& path, CustomPage& page)
+{
+    std::ifstream ifs(path.c_str(), std::ios_base::binary);
+
+    if (!ifs.is_open())
+    {
+        ws::log << ws::warn << "Cannot read error page `" << path << "`: " << strerror(errno) << "\n";
+        page.content = SharedBuffer();
+    }
+    else
+    {
+        std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        page.content = SharedBuffer(content);
+    }
+
+    for (std::map<int, Encoded>::iterator it = page.encoded.begin(); it != page.encoded.end(); it++)
+    {
+        if (page.content.is_null())
+            it->second = Encoded();
+        else
+            _encode(it->first, page.content, it->second);
+    }
+}
+
+/*
+    Encode the response the way `Response::enqueue` does, with the body after the header.
+ */
+void ErrorPages::_encode(int code, const SharedBuffer& content, Encoded& encoded)
+{
+    Arena arena;
+    Response response = Response::ok(code, File::shared(content, "text/html"));
+
+    response.set_keep_alive(false);
+    encoded.close = SharedBuffer(response.encode_header(arena).str() + content.str());
+    response.set_keep_alive(true);
+    encoded.keep_alive = SharedBuffer(response.encode_header(arena).str() + content.str());
+}
+
+void ErrorPages::on_change(const std::string& dir, const std::string& name)
+{
+    for (std::map<std::string, CustomPage>::iterator it = m_custom.begin(); it != m_custom.end(); it++)
+    {
+        CustomPage& page = it->second;
+
+        if (page.dir == dir && page.name == name)
+        {
+            ws::log << ws::info << "Reloading error page `" << it->first << "`\n";
+            _load(it->first, page);
+        }
+    }
+}
+
+Response ErrorPages::response(HttpStatus status, ServerConfig& config, const char *func, const char *file,
+                              int line)
+{
+    (void)func;
+    (void)file;
+    (void)line;
+
+    std::map<int, std::string>::iterator custom_path = config.error_pages().find(status.code());
+    if (custom_path != config.error_pages().end())
+    {
+        std::map<std::string, CustomPage>::iterator custom = m_custom.find(custom_path->second);
+        if (custom != m_custom.end() && !custom->second.content.is_null())
+        {
+            Response response = Response::ok(status, File::shared(custom->second.content, "text/html"));
+            std::map<int, Encoded>::iterator encoded = custom->second.encoded.find(status.code());
+            if (encoded != custom->second.encoded.end())
+                response.set_encoded(encoded->second.close, encoded->second.keep_alive);
+            return response;
+        }
+    }
+
+    std::map<std::string, std::map<int, Page> >::iterator theme = m_pages.find(config.error_theme());
+    if (theme == m_pages.end())
+        theme = m_pages.find("cat");
+
+    // The pages are shared by every connection, they are not changed while serving a request.
+    std::map<int, Page>::iterator found = theme->second.find(status.code());
+    if (found == theme->second.end())
+    {
+        Page rendered;
+        _render(theme->first, status.code(), rendered);
+        return Response::ok(status, File::shared(rendered.content, "text/html"));
+    }
+
+    Page& rendered = found->second;
+
+#ifdef ERROR_PAGE_CALLSITE
+    if (rendered.callsite != std::string::npos)
+    {
+        const std::string& content = rendered.content.str();
+        std::string page;
+
+        page.reserve(content.size() + 256);
+        page.append(content, 0, rendered.callsite);
+        page += "        <h2 style='color: yellow;'>in ";
+        page += func;
+        page += "() at <a style='color: yellow;' href='vscode://file/" + m_cwd + "/" + file + ":" + to_string(line) +
+                "'>" + file + ":" + to_string(line) + "</a></h2>" SEP;
+        page.append(content, rendered.callsite, std::string::npos);
+
+        return Response::ok(status, File::memory(page, "text/html"));
+    }
+#endif
+
+    Response response = Response::ok(status, File::shared(rendered.content, "text/html"));
+    response.set_encoded(rendered.encoded.close, rendered.encoded.keep_alive);
+    return response;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "buffer.hpp"
+#include "config/config.hpp"
+#include "file.hpp"
+#include "http/response.hpp"
+#include "http/status.hpp"
+#include "watcher.hpp"
+
+/*
+    Error pages are rendered once when the configuration is loaded, for every theme and status
+    code, and custom `error_page` files are read in memory. The whole HTTP/1.1 response, header
+    included, is encoded along with them, so an error is queued without being encoded again.
+    Custom files are reloaded when they change on disk.
+ */
+class ErrorPages : public WatchListener
+{
+public:
+    ErrorPages();
+
+    void build(Config& config, Watcher& watcher);
+
+    /*
+        Returns the error response for `status`. `func`, `file` and `line` are the call site, they
+        are only shown when built with `ERROR_PAGE_CALLSITE`, which renders the page again on every
+        error. Codes the server does not emit itself are rendered for this response only.
+     */
+    Response response(HttpStatus status, ServerConfig& config, const char *func, const char *file, int line);
+
+    virtual void on_change(const std::string& dir, const std::string& name);
+
+private:
+    /* The whole response for a page, for each value of `Connection`. */
+    struct Encoded
+    {
+        SharedBuffer close;
+        SharedBuffer keep_alive;
+    };
+
+    struct Page
+    {
+        SharedBuffer content;
+        Encoded encoded;
+        /* Offset at which the call site is inserted with `ERROR_PAGE_CALLSITE`. */
+        size_t callsite;
+    };
+
+    struct CustomPage
+    {
+        std::string dir;
+        std::string name;
+        /* Null if the file cannot be read, the builtin page is used instead. */
+        SharedBuffer content;
+        /* Responses for every code the page is configured for. */
+        std::map<int, Encoded> encoded;
+    };
+
+    std::map<std::string, std::string> m_themes;
+    /* Builtin pages indexed by theme and status code. */
+    std::map<std::string, std::map<int, Page> > m_pages;
+    /* Custom pages indexed by their path in the configuration. */
+    std::map<std::string, CustomPage> m_custom;
+
+    std::string m_cwd;
+
+    void _render(const std::string& theme, int code, Page& page);
+    void _load(const std::string& path, CustomPage& page);
+    void _encode(int code, const SharedBuffer& content, Encoded& encoded);
+};
+
+extern ErrorPages g_error_pages;
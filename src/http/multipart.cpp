@@ -0,0 +1,304 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "http/multipart.hpp"
+#include "http/request.hpp"
+#include "http/scan.hpp"
+#include "logger.hpp"
+#include "negative_cache.hpp"
+
+MultipartParser::MultipartParser(StringView content_type, const std::string& upload_dir)
+    : m_state(STATE_START), m_upload_dir(upload_dir), m_fd(-1), m_conflict(false)
+{
+    size_t start = content_type.find("boundary=");
+    StringView boundary;
+
+    if (start != StringView::npos)
+    {
+        boundary = content_type.substr(start + 9);
+        boundary = boundary.substr(0, boundary.find(';'));
+        if (boundary.size() >= 2 && boundary[0] == '"' && boundary[boundary.size() - 1] == '"')
+            boundary = boundary.substr(1, boundary.size() - 2);
+    }
+
+    if (boundary.empty() || boundary.size() > MULTIPART_MAX_BOUNDARY)
+    {
+        m_state = STATE_ERROR;
+        m_error = 400;
+        return;
+    }
+
+    m_delimiter = "\r\n--" + boundary.str();
+
+    // Horspool's shift table: how far the delimiter can move when the byte under its last
+    // character is `c`.
+    size_t n = m_delimiter.size();
+    for (size_t c = 0; c < 256; c++)
+        m_skip[c] = n;
+    for (size_t i = 0; i + 1 < n; i++)
+        m_skip[(unsigned char)m_delimiter[i]] = n - 1 - i;
+}
+
+MultipartParser::~MultipartParser()
+{
+    _close_part(false);
+}
+
+size_t MultipartParser::_find_delimiter(const char *data, size_t size) const
+{
+    const char *pattern = m_delimiter.data();
+    size_t n = m_delimiter.size();
+    size_t i = 0;
+
+    while (i + n <= size)
+    {
+        unsigned char last = data[i + n - 1];
+        if (last == (unsigned char)pattern[n - 1] && std::memcmp(data + i, pattern, n - 1) == 0)
+            return i;
+        i += m_skip[last];
+    }
+    return StringView::npos;
+}
+
+size_t MultipartParser::feed(const char *data, size_t size)
+{
+    size_t pos = 0;
+
+    while (true)
+    {
+        const char *p = data + pos;
+        size_t left = size - pos;
+
+        switch (m_state)
+        {
+        case STATE_START:
+            // The first delimiter usually starts the body, in which case it has no leading `\r\n`.
+            if (left < m_delimiter.size() - 2)
+                return pos;
+
+            if (std::memcmp(p, m_delimiter.data() + 2, m_delimiter.size() - 2) == 0)
+            {
+                pos += m_delimiter.size() - 2;
+                m_state = STATE_DELIMITER_END;
+            }
+            else
+                m_state = STATE_PREAMBLE;
+            break;
+
+        case STATE_PREAMBLE: {
+            size_t found = _find_delimiter(p, left);
+            if (found == StringView::npos)
+                return left >= m_delimiter.size() ? size - m_delimiter.size() + 1 : pos;
+
+            pos += found + m_delimiter.size();
+            m_state = STATE_DELIMITER_END;
+            break;
+        }
+
+        case STATE_DELIMITER_END:
+            if (left < 2)
+                return pos;
+
+            if (p[0] == '-' && p[1] == '-')
+                m_state = STATE_EPILOGUE;
+            else if (p[0] == '\r' && p[1] == '\n')
+                m_state = STATE_HEADERS;
+            else
+                return _fail(400, size);
+            pos += 2;
+            break;
+
+        case STATE_HEADERS: {
+            size_t n = _parse_headers(p, left);
+            if (m_state == STATE_ERROR)
+                return size;
+            if (n == 0)
+                return pos;
+
+            pos += n;
+            m_state = STATE_CONTENT;
+            break;
+        }
+
+        case STATE_CONTENT: {
+            size_t found = _find_delimiter(p, left);
+            if (found == StringView::npos)
+            {
+                // Keep the end in case it is the beginning of the delimiter.
+                size_t keep = m_delimiter.size() - 1;
+                if (left <= keep)
+                    return pos;
+                if (!_write(p, left - keep))
+                    return _fail(500, size);
+                return size - keep;
+            }
+
+            if (!_write(p, found) || !_close_part(true))
+                return _fail(500, size);
+
+            pos += found + m_delimiter.size();
+            m_state = STATE_DELIMITER_END;
+            break;
+        }
+
+        case STATE_EPILOGUE:
+        case STATE_ERROR:
+            return size;
+        }
+    }
+}
+
+Result<int, HttpStatus> MultipartParser::finish()
+{
+    if (m_state == STATE_ERROR)
+        return m_error;
+
+    if (m_state != STATE_EPILOGUE)
+    {
+        // The body ended in the middle of a part.
+        _close_part(false);
+        return HttpStatus(400);
+    }
+    if (m_conflict)
+        return HttpStatus(409);
+    return 0;
+}
+
+/*
+    Parse the headers of a part and open the file its content goes to. Returns the size of the
+    headers, or `0` if they were not fully received yet.
+ */
+size_t MultipartParser::_parse_headers(const char *data, size_t size)
+{
+    size_t header_size;
+
+    if (size >= 2 && data[0] == '\r' && data[1] == '\n')
+        header_size = 2;
+    else
+    {
+        size_t end = scan_header_end(data, size, 0);
+        if (end == (size_t)-1)
+        {
+            if (size > MULTIPART_MAX_HEADER_SIZE)
+                _fail(400, size);
+            return 0;
+        }
+        header_size = end + 4;
+    }
+
+    Request part;
+    if (part.parse_part(data, header_size).is_err())
+        return _fail(400, size);
+
+    StringView disposition = part.header(HEADER_CONTENT_DISPOSITION);
+    size_t start = disposition.find("filename=\"");
+    if (start == StringView::npos)
+        return header_size;
+
+    StringView filename = disposition.substr(start + 10);
+    filename = filename.substr(0, filename.find('"'));
+
+    // Only keep the last component, the client does not choose where the file goes.
+    for (size_t i = filename.size(); i > 0; i--)
+    {
+        if (filename[i - 1] == '/' || filename[i - 1] == '\\')
+        {
+            filename = filename.substr(i);
+            break;
+        }
+    }
+
+    if (filename.empty() || filename == "." || filename == "..")
+        return header_size;
+
+    m_path = m_upload_dir + "/" + filename.str();
+
+    if (access(m_path.c_str(), F_OK) == 0)
+    {
+        ws::log << ws::warn << "`" << m_path << "` already exists, the part is discarded\n";
+        m_conflict = true;
+        return header_size;
+    }
+
+    // The part goes to a temporary file linked to the target once complete, so readers never see a partial
+    // file.
+    std::string temp_path = m_upload_dir + "/.webserv-upload-XXXXXX";
+    m_fd = mkstemp(&temp_path[0]);
+    if (m_fd == -1)
+    {
+        ws::log << ws::err << "cannot create a temporary file in `" << m_upload_dir << "`: " << strerror(errno)
+                << "\n";
+        return _fail(500, size);
+    }
+    m_temp_path = temp_path;
+
+    fcntl(m_fd, F_SETFD, FD_CLOEXEC);
+    fchmod(m_fd, 0644);
+    return header_size;
+}
+
+bool MultipartParser::_write(const char *data, size_t size)
+{
+    if (m_fd == -1)
+        return true;
+
+    while (size > 0)
+    {
+        ssize_t n = write(m_fd, data, size);
+        if (n == -1)
+        {
+            ws::log << ws::err << "cannot write `" << m_temp_path << "`: " << strerror(errno) << "\n";
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/*
+    Close the file of the current part, it is linked to the target if it was fully received and removed in
+    any case. `link` fails if the target was created since the headers were parsed, so it is never
+    replaced. Returns `false` on other errors.
+ */
+bool MultipartParser::_close_part(bool complete)
+{
+    if (m_fd == -1)
+        return true;
+
+    close(m_fd);
+    m_fd = -1;
+
+    bool ok = true;
+    if (complete && link(m_temp_path.c_str(), m_path.c_str()) == -1)
+    {
+        if (errno == EEXIST)
+        {
+            ws::log << ws::warn << "`" << m_path << "` already exists, the part is discarded\n";
+            m_conflict = true;
+        }
+        else
+        {
+            ws::log << ws::err << "cannot link `" << m_temp_path << "` to `" << m_path << "`: " << strerror(errno)
+                    << "\n";
+            ok = false;
+        }
+    }
+    else if (complete)
+        g_negative_cache.clear();
+
+    unlink(m_temp_path.c_str());
+    return ok;
+}
+
+size_t MultipartParser::_fail(HttpStatus status, size_t size)
+{
+    _close_part(false);
+    m_state = STATE_ERROR;
+    m_error = status;
+    return size;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "http/status.hpp"
+#include "result.hpp"
+#include "string.hpp"
+
+/* Longest boundary allowed by RFC 2046. */
+#define MULTIPART_MAX_BOUNDARY 70
+/* Maximum size of the headers of a single part. */
+#define MULTIPART_MAX_HEADER_SIZE 8192
+
+/*
+    Incremental `multipart/form-data` parser which writes the uploaded files to a directory as the
+    body arrives. Existing files are never replaced: a part whose file exists is discarded, the other
+    parts are still written, and `finish` answers `409 Conflict`.
+
+    `feed` is called with the part of the body not consumed yet and returns how much of it was used.
+    The caller keeps the rest, at most a part's headers or a possible beginning of the delimiter, and
+    gives it back with the next bytes. Delimiters are found with Boyer-Moore-Horspool so the content
+    of a part is skipped by up to the delimiter length at a time.
+
+    Once an error is found, the rest of the body is discarded and `finish` returns the error.
+ */
+class MultipartParser
+{
+public:
+    MultipartParser(StringView content_type, const std::string& upload_dir);
+    ~MultipartParser();
+
+    size_t feed(const char *data, size_t size);
+
+    /*
+        Called once the whole body was fed, fails if the closing delimiter was not found.
+     */
+    Result<int, HttpStatus> finish();
+
+private:
+    enum State
+    {
+        STATE_START,
+        STATE_PREAMBLE,
+        STATE_DELIMITER_END,
+        STATE_HEADERS,
+        STATE_CONTENT,
+        STATE_EPILOGUE,
+        STATE_ERROR,
+    };
+
+    State m_state;
+    HttpStatus m_error;
+
+    /* `\r\n--` followed by the boundary. */
+    std::string m_delimiter;
+    size_t m_skip[256];
+
+    std::string m_upload_dir;
+
+    /* Temporary file of the part being received, `-1` if its content is discarded, and its target. */
+    int m_fd;
+    std::string m_temp_path;
+    std::string m_path;
+    /* Set once a part was discarded because its file exists. */
+    bool m_conflict;
+
+    size_t _find_delimiter(const char *data, size_t size) const;
+    size_t _parse_headers(const char *data, size_t size);
+    bool _write(const char *data, size_t size);
+    bool _close_part(bool complete);
+    size_t _fail(HttpStatus status, size_t size);
+
+    MultipartParser(const MultipartParser& other);
+    MultipartParser& operator=(const MultipartParser& other);
+};
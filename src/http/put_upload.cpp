@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "http/put_upload.hpp"
+#include "logger.hpp"
+#include "negative_cache.hpp"
+
+/*
+    Returns `true` if `name` is a relative path which stays inside the directory it is relative to.
+ */
+static bool _is_safe_name(StringView name)
+{
+    if (name.empty())
+        return false;
+
+    while (true)
+    {
+        size_t end = name.find('/');
+        StringView segment = name.substr(0, end);
+
+        if (segment.empty() || segment == "." || segment == "..")
+            return false;
+        if (end == StringView::npos)
+            return true;
+        name = name.substr(end + 1);
+    }
+}
+
+PutUpload::PutUpload(const std::string& upload_dir, StringView name) : m_fd(-1)
+{
+    m_pipe[0] = -1;
+    m_pipe[1] = -1;
+
+    while (!name.empty() && name[0] == '/')
+        name = name.substr(1);
+
+    if (!_is_safe_name(name))
+    {
+        m_status = 403;
+        return;
+    }
+
+    m_path = upload_dir + "/" + name.str();
+
+    // The temporary file is in the upload directory so it can be renamed to the target.
+    std::string temp_path = upload_dir + "/.webserv-put-XXXXXX";
+    m_fd = mkstemp(&temp_path[0]);
+    if (m_fd == -1)
+    {
+        ws::log << ws::err << "cannot create a temporary file in `" << upload_dir << "`: " << strerror(errno)
+                << "\n";
+        m_status = 500;
+        return;
+    }
+    m_temp_path = temp_path;
+
+    fcntl(m_fd, F_SETFD, FD_CLOEXEC);
+    fchmod(m_fd, 0644);
+
+    if (pipe(m_pipe) == -1)
+    {
+        ws::log << ws::err << "pipe() failed: " << strerror(errno) << "\n";
+        m_status = 500;
+        return;
+    }
+
+    fcntl(m_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(m_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(m_pipe[1], F_SETPIPE_SZ, PUT_PIPE_SIZE);
+}
+
+PutUpload::~PutUpload()
+{
+    if (m_fd != -1)
+        close(m_fd);
+    if (m_pipe[0] != -1)
+        close(m_pipe[0]);
+    if (m_pipe[1] != -1)
+        close(m_pipe[1]);
+
+    // The body was not fully received.
+    if (!m_temp_path.empty())
+        unlink(m_temp_path.c_str());
+}
+
+bool PutUpload::write(const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = ::write(m_fd, data, size);
+        if (n == -1)
+        {
+            ws::log << ws::err << "cannot write `" << m_temp_path << "`: " << strerror(errno) << "\n";
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+ssize_t PutUpload::splice_from(int fd, size_t size)
+{
+    // Only one read from the socket, it would block if called again before more data arrives.
+    ssize_t n = splice(fd, NULL, m_pipe[1], NULL, std::min(size, (size_t)PUT_PIPE_SIZE),
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n <= 0)
+        return n;
+
+    for (ssize_t left = n; left > 0;)
+    {
+        ssize_t m = splice(m_pipe[0], NULL, m_fd, NULL, left, SPLICE_F_MOVE);
+        if (m <= 0)
+        {
+            ws::log << ws::err << "cannot write `" << m_temp_path << "`: " << strerror(errno) << "\n";
+            return -1;
+        }
+        left -= m;
+    }
+    return n;
+}
+
+HttpStatus PutUpload::finish()
+{
+    if (failed())
+        return m_status;
+
+    struct stat sb;
+    HttpStatus status = stat(m_path.c_str(), &sb) == 0 ? 204 : 201;
+
+    if (rename(m_temp_path.c_str(), m_path.c_str()) == -1)
+    {
+        ws::log << ws::err << "cannot rename `" << m_temp_path << "` to `" << m_path << "`: " << strerror(errno)
+                << "\n";
+        return errno == ENOENT || errno == ENOTDIR ? 404 : errno == EISDIR ? 403 : 500;
+    }
+
+    m_temp_path.clear();
+    g_negative_cache.clear();
+    return status;
+}
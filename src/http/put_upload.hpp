@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <sys/types.h>
+
+#include "http/status.hpp"
+#include "string.hpp"
+
+/* Size requested for the pipe used to splice a body, the kernel may give less. */
+#define PUT_PIPE_SIZE (1024 * 1024)
+
+/*
+    Body of a `PUT` request written to a file of an upload directory.
+
+    The body is first written to a temporary file in the same directory, then renamed over the target
+    once complete, so readers never see a partial file. Data still in the receive buffer is written
+    with `write`, the rest is moved from the socket to the file with `splice` through a pipe and is
+    never copied to user space.
+ */
+class PutUpload
+{
+public:
+    PutUpload(const std::string& upload_dir, StringView name);
+    ~PutUpload();
+
+    /*
+        Whether the temporary file could not be created, `finish` returns why.
+     */
+    bool failed() const
+    {
+        return m_status.is_error();
+    }
+
+    bool write(const char *data, size_t size);
+
+    /*
+        Move at most `size` bytes from the socket `fd` to the file. Returns the number of bytes moved,
+        `0` if the peer closed the connection or `-1` on error (`EAGAIN` when there is nothing to read).
+     */
+    ssize_t splice_from(int fd, size_t size);
+
+    /*
+        Called once the whole body was received. Moves the file to its final name and returns `201`
+        if it was created or `204` if it replaced an existing file.
+     */
+    HttpStatus finish();
+
+private:
+    std::string m_path;
+    std::string m_temp_path;
+    int m_fd;
+    int m_pipe[2];
+    HttpStatus m_status;
+
+    PutUpload(const PutUpload& other);
+    PutUpload& operator=(const PutUpload& other);
+};
@@ -1,132 +1,429 @@
 #include "request.hpp"
 #include "string.hpp"
 #include <cctype>
-#include <iostream>
-#include <vector>
+#include <cstring>
+
+#include "http/scan.hpp"
+#include "logger.hpp"
+
+static const char *header_names[HEADER_COUNT] = {
+    "Host",
+    "Connection",
+    "Keep-Alive",
+    "Content-Length",
+    "Content-Type",
+    "Content-Disposition",
+    "Transfer-Encoding",
+    "TE",
+    "Expect",
+    "Upgrade",
+    "Cookie",
+    "User-Agent",
+    "Accept",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Authorization",
+    "Referer",
+    "Origin",
+    "Cache-Control",
+    "Pragma",
+    "If-Modified-Since",
+    "If-None-Match",
+    "Range",
+    "Forwarded",
+    "X-Forwarded-For",
+    "Sec-WebSocket-Key",
+    "Sec-WebSocket-Version",
+    "Sec-WebSocket-Protocol",
+    "HTTP2-Settings",
+    "Last-Event-ID",
+};
+
+HeaderName Request::m_header_table[HEADER_TABLE_SIZE];
 
 Request::Request()
+    : m_data(""), m_size(0), m_method(GET), m_known_mask(0), m_others_count(0), m_header_size(0), m_body_fd(-1),
+      m_body_stored(0), m_header_count(0), m_content_length((size_t)-1),
+      m_chunked(false)
+{
+    m_path.offset = m_path.size = 0;
+    m_query.offset = m_query.size = 0;
+    m_protocol.offset = m_protocol.size = 0;
+}
+
+/*
+    Hash function for the standard headers, it was chosen so that none of them collide in a table of
+    `HEADER_TABLE_SIZE` slots.
+ */
+size_t Request::_hash_header(const char *name, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    size_t first = std::tolower((unsigned char)name[0]);
+    size_t middle = std::tolower((unsigned char)name[size / 2]);
+    size_t last = std::tolower((unsigned char)name[size - 1]);
+
+    return (size + first * 17 + last * 19 + middle) & (HEADER_TABLE_SIZE - 1);
+}
+
+void Request::_build_header_table()
+{
+    for (size_t i = 0; i < HEADER_TABLE_SIZE; i++)
+        m_header_table[i] = HEADER_COUNT;
+
+    for (size_t i = 0; i < HEADER_COUNT; i++)
+    {
+        size_t hash = _hash_header(header_names[i], std::strlen(header_names[i]));
+
+        if (m_header_table[hash] != HEADER_COUNT)
+            ws::log << ws::err << "Header `" << header_names[i] << "` collides with `"
+                    << header_names[m_header_table[hash]] << "`\n";
+        m_header_table[hash] = (HeaderName)i;
+    }
+}
+
+const char *Request::header_name(HeaderName name)
+{
+    return header_names[name];
+}
+
+HeaderName Request::_find_header(StringView name)
 {
+    HeaderName header = m_header_table[_hash_header(name.data(), name.size())];
+
+    if (header != HEADER_COUNT && name.equals_ignore_case(header_names[header]))
+        return header;
+    return HEADER_COUNT;
 }
 
-std::string& Request::get_param(std::string key)
+static bool _is_ows(char c)
 {
-    return m_params[key];
+    return c == ' ' || c == '\t';
 }
 
-bool Request::has_param(std::string key)
+static StringView _trim_ows(StringView s)
 {
-    return m_params.count(key) > 0;
+    while (!s.empty() && _is_ows(s[0]))
+        s = s.substr(1);
+    while (!s.empty() && _is_ows(s[s.size() - 1]))
+        s = s.substr(0, s.size() - 1);
+    return s;
 }
 
 /*
-    Extract parameters (eg `<url>?foo=bar&test=123`) from the path.
+    Look for the unknown header `key` in the indexed ones, then in the lines after them.
  */
-void Request::_parse_path(std::string path)
+bool Request::_find_other(StringView key, StringView& value) const
 {
-    std::string args_str = path;
-    std::vector<std::string> args_vec = split(args_str, "&");
+    for (size_t i = 0; i < m_others_count; i++)
+    {
+        if (_view(m_others[i].name).equals_ignore_case(key))
+        {
+            value = _view(m_others[i].value);
+            return true;
+        }
+    }
+
+    size_t start = m_more_others.offset;
+    size_t end = start + m_more_others.size;
 
-    for (size_t i = 0; i < args_vec.size(); i++)
+    while (start < end)
     {
-        size_t pos = args_vec[i].find("=");
-        std::string key = args_vec[i].substr(0, pos);
-        std::string value;
+        size_t line_end = scan_crlf(m_data, end, start);
+        if (line_end == StringView::npos)
+            line_end = end;
+
+        // The lines were validated by `_parse_params`, empty ones have no colon.
+        size_t colon = scan_byte(m_data, line_end, start, ':');
+        if (colon != StringView::npos && StringView(m_data + start, colon - start).equals_ignore_case(key))
+        {
+            value = _trim_ows(StringView(m_data + colon + 1, line_end - colon - 1));
+            return true;
+        }
+        start = line_end + 2;
+    }
+    return false;
+}
+
+StringView Request::get_param(StringView key) const
+{
+    HeaderName known = _find_header(key);
+    if (known != HEADER_COUNT)
+        return header(known);
 
-        if (pos == std::string::npos)
-            value = "";
-        else
-            value = args_vec[i].substr(pos + 1);
+    StringView value;
+    _find_other(key, value);
+    return value;
+}
+
+bool Request::has_param(StringView key) const
+{
+    HeaderName known = _find_header(key);
+    if (known != HEADER_COUNT)
+        return has_header(known);
+
+    StringView value;
+    return _find_other(key, value);
+}
+
+std::string Request::params() const
+{
+    std::stringstream ss;
+
+    for (size_t i = 0; i < HEADER_COUNT; i++)
+        if (has_header((HeaderName)i))
+            ss << header_name((HeaderName)i) << ": " << _view(m_known[i]) << "\n";
+
+    for (size_t i = 0; i < m_others_count; i++)
+        ss << _view(m_others[i].name) << ": " << _view(m_others[i].value) << "\n";
+
+    // The lines which are not indexed, without the standard headers already listed.
+    size_t start = m_more_others.offset;
+    size_t end = start + m_more_others.size;
+    while (start < end)
+    {
+        size_t line_end = scan_crlf(m_data, end, start);
+        if (line_end == StringView::npos)
+            line_end = end;
 
-        m_args[key] = value;
+        size_t colon = scan_byte(m_data, line_end, start, ':');
+        if (colon != StringView::npos && _find_header(StringView(m_data + start, colon - start)) == HEADER_COUNT)
+            ss << StringView(m_data + start, colon - start) << ": "
+               << _trim_ows(StringView(m_data + colon + 1, line_end - colon - 1)) << "\n";
+        start = line_end + 2;
     }
+
+    return ss.str();
+}
+
+void Request::_reset(const char *data, size_t size)
+{
+    m_data = data;
+    m_size = size;
+    m_known_mask = 0;
+    m_others_count = 0;
+    m_more_others.offset = 0;
+    m_more_others.size = 0;
+    m_body_fd = -1;
+    m_body_stored = 0;
+    m_header_count = 0;
+    m_content_length = (size_t)-1;
+    m_chunked = false;
 }
 
-void Request::_parse_params(std::vector<std::string>& lines, size_t i, bool ignore_invalid)
+/*
+    Parse header lines between `start` and `end`, each ended by a `\r\n`.
+ */
+Result<int, HttpStatus> Request::_parse_params(size_t start, size_t end)
 {
-    (void)ignore_invalid;
-    for (; i < lines.size(); i++)
+    while (start < end)
     {
-        if (lines[i].empty())
+        size_t line_end = scan_crlf(m_data, end, start);
+        if (line_end == StringView::npos)
+            line_end = end;
+
+        if (line_end == start)
+        {
+            start = line_end + 2;
             continue;
-        size_t comma = lines[i].find(":");
-        std::string key = trim(lines[i].substr(0, comma));
-        std::string value = trim(lines[i].substr(comma + 1));
+        }
+
+        // No whitespace is allowed between the name and the colon.
+        size_t colon = scan_byte(m_data, line_end, start, ':');
+        if (colon == StringView::npos || !scan_is_token(m_data + start, colon - start))
+            return HttpStatus(400);
+
+        size_t value_start = colon + 1;
+        size_t value_end = line_end;
+        while (value_start < value_end && _is_ows(m_data[value_start]))
+            value_start++;
+        while (value_end > value_start && _is_ows(m_data[value_end - 1]))
+            value_end--;
+
+        m_header_count++;
+
+        Span name;
+        name.offset = start;
+        name.size = colon - start;
 
-        m_params[key] = value;
+        Span value;
+        value.offset = value_start;
+        value.size = value_end - value_start;
+
+        HeaderName known = _find_header(_view(name));
+
+        if (known == HEADER_COUNT)
+        {
+            Header header;
+            header.name = name;
+            header.value = value;
+
+            if (m_others_count < REQUEST_INLINE_HEADERS)
+                m_others[m_others_count++] = header;
+            else if (m_more_others.size == 0)
+            {
+                m_more_others.offset = start;
+                m_more_others.size = end - start;
+            }
+        }
+        else if (!has_header(known))
+        {
+            m_known[known] = value;
+            m_known_mask |= (uint64_t)1 << known;
+        }
+        else if ((known == HEADER_HOST || known == HEADER_CONTENT_LENGTH) && _view(m_known[known]) != _view(value))
+        {
+            // Conflicting values would let a proxy in front of us and ourselves disagree on the
+            // target or the size of the request.
+            return HttpStatus(400);
+        }
+
+        start = line_end + 2;
     }
+
+    return 0;
 }
 
-Result<Request, int> Request::parse(std::string source)
+Result<int, HttpStatus> Request::parse(const char *data, size_t size)
 {
-    size_t pos = source.find(SEP SEP);
-    std::string header = source.substr(0, pos);
-    std::string body = source.substr(pos + 4);
-    std::vector<std::string> lines = split(header, SEP);
+    StringView source(data, size);
+    size_t pos = scan_header_end(data, size, 0);
 
-    // We need at least the `GET / HTTP/1.1`
+    if (pos == StringView::npos)
+        return HttpStatus(400);
 
-    if (lines.size() == 0)
-        return Err<Request, int>(0);
+    _reset(data, size);
+    m_header_size = pos + 4; // "\r\n\r\n"
 
-    std::vector<std::string> request_line = split(lines[0], " ");
+    // We need at least the `GET / HTTP/1.1`
+    size_t line_end = scan_crlf(data, size, 0);
+    size_t method_end = scan_byte(data, line_end, 0, ' ');
+
+    if (method_end == StringView::npos || !scan_is_token(data, method_end))
+        return HttpStatus(400);
 
-    if (request_line.size() != 3)
-        return Err<Request, int>(0);
+    size_t path_end = scan_byte(data, line_end, method_end + 1, ' ');
 
-    std::string method = request_line[0];
-    std::string path = request_line[1];
-    std::string protocol = request_line[2];
+    if (path_end == StringView::npos || path_end == method_end + 1 ||
+        scan_byte(data, line_end, path_end + 1, ' ') != StringView::npos)
+        return HttpStatus(400);
 
-    Request request;
-    request.m_header_size = pos + 4; // "\r\n\r\n"
+    StringView method = source.substr(0, method_end);
 
     if (method == "GET")
-        request.m_method = GET;
+        m_method = GET;
     else if (method == "POST")
-        request.m_method = POST;
+        m_method = POST;
     else if (method == "DELETE")
-        request.m_method = DELETE;
+        m_method = DELETE;
     else if (method == "HEAD")
-        request.m_method = HEAD;
+        m_method = HEAD;
+    else if (method == "PUT")
+        m_method = PUT;
     else
-        return Err<Request, int>(0);
+        return HttpStatus(400);
 
-    request.m_protocol = protocol;
-    request.m_body = body;
-    request.m_path = path.substr(0, path.find("?"));
-    request._parse_path(path.substr(1));
+    size_t path_start = method_end + 1;
+    size_t question = scan_byte(data, path_end, path_start, '?');
 
-    request._parse_params(lines);
+    m_path.offset = path_start;
+    m_query.offset = path_end;
+    m_query.size = 0;
 
-    return request;
-}
+    if (question != StringView::npos)
+    {
+        m_path.size = question - path_start;
+        m_query.offset = question + 1;
+        m_query.size = path_end - question - 1;
+    }
+    else
+        m_path.size = path_end - path_start;
 
-Result<Request, int> Request::parse_part(std::string header)
-{
-    std::vector<std::string> lines = split(header, "\r\n");
+    m_protocol.offset = path_end + 1;
+    m_protocol.size = line_end - path_end - 1;
+
+    // `HTTP/` followed by a major and a minor digit (RFC 9112 section 2.3). Other minor versions of HTTP/1
+    // are answered as HTTP/1.1 clients, other major versions are not spoken here.
+    StringView protocol = source.substr(m_protocol.offset, m_protocol.size);
+    if (protocol.size() != 8 || !protocol.starts_with("HTTP/") || !std::isdigit((unsigned char)protocol[5]) ||
+        protocol[6] != '.' || !std::isdigit((unsigned char)protocol[7]))
+        return HttpStatus(400);
+    if (protocol[5] != '1')
+        return HttpStatus(505);
 
-    Request req;
-    req._parse_params(lines, 0, true);
-    return req;
+    Result<int, HttpStatus> res = _parse_params(line_end + 2, pos + 2);
+    if (res.is_err())
+        return res;
+
+    return _parse_body_length();
 }
 
-void Request::set_args(std::string param)
+/*
+    Find how the end of the body is marked. The `Content-Length` is validated once so the body size
+    can be compared with it cheaply.
+ */
+Result<int, HttpStatus> Request::_parse_body_length()
 {
-    _parse_path(param);
+    if (has_header(HEADER_TRANSFER_ENCODING))
+    {
+        // A request with both could be framed differently by a proxy in front of us (RFC 9112
+        // section 6.1), and `chunked` is the only coding we can decode.
+        if (has_header(HEADER_CONTENT_LENGTH))
+            return HttpStatus(400);
+        if (!header(HEADER_TRANSFER_ENCODING).equals_ignore_case("chunked"))
+            return HttpStatus(501);
+
+        m_chunked = true;
+        return 0;
+    }
+
+    if (!has_header(HEADER_CONTENT_LENGTH))
+        return 0;
+
+    StringView value = header(HEADER_CONTENT_LENGTH);
+    if (value.empty() || value.size() > 18)
+        return HttpStatus(400);
+
+    size_t length = 0;
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        if (value[i] < '0' || value[i] > '9')
+            return HttpStatus(400);
+        length = length * 10 + (value[i] - '0');
+    }
+
+    m_content_length = length;
+    return 0;
 }
 
-std::string Request::args_str()
+bool Request::has_connection_option(StringView option) const
 {
-    std::string s = "";
+    StringView options = header(HEADER_CONNECTION);
 
-    for (std::map<std::string, std::string>::iterator it = m_args.begin(); it != m_args.end(); it++)
+    while (!options.empty())
     {
-        s += it->first + "=" + it->second;
-        std::map<std::string, std::string>::iterator it2 = it;
-        it2++;
-        if (it2 != m_args.end())
-            s += "&";
+        size_t end = options.find(',');
+        StringView current = options.substr(0, end);
+
+        while (!current.empty() && _is_ows(current[0]))
+            current = current.substr(1);
+        while (!current.empty() && _is_ows(current[current.size() - 1]))
+            current = current.substr(0, current.size() - 1);
+
+        if (current.equals_ignore_case(option))
+            return true;
+        if (end == StringView::npos)
+            break;
+        options = options.substr(end + 1);
     }
+    return false;
+}
 
-    return s;
+Result<int, HttpStatus> Request::parse_part(const char *data, size_t size)
+{
+    _reset(data, size);
+    m_header_size = size;
+
+    return _parse_params(0, size);
 }
@@ -1,20 +1,66 @@
 #pragma once
 
+#include "http/status.hpp"
 #include "result.hpp"
+#include "string.hpp"
 #include <cstdlib>
-#include <map>
 #include <sstream>
+#include <stdint.h>
 #include <string>
-#include <vector>
 
 #define SEP "\r\n"
 
+/* Number of unknown headers indexed inside the request, the others are found by scanning the header lines. */
+#define REQUEST_INLINE_HEADERS 16
+
+/*
+    Standard headers, which are stored in fixed slots of the request.
+ */
+enum HeaderName
+{
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_KEEP_ALIVE,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_CONTENT_DISPOSITION,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_TE,
+    HEADER_EXPECT,
+    HEADER_UPGRADE,
+    HEADER_COOKIE,
+    HEADER_USER_AGENT,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_AUTHORIZATION,
+    HEADER_REFERER,
+    HEADER_ORIGIN,
+    HEADER_CACHE_CONTROL,
+    HEADER_PRAGMA,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_RANGE,
+    HEADER_FORWARDED,
+    HEADER_X_FORWARDED_FOR,
+    HEADER_SEC_WEBSOCKET_KEY,
+    HEADER_SEC_WEBSOCKET_VERSION,
+    HEADER_SEC_WEBSOCKET_PROTOCOL,
+    HEADER_HTTP2_SETTINGS,
+    HEADER_LAST_EVENT_ID,
+    HEADER_COUNT
+};
+
+/* Size of the perfect hash table of standard headers, must be a power of two. */
+#define HEADER_TABLE_SIZE 64
+
 enum Method
 {
     GET,
     POST,
     DELETE,
-    HEAD
+    HEAD,
+    PUT
 };
 
 inline const char *strmethod(Method method)
@@ -29,107 +75,285 @@ inline const char *strmethod(Method method)
         return "DELETE";
     case POST:
         return "POST";
+    case PUT:
+        return "PUT";
     }
 }
 
+/*
+    A parsed HTTP request. The request does not own any of its content: the path, headers and body
+    are stored as offsets into the buffer it was parsed from, so parsing does not allocate. Only the
+    first `REQUEST_INLINE_HEADERS` unknown headers are indexed, the lines after them are scanned again
+    when a header is looked up.
+
+    The buffer must outlive the request. If it is moved (e.g. because the connection received more
+    data), `rebase` must be called with its new location.
+ */
 class Request
 {
 public:
-    static Result<Request, int> parse(std::string body);
+    Request();
 
     /*
-        Parse a request from a multipart/form-data
+        Fill the perfect hash table used to recognize standard headers.
      */
-    static Result<Request, int> parse_part(std::string header);
+    static void _build_header_table();
 
-    Request();
+    /*
+        Returns the name of a standard header (e.g. `Content-Length`).
+     */
+    static const char *header_name(HeaderName name);
+
+    /*
+        Parse the request line and headers at the start of `data`, up to and including the empty
+        line. Everything after it is the body.
+     */
+    Result<int, HttpStatus> parse(const char *data, size_t size);
 
-    bool is_coffee()
+    /*
+        Parse the headers of a multipart/form-data part.
+     */
+    Result<int, HttpStatus> parse_part(const char *data, size_t size);
+
+    void rebase(const char *data, size_t size)
     {
-        return m_params.count("User-Agent") > 0 && m_params["User-Agent"].find("coffee") != std::string::npos;
+        m_data = data;
+        m_size = size;
     }
 
-    std::string& get_param(std::string key);
-    bool has_param(std::string key);
+    bool is_coffee() const
+    {
+        return user_agent().find("coffee") != StringView::npos;
+    }
 
-    std::string params()
+    /*
+        Returns the value of a standard header, or an empty string if it is not present.
+     */
+    StringView header(HeaderName name) const
     {
-        std::stringstream ss;
+        return has_header(name) ? _view(m_known[name]) : StringView();
+    }
+
+    bool has_header(HeaderName name) const
+    {
+        return (m_known_mask & ((uint64_t)1 << name)) != 0;
+    }
 
-        for (std::map<std::string, std::string>::iterator it = m_params.begin(); it != m_params.end(); it++)
-        {
-            ss << it->first << ": " << it->second << "\n";
-        }
+    /*
+        Returns the value of any header, matched case-insensitively, or an empty string if it is
+        not present.
+     */
+    StringView get_param(StringView key) const;
+    bool has_param(StringView key) const;
 
-        return ss.str();
+    std::string params() const;
+
+    /*
+        Whether the client wants the connection kept open after the response. HTTP/1.1 connections are
+        persistent unless the client sends `Connection: close`, HTTP/1.0 clients have to ask for it with
+        `Connection: keep-alive`.
+     */
+    bool is_keep_alive() const
+    {
+        if (protocol() == "HTTP/1.0")
+            return has_connection_option("keep-alive");
+        return !has_connection_option("close");
     }
 
-    bool is_keep_alive()
+    bool is_closed() const
     {
-        return m_params.count("Connection") > 0 && m_params["Connection"] == "keep-alive";
+        return has_connection_option("close");
     }
 
-    bool is_closed()
+    /*
+        Whether `option` is one of the comma-separated options of the `Connection` header.
+     */
+    bool has_connection_option(StringView option) const;
+
+    /*
+        Whether the client asks to switch the connection to the WebSocket protocol (RFC 6455 section 4.1).
+     */
+    bool is_websocket() const
     {
-        return m_params.count("Connection") > 0 && m_params["Connection"] == "close";
+        return header(HEADER_UPGRADE).equals_ignore_case("websocket") && has_connection_option("upgrade");
     }
 
-    size_t content_length()
+    /*
+        Declared size of the body, `(size_t)-1` if there is no `Content-Length`.
+     */
+    size_t content_length() const
     {
-        return m_params.count("Content-Length") > 0 ? std::atoi(m_params["Content-Length"].c_str()) : (size_t)-1;
+        return m_content_length;
     }
 
-    std::string& content_type()
+    /*
+        Whether the body is sent with `Transfer-Encoding: chunked`, its size is then only known once
+        it was fully received.
+     */
+    bool is_chunked() const
     {
-        return m_params["Content-Type"];
+        return m_chunked;
     }
 
-    std::string& cookies()
+    /*
+        Number of header lines, duplicates included.
+     */
+    size_t header_count() const
+    {
+        return m_header_count;
+    }
+
+    StringView content_type() const
+    {
+        return header(HEADER_CONTENT_TYPE);
+    }
+
+    StringView cookies() const
     {
-        return get_param("Cookie");
+        return header(HEADER_COOKIE);
     }
 
-    std::string& user_agent()
+    StringView user_agent() const
     {
-        return get_param("User-Agent");
+        return header(HEADER_USER_AGENT);
     }
 
-    std::string& path()
+    StringView path() const
     {
-        return m_path;
+        return _view(m_path);
     }
 
-    Method method()
+    /*
+        Arguments of the request, without the `?`: `page=1&foo=bar`
+     */
+    StringView query() const
+    {
+        return _view(m_query);
+    }
+
+    StringView protocol() const
+    {
+        return _view(m_protocol);
+    }
+
+    Method method() const
     {
         return m_method;
     }
 
-    size_t header_size()
+    size_t header_size() const
     {
         return m_header_size;
     }
 
-    std::string& body()
+    /*
+        Header lines as received, each one ended by `\r\n`, without the request line and the empty line.
+     */
+    StringView raw_headers() const
     {
-        return m_body;
+        size_t start = m_protocol.offset + m_protocol.size + 2;
+        return StringView(m_data + start, m_header_size - 2 - start);
     }
 
-    void set_args(std::string param);
-    std::string args_str();
+    /*
+        Part of the body held in memory, without what was already moved to a file.
+     */
+    StringView body() const
+    {
+        return StringView(m_data + m_header_size, m_size - m_header_size);
+    }
+
+    /*
+        Size of the body received so far, in memory or not.
+     */
+    size_t body_size() const
+    {
+        return m_body_stored + m_size - m_header_size;
+    }
+
+    bool body_in_file() const
+    {
+        return m_body_fd != -1;
+    }
+
+    /*
+        File holding the body if it was too large to stay in memory, `-1` otherwise.
+     */
+    int body_fd() const
+    {
+        return m_body_fd;
+    }
 
-private:
-    Method m_method;
-    std::string m_path;
-    std::map<std::string, std::string> m_params;
-    std::string m_protocol;
     /*
-        Request arguments: `?page=1&foo=bar`
+        Mark the body as stored in `fd`, the request does not take ownership of the file.
      */
-    std::map<std::string, std::string> m_args;
+    void set_body_file(int fd)
+    {
+        m_body_fd = fd;
+    }
+
+    /*
+        Set how many bytes at the start of the body were taken out of the receive buffer, either
+        written to the body file or consumed by an upload.
+     */
+    void set_body_stored(size_t size)
+    {
+        m_body_stored = size;
+    }
+
+private:
+    struct Span
+    {
+        size_t offset;
+        size_t size;
+    };
+
+    struct Header
+    {
+        Span name;
+        Span value;
+    };
+
+    const char *m_data;
+    size_t m_size;
+
+    Method m_method;
+    Span m_path;
+    Span m_query;
+    Span m_protocol;
+
+    /* Values of standard headers, `m_known_mask` has a bit set for each one present. */
+    Span m_known[HEADER_COUNT];
+    uint64_t m_known_mask;
+
+    /* Other headers, up to `REQUEST_INLINE_HEADERS`. */
+    Header m_others[REQUEST_INLINE_HEADERS];
+    size_t m_others_count;
+    /* Header lines after the last indexed one, empty unless there are more other headers. */
+    Span m_more_others;
 
     size_t m_header_size;
-    std::string m_body;
 
-    void _parse_path(std::string path);
-    void _parse_params(std::vector<std::string>& lines, size_t i = 1, bool ignore_invalid = false);
+    int m_body_fd;
+    size_t m_body_stored;
+
+    size_t m_header_count;
+    size_t m_content_length;
+    bool m_chunked;
+
+    static HeaderName m_header_table[HEADER_TABLE_SIZE];
+
+    static size_t _hash_header(const char *name, size_t size);
+    static HeaderName _find_header(StringView name);
+
+    StringView _view(Span span) const
+    {
+        return StringView(m_data + span.offset, span.size);
+    }
+
+    bool _find_other(StringView key, StringView& value) const;
+
+    void _reset(const char *data, size_t size);
+    Result<int, HttpStatus> _parse_body_length();
+    Result<int, HttpStatus> _parse_params(size_t start, size_t end);
 };
@@ -1,108 +1,38 @@
+#include <cerrno>
 #include <cstddef>
-#include <sstream>
+#include <cstring>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <vector>
 
 #include "file.hpp"
+#include "http/error_pages.hpp"
 #include "logger.hpp"
 #include "request.hpp"
 #include "response.hpp"
 #include "string.hpp"
 
-// clang-format off
-#ifndef _DEBUG
-static std::string source =
-"<!DOCTYPE html>" SEP
-"<html lang='en'>" SEP
-"    <head>" SEP
-"        <meta charset='UTF-8'>" SEP
-"        <meta name='viewport' content='width=device-width, initial-scale=1.0'>" SEP
-"        <title>Error %{error}</title>" SEP
-"        <style>" SEP
-"            * {" SEP
-"                background-color: black;" SEP
-"            }" SEP
-"" SEP
-"            h1, h2, h3 {" SEP
-"                color: white;" SEP
-"                font-family: Verdana, Geneva, Tahoma, sans-serif;" SEP
-"            }" SEP
-"" SEP
-"            body {" SEP
-"                text-align: center;" SEP
-"            }" SEP
-"        </style>" SEP
-"    </head>" SEP
-"    <body>" SEP
-"        <h1>Oops, there seems to be an error !</h1>" SEP
-"        <h2>Here's a %{error_theme} to make you feel better</h3>" SEP
-"        <img src='%{error_url}/%{error}.jpg' style='height: 70%'>" SEP
-"    </body>" SEP
-"</html>" SEP;
-#else
-static std::string source =
-"<!DOCTYPE html>" SEP
-"<html lang='en'>" SEP
-"    <head>" SEP
-"        <meta charset='UTF-8'>" SEP
-"        <meta name='viewport' content='width=device-width, initial-scale=1.0'>" SEP
-"        <title>Error %{error}</title>" SEP
-"        <style>" SEP
-"            * {" SEP
-"                background-color: black;" SEP
-"            }" SEP
-"" SEP
-"            h1, h2, h3 {" SEP
-"                color: white;" SEP
-"                font-family: Verdana, Geneva, Tahoma, sans-serif;" SEP
-"            }" SEP
-"" SEP
-"            body {" SEP
-"                text-align: center;" SEP
-"            }" SEP
-"        </style>" SEP
-"    </head>" SEP
-"    <body>" SEP
-"        <h1>Oops, there seems to be an error !</h1>" SEP
-"        <h2>Here's a %{error_theme} to make you feel better</h3>" SEP
-"        <h2 style='color: yellow;'>in %{func}() at <a style='color: yellow;' href='vscode://file/%{path}/%{file}:%{line}'>%{file}:%{line}</a></h2>" SEP
-"        <img src='%{error_url}/%{error}.jpg' style='width: 45%;'>" SEP
-"    </body>" SEP
-"</html>" SEP;
-#endif
-// clang-format on
-
-std::map<std::string, std::string> Response::m_themes;
-
-void Response::_build_themes()
+Response::Response() : m_status(200), m_keep_alive(true), m_params_count(0), m_storage_size(0)
 {
-    m_themes["cat"] = "https://http.cat";
-    m_themes["dog"] = "https://http.dog";
-    m_themes["duck"] = "https://httpducks.com";
-    m_themes["goat"] = "https://httpgoats.com";
-    m_themes["garden"] = "https://http.garden";
-    m_themes["pizza"] = "https://http.pizza";
-    m_themes["fish"] = "https://http.fish";
 }
 
-Response::Response() : m_status(200)
+Response::Response(HttpStatus status) : m_status(status), m_keep_alive(true), m_params_count(0), m_storage_size(0)
 {
 }
 
-Response::Response(HttpStatus status) : m_status(status)
-{
-    (void)m_body;
-}
-
 Response Response::ok(HttpStatus status, File file)
 {
     Response response(status);
-    response.m_body = file;
+    response.m_body.swap(file);
 
-    response.add_param("Content-Length", to_string(file.file_size()));
-    response.add_param("Content-Type", file.mime());
+    // A `204 No Content` response cannot have a body, not even an empty one.
+    if (status.code() == 204)
+        return response;
+
+    // Responses without a body (e.g. `201 Created` for a `PUT`) have no type either.
+    if (!response.m_body.mime().empty())
+        response.add_param("Content-Type", response.m_body.mime());
 
     return response;
 }
@@ -128,12 +58,13 @@ Response Response::from_cgi(HttpStatus status, std::string str)
         std::string key = lines[i].substr(0, comma);
         std::string value = trim(lines[i].substr(comma + 1));
 
-        response.m_params[key] = value;
+        // These describe the response as the server sends it.
+        if (StringView(key).equals_ignore_case("Content-Length") || StringView(key).equals_ignore_case("Connection"))
+            continue;
+        response.add_param(key, value);
     }
 
     response.m_body = File::memory(body, "text/html");
-    response.add_param("Content-Length", to_string(response.body().file_size()));
-
     return response;
 }
 
@@ -147,101 +78,189 @@ File& Response::body()
     return m_body;
 }
 
-std::string Response::encode_header()
+StringView Response::encode_header(Arena& arena)
 {
-    std::stringstream r;
-
-    r << "HTTP/1.1 " << m_status.code() << " " << m_status << SEP;
-
-    for (std::map<std::string, std::string>::iterator it = m_params.begin(); it != m_params.end(); it++)
-        r << it->first << ": " << it->second << SEP;
-
-    r << SEP;
+    char code[4];
+    const char *reason = m_status.reason();
+    const char *connection = m_keep_alive ? "Connection: keep-alive" SEP : "Connection: close" SEP;
+    size_t size = sizeof("HTTP/1.1 000 \r\n") - 1 + std::strlen(reason) + std::strlen(connection) + 2;
+
+    // A `204 No Content` response has no `Content-Length`.
+    char length[32];
+    size_t length_size = 0;
+    if (m_status.code() != 204)
+    {
+        char digits[20];
+        size_t count = 0;
+        size_t n = m_body.file_size();
+
+        do
+            digits[count++] = '0' + n % 10;
+        while ((n /= 10) > 0);
+
+        std::memcpy(length, "Content-Length: ", 16);
+        length_size = 16;
+        while (count > 0)
+            length[length_size++] = digits[--count];
+        std::memcpy(length + length_size, SEP, 2);
+        length_size += 2;
+    }
+    size += length_size;
+
+    for (size_t i = 0; i < param_count(); i++)
+        size += _param(i).name.size + 2 + _param(i).value.size + 2;
+
+    char *header = (char *)arena.alloc(size);
+    char *p = header;
+
+    code[0] = '0' + (m_status.code() / 100) % 10;
+    code[1] = '0' + (m_status.code() / 10) % 10;
+    code[2] = '0' + m_status.code() % 10;
+    code[3] = ' ';
+
+    std::memcpy(p, "HTTP/1.1 ", 9);
+    p += 9;
+    std::memcpy(p, code, 4);
+    p += 4;
+    std::memcpy(p, reason, std::strlen(reason));
+    p += std::strlen(reason);
+    std::memcpy(p, SEP, 2);
+    p += 2;
+    std::memcpy(p, connection, std::strlen(connection));
+    p += std::strlen(connection);
+    std::memcpy(p, length, length_size);
+    p += length_size;
+
+    for (size_t i = 0; i < param_count(); i++)
+    {
+        StringView name = param_name(i);
+        StringView value = param_value(i);
+
+        std::memcpy(p, name.data(), name.size());
+        p += name.size();
+        std::memcpy(p, ": ", 2);
+        p += 2;
+        std::memcpy(p, value.data(), value.size());
+        p += value.size();
+        std::memcpy(p, SEP, 2);
+        p += 2;
+    }
 
-    return r.str();
+    std::memcpy(p, SEP, 2);
+    return StringView(header, size);
 }
 
-bool Response::send(int conn, ServerConfig& config)
+bool Response::enqueue(OutputQueue& out, ServerConfig& config, Arena& arena)
 {
     if (!m_body.exists())
     {
         ws::log << ws::err << FILE_INFO << "Attempted to send a invalid response\n";
         Response err = HTTP_ERROR(500, config); // Internal server error
-        err.send(conn, config);
+        err.enqueue(out, config, arena);
         return false;
     }
 
-    std::string header = encode_header();
-
-    ssize_t s = ::send(conn, header.c_str(), header.size(), 0);
-
-    if (s == -1 || s == 0)
+    SharedBuffer& encoded = m_keep_alive ? m_encoded_keep_alive : m_encoded_close;
+    if (!encoded.is_null())
     {
-        return false;
+        out.push(encoded);
+        return true;
     }
 
-    if (!m_body.send(conn))
+    StringView header = encode_header(arena);
+    out.push_borrowed(header.data(), header.size());
+
+    if (!m_body.enqueue(out))
     {
+        ws::log << ws::err << FILE_INFO << "Cannot open `" << m_body.file_name() << "`: " << strerror(errno) << "\n";
+        out.clear();
+        Response err = HTTP_ERROR(500, config); // Internal server error
+        err.enqueue(out, config, arena);
         return false;
     }
 
     return true;
 }
 
-void Response::add_param(std::string key, std::string value)
+Response::Span Response::_store(StringView s)
 {
-    m_params[key] = value;
+    Span span;
+    span.size = s.size();
+
+    if (m_storage_size + s.size() <= RESPONSE_INLINE_STORAGE)
+    {
+        std::memcpy(m_storage + m_storage_size, s.data(), s.size());
+        span.offset = m_storage_size;
+        m_storage_size += s.size();
+    }
+    else
+    {
+        span.offset = RESPONSE_INLINE_STORAGE + m_more_storage.size();
+        m_more_storage.append(s.data(), s.size());
+    }
+    return span;
 }
 
-Response Response::http_error(HttpStatus status, ServerConfig& config, const char *func, const char *file, int line)
+long Response::_find_param(StringView key) const
 {
-    (void)func;
-    (void)file;
-    (void)line;
+    for (size_t i = 0; i < param_count(); i++)
+        if (param_name(i).equals_ignore_case(key))
+            return i;
+    return -1;
+}
 
-    Response response(status);
+void Response::add_param(StringView key, StringView value)
+{
+    m_encoded_close = SharedBuffer();
+    m_encoded_keep_alive = SharedBuffer();
 
-    if (config.error_pages().count(status.code()) == 0 ||
-        access(config.error_pages()[status.code()].c_str(), F_OK | R_OK) == -1)
+    // The bytes of a replaced value are not reused, headers are rarely set twice.
+    long i = _find_param(key);
+    if (i != -1)
     {
-        std::string content = source;
+        _param(i).value = _store(value);
+        return;
+    }
 
-        std::string theme;
-        if (m_themes.count(config.error_theme()) > 0)
-            theme = config.error_theme();
-        else
-            theme = "cat";
+    Param param;
+    param.name = _store(key);
+    param.value = _store(value);
 
-        replace_all(content, "%{error_url}", m_themes[theme]);
-        replace_all(content, "%{error_theme}", theme);
-        replace_all(content, "%{error}", to_string(status.code()));
+    if (m_params_count < RESPONSE_INLINE_PARAMS)
+        m_params[m_params_count++] = param;
+    else
+        m_more_params.push_back(param);
+}
 
-#ifdef _DEBUG
-        replace_all(content, "%{func}", func);
-        replace_all(content, "%{file}", file);
-        replace_all(content, "%{line}", to_string(line));
+StringView Response::get_param(StringView key) const
+{
+    long i = _find_param(key);
+    return i != -1 ? param_value(i) : StringView();
+}
 
-        char buf[64];
+bool Response::has_param(StringView key) const
+{
+    return _find_param(key) != -1;
+}
 
-        getcwd(buf, 64);
-        replace_all(content, "%{path}", buf);
-#endif
+void Response::remove_param(StringView key)
+{
+    long i = _find_param(key);
+    if (i == -1)
+        return;
 
-        response.m_body = File::memory(content, "text/html");
+    m_encoded_close = SharedBuffer();
+    m_encoded_keep_alive = SharedBuffer();
+    for (size_t j = i; j + 1 < param_count(); j++)
+        _param(j) = _param(j + 1);
 
-        response.add_param("Content-Type", "text/html");
-        response.add_param("Content-Length", to_string(response.body().file_size()));
-    }
+    if (!m_more_params.empty())
+        m_more_params.pop_back();
     else
-    {
-        response.m_body = File::stream(config.error_pages()[status.code()]);
-
-        response.add_param("Content-Type", "text/html");
-        response.add_param("Content-Length", to_string(response.body().file_size()));
-    }
-
-    if (response.status().code() >= 400)
-        response.add_param("Connection", "close");
+        m_params_count--;
+}
 
-    return response;
+Response Response::http_error(HttpStatus status, ServerConfig& config, const char *func, const char *file, int line)
+{
+    return g_error_pages.response(status, config, func, file, line);
 }
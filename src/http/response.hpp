@@ -1,12 +1,24 @@
 #pragma once
 
-#include <map>
 #include <string>
+#include <vector>
 
+#include "arena.hpp"
 #include "config/config.hpp"
 #include "file.hpp"
+#include "output_queue.hpp"
 #include "status.hpp"
 
+/* Number of headers stored inside the response before spilling to the heap. */
+#define RESPONSE_INLINE_PARAMS 8
+/* Bytes of header names and values stored inside the response before spilling to the heap. */
+#define RESPONSE_INLINE_STORAGE 256
+
+/*
+    A response to send. Like those of a `Request`, the headers of a typical response are stored inside
+    the object, their names and values copied to a fixed buffer, so they do not allocate. Only responses
+    with many or long headers (e.g. from a CGI) use the heap.
+ */
 class Response
 {
 public:
@@ -15,40 +27,127 @@ public:
     static Response ok(HttpStatus status, File file);
     static Response http_error(HttpStatus status, ServerConfig& config, const char *func, const char *file, int line);
 
-    static void _build_themes();
-
     /*
         CGIs will starts the response with a few headers value, but without the first line.
      */
     static Response from_cgi(HttpStatus status, std::string str);
 
-    void add_param(std::string key, std::string value);
+    /*
+        Set the header `key`, replacing any header with the same name. Both strings are copied.
+     */
+    void add_param(StringView key, StringView value);
+
+    /*
+        Value of the header `key`, or an empty view if there is none.
+     */
+    StringView get_param(StringView key) const;
+
+    bool has_param(StringView key) const;
+    void remove_param(StringView key);
+
+    size_t param_count() const
+    {
+        return m_params_count + m_more_params.size();
+    }
+
+    StringView param_name(size_t i) const
+    {
+        return _view(_param(i).name);
+    }
 
-    std::string& get_param(const std::string& key)
+    StringView param_value(size_t i) const
     {
-        return m_params[key];
+        return _view(_param(i).value);
     }
 
-    bool has_param(const std::string& key)
+    /*
+        Whether the connection stays open after the response, which is told with `Connection`. The header and
+        `Content-Length` are not among the params, they are written by `encode_header`.
+     */
+    bool keep_alive() const
     {
-        return m_params.count(key) > 0;
+        return m_keep_alive;
     }
 
-    bool send(int conn, ServerConfig& config);
+    void set_keep_alive(bool keep_alive)
+    {
+        m_keep_alive = keep_alive;
+    }
+
+    /*
+        Queue `close` or `keep_alive` on HTTP/1.1 connections instead of encoding the response, they hold the
+        status line, the headers and the body. Setting or removing a header drops them.
+     */
+    void set_encoded(const SharedBuffer& close, const SharedBuffer& keep_alive)
+    {
+        m_encoded_close = close;
+        m_encoded_keep_alive = keep_alive;
+    }
+
+    /*
+        Queue the response to be written to a connection, its header is encoded in `arena` which must not
+        be reset before the queue is written. If the body cannot be read a `500` is queued instead and
+        `false` is returned, the connection should then be closed.
+     */
+    bool enqueue(OutputQueue& out, ServerConfig& config, Arena& arena);
 
     HttpStatus status();
     File& body();
 
-    std::string encode_header();
+    /*
+        Encode the status line and headers in `arena`.
+     */
+    StringView encode_header(Arena& arena);
 
 private:
+    struct Span
+    {
+        /* Offsets past `RESPONSE_INLINE_STORAGE` are in `m_more_storage`. */
+        size_t offset;
+        size_t size;
+    };
+
+    struct Param
+    {
+        Span name;
+        Span value;
+    };
+
     HttpStatus m_status;
     File m_body;
-    std::map<std::string, std::string> m_params;
+    bool m_keep_alive;
+    SharedBuffer m_encoded_close;
+    SharedBuffer m_encoded_keep_alive;
+
+    Param m_params[RESPONSE_INLINE_PARAMS];
+    size_t m_params_count;
+    std::vector<Param> m_more_params;
+
+    char m_storage[RESPONSE_INLINE_STORAGE];
+    size_t m_storage_size;
+    std::string m_more_storage;
 
     Response(HttpStatus status);
 
-    static std::map<std::string, std::string> m_themes;
+    Span _store(StringView s);
+    long _find_param(StringView key) const;
+
+    StringView _view(Span span) const
+    {
+        if (span.offset < RESPONSE_INLINE_STORAGE)
+            return StringView(m_storage + span.offset, span.size);
+        return StringView(m_more_storage.data() + span.offset - RESPONSE_INLINE_STORAGE, span.size);
+    }
+
+    Param& _param(size_t i)
+    {
+        return i < RESPONSE_INLINE_PARAMS ? m_params[i] : m_more_params[i - RESPONSE_INLINE_PARAMS];
+    }
+
+    const Param& _param(size_t i) const
+    {
+        return i < RESPONSE_INLINE_PARAMS ? m_params[i] : m_more_params[i - RESPONSE_INLINE_PARAMS];
+    }
 };
 
 #define HTTP_ERROR(CODE, CONF) Response::http_error(CODE, CONF, __FUNCTION__, __FILE__, __LINE__)
@@ -0,0 +1,171 @@
+#include <cstring>
+
+#include "http/scan.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define NOT_FOUND ((size_t)-1)
+
+/*
+    Scalar implementations, also used for the tails of the vectorized ones.
+ */
+
+static size_t _scalar_byte(const char *data, size_t size, size_t pos, char c)
+{
+    if (pos >= size)
+        return NOT_FOUND;
+
+    const void *p = std::memchr(data + pos, c, size - pos);
+    return p ? (const char *)p - data : NOT_FOUND;
+}
+
+/*
+    `\r` is rare in headers, about once per line, so the libc's vectorized `memchr` finds the candidates
+    and only the following bytes are compared. This was measured faster than comparing shifted vectors.
+ */
+static size_t _scalar_crlf(const char *data, size_t size, size_t pos)
+{
+    while (pos + 1 < size)
+    {
+        const char *p = (const char *)std::memchr(data + pos, '\r', size - pos - 1);
+        if (!p)
+            return NOT_FOUND;
+
+        pos = p - data;
+        if (data[pos + 1] == '\n')
+            return pos;
+        pos++;
+    }
+    return NOT_FOUND;
+}
+
+static size_t _scalar_header_end(const char *data, size_t size, size_t pos)
+{
+    while (pos + 3 < size)
+    {
+        const char *p = (const char *)std::memchr(data + pos, '\r', size - pos - 3);
+        if (!p)
+            return NOT_FOUND;
+
+        pos = p - data;
+        if (data[pos + 1] == '\n' && data[pos + 2] == '\r' && data[pos + 3] == '\n')
+            return pos;
+        pos++;
+    }
+    return NOT_FOUND;
+}
+
+static bool tokens[256];
+
+static bool _scalar_is_token(const char *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        if (!tokens[(unsigned char)data[i]])
+            return false;
+    return size > 0;
+}
+
+#ifdef SCAN_X86
+
+static inline size_t _ctz(unsigned int mask)
+{
+    return __builtin_ctz(mask);
+}
+
+/*
+    SSE2, always available on x86_64.
+ */
+
+static size_t _sse2_header_end(const char *data, size_t size, size_t pos)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    for (; pos + 19 <= size; pos += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + pos));
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + pos + 1));
+        __m128i c = _mm_loadu_si128((const __m128i *)(data + pos + 2));
+        __m128i d = _mm_loadu_si128((const __m128i *)(data + pos + 3));
+        __m128i m = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf)),
+                                  _mm_and_si128(_mm_cmpeq_epi8(c, cr), _mm_cmpeq_epi8(d, lf)));
+        unsigned int mask = _mm_movemask_epi8(m);
+
+        if (mask)
+            return pos + _ctz(mask);
+    }
+    return _scalar_header_end(data, size, pos);
+}
+
+/*
+    AVX2, compiled for that target only and used if the CPU supports it.
+ */
+
+__attribute__((target("avx2"))) static size_t _avx2_header_end(const char *data, size_t size, size_t pos)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    for (; pos + 35 <= size; pos += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + pos));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + pos + 1));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(data + pos + 2));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(data + pos + 3));
+        __m256i m = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf)),
+                                     _mm256_and_si256(_mm256_cmpeq_epi8(c, cr), _mm256_cmpeq_epi8(d, lf)));
+        unsigned int mask = _mm256_movemask_epi8(m);
+
+        if (mask)
+            return pos + _ctz(mask);
+    }
+
+    // The tail is legacy SSE code, which is slowed down on every instruction while the upper halves of the
+    // registers are dirty. The compiler does not always clear them before a tail call.
+    _mm256_zeroupper();
+    return _sse2_header_end(data, size, pos);
+}
+
+#endif
+
+static size_t (*header_end_impl)(const char *, size_t, size_t) = _scalar_header_end;
+
+void _init_scanners()
+{
+    const char *special = "!#$%&'*+-.^_`|~";
+
+    for (int c = 0; c < 256; c++)
+        tokens[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                    (c != 0 && std::strchr(special, c) != NULL);
+
+#ifdef SCAN_X86
+    header_end_impl = _sse2_header_end;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        header_end_impl = _avx2_header_end;
+#endif
+}
+
+size_t scan_byte(const char *data, size_t size, size_t pos, char c)
+{
+    return _scalar_byte(data, size, pos, c);
+}
+
+size_t scan_crlf(const char *data, size_t size, size_t pos)
+{
+    return _scalar_crlf(data, size, pos);
+}
+
+size_t scan_header_end(const char *data, size_t size, size_t pos)
+{
+    return header_end_impl(data, size, pos);
+}
+
+bool scan_is_token(const char *data, size_t size)
+{
+    return _scalar_is_token(data, size);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+    Byte scanning kernels used by the HTTP parser. Only `scan_header_end` is vectorized, with SSE2 or
+    AVX2 picked at runtime by `_init_scanners`, the others did not beat the libc's `memchr` or a lookup
+    table in `bench/parser_bench`. All of them return `(size_t)-1` when nothing is found.
+ */
+
+/*
+    Select the fastest implementation supported by the CPU.
+ */
+void _init_scanners();
+
+/*
+    Find the first `c` in `data[pos..size)`.
+ */
+size_t scan_byte(const char *data, size_t size, size_t pos, char c);
+
+/*
+    Find the first `\r\n` in `data[pos..size)`.
+ */
+size_t scan_crlf(const char *data, size_t size, size_t pos);
+
+/*
+    Find the first `\r\n\r\n` in `data[pos..size)`, which ends the headers of a request.
+ */
+size_t scan_header_end(const char *data, size_t size, size_t pos);
+
+/*
+    Returns `true` if `data` is a non-empty HTTP token (RFC 9110 section 5.6.2), which is what
+    header names and methods are made of.
+ */
+bool scan_is_token(const char *data, size_t size);
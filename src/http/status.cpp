@@ -1,3 +1,5 @@
+#include <cstddef>
+
 #include "status.hpp"
 
 HttpStatus::HttpStatus() : m_code(200)
@@ -18,45 +20,86 @@ int HttpStatus::code() const
     return m_code;
 }
 
-std::ostream& operator<<(std::ostream& os, HttpStatus const& error)
+/*
+    Reason phrase of the statuses the server emits, `NULL` for the others.
+ */
+static const char *_reason(int code)
 {
-    switch (error.code())
+    switch (code)
     {
     case 100:
-        os << "Continue";
+        return "Continue";
+    case 101:
+        return "Switching Protocols";
     case 200:
-        os << "OK";
-        break;
+        return "OK";
+    case 201:
+        return "Created";
+    case 204:
+        return "No Content";
     case 301:
-        os << "Moved Permanently";
-        break;
+        return "Moved Permanently";
+    case 302:
+        return "Found";
+    case 304:
+        return "Not Modified";
     case 307:
-        os << "Temporary Redirect";
-        break;
+        return "Temporary Redirect";
     case 308:
-        os << "Permanent Redirect";
-        break;
+        return "Permanent Redirect";
+    case 400:
+        return "Bad Request";
+    case 401:
+        return "Unauthorized";
     case 403:
-        os << "Forbidden";
-        break;
+        return "Forbidden";
     case 404:
-        os << "Not found";
-        break;
+        return "Not found";
     case 405:
-        os << "Method not allowed";
-        break;
+        return "Method not allowed";
+    case 409:
+        return "Conflict";
     case 411:
-        os << "Length required";
-        break;
+        return "Length required";
     case 413:
-        os << "Payload Too Large";
-        break;
+        return "Payload Too Large";
+    case 417:
+        return "Expectation Failed";
+    case 426:
+        return "Upgrade Required";
+    case 431:
+        return "Request Header Fields Too Large";
     case 500:
-        os << "Internal server error";
-        break;
+        return "Internal server error";
+    case 501:
+        return "Not Implemented";
+    case 502:
+        return "Bad Gateway";
+    case 503:
+        return "Service Unavailable";
+    case 504:
+        return "Gateway Timeout";
+    case 505:
+        return "HTTP Version Not Supported";
     default:
-        os << "UNKNOWN"; // NOTE: Unreachable
-        break;
+        return NULL;
     }
-    return os;
+}
+
+bool HttpStatus::is_known() const
+{
+    return _reason(m_code) != NULL;
+}
+
+const char *HttpStatus::reason() const
+{
+    const char *reason = _reason(m_code);
+
+    // Statuses passed on from an upstream server may not be listed.
+    return reason ? reason : "UNKNOWN";
+}
+
+std::ostream& operator<<(std::ostream& os, HttpStatus const& error)
+{
+    return os << error.reason();
 }
@@ -11,6 +11,16 @@ public:
     bool is_error() const;
     int code() const;
 
+    /*
+        Whether the status is one the server emits itself, which has a reason phrase.
+     */
+    bool is_known() const;
+
+    /*
+        Returns the reason phrase of the status (e.g. `Not found`).
+     */
+    const char *reason() const;
+
 private:
     int m_code;
 };
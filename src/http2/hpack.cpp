@@ -0,0 +1,375 @@
+#include <cstring>
+
+#include "http2/hpack.hpp"
+
+int16_t HpackDecoder::m_huffman_tree[512][2];
+
+/*
+    Read an integer with an `prefix` bits prefix (RFC 7541 section 5.1).
+ */
+static bool _read_integer(const unsigned char *& p, const unsigned char *end, int prefix, size_t& value)
+{
+    if (p >= end)
+        return false;
+
+    size_t max = (1 << prefix) - 1;
+    value = *p++ & max;
+    if (value < max)
+        return true;
+
+    for (int shift = 0; shift <= 28; shift += 7)
+    {
+        if (p >= end)
+            return false;
+
+        unsigned char byte = *p++;
+        value += (size_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static void _write_integer(std::string& out, unsigned char first, int prefix, size_t value)
+{
+    size_t max = (1 << prefix) - 1;
+
+    if (value < max)
+    {
+        out += (char)(first | value);
+        return;
+    }
+
+    out += (char)(first | max);
+    value -= max;
+    while (value >= 128)
+    {
+        out += (char)(value % 128 + 128);
+        value /= 128;
+    }
+    out += (char)value;
+}
+
+static void _write_string(std::string& out, StringView s)
+{
+    size_t bits = 0;
+    for (size_t i = 0; i < s.size(); i++)
+        bits += g_huffman_code_lengths[(unsigned char)s[i]];
+
+    // Huffman only pays off for text, binary values are sent as they are.
+    size_t encoded_size = (bits + 7) / 8;
+    if (encoded_size >= s.size())
+    {
+        _write_integer(out, 0x00, 7, s.size());
+        out.append(s.data(), s.size());
+        return;
+    }
+
+    _write_integer(out, 0x80, 7, encoded_size);
+
+    uint64_t acc = 0;
+    int count = 0;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        unsigned char c = s[i];
+        acc = (acc << g_huffman_code_lengths[c]) | g_huffman_codes[c];
+        count += g_huffman_code_lengths[c];
+
+        while (count >= 8)
+        {
+            count -= 8;
+            out += (char)(acc >> count);
+        }
+        acc &= ((uint64_t)1 << count) - 1;
+    }
+
+    // The last byte is padded with the most significant bits of the EOS symbol, which are all ones.
+    if (count > 0)
+        out += (char)((acc << (8 - count)) | (0xff >> count));
+}
+
+HpackDecoder::HpackDecoder() : m_table_size(0), m_max_table_size(HPACK_DEFAULT_TABLE_SIZE)
+{
+}
+
+void HpackDecoder::_build_huffman_tree()
+{
+    std::memset(m_huffman_tree, 0, sizeof(m_huffman_tree));
+
+    // Node `0` is the root, a child of `0` means there is no such code and leaves are stored as
+    // `-(symbol + 1)`.
+    int16_t nodes = 1;
+
+    for (int symbol = 0; symbol < 256; symbol++)
+    {
+        uint32_t code = g_huffman_codes[symbol];
+        int length = g_huffman_code_lengths[symbol];
+        int16_t node = 0;
+
+        for (int i = length - 1; i > 0; i--)
+        {
+            int bit = (code >> i) & 1;
+            if (m_huffman_tree[node][bit] == 0)
+                m_huffman_tree[node][bit] = nodes++;
+            node = m_huffman_tree[node][bit];
+        }
+        m_huffman_tree[node][code & 1] = -(symbol + 1);
+    }
+}
+
+bool HpackDecoder::_huffman_decode(const unsigned char *data, size_t size, std::string& out)
+{
+    int16_t node = 0;
+    int padding = 0;
+    bool padding_ones = true;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        for (int shift = 7; shift >= 0; shift--)
+        {
+            int bit = (data[i] >> shift) & 1;
+            int16_t next = m_huffman_tree[node][bit];
+
+            // Only the EOS symbol, which must not appear in a string, is missing from the tree.
+            if (next == 0)
+                return false;
+
+            if (next < 0)
+            {
+                out += (char)(-next - 1);
+                node = 0;
+                padding = 0;
+                padding_ones = true;
+            }
+            else
+            {
+                node = next;
+                padding++;
+                padding_ones = padding_ones && bit;
+            }
+        }
+
+        if (out.size() > HPACK_MAX_STRING_SIZE)
+            return false;
+    }
+
+    // The padding must be shorter than a byte and a prefix of EOS (RFC 7541 section 5.2).
+    return padding <= 7 && padding_ones;
+}
+
+bool HpackDecoder::_read_string(const unsigned char *& p, const unsigned char *end, std::string& out)
+{
+    if (p >= end)
+        return false;
+
+    bool huffman = *p & 0x80;
+    size_t size;
+
+    if (!_read_integer(p, end, 7, size) || size > (size_t)(end - p))
+        return false;
+
+    out.clear();
+    if (huffman)
+    {
+        if (!_huffman_decode(p, size, out))
+            return false;
+    }
+    else
+    {
+        if (size > HPACK_MAX_STRING_SIZE)
+            return false;
+        out.assign((const char *)p, size);
+    }
+
+    p += size;
+    return true;
+}
+
+bool HpackDecoder::_lookup(size_t index, HpackHeader& header)
+{
+    if (index == 0)
+        return false;
+
+    if (index <= HPACK_STATIC_TABLE_SIZE)
+    {
+        header.name = g_hpack_static_table[index - 1].name;
+        header.value = g_hpack_static_table[index - 1].value;
+        return true;
+    }
+
+    index -= HPACK_STATIC_TABLE_SIZE + 1;
+    if (index >= m_table.size())
+        return false;
+
+    header = m_table[index];
+    return true;
+}
+
+bool HpackDecoder::_has_index(size_t index) const
+{
+    return index > 0 && index <= HPACK_STATIC_TABLE_SIZE + m_table.size();
+}
+
+/*
+    Append `header` to `headers` unless the list becomes larger than `max_list_size`, in which case the
+    list is dropped. A block of references to a large entry of the dynamic table would otherwise expand
+    to far more memory than it takes.
+ */
+static bool _append_header(std::vector<HpackHeader>& headers, const HpackHeader& header, size_t& list_size,
+                           size_t max_list_size)
+{
+    list_size += header.name.size() + header.value.size() + HPACK_ENTRY_OVERHEAD;
+    if (list_size > max_list_size)
+    {
+        headers.clear();
+        return false;
+    }
+
+    headers.push_back(header);
+    return true;
+}
+
+void HpackDecoder::_evict(size_t max_size)
+{
+    while (!m_table.empty() && m_table_size > max_size)
+    {
+        m_table_size -= m_table.back().name.size() + m_table.back().value.size() + HPACK_ENTRY_OVERHEAD;
+        m_table.pop_back();
+    }
+}
+
+void HpackDecoder::_insert(const HpackHeader& header)
+{
+    size_t size = header.name.size() + header.value.size() + HPACK_ENTRY_OVERHEAD;
+
+    // An entry larger than the table empties it and is not added (RFC 7541 section 4.4).
+    if (size > m_max_table_size)
+    {
+        _evict(0);
+        return;
+    }
+
+    _evict(m_max_table_size - size);
+    m_table.push_front(header);
+    m_table_size += size;
+}
+
+HpackStatus HpackDecoder::decode(const unsigned char *data, size_t size, size_t max_list_size,
+                                 std::vector<HpackHeader>& headers)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = data + size;
+    size_t list_size = 0;
+    bool too_large = false;
+
+    while (p < end)
+    {
+        unsigned char first = *p;
+        HpackHeader header;
+        size_t index;
+
+        if (first & 0x80)
+        {
+            // Indexed header field, only checked once the list is too large.
+            if (!_read_integer(p, end, 7, index))
+                return HPACK_ERROR;
+            if (too_large)
+            {
+                if (!_has_index(index))
+                    return HPACK_ERROR;
+                continue;
+            }
+            if (!_lookup(index, header))
+                return HPACK_ERROR;
+            too_large = !_append_header(headers, header, list_size, max_list_size);
+            continue;
+        }
+
+        if ((first & 0xe0) == 0x20)
+        {
+            // Dynamic table size update, bounded by the default size since we never advertise another.
+            if (!_read_integer(p, end, 5, index) || index > HPACK_DEFAULT_TABLE_SIZE)
+                return HPACK_ERROR;
+            m_max_table_size = index;
+            _evict(m_max_table_size);
+            continue;
+        }
+
+        // Literal header field, with incremental indexing (`01`), without indexing (`0000`) or never
+        // indexed (`0001`).
+        bool indexing = first & 0x40;
+        if (!_read_integer(p, end, indexing ? 6 : 4, index))
+            return HPACK_ERROR;
+
+        if (index == 0)
+        {
+            if (!_read_string(p, end, header.name))
+                return HPACK_ERROR;
+        }
+        else if (too_large && !indexing)
+        {
+            if (!_has_index(index))
+                return HPACK_ERROR;
+        }
+        else if (!_lookup(index, header))
+            return HPACK_ERROR;
+
+        if (!_read_string(p, end, header.value))
+            return HPACK_ERROR;
+
+        if (indexing)
+            _insert(header);
+        if (!too_large)
+            too_large = !_append_header(headers, header, list_size, max_list_size);
+    }
+
+    return too_large ? HPACK_TOO_LARGE : HPACK_OK;
+}
+
+namespace hpack
+{
+
+void encode_status(std::string& out, int code)
+{
+    static const int indexed[] = {200, 204, 206, 304, 400, 404, 500};
+
+    // Statuses of the static table take a single byte.
+    for (size_t i = 0; i < sizeof(indexed) / sizeof(int); i++)
+    {
+        if (indexed[i] == code)
+        {
+            _write_integer(out, 0x80, 7, 8 + i);
+            return;
+        }
+    }
+
+    char value[3];
+    value[0] = '0' + (code / 100) % 10;
+    value[1] = '0' + (code / 10) % 10;
+    value[2] = '0' + code % 10;
+
+    // `:status` is entry 8 of the static table.
+    _write_integer(out, 0x00, 4, 8);
+    _write_string(out, StringView(value, 3));
+}
+
+void encode_header(std::string& out, StringView name, StringView value)
+{
+    size_t index = 0;
+
+    for (size_t i = 0; i < HPACK_STATIC_TABLE_SIZE; i++)
+    {
+        if (name == g_hpack_static_table[i].name)
+        {
+            index = i + 1;
+            break;
+        }
+    }
+
+    _write_integer(out, 0x00, 4, index);
+    if (index == 0)
+        _write_string(out, name);
+    _write_string(out, value);
+}
+
+} // namespace hpack
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "string.hpp"
+
+#define HPACK_STATIC_TABLE_SIZE 61
+/* Size of the dynamic table until the peer changes it, also the largest size we accept. */
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+/* Size counted for an entry on top of its name and value (RFC 7541 section 4.1). */
+#define HPACK_ENTRY_OVERHEAD 32
+/* Largest decoded string accepted in a header block. */
+#define HPACK_MAX_STRING_SIZE 16384
+
+struct HpackEntry
+{
+    const char *name;
+    const char *value;
+};
+
+extern const HpackEntry g_hpack_static_table[HPACK_STATIC_TABLE_SIZE];
+extern const uint32_t g_huffman_codes[256];
+extern const uint8_t g_huffman_code_lengths[256];
+
+struct HpackHeader
+{
+    std::string name;
+    std::string value;
+};
+
+enum HpackStatus
+{
+    HPACK_OK,
+    /* The header list is larger than allowed. The block was still decoded, so the dynamic table stays in
+       sync, but the headers were not kept. */
+    HPACK_TOO_LARGE,
+    HPACK_ERROR,
+};
+
+/*
+    Decoder of HPACK header blocks (RFC 7541), one per connection since the dynamic table is shared
+    by all the header blocks the peer sends.
+ */
+class HpackDecoder
+{
+public:
+    HpackDecoder();
+
+    /*
+        Build the tree used to decode Huffman-encoded strings.
+     */
+    static void _build_huffman_tree();
+
+    /*
+        Decode a complete header block, the headers are appended to `headers` as long as their size,
+        counted like entries of the dynamic table, stays under `max_list_size`. Returns `HPACK_ERROR` if
+        the block is invalid, which is a connection error since the dynamic table can no longer be trusted.
+     */
+    HpackStatus decode(const unsigned char *data, size_t size, size_t max_list_size,
+                       std::vector<HpackHeader>& headers);
+
+private:
+    /* Newest entry first, as dynamic indices count from the most recent entry. */
+    std::deque<HpackHeader> m_table;
+    size_t m_table_size;
+    size_t m_max_table_size;
+
+    static int16_t m_huffman_tree[512][2];
+
+    bool _lookup(size_t index, HpackHeader& header);
+    bool _has_index(size_t index) const;
+    bool _read_string(const unsigned char *& p, const unsigned char *end, std::string& out);
+    void _insert(const HpackHeader& header);
+    void _evict(size_t max_size);
+    static bool _huffman_decode(const unsigned char *data, size_t size, std::string& out);
+};
+
+/*
+    Encoder of response header blocks. Headers are sent as literals without indexing, so the peer's
+    dynamic table stays empty and no state is kept between responses.
+ */
+namespace hpack
+{
+
+void encode_status(std::string& out, int code);
+
+/*
+    Append a header, `name` must already be in lowercase.
+ */
+void encode_header(std::string& out, StringView name, StringView value);
+
+} // namespace hpack
@@ -0,0 +1,967 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "http2/session.hpp"
+#include "logger.hpp"
+
+/*
+    Decode the base64url value of an `HTTP2-Settings` header (RFC 7540 section 3.2.1).
+ */
+static bool _decode_base64url(StringView in, std::string& out)
+{
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        char c = in[i];
+        int value;
+
+        if (c >= 'A' && c <= 'Z')
+            value = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            value = c - '0' + 52;
+        else if (c == '-' || c == '+')
+            value = 62;
+        else if (c == '_' || c == '/')
+            value = 63;
+        else if (c == '=')
+            break;
+        else
+            return false;
+
+        acc = (acc << 6) | value;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            out += (char)(acc >> bits);
+            acc &= (1 << bits) - 1;
+        }
+    }
+    return true;
+}
+
+/*
+    Headers which only make sense on an HTTP/1.1 connection, a request containing one is malformed
+    (RFC 9113 section 8.2.2).
+ */
+static bool _is_connection_header(StringView name)
+{
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+           name == "transfer-encoding" || name == "upgrade";
+}
+
+/*
+    Whether a header value can be copied in an HTTP/1.1 header line.
+ */
+static bool _is_valid_value(const std::string& value)
+{
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        if (value[i] == '\r' || value[i] == '\n' || value[i] == '\0')
+            return false;
+    }
+    return true;
+}
+
+Http2Session::Stream::Stream(uint32_t id, int64_t send_window)
+    : id(id), host(NULL), remote_closed(false), responded(false), recv_window(H2_STREAM_WINDOW),
+      send_window(send_window), body_size(0), body_fd(-1), upload(NULL), put(NULL), file_fd(-1),
+      offset(0), remaining(0)
+{
+}
+
+Http2Session::Stream::~Stream()
+{
+    if (body_fd != -1)
+        close(body_fd);
+    if (file_fd != -1)
+        close(file_fd);
+    delete upload;
+    delete put;
+}
+
+Http2Session::Http2Session(Server& server)
+    : m_server(server), m_last_stream_id(0), m_preface_received(false), m_closing(false), m_peer_goaway(false),
+      m_header_stream(0), m_header_flags(0), m_recv_window(H2_DEFAULT_WINDOW), m_send_window(H2_DEFAULT_WINDOW),
+      m_peer_initial_window(H2_DEFAULT_WINDOW), m_peer_max_frame_size(H2_DEFAULT_FRAME_SIZE), m_requests(0)
+{
+}
+
+Http2Session::~Http2Session()
+{
+    for (std::map<uint32_t, Stream *>::iterator it = m_streams.begin(); it != m_streams.end(); it++)
+        delete it->second;
+}
+
+void Http2Session::start()
+{
+    h2_append_frame_header(m_control, 18, H2_SETTINGS, 0, 0);
+    m_control += (char)0;
+    m_control += (char)H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    h2_append_u32(m_control, H2_MAX_CONCURRENT_STREAMS);
+    m_control += (char)0;
+    m_control += (char)H2_SETTINGS_INITIAL_WINDOW_SIZE;
+    h2_append_u32(m_control, H2_STREAM_WINDOW);
+    m_control += (char)0;
+    m_control += (char)H2_SETTINGS_MAX_HEADER_LIST_SIZE;
+    h2_append_u32(m_control, m_server.default_host().config().max_header_size());
+
+    _window_update(0, m_recv_window, H2_CONNECTION_WINDOW - m_recv_window);
+}
+
+void Http2Session::upgrade(StringView head, StringView settings)
+{
+    std::string payload;
+    if (!_decode_base64url(settings, payload) || payload.size() % 6 != 0)
+        return _goaway(H2_PROTOCOL_ERROR);
+    if (!_on_settings((const unsigned char *)payload.data(), payload.size()))
+        return;
+    // The `101` acknowledges them, a `SETTINGS` ack would be unexpected (RFC 7540 section 3.2.1).
+
+    Stream *stream = new Stream(1, m_peer_initial_window);
+    m_streams[1] = stream;
+    m_last_stream_id = 1;
+
+    stream->remote_closed = true;
+    stream->data.assign(head.data(), head.size());
+
+    Result<int, HttpStatus> res = stream->req.parse(stream->data.data(), stream->data.size());
+    if (res.is_err())
+        _respond_error(*stream, res.unwrap_err());
+    else
+        _start_stream(*stream);
+}
+
+size_t Http2Session::receive(const char *data, size_t size)
+{
+    size_t pos = 0;
+
+    if (!m_preface_received)
+    {
+        size_t n = std::min(size, (size_t)H2_PREFACE_SIZE);
+        if (std::memcmp(data, H2_PREFACE, n) != 0)
+        {
+            _goaway(H2_PROTOCOL_ERROR);
+            return size;
+        }
+        if (n < H2_PREFACE_SIZE)
+            return 0;
+
+        m_preface_received = true;
+        pos = H2_PREFACE_SIZE;
+    }
+
+    while (!m_closing && size - pos >= H2_FRAME_HEADER_SIZE)
+    {
+        const unsigned char *header = (const unsigned char *)data + pos;
+        size_t length = (size_t)header[0] << 16 | (size_t)header[1] << 8 | header[2];
+
+        if (length > H2_DEFAULT_FRAME_SIZE)
+        {
+            _goaway(H2_FRAME_SIZE_ERROR);
+            break;
+        }
+        if (size - pos < H2_FRAME_HEADER_SIZE + length)
+            break;
+
+        uint32_t id = h2_read_u32(header + 5) & 0x7fffffff;
+        _frame(header[3], header[4], id, header + H2_FRAME_HEADER_SIZE, length);
+        pos += H2_FRAME_HEADER_SIZE + length;
+    }
+
+    // Nothing is read anymore once the connection is going away.
+    return m_closing ? size : pos;
+}
+
+void Http2Session::_frame(uint8_t type, uint8_t flags, uint32_t id, const unsigned char *payload, size_t length)
+{
+    // A header block cannot be interrupted by any other frame.
+    if (m_header_stream != 0 && (type != H2_CONTINUATION || id != m_header_stream))
+        return _goaway(H2_PROTOCOL_ERROR);
+
+    switch (type)
+    {
+    case H2_DATA:
+        if (id == 0)
+            return _goaway(H2_PROTOCOL_ERROR);
+        return _on_data(id, flags, payload, length);
+
+    case H2_HEADERS: {
+        if (id == 0 || id % 2 == 0)
+            return _goaway(H2_PROTOCOL_ERROR);
+
+        size_t padding = 0;
+        if (flags & H2_FLAG_PADDED)
+        {
+            if (length < 1)
+                return _goaway(H2_PROTOCOL_ERROR);
+            padding = payload[0];
+            payload++;
+            length--;
+        }
+        if (flags & H2_FLAG_PRIORITY)
+        {
+            if (length < 5)
+                return _goaway(H2_PROTOCOL_ERROR);
+            payload += 5;
+            length -= 5;
+        }
+        if (padding > length)
+            return _goaway(H2_PROTOCOL_ERROR);
+        length -= padding;
+
+        if (flags & H2_FLAG_END_HEADERS)
+            return _on_headers(id, flags, payload, length);
+
+        m_header_stream = id;
+        m_header_flags = flags;
+        m_header_block.assign((const char *)payload, length);
+        return;
+    }
+
+    case H2_CONTINUATION:
+        if (m_header_stream == 0)
+            return _goaway(H2_PROTOCOL_ERROR);
+        if (m_header_block.size() + length > H2_MAX_HEADER_BLOCK)
+            return _goaway(H2_ENHANCE_YOUR_CALM);
+
+        m_header_block.append((const char *)payload, length);
+        if (flags & H2_FLAG_END_HEADERS)
+        {
+            std::string block;
+            block.swap(m_header_block);
+            m_header_stream = 0;
+            _on_headers(id, m_header_flags, (const unsigned char *)block.data(), block.size());
+        }
+        return;
+
+    case H2_PRIORITY:
+        if (id == 0)
+            return _goaway(H2_PROTOCOL_ERROR);
+        if (length != 5)
+            return _reset_stream(id, H2_FRAME_SIZE_ERROR);
+        return;
+
+    case H2_RST_STREAM:
+        if (id == 0)
+            return _goaway(H2_PROTOCOL_ERROR);
+        if (length != 4)
+            return _goaway(H2_FRAME_SIZE_ERROR);
+        if (id > m_last_stream_id)
+            return _goaway(H2_PROTOCOL_ERROR);
+
+        if (m_streams.count(id))
+        {
+            delete m_streams[id];
+            m_streams.erase(id);
+        }
+        return;
+
+    case H2_SETTINGS:
+        if (id != 0)
+            return _goaway(H2_PROTOCOL_ERROR);
+        if (flags & H2_FLAG_ACK)
+        {
+            if (length != 0)
+                return _goaway(H2_FRAME_SIZE_ERROR);
+            return;
+        }
+        if (length % 6 != 0)
+            return _goaway(H2_FRAME_SIZE_ERROR);
+        if (!_on_settings(payload, length))
+            return;
+
+        h2_append_frame_header(m_control, 0, H2_SETTINGS, H2_FLAG_ACK, 0);
+        return;
+
+    case H2_PUSH_PROMISE:
+        // Clients cannot push.
+        return _goaway(H2_PROTOCOL_ERROR);
+
+    case H2_PING:
+        if (id != 0)
+            return _goaway(H2_PROTOCOL_ERROR);
+        if (length != 8)
+            return _goaway(H2_FRAME_SIZE_ERROR);
+        if (!(flags & H2_FLAG_ACK))
+        {
+            h2_append_frame_header(m_control, 8, H2_PING, H2_FLAG_ACK, 0);
+            m_control.append((const char *)payload, 8);
+        }
+        return;
+
+    case H2_GOAWAY:
+        if (id != 0)
+            return _goaway(H2_PROTOCOL_ERROR);
+        if (length < 8)
+            return _goaway(H2_FRAME_SIZE_ERROR);
+
+        // Streams already opened are still answered, the connection is closed after them.
+        m_peer_goaway = true;
+        return;
+
+    case H2_WINDOW_UPDATE:
+        if (length != 4)
+            return _goaway(H2_FRAME_SIZE_ERROR);
+        return _on_window_update(id, h2_read_u32(payload) & 0x7fffffff);
+
+    default:
+        // Unknown frame types are ignored (RFC 9113 section 4.1).
+        return;
+    }
+}
+
+bool Http2Session::_on_settings(const unsigned char *payload, size_t length)
+{
+    if (length % 6 != 0)
+        return false;
+
+    for (size_t i = 0; i < length; i += 6)
+    {
+        uint16_t setting = (uint16_t)(payload[i] << 8 | payload[i + 1]);
+        uint32_t value = h2_read_u32(payload + i + 2);
+
+        switch (setting)
+        {
+        case H2_SETTINGS_ENABLE_PUSH:
+            if (value > 1)
+            {
+                _goaway(H2_PROTOCOL_ERROR);
+                return false;
+            }
+            break;
+
+        case H2_SETTINGS_INITIAL_WINDOW_SIZE: {
+            if (value > H2_MAX_WINDOW)
+            {
+                _goaway(H2_FLOW_CONTROL_ERROR);
+                return false;
+            }
+
+            // The change applies to the windows of the streams already open.
+            int64_t delta = (int64_t)value - m_peer_initial_window;
+            for (std::map<uint32_t, Stream *>::iterator it = m_streams.begin(); it != m_streams.end(); it++)
+                it->second->send_window += delta;
+            m_peer_initial_window = value;
+            break;
+        }
+
+        case H2_SETTINGS_MAX_FRAME_SIZE:
+            if (value < H2_DEFAULT_FRAME_SIZE || value > H2_MAX_FRAME_SIZE)
+            {
+                _goaway(H2_PROTOCOL_ERROR);
+                return false;
+            }
+            m_peer_max_frame_size = value;
+            break;
+
+        default:
+            // We never push and never index response headers, the other settings do not matter.
+            break;
+        }
+    }
+    return true;
+}
+
+void Http2Session::_on_window_update(uint32_t id, uint32_t increment)
+{
+    if (id == 0)
+    {
+        if (increment == 0)
+            return _goaway(H2_PROTOCOL_ERROR);
+
+        m_send_window += increment;
+        if (m_send_window > H2_MAX_WINDOW)
+            _goaway(H2_FLOW_CONTROL_ERROR);
+        return;
+    }
+
+    if (increment == 0)
+        return _reset_stream(id, H2_PROTOCOL_ERROR);
+
+    // The stream may have been answered already.
+    std::map<uint32_t, Stream *>::iterator it = m_streams.find(id);
+    if (it == m_streams.end())
+        return;
+
+    it->second->send_window += increment;
+    if (it->second->send_window > H2_MAX_WINDOW)
+        _reset_stream(id, H2_FLOW_CONTROL_ERROR);
+}
+
+void Http2Session::_on_headers(uint32_t id, uint8_t flags, const unsigned char *block, size_t size)
+{
+    // The block is decoded even if the stream is refused, the dynamic table must stay in sync.
+    std::vector<HpackHeader> headers;
+    HpackStatus status = m_decoder.decode(block, size, m_server.default_host().config().max_header_size(), headers);
+    if (status == HPACK_ERROR)
+        return _goaway(H2_COMPRESSION_ERROR);
+
+    if (id <= m_last_stream_id)
+    {
+        std::map<uint32_t, Stream *>::iterator it = m_streams.find(id);
+
+        // Trailers end the body, their fields are not used.
+        if (it != m_streams.end() && !it->second->remote_closed && (flags & H2_FLAG_END_STREAM))
+        {
+            Stream& stream = *it->second;
+            stream.remote_closed = true;
+            if (!stream.responded)
+                _dispatch(stream);
+            else if (stream.remaining == 0)
+                _finish_stream(stream);
+            return;
+        }
+        return _reset_stream(id, H2_STREAM_CLOSED);
+    }
+
+    m_last_stream_id = id;
+
+    if (m_streams.size() >= H2_MAX_CONCURRENT_STREAMS)
+        return _reset_stream(id, H2_REFUSED_STREAM);
+
+    Stream *stream = new Stream(id, m_peer_initial_window);
+    m_streams[id] = stream;
+    stream->remote_closed = flags & H2_FLAG_END_STREAM;
+
+    if (status == HPACK_TOO_LARGE)
+        return _respond_error(*stream, 431); // Request Header Fields Too Large
+    if (!_build_request(*stream, headers))
+        return _reset_stream(id, H2_PROTOCOL_ERROR);
+
+    Result<int, HttpStatus> res = stream->req.parse(stream->data.data(), stream->data.size());
+    if (res.is_err())
+        return _respond_error(*stream, res.unwrap_err());
+
+    _start_stream(*stream);
+}
+
+/*
+    Write the request line and headers of a stream as an HTTP/1.1 request, so it can be parsed and routed
+    like any other request. Returns `false` if the request is malformed (RFC 9113 section 8.1.1).
+ */
+bool Http2Session::_build_request(Stream& stream, const std::vector<HpackHeader>& headers)
+{
+    std::string method;
+    std::string path;
+    std::string authority;
+    std::string cookies;
+    bool has_scheme = false;
+    bool has_host = false;
+    size_t i = 0;
+
+    // Pseudo-headers come first and only once.
+    for (; i < headers.size() && !headers[i].name.empty() && headers[i].name[0] == ':'; i++)
+    {
+        const HpackHeader& header = headers[i];
+
+        if (!_is_valid_value(header.value))
+            return false;
+        if (header.name == ":method" && method.empty())
+            method = header.value;
+        else if (header.name == ":path" && path.empty())
+            path = header.value;
+        else if (header.name == ":authority" && authority.empty())
+            authority = header.value;
+        else if (header.name == ":scheme" && !has_scheme)
+            has_scheme = true;
+        else
+            return false;
+    }
+
+    if (method.empty() || path.empty() || !has_scheme)
+        return false;
+
+    std::string& data = stream.data;
+    data.reserve(256);
+    data += method;
+    data += ' ';
+    data += path;
+    data += " HTTP/1.1" SEP;
+
+    for (; i < headers.size(); i++)
+    {
+        const HpackHeader& header = headers[i];
+        StringView name = header.name;
+
+        if (name.empty() || name[0] == ':' || !_is_valid_value(header.value) || _is_connection_header(name))
+            return false;
+        for (size_t j = 0; j < name.size(); j++)
+        {
+            if (name[j] >= 'A' && name[j] <= 'Z')
+                return false;
+        }
+        if (name == "te" && header.value != "trailers")
+            return false;
+
+        // Cookies may be split in several fields, they are joined back (RFC 9113 section 8.2.3).
+        if (name == "cookie")
+        {
+            cookies += cookies.empty() ? "" : "; ";
+            cookies += header.value;
+            continue;
+        }
+        if (name == "host")
+            has_host = true;
+
+        data += header.name;
+        data += ": ";
+        data += header.value;
+        data += SEP;
+    }
+
+    if (!has_host && !authority.empty())
+        data += "host: " + authority + SEP;
+    if (!cookies.empty())
+        data += "cookie: " + cookies + SEP;
+    data += SEP;
+    return true;
+}
+
+/*
+    Called once the headers of a stream are parsed. Like for HTTP/1.1 requests, requests which would
+    be refused anyway are answered before their body is received, and uploads are started.
+ */
+void Http2Session::_start_stream(Stream& stream)
+{
+    Request& req = stream.req;
+    ServerConfig& limits = m_server.default_host().config();
+
+    stream.host = &m_server.resolve(req.header(HEADER_HOST));
+    ServerConfig& config = stream.host->config();
+
+    if (req.header_size() > limits.max_header_size() || req.header_count() > limits.max_headers())
+        return _respond_error(stream, 431); // Request Header Fields Too Large
+
+    if (config.max_content_length() > 0 && req.has_header(HEADER_CONTENT_LENGTH) &&
+        req.content_length() > config.max_content_length())
+        return _respond_error(stream, 413); // Payload Too Large
+
+    Location *loc = stream.host->router().match(req.path());
+
+    if (req.method() == POST && req.content_type().starts_with("multipart/form-data"))
+    {
+        if (loc && loc->allows(POST) && loc->redirect().is_none() && loc->root().is_some() &&
+            loc->upload_dir().is_some())
+            stream.upload = new MultipartParser(req.content_type(), loc->upload_dir().unwrap());
+    }
+    else if (req.method() == PUT)
+    {
+        if (loc && loc->allows(PUT) && loc->redirect().is_none() && loc->upload_dir().is_some())
+            stream.put = new PutUpload(loc->upload_dir().unwrap(), req.path().substr(loc->route().size()));
+    }
+
+    if (stream.remote_closed || (stream.put && stream.put->failed()))
+        _dispatch(stream);
+}
+
+void Http2Session::_on_data(uint32_t id, uint8_t flags, const unsigned char *payload, size_t length)
+{
+    // The whole frame counts for flow control, padding included.
+    if ((int64_t)length > m_recv_window)
+        return _goaway(H2_FLOW_CONTROL_ERROR);
+    m_recv_window -= length;
+    if (m_recv_window < H2_CONNECTION_WINDOW / 2)
+        _window_update(0, m_recv_window, H2_CONNECTION_WINDOW - m_recv_window);
+
+    std::map<uint32_t, Stream *>::iterator it = m_streams.find(id);
+    if (it == m_streams.end())
+    {
+        if (id > m_last_stream_id)
+            return _goaway(H2_PROTOCOL_ERROR);
+        // The stream was answered or reset while the client was still sending its body.
+        return;
+    }
+
+    Stream& stream = *it->second;
+    if (stream.remote_closed)
+        return _reset_stream(id, H2_STREAM_CLOSED);
+
+    if ((int64_t)length > stream.recv_window)
+        return _reset_stream(id, H2_FLOW_CONTROL_ERROR);
+    stream.recv_window -= length;
+
+    size_t padding = 0;
+    if (flags & H2_FLAG_PADDED)
+    {
+        if (length < 1 || (size_t)payload[0] >= length)
+            return _goaway(H2_PROTOCOL_ERROR);
+        padding = payload[0];
+        payload++;
+        length--;
+    }
+    length -= padding;
+
+    if (flags & H2_FLAG_END_STREAM)
+        stream.remote_closed = true;
+    else if (stream.recv_window < H2_STREAM_WINDOW / 2)
+        _window_update(id, stream.recv_window, H2_STREAM_WINDOW - stream.recv_window);
+
+    if (!stream.responded)
+        _store_body(stream, (const char *)payload, length);
+
+    if (stream.remote_closed)
+    {
+        if (!stream.responded)
+            _dispatch(stream);
+        else if (stream.remaining == 0)
+            _finish_stream(stream);
+    }
+}
+
+void Http2Session::_store_body(Stream& stream, const char *data, size_t size)
+{
+    ServerConfig& config = stream.host->config();
+
+    stream.body_size += size;
+    if (config.max_content_length() > 0 && stream.body_size > config.max_content_length())
+        return _respond_error(stream, 413); // Payload Too Large
+
+    if (stream.put)
+    {
+        if (!stream.put->failed() && !stream.put->write(data, size))
+            _respond_error(stream, 500);
+        return;
+    }
+
+    if (stream.upload)
+    {
+        stream.upload_pending.append(data, size);
+        size_t n = stream.upload->feed(stream.upload_pending.data(), stream.upload_pending.size());
+        stream.upload_pending.erase(0, n);
+        return;
+    }
+
+    size_t header_size = stream.req.header_size();
+
+    if (stream.body_fd == -1)
+    {
+        if (stream.data.size() - header_size + size <= config.client_body_buffer_size())
+        {
+            stream.data.append(data, size);
+            stream.req.rebase(stream.data.data(), stream.data.size());
+            return;
+        }
+
+        // Large bodies are moved to a temporary file so they do not stay in memory.
+        std::string name = config.client_body_temp_path() + "/webserv-body-XXXXXX";
+        stream.body_fd = mkstemp(&name[0]);
+        if (stream.body_fd == -1)
+        {
+            ws::log << ws::err << "cannot create a temporary file in `" << config.client_body_temp_path()
+                    << "`: " << strerror(errno) << "\n";
+            return _respond_error(stream, 500);
+        }
+        unlink(name.c_str());
+        fcntl(stream.body_fd, F_SETFD, FD_CLOEXEC);
+
+        stream.data.append(data, size);
+        stream.req.rebase(stream.data.data(), stream.data.size());
+        data = stream.data.data() + header_size;
+        size = stream.data.size() - header_size;
+    }
+
+    while (size > 0)
+    {
+        ssize_t n = write(stream.body_fd, data, size);
+        if (n == -1)
+        {
+            ws::log << ws::err << "cannot write a request body to `" << config.client_body_temp_path()
+                    << "`: " << strerror(errno) << "\n";
+            return _respond_error(stream, 500);
+        }
+        data += n;
+        size -= n;
+    }
+    stream.data.resize(header_size);
+    stream.req.rebase(stream.data.data(), stream.data.size());
+}
+
+/*
+    Answer a stream whose request was fully received.
+ */
+void Http2Session::_dispatch(Stream& stream)
+{
+    Request& req = stream.req;
+    ServerConfig& config = stream.host->config();
+
+    // The body is delimited by the end of the stream, the router still expects a `Content-Length`.
+    if (req.has_header(HEADER_CONTENT_LENGTH))
+    {
+        if (stream.remote_closed && req.content_length() != stream.body_size)
+            return _reset_stream(stream.id, H2_PROTOCOL_ERROR);
+        req.rebase(stream.data.data(), stream.data.size());
+    }
+    else if (req.method() == POST || req.method() == PUT)
+    {
+        std::string length = "content-length: " + to_string(stream.body_size) + SEP;
+        stream.data.insert(req.header_size() - 2, length);
+        req.parse(stream.data.data(), stream.data.size());
+    }
+    else
+        req.rebase(stream.data.data(), stream.data.size());
+
+    if (stream.body_fd != -1)
+        req.set_body_file(stream.body_fd);
+    if (stream.body_fd != -1 || stream.upload || stream.put)
+        req.set_body_stored(stream.body_size - req.body().size());
+
+    Result<int, HttpStatus> upload = stream.upload ? stream.upload->finish() : Result<int, HttpStatus>(0);
+
+    Response response;
+    if (upload.is_err())
+        response = HTTP_ERROR(upload.unwrap_err(), config);
+    else if (stream.put)
+    {
+        HttpStatus status = stream.put->finish();
+        if (status.is_error())
+            response = HTTP_ERROR(status, config);
+        else
+            response = Response::ok(status, File::memory("", ""));
+    }
+    else
+        response = stream.host->router().route(req, m_arena);
+
+    _respond(stream, response);
+
+    // The arena only lives during `route`, its block goes back to the pool rather than staying with the session.
+    m_arena.release();
+}
+
+void Http2Session::_respond_error(Stream& stream, HttpStatus status)
+{
+    ServerConfig& config = stream.host ? stream.host->config() : m_server.default_host().config();
+    Response response = HTTP_ERROR(status, config);
+    _respond(stream, response);
+}
+
+/*
+    Queue the headers of a response, its body is sent by `produce` as flow control allows. The stream
+    is only forgotten by `produce`, so callers can still use it.
+ */
+void Http2Session::_respond(Stream& stream, Response& response)
+{
+    Request& req = stream.req;
+    File& body = response.body();
+    size_t size = 0;
+
+    m_requests++;
+    stream.responded = true;
+
+    if (body.in_memory())
+    {
+        stream.body = body.content();
+        size = stream.body.size();
+    }
+    else
+    {
+        struct stat sb;
+
+        stream.file_fd = open(body.file_name().c_str(), O_RDONLY | O_CLOEXEC);
+        if (stream.file_fd == -1 || fstat(stream.file_fd, &sb) == -1)
+        {
+            ws::log << ws::err << "Cannot open `" << body.file_name() << "`: " << strerror(errno) << "\n";
+            ServerConfig& config = stream.host ? stream.host->config() : m_server.default_host().config();
+            Response error = HTTP_ERROR(500, config);
+            return _respond(stream, error);
+        }
+        size = sb.st_size;
+    }
+
+    HttpStatus status = response.status();
+    size_t length = size;
+    if (req.method() == HEAD || status.code() == 204 || status.code() == 304)
+        size = 0;
+    stream.remaining = size;
+
+    ws::log << ws::info << strmethod(req.method()) << " `" << req.path() << "` -> "
+            << (status.is_error() ? NRED : NGREEN) << status.code() << " " << status << RESET " (HTTP/2)\n";
+
+    std::string block;
+    hpack::encode_status(block, status.code());
+
+    // Like `Response::encode_header`, the length of a `HEAD` response is the one of the body it does not have.
+    if (status.code() != 204)
+        hpack::encode_header(block, "content-length", to_string(length));
+
+    for (size_t i = 0; i < response.param_count(); i++)
+    {
+        std::string name = response.param_name(i).str();
+        for (size_t j = 0; j < name.size(); j++)
+            name[j] = std::tolower(name[j]);
+
+        if (!_is_connection_header(name))
+            hpack::encode_header(block, name, response.param_value(i));
+    }
+
+    // The block is split in `CONTINUATION` frames if it does not fit in one frame.
+    for (size_t offset = 0; offset == 0 || offset < block.size();)
+    {
+        size_t n = std::min(block.size() - offset, m_peer_max_frame_size);
+        uint8_t flags = offset + n == block.size() ? H2_FLAG_END_HEADERS : 0;
+
+        if (offset == 0)
+            h2_append_frame_header(m_control, n, H2_HEADERS, flags | (size == 0 ? H2_FLAG_END_STREAM : 0), stream.id);
+        else
+            h2_append_frame_header(m_control, n, H2_CONTINUATION, flags, stream.id);
+
+        m_control.append(block, offset, n);
+        offset += n;
+    }
+}
+
+/*
+    Forget a stream once its response was fully queued.
+ */
+void Http2Session::_finish_stream(Stream& stream)
+{
+    uint32_t id = stream.id;
+
+    // The client does not need to send the rest of a body which will not be read.
+    if (!stream.remote_closed)
+    {
+        h2_append_frame_header(m_control, 4, H2_RST_STREAM, 0, id);
+        h2_append_u32(m_control, H2_NO_ERROR);
+    }
+
+    delete m_streams[id];
+    m_streams.erase(id);
+}
+
+bool Http2Session::produce(OutputQueue& out)
+{
+    bool queued = false;
+
+    // Responses without a body are complete as soon as their headers are queued.
+    for (std::map<uint32_t, Stream *>::iterator it = m_streams.begin(); it != m_streams.end();)
+    {
+        Stream& stream = *(it++)->second;
+        if (stream.responded && stream.remaining == 0)
+            _finish_stream(stream);
+    }
+
+    if (!m_control.empty())
+    {
+        out.push(SharedBuffer(m_control));
+        m_control.clear();
+        queued = true;
+    }
+
+    // One frame per stream and per round, so a large response does not hold back the others. After an
+    // upgrade, data waits for the client preface: some clients cannot buffer much past the `101`.
+    bool progress = m_preface_received;
+    while (progress && out.size() < H2_OUTPUT_HIGH_WATER && m_send_window > 0)
+    {
+        progress = false;
+
+        for (std::map<uint32_t, Stream *>::iterator it = m_streams.begin(); it != m_streams.end();)
+        {
+            Stream& stream = *(it++)->second;
+
+            if (!stream.responded || stream.remaining == 0 || stream.send_window <= 0)
+                continue;
+
+            size_t n = std::min(stream.remaining, m_peer_max_frame_size);
+            n = std::min(n, (size_t)std::min(m_send_window, stream.send_window));
+
+            _push_data(stream, n, out);
+            progress = queued = true;
+
+            if (out.size() >= H2_OUTPUT_HIGH_WATER || m_send_window <= 0)
+                break;
+        }
+    }
+
+    // Streams finished while sending their data may have queued a `RST_STREAM`.
+    if (!m_control.empty())
+    {
+        out.push(SharedBuffer(m_control));
+        m_control.clear();
+        queued = true;
+    }
+    return queued;
+}
+
+void Http2Session::_push_data(Stream& stream, size_t size, OutputQueue& out)
+{
+    uint8_t flags = size == stream.remaining ? H2_FLAG_END_STREAM : 0;
+    std::string frame;
+
+    frame.reserve(H2_FRAME_HEADER_SIZE + (stream.file_fd != -1 ? size : 0));
+    h2_append_frame_header(frame, size, H2_DATA, flags, stream.id);
+
+    if (stream.file_fd != -1)
+    {
+        frame.resize(H2_FRAME_HEADER_SIZE + size);
+        ssize_t n = pread(stream.file_fd, &frame[H2_FRAME_HEADER_SIZE], size, stream.offset);
+
+        // The file was truncated since the response was made.
+        if (n != (ssize_t)size)
+            return _reset_stream(stream.id, H2_INTERNAL_ERROR);
+
+        out.push(SharedBuffer(frame));
+    }
+    else
+    {
+        out.push(SharedBuffer(frame));
+        out.push(stream.body, stream.offset, size);
+    }
+
+    stream.offset += size;
+    stream.remaining -= size;
+    stream.send_window -= size;
+    m_send_window -= size;
+
+    if (stream.remaining == 0)
+        _finish_stream(stream);
+}
+
+void Http2Session::_goaway(H2Error error)
+{
+    if (m_closing)
+        return;
+
+    ws::log << ws::warn << "HTTP/2 connection error " << error << ", sending GOAWAY\n";
+
+    h2_append_frame_header(m_control, 8, H2_GOAWAY, 0, 0);
+    h2_append_u32(m_control, m_last_stream_id);
+    h2_append_u32(m_control, error);
+    m_closing = true;
+
+    for (std::map<uint32_t, Stream *>::iterator it = m_streams.begin(); it != m_streams.end(); it++)
+        delete it->second;
+    m_streams.clear();
+}
+
+void Http2Session::_reset_stream(uint32_t id, H2Error error)
+{
+    h2_append_frame_header(m_control, 4, H2_RST_STREAM, 0, id);
+    h2_append_u32(m_control, error);
+
+    std::map<uint32_t, Stream *>::iterator it = m_streams.find(id);
+    if (it != m_streams.end())
+    {
+        delete it->second;
+        m_streams.erase(it);
+    }
+}
+
+/*
+    Give `size` bytes back to a receive window.
+ */
+void Http2Session::_window_update(uint32_t id, int64_t& window, int64_t size)
+{
+    h2_append_frame_header(m_control, 4, H2_WINDOW_UPDATE, 0, id);
+    h2_append_u32(m_control, size);
+    window += size;
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "buffer.hpp"
+#include "http/multipart.hpp"
+#include "http/put_upload.hpp"
+#include "http/request.hpp"
+#include "http/response.hpp"
+#include "http2/frame.hpp"
+#include "http2/hpack.hpp"
+#include "output_queue.hpp"
+#include "server.hpp"
+
+/* Streams a client can open at once. */
+#define H2_MAX_CONCURRENT_STREAMS 128
+/* Receive windows we advertise, large enough for uploads not to wait for our `WINDOW_UPDATE`s. */
+#define H2_STREAM_WINDOW (1024 * 1024)
+#define H2_CONNECTION_WINDOW (16 * 1024 * 1024)
+/* Largest header block, `CONTINUATION` frames included. */
+#define H2_MAX_HEADER_BLOCK (64 * 1024)
+/* Response data is only produced while less than this is waiting to be written to the socket. */
+#define H2_OUTPUT_HIGH_WATER (256 * 1024)
+
+/*
+    Server side of an HTTP/2 connection (RFC 9113), either started with the connection preface or by
+    upgrading an HTTP/1.1 request with `Upgrade: h2c`.
+
+    Each stream is turned back into an HTTP/1.1 request which goes through the same `Router` as the
+    other connections. Request bodies are handled like on HTTP/1.1 connections: uploads are written to
+    their files as `DATA` frames arrive and large bodies are moved to a temporary file. Responses are
+    interleaved frame by frame between streams, within the flow control windows of the peer.
+ */
+class Http2Session
+{
+public:
+    Http2Session(Server& server);
+    ~Http2Session();
+
+    /*
+        Queue the server connection preface, which must be the first frame sent.
+     */
+    void start();
+
+    /*
+        Answer an HTTP/1.1 request upgraded to HTTP/2 as stream `1`. `head` holds its request line and
+        headers, it must not have a body. The connection is closed if its `HTTP2-Settings` are invalid.
+     */
+    void upgrade(StringView head, StringView settings);
+
+    /*
+        Process the frames received, returns how many bytes were used. An incomplete frame at the end
+        is left for the next call.
+     */
+    size_t receive(const char *data, size_t size);
+
+    /*
+        Queue the pending frames and as much response data as flow control allows. Returns whether
+        anything was queued.
+     */
+    bool produce(OutputQueue& out);
+
+    /*
+        Whether no stream is open, so the connection only waits for the next request.
+     */
+    bool idle() const
+    {
+        return m_streams.empty();
+    }
+
+    /*
+        Whether the connection must be closed once the output queue is written.
+     */
+    bool closing() const
+    {
+        return m_closing || (m_peer_goaway && m_streams.empty());
+    }
+
+    /*
+        Number of requests answered.
+     */
+    size_t requests() const
+    {
+        return m_requests;
+    }
+
+private:
+    struct Stream
+    {
+        Stream(uint32_t id, int64_t send_window);
+        ~Stream();
+
+        uint32_t id;
+        Host *host;
+
+        /* Request line and headers in HTTP/1.1 syntax, followed by the body held in memory. */
+        std::string data;
+        Request req;
+
+        /* Whether the client ended its side of the stream and the response headers were queued. */
+        bool remote_closed;
+        bool responded;
+
+        int64_t recv_window;
+        int64_t send_window;
+
+        size_t body_size;
+        /* File holding the body once it is larger than `client_body_buffer_size`. */
+        int body_fd;
+        MultipartParser *upload;
+        /* Part of the body not consumed by `upload` yet. */
+        std::string upload_pending;
+        PutUpload *put;
+
+        /* Response body not sent yet, read from `file_fd` if it is not `-1`. */
+        SharedBuffer body;
+        int file_fd;
+        size_t offset;
+        size_t remaining;
+
+    private:
+        Stream(const Stream& other);
+        Stream& operator=(const Stream& other);
+    };
+
+    Server& m_server;
+    Arena m_arena;
+    HpackDecoder m_decoder;
+
+    std::map<uint32_t, Stream *> m_streams;
+    uint32_t m_last_stream_id;
+
+    bool m_preface_received;
+    bool m_closing;
+    bool m_peer_goaway;
+
+    /* Header block being received in `CONTINUATION` frames, `0` if none. */
+    uint32_t m_header_stream;
+    uint8_t m_header_flags;
+    std::string m_header_block;
+
+    int64_t m_recv_window;
+    int64_t m_send_window;
+    int64_t m_peer_initial_window;
+    size_t m_peer_max_frame_size;
+
+    /* Frames other than `DATA` waiting to be queued. */
+    std::string m_control;
+    size_t m_requests;
+
+    void _frame(uint8_t type, uint8_t flags, uint32_t id, const unsigned char *payload, size_t length);
+    void _on_headers(uint32_t id, uint8_t flags, const unsigned char *block, size_t size);
+    void _on_data(uint32_t id, uint8_t flags, const unsigned char *payload, size_t length);
+    bool _on_settings(const unsigned char *payload, size_t length);
+    void _on_window_update(uint32_t id, uint32_t increment);
+
+    bool _build_request(Stream& stream, const std::vector<HpackHeader>& headers);
+    void _start_stream(Stream& stream);
+    void _store_body(Stream& stream, const char *data, size_t size);
+    void _dispatch(Stream& stream);
+    void _respond(Stream& stream, Response& response);
+    void _respond_error(Stream& stream, HttpStatus status);
+    void _finish_stream(Stream& stream);
+
+    void _goaway(H2Error error);
+    void _reset_stream(uint32_t id, H2Error error);
+    void _window_update(uint32_t id, int64_t& window, int64_t size);
+    void _push_data(Stream& stream, size_t size, OutputQueue& out);
+
+    Http2Session(const Http2Session& other);
+    Http2Session& operator=(const Http2Session& other);
+};
@@ -0,0 +1,136 @@
+#include <cstring>
+
+#include "location_trie.hpp"
+
+LocationTrie::LocationTrie()
+{
+}
+
+static int _compare_segment(const std::string& a, const char *b, size_t b_size)
+{
+    size_t n = a.size() < b_size ? a.size() : b_size;
+    int c = std::memcmp(a.data(), b, n);
+
+    if (c != 0)
+        return c;
+    if (a.size() == b_size)
+        return 0;
+    return a.size() < b_size ? -1 : 1;
+}
+
+size_t LocationTrie::_child(size_t node, const char *segment, size_t size) const
+{
+    const std::vector<size_t>& children = m_nodes[node].children;
+    size_t low = 0;
+    size_t high = children.size();
+
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        int c = _compare_segment(m_nodes[children[mid]].segment, segment, size);
+
+        if (c == 0)
+            return children[mid];
+        else if (c < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return 0;
+}
+
+size_t LocationTrie::_insert_child(size_t node, const std::string& segment)
+{
+    size_t existing = _child(node, segment.data(), segment.size());
+    if (existing != 0)
+        return existing;
+
+    Node child;
+    child.segment = segment;
+    child.location = -1;
+    child.route_size = 0;
+
+    size_t index = m_nodes.size();
+    m_nodes.push_back(child);
+
+    std::vector<size_t>& children = m_nodes[node].children;
+    std::vector<size_t>::iterator it = children.begin();
+
+    while (it != children.end() && m_nodes[*it].segment < segment)
+        it++;
+    children.insert(it, index);
+
+    return index;
+}
+
+void LocationTrie::build(std::vector<Location>& locations)
+{
+    m_nodes.clear();
+
+    // The root node matches `/` and has index 0, which `_child` uses as "not found" since it can
+    // never be a child.
+    Node root;
+    root.location = -1;
+    root.route_size = 0;
+    m_nodes.push_back(root);
+
+    for (size_t i = 0; i < locations.size(); i++)
+    {
+        const std::string& route = locations[i].route();
+        size_t node = 0;
+        size_t start = 0;
+
+        while (start < route.size())
+        {
+            size_t end = route.find('/', start);
+            if (end == std::string::npos)
+                end = route.size();
+            if (end > start)
+                node = _insert_child(node, route.substr(start, end - start));
+            start = end + 1;
+        }
+
+        // When two locations share the same route, the first one declared wins.
+        if (m_nodes[node].location == -1)
+        {
+            m_nodes[node].location = i;
+            m_nodes[node].route_size = route.size();
+        }
+    }
+}
+
+long LocationTrie::match(StringView path) const
+{
+    if (m_nodes.empty())
+        return -1;
+
+    size_t node = 0;
+    size_t start = 0;
+    long best = -1;
+
+    // A route is only a match if it is also a plain prefix of the path, this matters for routes
+    // ending with a `/` such as `/files/` which must not match `/files`.
+    if (m_nodes[0].location != -1 && path.size() >= m_nodes[0].route_size)
+        best = m_nodes[0].location;
+
+    while (start < path.size())
+    {
+        size_t end = path.find('/', start);
+        if (end == StringView::npos)
+            end = path.size();
+
+        if (end > start)
+        {
+            node = _child(node, path.data() + start, end - start);
+            if (node == 0)
+                break;
+
+            const Node& n = m_nodes[node];
+            if (n.location != -1 && path.size() >= n.route_size)
+                best = n.location;
+        }
+        start = end + 1;
+    }
+
+    return best;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "config/config.hpp"
+#include "string.hpp"
+
+/*
+    Longest-prefix matcher for `Location` routes, compiled once per host.
+
+    Every route is split into its path segments (`/api/v1` -> `api`, `v1`) and inserted in a trie
+    where each node stores the index of the location ending there. Nodes are kept in a flat vector
+    and reference each other by index, so the trie can be copied along with its `ServerConfig`.
+ */
+class LocationTrie
+{
+public:
+    LocationTrie();
+
+    void build(std::vector<Location>& locations);
+
+    /*
+        Returns the index of the location with the longest route matching `path`, or `-1` if none
+        does. This does not allocate.
+     */
+    long match(StringView path) const;
+
+private:
+    struct Node
+    {
+        std::string segment;
+        /* Children indices, sorted by segment. */
+        std::vector<size_t> children;
+        long location;
+        size_t route_size;
+    };
+
+    std::vector<Node> m_nodes;
+
+    size_t _child(size_t node, const char *segment, size_t size) const;
+    size_t _insert_child(size_t node, const std::string& segment);
+};
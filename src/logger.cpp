@@ -1,3 +1,250 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
 #include "logger.hpp"
 
 ws::Logger ws::log;
+
+/* Ring of the current thread, created when it first logs. */
+static __thread ws::LogRing *t_ring = NULL;
+
+ws::LogRing::LogRing()
+    : data(new char[LOG_RING_SIZE]), head(0), tail(0), dropped(0), reported(0), stream(&buffer), next(NULL)
+{
+}
+
+ws::LogRing::~LogRing()
+{
+    delete[] data;
+}
+
+ws::Logger::Logger()
+    : m_async(false), m_blocking(true), m_strip(!isatty(STDERR_FILENO)), m_started(false), m_stopping(false),
+      m_idle(false), m_rings(NULL)
+{
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+}
+
+ws::Logger::~Logger()
+{
+    if (m_started)
+    {
+        pthread_mutex_lock(&m_mutex);
+        m_stopping = true;
+        pthread_cond_signal(&m_cond);
+        pthread_mutex_unlock(&m_mutex);
+        pthread_join(m_thread, NULL);
+    }
+
+    // Objects destroyed after the logger may still log.
+    m_async = false;
+    m_started = false;
+    t_ring = NULL;
+
+    while (m_rings)
+    {
+        LogRing *next = m_rings->next;
+        delete m_rings;
+        m_rings = next;
+    }
+}
+
+void ws::Logger::init()
+{
+    if (m_started)
+        return;
+
+    pthread_atfork(NULL, NULL, _after_fork);
+    if (pthread_create(&m_thread, NULL, _thread_main, this) != 0)
+    {
+        *this << ws::warn << "Cannot start the logging thread, records are written directly\n";
+        return;
+    }
+    m_started = true;
+    m_async = true;
+}
+
+ws::LogRing& ws::Logger::_ring()
+{
+    if (t_ring)
+        return *t_ring;
+
+    t_ring = new LogRing();
+    pthread_mutex_lock(&m_mutex);
+    t_ring->next = m_rings;
+    __atomic_store_n(&m_rings, t_ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&m_mutex);
+    return *t_ring;
+}
+
+void ws::Logger::_commit(LogRing& ring)
+{
+    std::string& text = ring.buffer.text;
+    size_t size = std::min(text.size(), (size_t)LOG_RING_SIZE);
+
+    while (LOG_RING_SIZE - (ring.head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE)) < size)
+    {
+        if (!m_blocking)
+        {
+            __atomic_store_n(&ring.dropped, ring.dropped + 1, __ATOMIC_RELAXED);
+            text.clear();
+            return;
+        }
+        _wake();
+        usleep(1000);
+    }
+
+    size_t offset = ring.head & (LOG_RING_SIZE - 1);
+    size_t first = std::min(size, (size_t)LOG_RING_SIZE - offset);
+    std::memcpy(ring.data + offset, text.data(), first);
+    std::memcpy(ring.data, text.data() + first, size - first);
+    __atomic_store_n(&ring.head, ring.head + size, __ATOMIC_RELEASE);
+    text.clear();
+
+    // Pairs with the background thread setting `m_idle` before it looks at the rings a last time, so either
+    // it sees this record or this thread sees it waiting.
+    __sync_synchronize();
+    if (__atomic_load_n(&m_idle, __ATOMIC_RELAXED))
+        _wake();
+}
+
+void ws::Logger::_wake()
+{
+    pthread_mutex_lock(&m_mutex);
+    pthread_cond_signal(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+}
+
+bool ws::Logger::_pending()
+{
+    for (LogRing *ring = __atomic_load_n(&m_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail ||
+            __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED) != ring->reported)
+            return true;
+    }
+    return false;
+}
+
+/*
+    Append `size` bytes of `data` to `batch`, without the colors when `strip` is set. `escape` is set while
+    inside an escape sequence, which may be split where the ring wraps.
+ */
+static void _append(std::string& batch, const char *data, size_t size, bool strip, bool& escape)
+{
+    if (!strip)
+    {
+        batch.append(data, size);
+        return;
+    }
+
+    for (size_t i = 0; i < size; i++)
+    {
+        if (escape)
+            escape = data[i] != 'm';
+        else if (data[i] == '\033')
+            escape = true;
+        else
+            batch += data[i];
+    }
+}
+
+void ws::Logger::_drain(std::string& batch)
+{
+    batch.clear();
+
+    for (LogRing *ring = __atomic_load_n(&m_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        size_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped != ring->reported)
+        {
+            std::ostringstream ss;
+            ss << ws::warn << (dropped - ring->reported) << " log records dropped, the ring buffer was full\n";
+            std::string warning = ss.str();
+            bool escape = false;
+            _append(batch, warning.data(), warning.size(), m_strip, escape);
+            ring->reported = dropped;
+        }
+
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t tail = ring->tail;
+        bool escape = false;
+
+        while (tail != head)
+        {
+            size_t offset = tail & (LOG_RING_SIZE - 1);
+            size_t size = std::min(head - tail, (size_t)LOG_RING_SIZE - offset);
+            _append(batch, ring->data + offset, size, m_strip, escape);
+            tail += size;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    _write(batch);
+}
+
+void ws::Logger::_run()
+{
+    std::string batch;
+
+    while (true)
+    {
+        pthread_mutex_lock(&m_mutex);
+        __atomic_store_n(&m_idle, true, __ATOMIC_SEQ_CST);
+        while (!m_stopping && !_pending())
+            pthread_cond_wait(&m_cond, &m_mutex);
+        __atomic_store_n(&m_idle, false, __ATOMIC_RELAXED);
+        bool stopping = m_stopping;
+        pthread_mutex_unlock(&m_mutex);
+
+        if (!stopping)
+            usleep(LOG_FLUSH_DELAY * 1000);
+        _drain(batch);
+        if (stopping)
+            break;
+    }
+}
+
+void ws::Logger::_print(const std::string& text)
+{
+    if (!m_strip)
+        return _write(text);
+
+    std::string stripped;
+    bool escape = false;
+    _append(stripped, text.data(), text.size(), true, escape);
+    _write(stripped);
+}
+
+void ws::Logger::_write(const std::string& text)
+{
+    size_t written = 0;
+    while (written < text.size())
+    {
+        ssize_t n = write(STDERR_FILENO, text.data() + written, text.size() - written);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        written += n;
+    }
+}
+
+void *ws::Logger::_thread_main(void *logger)
+{
+    static_cast<Logger *>(logger)->_run();
+    return NULL;
+}
+
+/*
+    Only the thread which forked exists in the child, which writes its records directly from now on, and
+    must not wait for the background thread when it exits.
+ */
+void ws::Logger::_after_fork()
+{
+    ws::log.m_async = false;
+    ws::log.m_started = false;
+}
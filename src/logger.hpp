@@ -1,12 +1,21 @@
 #pragma once
 
 #include <cctype>
-#include <fstream>
-#include <iostream>
+#include <cstddef>
 #include <netinet/in.h>
+#include <ostream>
+#include <pthread.h>
+#include <sstream>
+#include <streambuf>
+#include <string>
 
 #include "colors.hpp"
 
+/* Size of the ring buffer of each thread which logs, must be a power of two. */
+#define LOG_RING_SIZE (1024 * 1024)
+/* How long the background thread lets records pile up after waking, to write them at once, in milliseconds. */
+#define LOG_FLUSH_DELAY 10
+
 namespace ws
 {
 enum LogLevel
@@ -17,56 +26,134 @@ enum LogLevel
     DEBUG = 3
 };
 
-class Logger
+/*
+    A `std::streambuf` appending to a string, where a record is formatted until its final `\n`.
+ */
+class LogBuffer : public std::streambuf
 {
 public:
-    void init()
+    std::string text;
+
+protected:
+    virtual int_type overflow(int_type c)
     {
-        // m_file_stream.open("webserv.log");
+        if (c != traits_type::eof())
+            text += traits_type::to_char_type(c);
+        return c;
     }
 
-    void print(std::string value)
+    virtual std::streamsize xsputn(const char *s, std::streamsize n)
     {
-        if (m_file_stream.is_open())
-        {
-            for (size_t i = 0; i < value.size(); i++)
-            {
-                // Filter shell colors which starts with a '\033' and ends with 'm'
-                if (value[i] == '\033')
-                {
-                    for (; i < value.size() && value[i] != 'm'; i++)
-                        ;
-                }
-                else
-                {
-                    m_file_stream << value[i];
-                }
-            }
-            m_file_stream.flush();
-        }
-        std::cerr << value;
+        text.append(s, n);
+        return n;
     }
+};
 
-    template <typename T>
-    void print(T value)
+/*
+    Records of one thread waiting for the background thread. The thread writes at `head` and the background
+    thread reads at `tail`, both only grow and are masked with `LOG_RING_SIZE - 1`. Each is written by a
+    single side, so they are shared with atomic loads and stores only.
+ */
+struct LogRing
+{
+    LogRing();
+    ~LogRing();
+
+    char *data;
+    size_t head;
+    size_t tail;
+    /* Records dropped because the ring was full, and how many of them were reported yet. */
+    size_t dropped;
+    size_t reported;
+
+    LogBuffer buffer;
+    std::ostream stream;
+    LogRing *next;
+
+private:
+    LogRing(const LogRing& other);
+    LogRing& operator=(const LogRing& other);
+};
+
+/*
+    Log records are written to the standard error by a background thread. Each thread formats its records
+    into its own ring buffer, a record being committed when a fragment ends with `\n`, and the background
+    thread writes what all rings hold with a single `write`. Colors are removed unless the standard error is
+    a terminal.
+
+    When a ring is full the record is either dropped, and a warning tells how many were, or the thread waits
+    for the background thread to make room (`log_overflow`).
+
+    Before `init`, and in a child process after `fork`, fragments are written directly instead.
+ */
+class Logger
+{
+public:
+    Logger();
+    ~Logger();
+
+    /*
+        Start the background thread.
+     */
+    void init();
+
+    /*
+        Make threads wait when their ring is full, instead of dropping records.
+     */
+    void set_blocking(bool blocking)
     {
-        if (m_file_stream.is_open())
-        {
-            m_file_stream << value;
-            m_file_stream.flush();
-        }
-        std::cerr << value;
+        m_blocking = blocking;
     }
 
     template <typename T>
-    Logger& operator<<(T value)
+    Logger& operator<<(const T& value)
     {
-        print(value);
+        if (!m_async)
+        {
+            std::ostringstream ss;
+            ss << value;
+            _print(ss.str());
+            return *this;
+        }
+
+        LogRing& ring = _ring();
+        ring.stream << value;
+
+        const std::string& text = ring.buffer.text;
+        if (!text.empty() && text[text.size() - 1] == '\n')
+            _commit(ring);
         return *this;
     }
 
 private:
-    std::ofstream m_file_stream;
+    /* Set while the background thread takes the records. */
+    bool m_async;
+    bool m_blocking;
+    bool m_strip;
+    bool m_started;
+    bool m_stopping;
+    /* Set while the background thread waits for records, so threads only signal it then. */
+    bool m_idle;
+    LogRing *m_rings;
+
+    pthread_t m_thread;
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+
+    LogRing& _ring();
+    void _commit(LogRing& ring);
+    void _wake();
+    bool _pending();
+    void _drain(std::string& batch);
+    void _run();
+    void _print(const std::string& text);
+    void _write(const std::string& text);
+
+    static void *_thread_main(void *logger);
+    static void _after_fork();
+
+    Logger(const Logger& other);
+    Logger& operator=(const Logger& other);
 };
 
 const std::string info = "[" NGREEN "INFO" RESET " ] ";
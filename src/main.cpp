@@ -1,4 +1,7 @@
+#include "http/scan.hpp"
+#include "http2/hpack.hpp"
 #include "logger.hpp"
+#include "tls.hpp"
 #include "webserv.hpp"
 #include <csignal>
 
@@ -13,10 +16,15 @@ void sigpipe(int signum)
 void signal_handler(int signum)
 {
     (void)signum;
-    ws::log << ws::info << "Shutdown...\n";
     g_webserv.quit();
 }
 
+void report_handler(int signum)
+{
+    (void)signum;
+    g_webserv.report();
+}
+
 int main(int argc, char *argv[], char *envp[])
 {
     ws::log.init();
@@ -31,9 +39,13 @@ int main(int argc, char *argv[], char *envp[])
 
     signal(SIGINT, signal_handler);
     signal(SIGPIPE, sigpipe);
+    signal(SIGUSR1, report_handler);
 
     File::_build_mime_table();
-    Response::_build_themes();
+    Request::_build_header_table();
+    _init_scanners();
+    HpackDecoder::_build_huffman_tree();
+    Tls::_build_ticket_keys();
 
     if (g_webserv.initialize(argv[1]) != 0)
         return 1;
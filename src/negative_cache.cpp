@@ -0,0 +1,97 @@
+#include "negative_cache.hpp"
+#include "webserv.hpp"
+
+NegativeCache g_negative_cache;
+
+NegativeCache::NegativeCache()
+{
+}
+
+void NegativeCache::build(Config& config, Watcher& watcher)
+{
+    for (size_t i = 0; i < config.servers().size(); i++)
+    {
+        std::vector<Location>& locations = config.servers()[i].locations();
+
+        for (size_t j = 0; j < locations.size(); j++)
+            if (locations[j].root().is_some())
+                watcher.watch_dir(locations[j].root().unwrap(), this);
+    }
+}
+
+/*
+    FNV-1a
+ */
+uint64_t NegativeCache::_hash(StringView path)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        hash ^= (unsigned char)path[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool NegativeCache::contains(StringView path)
+{
+    std::map<uint64_t, Entry>::iterator it = m_entries.find(_hash(path));
+
+    if (it == m_entries.end() || StringView(it->second.path) != path)
+        return false;
+
+    if (it->second.expires <= time())
+    {
+        _erase(it);
+        return false;
+    }
+    return true;
+}
+
+void NegativeCache::insert(StringView path)
+{
+    uint64_t hash = _hash(path);
+    std::map<uint64_t, Entry>::iterator it = m_entries.find(hash);
+
+    if (it != m_entries.end())
+        _erase(it);
+
+    if (m_entries.size() >= NEGATIVE_CACHE_SIZE)
+        _erase(m_entries.find(m_order.front()));
+
+    Entry& entry = m_entries[hash];
+    entry.path = path.str();
+    entry.expires = time() + NEGATIVE_CACHE_TTL;
+    entry.order = m_order.insert(m_order.end(), hash);
+}
+
+void NegativeCache::clear()
+{
+    m_entries.clear();
+    m_order.clear();
+}
+
+void NegativeCache::on_change(const std::string& dir, const std::string& name)
+{
+    (void)name;
+
+    // Forget every path under the root that changed.
+    std::string prefix = dir + "/";
+    std::map<uint64_t, Entry>::iterator it = m_entries.begin();
+
+    while (it != m_entries.end())
+    {
+        std::map<uint64_t, Entry>::iterator next = it;
+        next++;
+        if (it->second.path.compare(0, prefix.size(), prefix) == 0)
+            _erase(it);
+        it = next;
+    }
+}
+
+void NegativeCache::_erase(std::map<uint64_t, Entry>::iterator it)
+{
+    m_order.erase(it->second.order);
+    m_entries.erase(it);
+}
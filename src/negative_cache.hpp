@@ -0,0 +1,61 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include "config/config.hpp"
+#include "string.hpp"
+#include "watcher.hpp"
+
+/* Maximum number of paths remembered. */
+#define NEGATIVE_CACHE_SIZE 4096
+/* How long a miss is remembered, in milliseconds. */
+#define NEGATIVE_CACHE_TTL 2000
+
+/*
+    Remembers resolved paths which do not exist, so repeated requests to them (e.g. scanners
+    probing `/.env`) are answered without touching the filesystem.
+
+    Entries expire after `NEGATIVE_CACHE_TTL` and the oldest ones are evicted once the cache is
+    full. Location roots are watched so a file created there is served right away. Only the root
+    directory itself is watched, changes deeper in the tree are picked up when the entry expires.
+    Uploads may write elsewhere, so they call `clear` once a file is in place.
+ */
+class NegativeCache : public WatchListener
+{
+public:
+    NegativeCache();
+
+    void build(Config& config, Watcher& watcher);
+
+    bool contains(StringView path);
+    void insert(StringView path);
+
+    /*
+        Forget every path. The upload directory may be named differently from the root which
+        serves it, so an upload cannot tell which entries it makes stale.
+     */
+    void clear();
+
+    virtual void on_change(const std::string& dir, const std::string& name);
+
+private:
+    struct Entry
+    {
+        std::string path;
+        int64_t expires;
+        std::list<uint64_t>::iterator order;
+    };
+
+    /* Entries indexed by the hash of their path, so lookups do not need to build a string. */
+    std::map<uint64_t, Entry> m_entries;
+    /* Hashes in insertion order, which is also their expiration order. */
+    std::list<uint64_t> m_order;
+
+    static uint64_t _hash(StringView path);
+    void _erase(std::map<uint64_t, Entry>::iterator it);
+};
+
+extern NegativeCache g_negative_cache;
@@ -19,7 +19,7 @@ public:
     {
     }
 
-    T unwrap()
+    T& unwrap()
     {
         if (is_none())
             throw new std::runtime_error("Called `Option::unwrap` on None");
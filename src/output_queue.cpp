@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "output_queue.hpp"
+#include "tls.hpp"
+
+OutputQueue::OutputQueue() : m_head(0), m_size(0)
+{
+}
+
+OutputQueue::~OutputQueue()
+{
+    clear();
+}
+
+void OutputQueue::push(SharedBuffer buffer)
+{
+    push(buffer, 0, buffer.size());
+}
+
+void OutputQueue::push(SharedBuffer buffer, size_t offset, size_t size)
+{
+    if (size == 0)
+        return;
+
+    Segment segment;
+    segment.data = buffer.data();
+    segment.buffer = buffer;
+    segment.fd = -1;
+    segment.offset = offset;
+    segment.size = offset + size;
+
+    m_segments.push_back(segment);
+    m_size += size;
+}
+
+void OutputQueue::push_borrowed(const char *data, size_t size)
+{
+    if (size == 0)
+        return;
+
+    Segment segment;
+    segment.data = data;
+    segment.fd = -1;
+    segment.offset = 0;
+    segment.size = size;
+
+    m_segments.push_back(segment);
+    m_size += size;
+}
+
+void OutputQueue::push_file(int fd, size_t size)
+{
+    if (size == 0)
+    {
+        close(fd);
+        return;
+    }
+
+    Segment segment;
+    segment.data = NULL;
+    segment.fd = fd;
+    segment.offset = 0;
+    segment.size = size;
+
+    m_segments.push_back(segment);
+    m_size += size;
+}
+
+FlushStatus OutputQueue::flush(int sock)
+{
+    while (!m_segments.empty())
+    {
+        Segment& front = m_segments[m_head];
+        ssize_t n;
+
+        if (front.fd != -1)
+        {
+            off_t offset = front.offset;
+            n = sendfile(sock, front.fd, &offset, front.size - front.offset);
+
+            // The file was truncated since the response was made, its `Content-Length` cannot be
+            // honoured anymore.
+            if (n == 0)
+                return FLUSH_ERROR;
+        }
+        else
+        {
+            struct iovec iov[OUTPUT_QUEUE_IOV_MAX];
+            size_t count = 0;
+            bool more = false;
+
+            for (size_t i = m_head; i < m_segments.size() && count < OUTPUT_QUEUE_IOV_MAX; i++)
+            {
+                Segment& segment = m_segments[i];
+                if (segment.fd != -1)
+                {
+                    // Let the kernel merge the headers with the start of the file.
+                    more = true;
+                    break;
+                }
+                iov[count].iov_base = (void *)(segment.data + segment.offset);
+                iov[count].iov_len = segment.size - segment.offset;
+                count++;
+            }
+
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            n = sendmsg(sock, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        }
+
+        if (n == -1)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? FLUSH_AGAIN : FLUSH_ERROR;
+
+        _consume(n);
+    }
+
+    return FLUSH_DONE;
+}
+
+FlushStatus OutputQueue::flush(Tls& tls)
+{
+    char record[TLS_RECORD_SIZE];
+
+    while (!m_segments.empty())
+    {
+        Segment& front = m_segments[m_head];
+        size_t left = front.size - front.offset;
+        ssize_t n;
+
+        if (front.fd != -1)
+        {
+            if (tls.ktls())
+                n = tls.sendfile(front.fd, front.offset, left);
+            else
+            {
+                n = pread(front.fd, record, std::min(left, sizeof(record)), front.offset);
+                if (n > 0)
+                    n = tls.write(record, n);
+            }
+
+            if (n == 0)
+                return FLUSH_ERROR;
+        }
+        else if (left >= sizeof(record) || m_segments.size() - m_head == 1)
+            n = tls.write(front.data + front.offset, left);
+        else
+        {
+            size_t size = 0;
+            for (size_t i = m_head; i < m_segments.size() && m_segments[i].fd == -1 && size < sizeof(record); i++)
+            {
+                Segment& segment = m_segments[i];
+                size_t count = std::min(segment.size - segment.offset, sizeof(record) - size);
+
+                std::memcpy(record + size, segment.data + segment.offset, count);
+                size += count;
+            }
+            n = tls.write(record, size);
+        }
+
+        if (n == -1)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? FLUSH_AGAIN : FLUSH_ERROR;
+
+        _consume(n);
+    }
+
+    return FLUSH_DONE;
+}
+
+void OutputQueue::clear()
+{
+    while (!m_segments.empty())
+        _pop();
+    m_size = 0;
+}
+
+/*
+    Remove `n` written bytes from the front of the queue.
+ */
+void OutputQueue::_consume(size_t n)
+{
+    m_size -= n;
+
+    while (n > 0)
+    {
+        Segment& front = m_segments[m_head];
+        size_t left = front.size - front.offset;
+
+        if (n < left)
+        {
+            front.offset += n;
+            return;
+        }
+
+        n -= left;
+        _pop();
+    }
+}
+
+void OutputQueue::_pop()
+{
+    Segment& front = m_segments[m_head];
+    if (front.fd != -1)
+        close(front.fd);
+    front.buffer = SharedBuffer();
+    m_head++;
+
+    // The vector keeps its memory once the queue is empty, which it is after each response. A queue which
+    // never empties (e.g. an event stream) drops the written segments once they are most of it.
+    if (m_head == m_segments.size())
+    {
+        m_segments.clear();
+        m_head = 0;
+    }
+    else if (m_head >= 64 && m_head * 2 >= m_segments.size())
+    {
+        m_segments.erase(m_segments.begin(), m_segments.begin() + m_head);
+        m_head = 0;
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "buffer.hpp"
+
+class Tls;
+
+/* Maximum number of buffers written by a single `sendmsg`. */
+#define OUTPUT_QUEUE_IOV_MAX 16
+
+enum FlushStatus
+{
+    /* Everything was written. */
+    FLUSH_DONE,
+    /* The socket buffer is full, the rest has to wait for `EPOLLOUT`. */
+    FLUSH_AGAIN,
+    FLUSH_ERROR,
+};
+
+/*
+    Data waiting to be written to a non-blocking socket.
+
+    Buffers are referenced rather than copied, and consecutive buffers are written with a single
+    `sendmsg`. Files are sent with `sendfile` straight from the page cache.
+ */
+class OutputQueue
+{
+public:
+    OutputQueue();
+    ~OutputQueue();
+
+    void push(SharedBuffer buffer);
+
+    /*
+        Queue `size` bytes of `buffer` starting at `offset`.
+     */
+    void push(SharedBuffer buffer, size_t offset, size_t size);
+
+    /*
+        Queue `size` bytes of `data` without copying them, they must stay valid until they are written (e.g.
+        a response header in the arena of the connection).
+     */
+    void push_borrowed(const char *data, size_t size);
+
+    /*
+        Queue `size` bytes of the file `fd`, the queue takes ownership of the descriptor.
+     */
+    void push_file(int fd, size_t size);
+
+    bool empty() const
+    {
+        return m_segments.empty();
+    }
+
+    /*
+        Number of bytes not written yet.
+     */
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    FlushStatus flush(int sock);
+
+    /*
+        Same as `flush` on a TLS connection. Small buffers are gathered in a single record, and files
+        only go through `sendfile` when the kernel encrypts the records.
+     */
+    FlushStatus flush(Tls& tls);
+
+    /*
+        Drop everything not written yet.
+     */
+    void clear();
+
+private:
+    struct Segment
+    {
+        /* Bytes to write, which `buffer` keeps alive unless they are borrowed. */
+        const char *data;
+        SharedBuffer buffer;
+        /* File to send if not `-1`, `buffer` is unused then. */
+        int fd;
+        /* Position of the next byte to write and end of the data. */
+        size_t offset;
+        size_t size;
+    };
+
+    /* Segments from `m_head` on are not fully written yet. */
+    std::vector<Segment> m_segments;
+    size_t m_head;
+    size_t m_size;
+
+    void _consume(size_t n);
+    void _pop();
+
+    OutputQueue(const OutputQueue& other);
+    OutputQueue& operator=(const OutputQueue& other);
+};
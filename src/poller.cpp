@@ -0,0 +1,97 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include "logger.hpp"
+#include "poller.hpp"
+#include "uring_poller.hpp"
+
+Poller *Poller::create(EventBackend backend)
+{
+    if (backend == EVENT_BACKEND_IO_URING)
+    {
+        UringPoller *uring = new UringPoller;
+        if (uring->init())
+            return uring;
+        delete uring;
+
+        ws::log << ws::warn << "io_uring is not available, falling back to epoll\n";
+    }
+
+    EpollPoller *epoll = new EpollPoller;
+    if (epoll->init())
+        return epoll;
+    delete epoll;
+    return NULL;
+}
+
+EpollPoller::EpollPoller() : m_fd(-1)
+{
+}
+
+EpollPoller::~EpollPoller()
+{
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+bool EpollPoller::init()
+{
+    m_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_fd == -1)
+    {
+        ws::log << ws::err << "epoll_create1() failed: " << strerror(errno) << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool EpollPoller::listen(int sock)
+{
+    return add(sock, EPOLLIN);
+}
+
+bool EpollPoller::add(int fd, uint32_t events)
+{
+    return _ctl(EPOLL_CTL_ADD, fd, events);
+}
+
+bool EpollPoller::modify(int fd, uint32_t events)
+{
+    return _ctl(EPOLL_CTL_MOD, fd, events);
+}
+
+bool EpollPoller::remove(int fd)
+{
+    return _ctl(EPOLL_CTL_DEL, fd, 0);
+}
+
+int EpollPoller::wait(PollEvent *events, int max_events, int timeout)
+{
+    if (m_events.size() < (size_t)max_events)
+        m_events.resize(max_events);
+
+    int count = epoll_wait(m_fd, &m_events[0], max_events, timeout);
+
+    for (int i = 0; i < count; i++)
+    {
+        events[i].fd = m_events[i].data.fd;
+        events[i].events = m_events[i].events;
+        events[i].accepted = -1;
+    }
+    return count;
+}
+
+bool EpollPoller::_ctl(int op, int fd, uint32_t events)
+{
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+
+    if (epoll_ctl(m_fd, op, fd, &event) == -1)
+    {
+        ws::log << ws::err << "epoll_ctl() failed: " << strerror(errno) << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <vector>
+
+#include "config/config.hpp"
+
+/*
+    Readiness of a file descriptor. `events` uses the `EPOLL*` flags whatever the backend.
+ */
+struct PollEvent
+{
+    int fd;
+    uint32_t events;
+    /* Connection already accepted on the listening socket `fd` by the backend, `-1` if the socket is only
+       reported readable. */
+    int accepted;
+};
+
+/*
+    Backend of the event loop. Registrations are level-triggered: a file descriptor is reported again
+    as long as it stays readable or writable.
+ */
+class Poller
+{
+public:
+    virtual ~Poller()
+    {
+    }
+
+    virtual const char *name() const = 0;
+
+    /*
+        Watch a listening socket for new connections.
+     */
+    virtual bool listen(int sock) = 0;
+
+    virtual bool add(int fd, uint32_t events) = 0;
+    virtual bool modify(int fd, uint32_t events) = 0;
+
+    /*
+        Stop watching `fd`, must be called before it is closed.
+     */
+    virtual bool remove(int fd) = 0;
+
+    /*
+        Wait for at least one event, or `timeout` milliseconds unless it is `-1`. Returns the number of
+        events written to `events`, which may be `0`, or `-1` if the wait was interrupted or failed.
+     */
+    virtual int wait(PollEvent *events, int max_events, int timeout) = 0;
+
+    /*
+        Create the poller for `backend`, falls back to epoll if it is not supported by the kernel.
+        Returns `NULL` if no poller could be created.
+     */
+    static Poller *create(EventBackend backend);
+};
+
+class EpollPoller : public Poller
+{
+public:
+    EpollPoller();
+    virtual ~EpollPoller();
+
+    bool init();
+
+    virtual const char *name() const
+    {
+        return "epoll";
+    }
+
+    virtual bool listen(int sock);
+    virtual bool add(int fd, uint32_t events);
+    virtual bool modify(int fd, uint32_t events);
+    virtual bool remove(int fd);
+    virtual int wait(PollEvent *events, int max_events, int timeout);
+
+private:
+    int m_fd;
+    std::vector<struct epoll_event> m_events;
+
+    bool _ctl(int op, int fd, uint32_t events);
+
+    EpollPoller(const EpollPoller& other);
+    EpollPoller& operator=(const EpollPoller& other);
+};
@@ -0,0 +1,619 @@
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "http/scan.hpp"
+#include "logger.hpp"
+#include "proxy.hpp"
+#include "string.hpp"
+#include "upstream_pool.hpp"
+#include "webserv.hpp"
+
+/*
+    Headers which only concern a single connection (RFC 9110 section 7.6.1), or which the proxy sets
+    itself.
+ */
+static const char *g_request_hop_by_hop[] = {
+    "connection", "keep-alive",     "proxy-connection", "te",          "transfer-encoding", "trailer",
+    "upgrade",    "content-length", "expect",           "http2-settings", "x-forwarded-for", "x-forwarded-proto",
+    NULL,
+};
+
+static const char *g_response_hop_by_hop[] = {
+    "connection", "keep-alive", "proxy-connection", "te", "transfer-encoding", "trailer", "upgrade", "content-length",
+    NULL,
+};
+
+/*
+    Whether the header `name` must not be forwarded. `connection` is the value of the `Connection`
+    header, which can name more headers specific to the connection.
+ */
+static bool _is_hop_by_hop(StringView name, StringView connection, const char **names)
+{
+    for (size_t i = 0; names[i]; i++)
+    {
+        if (name.equals_ignore_case(names[i]))
+            return true;
+    }
+
+    while (!connection.empty())
+    {
+        size_t end = connection.find(',');
+        StringView option = connection.substr(0, end);
+
+        while (!option.empty() && (option[0] == ' ' || option[0] == '\t'))
+            option = option.substr(1);
+        while (!option.empty() && (option[option.size() - 1] == ' ' || option[option.size() - 1] == '\t'))
+            option = option.substr(0, option.size() - 1);
+
+        if (option.equals_ignore_case(name))
+            return true;
+        connection = end == StringView::npos ? StringView() : connection.substr(end + 1);
+    }
+    return false;
+}
+
+/*
+    Append the header lines of `block` to `out`, except the hop-by-hop ones.
+ */
+static void _copy_headers(std::string& out, StringView block, StringView connection, const char **names)
+{
+    size_t pos = 0;
+
+    while (pos < block.size())
+    {
+        size_t end = scan_crlf(block.data(), block.size(), pos);
+        if (end == StringView::npos)
+            end = block.size();
+
+        StringView line = block.substr(pos, end - pos);
+        pos = end + 2;
+
+        if (!_is_hop_by_hop(line.substr(0, line.find(':')), connection, names))
+        {
+            out.append(line.data(), line.size());
+            out += SEP;
+        }
+    }
+}
+
+/*
+    Value of `Sec-WebSocket-Accept` proving that a server read the handshake sent with `key` (RFC 6455
+    section 4.2.2).
+ */
+static std::string _websocket_accept(StringView key)
+{
+    std::string data = key.str() + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1((const unsigned char *)data.data(), data.size(), digest);
+
+    unsigned char encoded[(SHA_DIGEST_LENGTH + 2) / 3 * 4 + 1];
+    EVP_EncodeBlock(encoded, digest, SHA_DIGEST_LENGTH);
+    return std::string((const char *)encoded);
+}
+
+Proxy::Proxy(Upstream& upstream, const ProxyTarget& target)
+    : m_upstream(&upstream), m_path(target.path), m_hash(0), m_backend(NULL), m_start(0), m_deadline(0), m_fd(-1),
+      m_reused(false), m_connecting(false), m_state(STATE_SENDING), m_body_fd(-1), m_body_file_size(0),
+      m_head_request(false), m_idempotent(false), m_client_http10(false), m_received(0), m_no_body(false),
+      m_body_left(0), m_chunked(NULL), m_until_close(false), m_client_chunked(false), m_close_delimited(false),
+      m_keep_alive(false), m_paused(false), m_cache(NULL)
+{
+}
+
+Proxy::~Proxy()
+{
+    if (m_backend)
+        m_upstream->finish(*m_backend);
+    if (m_fd != -1)
+        close(m_fd);
+    if (m_body_fd != -1)
+        close(m_body_fd);
+    delete m_chunked;
+    delete m_cache;
+}
+
+void Proxy::prepare(Request& req, StringView route, const struct sockaddr_in& client, bool tls)
+{
+    std::string head;
+    head.reserve(req.header_size() + 128);
+
+    head += strmethod(req.method());
+    head += ' ';
+    if (m_path.empty())
+        head.append(req.path().data(), req.path().size());
+    else
+    {
+        StringView rest = req.path().substr(route.size());
+        head += m_path;
+        head.append(rest.data(), rest.size());
+    }
+    if (!req.query().empty())
+    {
+        head += '?';
+        head.append(req.query().data(), req.query().size());
+    }
+    head += " HTTP/1.1" SEP;
+
+    _copy_headers(head, req.raw_headers(), req.header(HEADER_CONNECTION), g_request_hop_by_hop);
+
+    // HTTP/1.0 clients may not send a `Host`, the name of the group is used instead, which is the address
+    // of the server unless the group is declared with `upstream`.
+    if (!req.has_header(HEADER_HOST))
+        head += "Host: " + m_upstream->config().name() + SEP;
+
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client.sin_addr, addr, sizeof(addr));
+    head += "X-Forwarded-For: ";
+    if (req.has_header(HEADER_X_FORWARDED_FOR))
+    {
+        head.append(req.header(HEADER_X_FORWARDED_FOR).data(), req.header(HEADER_X_FORWARDED_FOR).size());
+        head += ", ";
+    }
+    head += addr;
+    head += SEP;
+    head += tls ? "X-Forwarded-Proto: https" SEP : "X-Forwarded-Proto: http" SEP;
+
+    // What a WebSocket client sent after its handshake is already part of the new protocol, it follows the
+    // request as is. A chunked body was decoded as it was received, its size is known now.
+    if (req.is_websocket())
+    {
+        head += "Upgrade: websocket" SEP "Connection: Upgrade" SEP SEP;
+        m_accept = _websocket_accept(req.header(HEADER_SEC_WEBSOCKET_KEY));
+    }
+    else
+    {
+        if (req.method() == POST || req.method() == PUT || req.body_size() > 0)
+            head += "Content-Length: " + to_string(req.body_size()) + SEP;
+        head += "Connection: keep-alive" SEP SEP;
+    }
+
+    m_head = SharedBuffer(head);
+    m_body = SharedBuffer(req.body().str());
+
+    // The start of a large body is in its temporary file, which the client connection closes once it is done
+    // with the request.
+    if (req.body_in_file())
+    {
+        m_body_fd = fcntl(req.body_fd(), F_DUPFD_CLOEXEC, 0);
+        m_body_file_size = req.body_size() - req.body().size();
+    }
+
+    m_hash = m_upstream->hash(req, client);
+    m_head_request = req.method() == HEAD;
+    m_idempotent = req.method() != POST;
+    m_client_http10 = req.protocol() == "HTTP/1.0";
+}
+
+void Proxy::_queue_request()
+{
+    m_request.clear();
+    m_request.push(m_head);
+
+    if (m_body_fd != -1)
+    {
+        int fd = fcntl(m_body_fd, F_DUPFD_CLOEXEC, 0);
+        if (fd != -1)
+            m_request.push_file(fd, m_body_file_size);
+    }
+    m_request.push(m_body);
+}
+
+bool Proxy::connect()
+{
+    while ((m_backend = m_upstream->pick(m_hash, m_tried)))
+    {
+        m_fd = g_upstream_pool.acquire(m_backend->server.addr, m_reused);
+        if (m_fd != -1)
+            break;
+
+        fail(false);
+        _leave();
+    }
+    if (!m_backend)
+        return false;
+
+    m_connecting = !m_reused;
+    m_state = STATE_SENDING;
+    m_start = time();
+    m_deadline = m_start + (m_reused ? m_upstream->config().read_timeout() : m_upstream->config().connect_timeout());
+    _queue_request();
+    return true;
+}
+
+bool Proxy::retry()
+{
+    close(m_fd);
+    m_fd = UpstreamPool::connect(m_backend->server.addr);
+    if (m_fd == -1)
+        return false;
+
+    m_reused = false;
+    m_connecting = true;
+    m_state = STATE_SENDING;
+    m_deadline = time() + m_upstream->config().connect_timeout();
+    m_buffer.clear();
+    _queue_request();
+    return true;
+}
+
+void Proxy::fail(bool timeout)
+{
+    if (m_backend)
+        m_upstream->fail(*m_backend, timeout);
+}
+
+bool Proxy::can_try_next() const
+{
+    return m_backend && m_state <= STATE_HEADER && m_received == 0 &&
+           (m_idempotent || (m_state == STATE_SENDING && m_connecting));
+}
+
+bool Proxy::next()
+{
+    _leave();
+    m_buffer.clear();
+    return connect();
+}
+
+/*
+    Stop using the current server for this request.
+ */
+void Proxy::_leave()
+{
+    if (m_fd != -1)
+        close(m_fd);
+    m_fd = -1;
+
+    m_upstream->finish(*m_backend);
+    m_tried.push_back(m_backend);
+    m_backend = NULL;
+}
+
+FlushStatus Proxy::send()
+{
+    // The socket became writable, or failed, once the connection was established.
+    if (m_connecting)
+    {
+        int error = 0;
+        socklen_t size = sizeof(error);
+
+        if (getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &size) == -1 || error != 0)
+        {
+            errno = error ? error : errno;
+            return FLUSH_ERROR;
+        }
+        m_connecting = false;
+        m_deadline = time() + m_upstream->config().read_timeout();
+    }
+
+    FlushStatus status = m_request.flush(m_fd);
+    if (status == FLUSH_DONE)
+        m_state = STATE_HEADER;
+    return status;
+}
+
+ProxyStatus Proxy::receive(OutputQueue& out)
+{
+    char *data = m_buffer.reserve(PROXY_READ_SIZE);
+    if (!data)
+    {
+        ws::log << ws::err << "cannot allocate a buffer of " << PROXY_READ_SIZE << " bytes\n";
+        return PROXY_ERROR;
+    }
+
+    ssize_t n = recv(m_fd, data, PROXY_READ_SIZE, 0);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return PROXY_AGAIN;
+
+    if (n == -1 || (n == 0 && !(m_state == STATE_BODY && m_until_close)))
+    {
+        ws::log << ws::err << "upstream `" << server() << "` " << (n == 0 ? "closed the connection" : strerror(errno))
+                << (m_state <= STATE_HEADER ? " before responding" : " in the middle of the response") << "\n";
+        return PROXY_ERROR;
+    }
+
+    m_received += n;
+    m_buffer.commit(n);
+    m_deadline = time() + m_upstream->config().read_timeout();
+
+    if (n == 0)
+    {
+        // The server closed the connection to end the body.
+        if (m_client_chunked)
+            out.push(SharedBuffer("0" SEP SEP));
+        m_state = STATE_DONE;
+        return PROXY_DONE;
+    }
+
+    if (m_state == STATE_HEADER)
+        return _parse_head();
+    if (m_state == STATE_BODY)
+        return _pass_body(out);
+    return PROXY_AGAIN;
+}
+
+/*
+    Parse the status line and headers once they were fully received, and find how the body ends.
+ */
+ProxyStatus Proxy::_parse_head()
+{
+    size_t end;
+
+    // Interim responses are dropped, the client gets the final one.
+    while (true)
+    {
+        end = scan_header_end(m_buffer.data(), m_buffer.size(), 0);
+        if (end == StringView::npos)
+        {
+            if (m_buffer.size() <= PROXY_MAX_HEADER_SIZE)
+                return PROXY_AGAIN;
+            ws::log << ws::err << "response headers of upstream `" << server() << "` are too large\n";
+            return PROXY_ERROR;
+        }
+
+        const char *data = m_buffer.data();
+        if (end < 12 || std::memcmp(data, "HTTP/1.", 7) != 0 || data[8] != ' ' || !std::isdigit(data[9]) ||
+            !std::isdigit(data[10]) || !std::isdigit(data[11]) || (data[12] != ' ' && data[12] != '\r'))
+        {
+            ws::log << ws::err << "upstream `" << server() << "` sent an invalid status line\n";
+            return PROXY_ERROR;
+        }
+
+        m_status = (data[9] - '0') * 100 + (data[10] - '0') * 10 + (data[11] - '0');
+        if (m_status.code() >= 200 || (m_status.code() == 101 && !m_accept.empty()))
+        {
+            m_upstream->succeed(*m_backend, time() - m_start);
+            break;
+        }
+
+        // Only a WebSocket handshake asks the server to switch protocols.
+        if (m_status.code() == 101)
+        {
+            ws::log << ws::err << "upstream `" << server() << "` switched protocols\n";
+            return PROXY_ERROR;
+        }
+        m_buffer.erase(0, end + 4);
+    }
+
+    const char *data = m_buffer.data();
+    size_t line_end = scan_crlf(data, end + 2, 0);
+    bool http10 = data[7] == '0';
+
+    Request headers;
+    if (headers.parse_part(data + line_end + 2, end + 2 - (line_end + 2)).is_err())
+    {
+        ws::log << ws::err << "upstream `" << server() << "` sent invalid headers\n";
+        return PROXY_ERROR;
+    }
+
+    if (m_status.code() == 101)
+        return _parse_upgrade(headers, line_end, end);
+
+    m_keep_alive = http10 ? headers.has_connection_option("keep-alive") : !headers.has_connection_option("close");
+    m_no_body = m_head_request || m_status.code() == 204 || m_status.code() == 304;
+
+    if (!m_no_body && headers.has_header(HEADER_TRANSFER_ENCODING))
+    {
+        if (!headers.header(HEADER_TRANSFER_ENCODING).equals_ignore_case("chunked"))
+        {
+            ws::log << ws::err << "upstream `" << server() << "` used an unsupported transfer coding `"
+                    << headers.header(HEADER_TRANSFER_ENCODING) << "`\n";
+            return PROXY_ERROR;
+        }
+
+        // A `Content-Length` next to it is ignored, but the connection cannot be trusted anymore (RFC 9112
+        // section 6.3).
+        if (headers.has_header(HEADER_CONTENT_LENGTH))
+            m_keep_alive = false;
+        m_chunked = new ChunkedDecoder(PROXY_MAX_CHUNK_SIZE, 0);
+    }
+    else if (!m_no_body && headers.has_header(HEADER_CONTENT_LENGTH))
+    {
+        StringView value = headers.header(HEADER_CONTENT_LENGTH);
+        if (value.empty() || value.size() > 18)
+        {
+            ws::log << ws::err << "upstream `" << server() << "` sent an invalid `Content-Length`\n";
+            return PROXY_ERROR;
+        }
+
+        for (size_t i = 0; i < value.size(); i++)
+        {
+            if (!std::isdigit(value[i]))
+            {
+                ws::log << ws::err << "upstream `" << server() << "` sent an invalid `Content-Length`\n";
+                return PROXY_ERROR;
+            }
+            m_body_left = m_body_left * 10 + (value[i] - '0');
+        }
+    }
+    else if (!m_no_body)
+    {
+        m_until_close = true;
+        m_keep_alive = false;
+    }
+
+    m_response = "HTTP/1.1 ";
+    m_response.append(data + 9, line_end - 9);
+    m_response += line_end == 12 ? " " SEP : SEP;
+
+    size_t status_end = m_response.size();
+    _copy_headers(m_response, StringView(data + line_end + 2, end + 2 - (line_end + 2)),
+                  headers.header(HEADER_CONNECTION), g_response_hop_by_hop);
+
+    if (m_cache && !m_cache->start(m_status, headers, StringView(m_response).substr(status_end)))
+        _drop_cache();
+
+    // The response to a `HEAD` keeps the `Content-Length` of the body it does not have.
+    if (headers.has_header(HEADER_CONTENT_LENGTH) && !m_chunked && (!m_no_body || m_head_request))
+        m_response += "Content-Length: " + headers.header(HEADER_CONTENT_LENGTH).str() + SEP;
+    else if (!m_no_body && !m_client_http10)
+    {
+        m_response += "Transfer-Encoding: chunked" SEP;
+        m_client_chunked = true;
+    }
+    else if (!m_no_body)
+        m_close_delimited = true;
+
+    m_buffer.erase(0, end + 4);
+    m_state = STATE_RESPONSE;
+    return PROXY_HEADER;
+}
+
+/*
+    Check the answer of the server to a WebSocket handshake. Otherwise the client would take whatever the
+    server sends next for frames.
+ */
+ProxyStatus Proxy::_parse_upgrade(const Request& headers, size_t line_end, size_t end)
+{
+    if (!headers.is_websocket() || headers.get_param("Sec-WebSocket-Accept") != StringView(m_accept))
+    {
+        ws::log << ws::err << "upstream `" << server() << "` sent an invalid WebSocket handshake\n";
+        return PROXY_ERROR;
+    }
+
+    const char *data = m_buffer.data();
+    m_response = "HTTP/1.1 101 Switching Protocols" SEP;
+    _copy_headers(m_response, StringView(data + line_end + 2, end + 2 - (line_end + 2)),
+                  headers.header(HEADER_CONNECTION), g_response_hop_by_hop);
+    m_response += "Upgrade: websocket" SEP "Connection: Upgrade" SEP SEP;
+
+    m_buffer.erase(0, end + 4);
+    m_state = STATE_RESPONSE;
+    return PROXY_HEADER;
+}
+
+ProxyStatus Proxy::respond(OutputQueue& out, bool keep_alive)
+{
+    // What the server sent after switching protocols is the start of the tunnel.
+    if (upgraded())
+    {
+        out.push(SharedBuffer(m_response));
+        if (!m_buffer.empty())
+            out.push(SharedBuffer(std::string(m_buffer.data(), m_buffer.size())));
+        m_response.clear();
+        m_buffer.clear();
+        m_state = STATE_DONE;
+        return PROXY_DONE;
+    }
+
+    m_response += keep_alive ? "Connection: keep-alive" SEP SEP : "Connection: close" SEP SEP;
+    out.push(SharedBuffer(m_response));
+    m_response.clear();
+
+    if (m_no_body)
+    {
+        // Whatever follows would be taken for the next response.
+        if (!m_buffer.empty())
+            m_keep_alive = false;
+        m_state = STATE_DONE;
+        return PROXY_DONE;
+    }
+
+    m_state = STATE_BODY;
+    return _pass_body(out);
+}
+
+/*
+    Queue the part of the body held in the buffer for the client.
+ */
+ProxyStatus Proxy::_pass_body(OutputQueue& out)
+{
+    char *data = m_buffer.data();
+    size_t size = m_buffer.size();
+    bool done = false;
+
+    if (m_chunked)
+    {
+        size = m_chunked->decode(data, size);
+        if (m_chunked->failed())
+        {
+            ws::log << ws::err << "upstream `" << server() << "` sent an invalid chunked body\n";
+            return PROXY_ERROR;
+        }
+        done = m_chunked->done();
+    }
+    else if (!m_until_close)
+    {
+        if (size > m_body_left)
+        {
+            m_keep_alive = false;
+            size = m_body_left;
+        }
+        m_body_left -= size;
+        done = m_body_left == 0;
+    }
+
+    if (size > 0 && m_cache && !m_cache->write(data, size))
+        _drop_cache();
+
+    if (size > 0 && m_client_chunked)
+    {
+        std::string chunk = to_string(size, 16) + SEP;
+        chunk.reserve(chunk.size() + size + 2);
+        chunk.append(data, size);
+        chunk += SEP;
+        out.push(SharedBuffer(chunk));
+    }
+    else if (size > 0)
+        out.push(SharedBuffer(std::string(data, size)));
+
+    m_buffer.truncate(0);
+
+    if (!done)
+        return PROXY_AGAIN;
+
+    if (m_client_chunked)
+        out.push(SharedBuffer("0" SEP SEP));
+    m_state = STATE_DONE;
+    return PROXY_DONE;
+}
+
+Tunnel *Proxy::switch_protocols()
+{
+    Tunnel *tunnel = new Tunnel(*m_upstream, *m_backend, m_fd);
+    m_fd = -1;
+    m_backend = NULL;
+    return tunnel;
+}
+
+void Proxy::set_paused(bool paused)
+{
+    if (m_paused && !paused)
+        m_deadline = time() + m_upstream->config().read_timeout();
+    m_paused = paused;
+}
+
+/*
+    Stop storing the response, it cannot be cached.
+ */
+void Proxy::_drop_cache()
+{
+    delete m_cache;
+    m_cache = NULL;
+}
+
+void Proxy::release()
+{
+    if (m_cache && m_state == STATE_DONE)
+        m_cache->commit();
+    _drop_cache();
+
+    if (m_fd == -1)
+        return;
+
+    if (m_state == STATE_DONE && m_keep_alive)
+        g_upstream_pool.release(m_backend->server.addr, m_fd);
+    else
+        close(m_fd);
+    m_fd = -1;
+
+    m_upstream->finish(*m_backend);
+    m_backend = NULL;
+}
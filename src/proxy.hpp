@@ -0,0 +1,289 @@
+#pragma once
+
+#include <cstddef>
+#include <netinet/in.h>
+#include <string>
+
+#include "buffer.hpp"
+#include "buffer_pool.hpp"
+#include "config/config.hpp"
+#include "http/chunked.hpp"
+#include "http/request.hpp"
+#include "http/status.hpp"
+#include "output_queue.hpp"
+#include "proxy_cache.hpp"
+#include "tunnel.hpp"
+#include "upstream.hpp"
+
+/* Bytes read from an upstream server at once. */
+#define PROXY_READ_SIZE (64 * 1024)
+/* Largest status line and headers accepted from an upstream server. */
+#define PROXY_MAX_HEADER_SIZE (64 * 1024)
+/* Largest chunk accepted in a chunked response body, only there so the size cannot overflow. */
+#define PROXY_MAX_CHUNK_SIZE ((size_t)1 << 40)
+/* The upstream server is not read while more than this waits to be written to the client. */
+#define PROXY_HIGH_WATER (256 * 1024)
+
+enum ProxyStatus
+{
+    /* Waiting for the upstream server. */
+    PROXY_AGAIN,
+    /* The status line and headers of the response were received, see `respond`. */
+    PROXY_HEADER,
+    /* The whole response was queued for the client. */
+    PROXY_DONE,
+    PROXY_ERROR,
+};
+
+/*
+    Exchange of a request with an upstream server on behalf of a client (`proxy_pass`).
+
+    The request is sent once its body was received from the client, the body is read from memory or
+    from the temporary file it was moved to. The response is passed on as it arrives: the part of the
+    body read from the upstream server is queued for the client before the server is read again. A
+    response without a `Content-Length` is sent with chunked encoding to HTTP/1.1 clients, so their
+    connection can still be reused.
+
+    The server is picked from the `upstream` group of the location. If it cannot be reached, or fails before
+    responding to a request which can safely be sent again, the next server of the group is tried.
+    Connections come from `g_upstream_pool`, and go back to it once they carried a complete response.
+
+    If the location caches its responses, the body is also written to the cache as it is passed on, and
+    the response is stored once complete.
+
+    A WebSocket handshake is forwarded with its `Upgrade`, and the server has to answer it with `101`
+    and the `Sec-WebSocket-Accept` of the key. The connection to the server then becomes a `Tunnel`.
+ */
+class Proxy
+{
+public:
+    Proxy(Upstream& upstream, const ProxyTarget& target);
+    ~Proxy();
+
+    /*
+        Build the request sent upstream from `req`, received by a location with route `route`. Hop-by-hop
+        headers are dropped and the client is added to `X-Forwarded-For`. The `Upgrade` of a WebSocket
+        handshake, which must be valid, is kept.
+     */
+    void prepare(Request& req, StringView route, const struct sockaddr_in& client, bool tls);
+
+    /*
+        Store the response with `cache` if it can be cached, the proxy takes ownership of the writer.
+     */
+    void set_cache(CacheWriter *cache)
+    {
+        m_cache = cache;
+    }
+
+    /*
+        Pick a server and take a connection to it from the pool, or open a new one. Servers which cannot
+        be connected to are counted as failed and the next one is tried.
+     */
+    bool connect();
+
+    /*
+        Close the connection and send the request again on a new one. Only possible while `retryable`.
+     */
+    bool retry();
+
+    /*
+        Count a failure of the current server, `timeout` if it did not answer in time.
+     */
+    void fail(bool timeout);
+
+    /*
+        Whether the request can go to another server after a failure: nothing was received yet, and the
+        request either was not sent or can be repeated without harm.
+     */
+    bool can_try_next() const;
+
+    /*
+        Close the connection and send the request to the next server of the group.
+     */
+    bool next();
+
+    /*
+        When the server is considered as not answering, unless the exchange is paused.
+     */
+    int64_t deadline() const
+    {
+        return m_deadline;
+    }
+
+    /*
+        Whether the request can be sent again: it went to a pooled connection that failed before
+        anything was received, most likely because the server closed it while it was idle.
+     */
+    bool retryable() const
+    {
+        return m_reused && m_state <= STATE_HEADER && m_received == 0;
+    }
+
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    /*
+        Address of the current server, as written in the configuration.
+     */
+    const std::string& server() const
+    {
+        return m_backend->server.name;
+    }
+
+    /*
+        Whether the connection came from the pool, a new connection may still be connecting.
+     */
+    bool reused() const
+    {
+        return m_reused;
+    }
+
+    /*
+        Whether the request is still being sent, the socket is then waited for `EPOLLOUT`.
+     */
+    bool sending() const
+    {
+        return m_state == STATE_SENDING;
+    }
+
+    /*
+        Whether the response headers were queued for the client.
+     */
+    bool responding() const
+    {
+        return m_state >= STATE_BODY;
+    }
+
+    FlushStatus send();
+
+    /*
+        Read what the upstream server sent. Once the response headers were passed on with `respond`,
+        the body is queued in `out`.
+     */
+    ProxyStatus receive(OutputQueue& out);
+
+    /*
+        Queue the status line and headers of the response, followed by the part of the body already
+        received. `keep_alive` is whether the client connection stays open afterwards.
+     */
+    ProxyStatus respond(OutputQueue& out, bool keep_alive);
+
+    HttpStatus status() const
+    {
+        return m_status;
+    }
+
+    /*
+        Whether the server switched to the WebSocket protocol. Once `respond` queued its response, the
+        connection is handed over with `switch_protocols`.
+     */
+    bool upgraded() const
+    {
+        return m_status.code() == 101;
+    }
+
+    /*
+        Relay the connection to the server both ways from now on, the caller owns the tunnel.
+     */
+    Tunnel *switch_protocols();
+
+    /*
+        Whether the client can only see the end of the response by the connection closing, which
+        happens when the server does not give the size of the body to an HTTP/1.0 client.
+     */
+    bool close_delimited() const
+    {
+        return m_close_delimited;
+    }
+
+    /*
+        Whether the upstream server is not read, because the client is slow to take the response.
+     */
+    bool paused() const
+    {
+        return m_paused;
+    }
+
+    /*
+        The wait for the server starts over once the exchange resumes.
+     */
+    void set_paused(bool paused);
+
+    /*
+        Give the connection back to the pool if it can carry another request, otherwise close it.
+     */
+    void release();
+
+private:
+    enum State
+    {
+        STATE_SENDING,
+        STATE_HEADER,
+        /* Waiting for `respond`. */
+        STATE_RESPONSE,
+        STATE_BODY,
+        STATE_DONE,
+    };
+
+    Upstream *m_upstream;
+    std::string m_path;
+    uint64_t m_hash;
+    Backend *m_backend;
+    /* Servers which already failed this request. */
+    std::vector<Backend *> m_tried;
+    /* Start of the exchange with the current server, and end of the current wait for it. */
+    int64_t m_start;
+    int64_t m_deadline;
+
+    int m_fd;
+    bool m_reused;
+    bool m_connecting;
+    State m_state;
+
+    /* The request, kept to be sent again by `retry`. The body file is owned by the proxy. */
+    SharedBuffer m_head;
+    SharedBuffer m_body;
+    int m_body_fd;
+    size_t m_body_file_size;
+    OutputQueue m_request;
+
+    bool m_head_request;
+    bool m_idempotent;
+    bool m_client_http10;
+    /* `Sec-WebSocket-Accept` expected from the server, empty unless the request is a WebSocket handshake. */
+    std::string m_accept;
+
+    RecvBuffer m_buffer;
+    size_t m_received;
+    HttpStatus m_status;
+    /* Status line and headers for the client, without `Connection`. */
+    std::string m_response;
+
+    /* How the end of the response body is found: its size, chunked encoding, or the server closing. */
+    bool m_no_body;
+    size_t m_body_left;
+    ChunkedDecoder *m_chunked;
+    bool m_until_close;
+    /* Whether the body is sent with chunked encoding to the client, or delimited by closing. */
+    bool m_client_chunked;
+    bool m_close_delimited;
+
+    /* Whether the server can take another request on this connection once the response is complete. */
+    bool m_keep_alive;
+    bool m_paused;
+
+    /* Writer of the response to the cache, `NULL` if it is not stored. */
+    CacheWriter *m_cache;
+
+    void _queue_request();
+    void _leave();
+    void _drop_cache();
+    ProxyStatus _parse_head();
+    ProxyStatus _parse_upgrade(const Request& headers, size_t line_end, size_t end);
+    ProxyStatus _pass_body(OutputQueue& out);
+
+    Proxy(const Proxy& other);
+    Proxy& operator=(const Proxy& other);
+};
@@ -0,0 +1,505 @@
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file.hpp"
+#include "logger.hpp"
+#include "proxy_cache.hpp"
+#include "webserv.hpp"
+
+ProxyCache g_proxy_cache;
+
+/* Name of the files holding the bodies, and prefix of the ones being written. */
+#define CACHE_FILE_EXT ".cache"
+#define CACHE_TEMP_PREFIX ".webserv-cache-"
+
+/*
+    Parse an HTTP date such as `Sun, 06 Nov 1994 08:49:37 GMT`, in milliseconds. Returns `-1` if it is
+    invalid, which makes an `Expires` header mean the response is already expired.
+ */
+static int64_t _parse_date(StringView value)
+{
+    std::string str = value.str();
+    struct tm tm;
+
+    std::memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0')
+        return -1;
+    return (int64_t)timegm(&tm) * 1000;
+}
+
+/*
+    Directives of a `Cache-Control` header which matter to a shared cache, durations are in seconds and
+    `-1` when absent.
+ */
+struct CacheControl
+{
+    bool no_store;
+    bool no_cache;
+    bool is_private;
+    bool must_revalidate;
+    int64_t max_age;
+    int64_t s_maxage;
+    int64_t stale_while_revalidate;
+
+    CacheControl(StringView value)
+        : no_store(false), no_cache(false), is_private(false), must_revalidate(false), max_age(-1), s_maxage(-1),
+          stale_while_revalidate(-1)
+    {
+        while (!value.empty())
+        {
+            size_t end = value.find(',');
+            StringView directive = value.substr(0, end);
+            value = end == StringView::npos ? StringView() : value.substr(end + 1);
+
+            while (!directive.empty() && std::isspace(directive[0]))
+                directive = directive.substr(1);
+            while (!directive.empty() && std::isspace(directive[directive.size() - 1]))
+                directive = directive.substr(0, directive.size() - 1);
+
+            size_t equal = directive.find('=');
+            StringView name = directive.substr(0, equal);
+            int64_t seconds = -1;
+
+            if (equal != StringView::npos)
+            {
+                StringView arg = directive.substr(equal + 1);
+                if (arg.size() >= 2 && arg[0] == '"' && arg[arg.size() - 1] == '"')
+                    arg = arg.substr(1, arg.size() - 2);
+                if (!arg.empty() && arg.size() <= 10 && arg.str().find_first_not_of("0123456789") == std::string::npos)
+                    seconds = std::atol(arg.str().c_str());
+            }
+
+            if (name.equals_ignore_case("no-store"))
+                no_store = true;
+            else if (name.equals_ignore_case("no-cache"))
+                no_cache = true;
+            else if (name.equals_ignore_case("private"))
+                is_private = true;
+            else if (name.equals_ignore_case("must-revalidate") || name.equals_ignore_case("proxy-revalidate"))
+                must_revalidate = true;
+            else if (name.equals_ignore_case("max-age"))
+                max_age = seconds;
+            else if (name.equals_ignore_case("s-maxage"))
+                s_maxage = seconds;
+            else if (name.equals_ignore_case("stale-while-revalidate"))
+                stale_while_revalidate = seconds;
+        }
+    }
+};
+
+/*
+    Statuses which can be cached without knowing their meaning for the resource (RFC 9110 section 15.1),
+    along with the temporary redirections.
+ */
+static bool _is_cacheable_status(HttpStatus status)
+{
+    switch (status.code())
+    {
+    case 200:
+    case 203:
+    case 204:
+    case 300:
+    case 301:
+    case 302:
+    case 307:
+    case 308:
+    case 404:
+    case 405:
+    case 410:
+    case 414:
+    case 501:
+        return true;
+    }
+    return false;
+}
+
+CacheWriter::CacheWriter(CacheZone& zone, const std::string& key, uint64_t hash, bool refreshing)
+    : m_zone(zone), m_key(key), m_hash(hash), m_refreshing(refreshing), m_stored(0), m_expires(0), m_stale_until(0),
+      m_fd(-1), m_size(0)
+{
+}
+
+CacheWriter::~CacheWriter()
+{
+    _abandon();
+    if (m_refreshing)
+        m_zone._unlock(m_hash, m_key);
+}
+
+bool CacheWriter::start(HttpStatus status, const Request& headers, StringView lines)
+{
+    if (!_is_cacheable_status(status))
+        return false;
+
+    // The response is different for each client, or depends on request headers which are not in the key.
+    if (headers.has_param("Set-Cookie") || headers.has_param("Vary"))
+        return false;
+
+    CacheControl cc(headers.header(HEADER_CACHE_CONTROL));
+    if (cc.no_store || cc.no_cache || cc.is_private)
+        return false;
+
+    int64_t now = time();
+    int64_t lifetime;
+
+    // The lifetime given by `Expires` is counted from the `Date` of the server, so their clocks do not
+    // need to agree.
+    if (cc.s_maxage >= 0)
+        lifetime = cc.s_maxage * 1000;
+    else if (cc.max_age >= 0)
+        lifetime = cc.max_age * 1000;
+    else if (headers.has_param("Expires"))
+    {
+        int64_t date = headers.has_param("Date") ? _parse_date(headers.get_param("Date")) : -1;
+        lifetime = _parse_date(headers.get_param("Expires")) - (date == -1 ? now : date);
+    }
+    else
+        return false;
+
+    if (lifetime <= 0)
+        return false;
+
+    std::string temp_path = m_zone.config().path() + "/" CACHE_TEMP_PREFIX "XXXXXX";
+    m_fd = mkstemp(&temp_path[0]);
+    if (m_fd == -1)
+    {
+        ws::log << ws::err << "cannot create a temporary file in `" << m_zone.config().path()
+                << "`: " << strerror(errno) << "\n";
+        return false;
+    }
+    fcntl(m_fd, F_SETFD, FD_CLOEXEC);
+
+    m_temp_path = temp_path;
+    m_status = status;
+    m_lines = lines.str();
+    m_stored = now;
+    m_expires = now + lifetime;
+    m_stale_until = m_expires;
+    if (cc.stale_while_revalidate > 0 && !cc.must_revalidate)
+        m_stale_until += cc.stale_while_revalidate * 1000;
+    return true;
+}
+
+bool CacheWriter::write(const char *data, size_t size)
+{
+    if (m_fd == -1)
+        return false;
+
+    // A response larger than the whole zone would only evict everything else.
+    m_size += size;
+    if (m_size + m_lines.size() > m_zone.config().max_size())
+    {
+        _abandon();
+        return false;
+    }
+
+    while (size > 0)
+    {
+        ssize_t n = ::write(m_fd, data, size);
+        if (n == -1)
+        {
+            ws::log << ws::err << "cannot write `" << m_temp_path << "`: " << strerror(errno) << "\n";
+            _abandon();
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+void CacheWriter::commit()
+{
+    if (m_fd == -1)
+        return;
+
+    close(m_fd);
+    m_fd = -1;
+
+    CacheZone::Entry entry;
+    entry.key = m_key;
+    entry.status = m_status;
+    entry.lines = m_lines;
+    entry.body_size = m_size;
+    entry.stored = m_stored;
+    entry.expires = m_expires;
+    entry.stale_until = m_stale_until;
+    entry.updating = false;
+
+    if (!m_zone._insert(m_hash, entry, m_temp_path))
+        unlink(m_temp_path.c_str());
+    m_temp_path.clear();
+}
+
+void CacheWriter::store(Response& response)
+{
+    if (!response.body().in_memory())
+        return;
+
+    std::string lines;
+    for (size_t i = 0; i < response.param_count(); i++)
+    {
+        StringView name = response.param_name(i);
+        if (name.equals_ignore_case("Content-Length") || name.equals_ignore_case("Connection") ||
+            name.equals_ignore_case("Transfer-Encoding"))
+            continue;
+        lines += name.str() + ": " + response.param_value(i).str() + SEP;
+    }
+
+    Request headers;
+    if (headers.parse_part(lines.data(), lines.size()).is_err())
+        return;
+
+    SharedBuffer& body = response.body().content();
+    if (start(response.status(), headers, lines) && write(body.data(), body.size()))
+        commit();
+}
+
+/*
+    Stop writing, the temporary file is removed.
+ */
+void CacheWriter::_abandon()
+{
+    if (m_fd != -1)
+        close(m_fd);
+    m_fd = -1;
+
+    if (!m_temp_path.empty())
+        unlink(m_temp_path.c_str());
+    m_temp_path.clear();
+}
+
+CacheZone::CacheZone(const CacheZoneConfig& config) : m_config(config), m_size(0)
+{
+}
+
+bool CacheZone::init()
+{
+    if (mkdir(m_config.path().c_str(), 0755) == -1 && errno != EEXIST)
+    {
+        ws::log << ws::err << "cannot create the cache directory `" << m_config.path() << "`: " << strerror(errno)
+                << "\n";
+        return false;
+    }
+
+    DIR *dir = opendir(m_config.path().c_str());
+    if (!dir)
+    {
+        ws::log << ws::err << "cannot open the cache directory `" << m_config.path() << "`: " << strerror(errno)
+                << "\n";
+        return false;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        std::string name = entry->d_name;
+        size_t ext = name.size() - std::strlen(CACHE_FILE_EXT);
+
+        if (name.compare(0, std::strlen(CACHE_TEMP_PREFIX), CACHE_TEMP_PREFIX) == 0 ||
+            (name.size() > std::strlen(CACHE_FILE_EXT) && name.compare(ext, std::string::npos, CACHE_FILE_EXT) == 0))
+            unlink((m_config.path() + "/" + name).c_str());
+    }
+    closedir(dir);
+    return true;
+}
+
+/*
+    Key of the response to `req`: its `Host`, path and query.
+ */
+std::string CacheZone::_key(const Request& req)
+{
+    StringView host = req.header(HEADER_HOST);
+    StringView path = req.path();
+    StringView query = req.query();
+
+    std::string key;
+    key.reserve(host.size() + path.size() + query.size() + 2);
+    key.append(host.data(), host.size());
+    key += ' ';
+    key.append(path.data(), path.size());
+    key += '?';
+    key.append(query.data(), query.size());
+    return key;
+}
+
+/*
+    Index of `key` in the zone (FNV-1a), which also names the file of its body.
+ */
+uint64_t CacheZone::_hash(const std::string& key)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < key.size(); i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+CacheStatus CacheZone::lookup(const Request& req, Response& response, CacheWriter *& writer)
+{
+    writer = NULL;
+    if (req.method() != GET || req.has_header(HEADER_AUTHORIZATION))
+        return CACHE_BYPASS;
+
+    CacheControl cc(req.header(HEADER_CACHE_CONTROL));
+    if (cc.no_store)
+        return CACHE_BYPASS;
+
+    std::string key = _key(req);
+    uint64_t hash = _hash(key);
+    std::map<uint64_t, Entry>::iterator it = m_entries.find(hash);
+
+    // The client asks for a response from the origin, which then replaces the stored one. A response stored
+    // under another key with the same hash is replaced as well.
+    if (cc.no_cache || req.header(HEADER_PRAGMA).equals_ignore_case("no-cache") || it == m_entries.end() ||
+        it->second.key != key)
+    {
+        writer = new CacheWriter(*this, key, hash, false);
+        return CACHE_MISS;
+    }
+
+    Entry& entry = it->second;
+    int64_t now = time();
+
+    // Too old to be served at all.
+    if (now >= entry.stale_until)
+    {
+        _erase(it);
+        writer = new CacheWriter(*this, key, hash, false);
+        return CACHE_MISS;
+    }
+
+    // The first request after the response expired refreshes it, the others get the stale one meanwhile.
+    if (now >= entry.expires && !entry.updating)
+    {
+        entry.updating = true;
+        writer = new CacheWriter(*this, key, hash, true);
+        return CACHE_MISS;
+    }
+
+    m_lru.splice(m_lru.begin(), m_lru, entry.lru);
+
+    response = Response::ok(entry.status, File::stream(_path(hash)));
+    response.remove_param("Content-Type");
+
+    size_t pos = 0;
+    while (pos < entry.lines.size())
+    {
+        size_t end = entry.lines.find(SEP, pos);
+        size_t colon = entry.lines.find(':', pos);
+        if (end == std::string::npos)
+            end = entry.lines.size();
+
+        if (colon < end)
+        {
+            std::string name = entry.lines.substr(pos, colon - pos);
+            if (!StringView(name).equals_ignore_case("Age"))
+                response.add_param(name, trim(entry.lines.substr(colon + 1, end - colon - 1)));
+        }
+        pos = end + 2;
+    }
+
+    response.add_param("Age", to_string((now - entry.stored) / 1000));
+    return CACHE_HIT;
+}
+
+std::string CacheZone::_path(uint64_t key) const
+{
+    std::string name = to_string(key, 16);
+    return m_config.path() + "/" + std::string(16 - name.size(), '0') + name + CACHE_FILE_EXT;
+}
+
+/*
+    Move the body written to `temp_path` to the file of `key` and index the response, the least recently used
+    ones are removed if the zone grows too large.
+ */
+bool CacheZone::_insert(uint64_t key, Entry& entry, const std::string& temp_path)
+{
+    std::string path = _path(key);
+
+    if (rename(temp_path.c_str(), path.c_str()) == -1)
+    {
+        ws::log << ws::err << "cannot rename `" << temp_path << "` to `" << path << "`: " << strerror(errno) << "\n";
+        std::map<uint64_t, Entry>::iterator it = m_entries.find(key);
+        if (it != m_entries.end())
+            _erase(it);
+        return false;
+    }
+
+    // The file of the previous response was replaced by the rename.
+    std::map<uint64_t, Entry>::iterator it = m_entries.find(key);
+    if (it != m_entries.end())
+    {
+        m_size -= it->second.body_size + it->second.lines.size();
+        m_lru.erase(it->second.lru);
+        m_entries.erase(it);
+    }
+
+    m_lru.push_front(key);
+    entry.lru = m_lru.begin();
+    m_entries[key] = entry;
+    m_size += entry.body_size + entry.lines.size();
+
+    while (m_size > m_config.max_size() && m_lru.back() != key)
+        _erase(m_entries.find(m_lru.back()));
+    return true;
+}
+
+void CacheZone::_erase(std::map<uint64_t, Entry>::iterator it)
+{
+    unlink(_path(it->first).c_str());
+    m_size -= it->second.body_size + it->second.lines.size();
+    m_lru.erase(it->second.lru);
+    m_entries.erase(it);
+}
+
+/*
+    The request refreshing the response of `key` is done, whether or not it stored a new one.
+ */
+void CacheZone::_unlock(uint64_t hash, const std::string& key)
+{
+    std::map<uint64_t, Entry>::iterator it = m_entries.find(hash);
+    if (it != m_entries.end() && it->second.key == key)
+        it->second.updating = false;
+}
+
+ProxyCache::ProxyCache()
+{
+}
+
+ProxyCache::~ProxyCache()
+{
+    for (std::map<std::string, CacheZone *>::iterator it = m_zones.begin(); it != m_zones.end(); it++)
+        delete it->second;
+}
+
+bool ProxyCache::build(Config& config)
+{
+    std::map<std::string, CacheZoneConfig>& zones = config.cache_zones();
+
+    for (std::map<std::string, CacheZoneConfig>::iterator it = zones.begin(); it != zones.end(); it++)
+    {
+        CacheZone *zone = new CacheZone(it->second);
+        m_zones[it->first] = zone;
+        if (!zone->init())
+            return false;
+    }
+    return true;
+}
+
+CacheZone *ProxyCache::find(const std::string& name)
+{
+    std::map<std::string, CacheZone *>::iterator it = m_zones.find(name);
+    return it == m_zones.end() ? NULL : it->second;
+}
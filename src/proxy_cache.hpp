@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include "config/config.hpp"
+#include "http/request.hpp"
+#include "http/response.hpp"
+#include "http/status.hpp"
+#include "string.hpp"
+
+enum CacheStatus
+{
+    /* The stored response was put in `response`, it is fresh or being refreshed by another request. */
+    CACHE_HIT,
+    /* The request has to be processed, and its response may be stored with the `CacheWriter` given. */
+    CACHE_MISS,
+    /* The request has to be processed, and its response must not be stored. */
+    CACHE_BYPASS,
+};
+
+class CacheZone;
+
+/*
+    A response being stored in a zone. Its body is written to a temporary file in the directory of the
+    zone, which is renamed to the file of the entry once complete. A writer which is destroyed before
+    `commit` leaves the zone unchanged.
+ */
+class CacheWriter
+{
+public:
+    /*
+        `refreshing` is whether the response replaces a stale one served to other requests meanwhile.
+     */
+    CacheWriter(CacheZone& zone, const std::string& key, uint64_t hash, bool refreshing);
+    ~CacheWriter();
+
+    /*
+        Start storing a response with status `status` and header lines `lines`, each one ended by `\r\n` and
+        without the ones describing the connection or the size of the body. `headers` are the same lines once
+        parsed. Returns `false` if the response must not be stored.
+     */
+    bool start(HttpStatus status, const Request& headers, StringView lines);
+
+    /*
+        Append to the body. Returns `false` if the body cannot be stored, the writer is then abandoned.
+     */
+    bool write(const char *data, size_t size);
+
+    /*
+        The whole body was written, the response replaces the one stored under the same key.
+     */
+    void commit();
+
+    /*
+        Store a response built in memory, such as the output of a CGI script.
+     */
+    void store(Response& response);
+
+private:
+    CacheZone& m_zone;
+    std::string m_key;
+    uint64_t m_hash;
+    bool m_refreshing;
+
+    HttpStatus m_status;
+    std::string m_lines;
+    int64_t m_stored;
+    int64_t m_expires;
+    int64_t m_stale_until;
+
+    std::string m_temp_path;
+    int m_fd;
+    size_t m_size;
+
+    void _abandon();
+
+    CacheWriter(const CacheWriter& other);
+    CacheWriter& operator=(const CacheWriter& other);
+};
+
+/*
+    Responses of the `proxy_cache` locations using a `proxy_cache_zone`.
+
+    Bodies are kept in files under the directory of the zone, so they live in the page cache and are sent
+    with `sendfile`, the kernel can take the memory back under pressure. Only the index stays in memory: the
+    status and header lines of each response with its freshness and key (the `Host`, path and query of the
+    request), by the hash of the key. Files left by a previous run are removed, since they are not in the index.
+
+    Responses are stored if they say for how long with `Cache-Control` (`s-maxage` or `max-age`) or
+    `Expires`, and are served until then. Once expired, a response with `stale-while-revalidate` is still
+    served during that time to all requests but the first one, which refreshes it. The least recently
+    used responses are removed once the zone is larger than `max_size`.
+ */
+class CacheZone
+{
+public:
+    CacheZone(const CacheZoneConfig& config);
+
+    /*
+        Create the directory of the zone if needed and remove the files it holds.
+     */
+    bool init();
+
+    /*
+        Look `req` up. On a miss `writer` is set to a new writer for the response, which the caller owns.
+     */
+    CacheStatus lookup(const Request& req, Response& response, CacheWriter *& writer);
+
+    const CacheZoneConfig& config() const
+    {
+        return m_config;
+    }
+
+private:
+    friend class CacheWriter;
+
+    struct Entry
+    {
+        /* The key itself, two keys may have the same hash. */
+        std::string key;
+        HttpStatus status;
+        std::string lines;
+        size_t body_size;
+        /* When the response was received, until when it is fresh, and until when it can be served stale. */
+        int64_t stored;
+        int64_t expires;
+        int64_t stale_until;
+        /* Whether a request is refreshing the response, the others are served the stale one meanwhile. */
+        bool updating;
+        std::list<uint64_t>::iterator lru;
+    };
+
+    CacheZoneConfig m_config;
+    std::map<uint64_t, Entry> m_entries;
+    /* Keys from the most to the least recently used. */
+    std::list<uint64_t> m_lru;
+    /* Total size of the stored responses. */
+    size_t m_size;
+
+    static std::string _key(const Request& req);
+    static uint64_t _hash(const std::string& key);
+    std::string _path(uint64_t key) const;
+    bool _insert(uint64_t key, Entry& entry, const std::string& temp_path);
+    void _erase(std::map<uint64_t, Entry>::iterator it);
+    void _unlock(uint64_t hash, const std::string& key);
+
+    CacheZone(const CacheZone& other);
+    CacheZone& operator=(const CacheZone& other);
+};
+
+/*
+    All `proxy_cache_zone` declarations of the configuration, by name.
+ */
+class ProxyCache
+{
+public:
+    ProxyCache();
+    ~ProxyCache();
+
+    /*
+        Returns `false` if the directory of a zone cannot be used.
+     */
+    bool build(Config& config);
+
+    /*
+        Returns the zone `name`, which exists for every `proxy_cache` of the configuration.
+     */
+    CacheZone *find(const std::string& name);
+
+private:
+    std::map<std::string, CacheZone *> m_zones;
+
+    ProxyCache(const ProxyCache& other);
+    ProxyCache& operator=(const ProxyCache& other);
+};
+
+extern ProxyCache g_proxy_cache;
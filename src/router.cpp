@@ -1,6 +1,6 @@
 #include <cctype>
 #include <cstddef>
-#include <fstream>
+#include <cstring>
 #include <ios>
 #include <iostream>
 #include <map>
@@ -15,6 +15,8 @@
 #include "http/response.hpp"
 #include "http/status.hpp"
 #include "logger.hpp"
+#include "negative_cache.hpp"
+#include "proxy_cache.hpp"
 #include "result.hpp"
 #include "router.hpp"
 #include "string.hpp"
@@ -82,14 +84,15 @@ static const std::string source =
 
 Router::Router(ServerConfig config) : m_config(config)
 {
+    m_trie.build(m_config.locations());
 }
 
-Response Router::_directory_listing(Request& req, Location& loc, std::string& path)
+Response Router::_directory_listing(Request& req, Location& loc, StringView path)
 {
     DIR *dir;
     struct dirent *entry;
 
-    if ((dir = opendir(path.c_str())) == NULL)
+    if ((dir = opendir(path.data())) == NULL)
     {
         ws::log << ws::err << "opendir() failed: " << strerror(errno) << "\n";
         return HTTP_ERROR(404, m_config);
@@ -109,7 +112,7 @@ Response Router::_directory_listing(Request& req, Location& loc, std::string& pa
 
         indexing += entry->d_name;
 
-        std::string filepath = path + "/" + entry->d_name;
+        std::string filepath = path.str() + "/" + entry->d_name;
 
         if (stat(filepath.c_str(), &sb) == -1)
         {
@@ -140,68 +143,13 @@ Response Router::_directory_listing(Request& req, Location& loc, std::string& pa
 
     std::string source2 = source;
     replace_all(source2, "#replace", indexing);
-    replace_all(source2, "#path", req.path());
+    replace_all(source2, "#path", req.path().str());
 
     closedir(dir);
     return Response::ok(200, File::memory(source2, File::mime_from_ext("html")));
 }
 
-void Router::_upload_files(Location& loc, Request& req)
-{
-    size_t i = 0;
-    const std::string& body = req.body();
-
-    size_t boundarySize = body.find(SEP);
-    std::string boundary = body.substr(i, boundarySize + 2);
-    std::string endBoundary = body.substr(i, boundarySize) + "--";
-
-    while (i != std::string::npos)
-    {
-        size_t headerStart = i + boundary.size();
-        size_t contentStart = body.find("\r\n\r\n", headerStart) + 4;
-
-        Request req = Request::parse_part(body.substr(headerStart, contentStart - headerStart)).unwrap();
-
-        std::string& contentDisp = req.get_param("Content-Disposition");
-        size_t filenameStart = contentDisp.find("filename=") + 10;
-        std::string filename = contentDisp.substr(
-            filenameStart, contentDisp.find('\"', contentDisp.find("filename=") + 10) - filenameStart);
-
-        size_t contentEnd = body.find(boundary, contentStart);
-        if (contentEnd == std::string::npos)
-            contentEnd = body.find(endBoundary, contentStart);
-
-        i = body.find(boundary, contentEnd);
-
-        std::string str = body.substr(contentStart, contentEnd - contentStart);
-        std::string filepath = loc.upload_dir().unwrap() + "/" + filename;
-
-        if (filename.empty())
-        {
-            continue;
-        }
-
-        if (access(filepath.c_str(), F_OK) != -1)
-        {
-            continue;
-        }
-
-        std::ofstream file(filepath.c_str(), std::ios_base::binary | std::ios_base::trunc);
-        file.write(str.data(), str.size());
-
-        if (contentEnd == std::string::npos)
-        {
-            // NOTE: Unreachable if the http request is correctly formatted.
-            break;
-        }
-        if (body.substr(contentEnd, 60) == endBoundary)
-        {
-            break;
-        }
-    }
-}
-
-Response Router::_route_with_location(Request& req, Location& loc)
+Response Router::_route_with_location(Request& req, Location& loc, Arena& arena)
 {
     Option<std::string> res = loc.redirect();
     if (res.is_some())
@@ -213,35 +161,51 @@ Response Router::_route_with_location(Request& req, Location& loc)
         return response;
     }
 
-    size_t n = 0;
-    for (std::vector<Method>::iterator it = loc.methods().begin(); it != loc.methods().end(); it++)
+    if (!loc.allows(req.method()))
+        return HTTP_ERROR(405, m_config); // Method not allowed
+
+    // Proxied requests are answered by the event loop as the upstream server responds, and subscribers get
+    // events as they are published, which is only done for HTTP/1.x connections.
+    if (loc.proxy_pass().is_some())
     {
-        if (*it == req.method())
-        {
-            n = 1;
-            break;
-        }
+        ws::log << ws::warn << "`proxy_pass` is not supported over HTTP/2\n";
+        return HTTP_ERROR(502, m_config);
+    }
+    if (loc.sse_channel().is_some())
+    {
+        ws::log << ws::warn << "`sse_channel` is not supported over HTTP/2\n";
+        return HTTP_ERROR(501, m_config); // Not Implemented
     }
 
-    if (n == 0)
-        return HTTP_ERROR(405, m_config); // Method not allowed
+    // `PUT` bodies are written to the `upload_dir` while they are received, the request only gets
+    // here if the location has none.
+    if (req.method() == PUT)
+        return HTTP_ERROR(403, m_config);
 
     if (loc.root().is_none())
     {
         return HTTP_ERROR(404, m_config);
     }
 
+    // Paths only live for the duration of the request, they are built in the connection's arena.
     struct stat sb;
-    std::string path = loc.root().unwrap() + "/" + req.path().substr(loc.route().size());
-    std::string final_path;
+    StringView path = arena.concat(loc.root().unwrap(), "/", req.path().substr(loc.route().size()));
+    StringView final_path;
+
+    if (g_negative_cache.contains(path))
+        return HTTP_ERROR(404, m_config);
 
-    if (stat(path.c_str(), &sb) == -1)
+    if (stat(path.data(), &sb) == -1)
+    {
+        if (errno == ENOENT || errno == ENOTDIR)
+            g_negative_cache.insert(path);
         return HTTP_ERROR(404, m_config);
+    }
 
     if (S_ISDIR(sb.st_mode))
     {
-        final_path = path + "/" + loc.default_page().unwrap_or("");
-        if (stat(final_path.c_str(), &sb) == -1)
+        final_path = arena.concat(path, "/", loc.default_page().is_some() ? loc.default_page().unwrap() : "");
+        if (stat(final_path.data(), &sb) == -1)
             final_path = path;
     }
     else
@@ -250,37 +214,39 @@ Response Router::_route_with_location(Request& req, Location& loc)
     if (req.method() == DELETE)
         return _delete_file(req, loc, path);
 
-    if (stat(final_path.c_str(), &sb) == -1)
+    if (stat(final_path.data(), &sb) == -1)
         return HTTP_ERROR(404, m_config);
     else if (S_ISDIR(sb.st_mode) && loc.indexing())
         return _directory_listing(req, loc, path);
 
-    if (req.method() == POST && req.get_param("Content-Type").find("multipart/form-data") == 0 &&
-        loc.upload_dir().is_some())
-    {
-        _upload_files(loc, req);
-    }
+    StringView ext = final_path.substr(final_path.rfind('.') + 1);
+    std::map<std::string, std::string>::iterator cgi_path = loc.cgis().begin();
 
-    std::string ext = final_path.substr(final_path.rfind('.') + 1);
-    n = 0;
+    while (cgi_path != loc.cgis().end() && StringView(cgi_path->first) != ext)
+        cgi_path++;
 
-    for (std::map<std::string, std::string>::iterator it = loc.cgis().begin(); it != loc.cgis().end(); it++)
+    if (cgi_path != loc.cgis().end())
     {
-        if (it->first == ext)
-        {
-            n = 1;
-            break;
-        }
-    }
-
-    if (n > 0)
-    {
-        CGI cgi(loc.cgis()[ext]);
-        Result<Response, HttpStatus> res = cgi.process(final_path, req, m_config.cgi_timeout(), req.body());
+        // The script is not run again while its stored output is fresh.
+        CacheZone *zone = loc.proxy_cache().is_some() ? g_proxy_cache.find(loc.proxy_cache().unwrap()) : NULL;
+        CacheWriter *cache = NULL;
+        Response cached;
+        if (zone && zone->lookup(req, cached, cache) == CACHE_HIT)
+            return cached;
+
+        CGI cgi(cgi_path->second);
+        Result<Response, HttpStatus> res = cgi.process(final_path.str(), req, m_config.cgi_timeout(), req.body());
         if (res.is_err())
+        {
+            delete cache;
             return HTTP_ERROR(res.unwrap_err(), m_config);
+        }
 
-        return res.unwrap();
+        Response response = res.unwrap();
+        if (cache)
+            cache->store(response);
+        delete cache;
+        return response;
     }
     else
     {
@@ -288,45 +254,34 @@ Response Router::_route_with_location(Request& req, Location& loc)
     }
 }
 
-Response Router::_delete_file(Request& req, Location& loc, std::string& path)
+Response Router::_delete_file(Request& req, Location& loc, StringView path)
 {
     (void)req;
-    if (access(path.c_str(), F_OK | R_OK) == -1)
+    if (access(path.data(), F_OK | R_OK) == -1)
         return HTTP_ERROR(404, m_config);
-    if (unlink(path.c_str()) == -1)
+    if (unlink(path.data()) == -1)
     {
         ws::log << ws::err << "Cannot delete file " << loc.root().unwrap() << "/" << path << ": " << strerror(errno)
-                << "\n ";
+                << "\n";
         return HTTP_ERROR(500, m_config);
     }
     return HTTP_ERROR(200, m_config);
 }
 
-Response Router::route(Request& req)
+Location *Router::match(StringView path)
 {
-    std::string& path = req.path();
-
-    if (m_config.locations().size() == 0)
-        return HTTP_ERROR(404, m_config);
+    long index = m_trie.match(path);
 
-    Location best_match_loc = m_config.locations()[0];
-    size_t best_match = -1;
-
-    // std::cout << m_config.locations()[0].route() << ", " << m_config.locations()[1].route() << "\n";
+    if (index == -1)
+        return NULL;
+    return &m_config.locations()[index];
+}
 
-    for (std::vector<Location>::iterator it = m_config.locations().begin(); it != m_config.locations().end(); it++)
-    {
-        Location& location = *it;
-        if (path.find(location.route()) == 0 && (best_match == (size_t)-1 || location.route().size() > best_match))
-        {
-            best_match = location.route().size();
-            best_match_loc = location;
-        }
-    }
+Response Router::route(Request& req, Arena& arena)
+{
+    Location *loc = match(req.path());
 
-    if (path.find(best_match_loc.route()) == 0)
-    {
-        return _route_with_location(req, best_match_loc);
-    }
-    return HTTP_ERROR(404, m_config);
+    if (loc == NULL)
+        return HTTP_ERROR(404, m_config);
+    return _route_with_location(req, *loc, arena);
 }
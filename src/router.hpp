@@ -2,10 +2,12 @@
 
 #include <map>
 
+#include "arena.hpp"
 #include "cgi/cgi.hpp"
 #include "config/config.hpp"
 #include "http/request.hpp"
 #include "http/response.hpp"
+#include "location_trie.hpp"
 
 class Router
 {
@@ -17,16 +19,22 @@ public:
     Router(ServerConfig config);
 
     /*
-        Take the path of the request and return the access to a file.
+        Take the path of the request and return the access to a file. Temporary data is allocated
+        in `arena`.
     */
-    Response route(Request& req);
+    Response route(Request& req, Arena& arena);
+
+    /*
+        Returns the location with the longest route matching `path`, or `NULL` if there is none.
+     */
+    Location *match(StringView path);
 
 private:
     std::map<std::string, CGI> m_cgis;
     ServerConfig m_config;
+    LocationTrie m_trie;
 
-    Response _route_with_location(Request& req, Location& loc);
-    Response _directory_listing(Request& req, Location& loc, std::string& path);
-    Response _delete_file(Request& req, Location& loc, std::string& path);
-    void _upload_files(Location& loc, Request& req);
+    Response _route_with_location(Request& req, Location& loc, Arena& arena);
+    Response _directory_listing(Request& req, Location& loc, StringView path);
+    Response _delete_file(Request& req, Location& loc, StringView path);
 };
@@ -1,14 +1,16 @@
+#include <cerrno>
 #include <cstring>
 #include <netinet/in.h>
 
 #include "logger.hpp"
 #include "server.hpp"
 
-Server::Server() : m_sock_fd(-1)
+Server::Server() : m_sock_fd(-1), m_ssl(false), m_default(0), m_has_explicit_default(false)
 {
 }
 
-Server::Server(struct sockaddr_in addr) : m_addr(addr)
+Server::Server(struct sockaddr_in addr, bool ssl)
+    : m_addr(addr), m_ssl(ssl), m_default(0), m_has_explicit_default(false)
 {
     m_sock_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (m_sock_fd == -1)
@@ -39,3 +41,55 @@ int Server::sock_fd()
 {
     return m_sock_fd;
 }
+
+bool Server::add_host(std::string name, ServerConfig config, SSL_CTX *ssl_ctx)
+{
+    if (!m_names.insert(name, m_hosts.size()))
+    {
+        SSL_CTX_free(ssl_ctx);
+        return false;
+    }
+
+    if (config.default_server())
+    {
+        if (m_has_explicit_default)
+            ws::log << ws::warn << "Multiple `default_server` on the same address, keeping the first one\n";
+        else
+        {
+            m_default = m_hosts.size();
+            m_has_explicit_default = true;
+        }
+    }
+
+    m_hosts.push_back(Host(config, ssl_ctx));
+    return true;
+}
+
+Host& Server::resolve(StringView host_header)
+{
+    const char *name = host_header.data();
+    size_t size = host_header.size();
+
+    // Strip the port, taking care of IPv6 literals such as `[::1]:8080`.
+    if (size > 0 && name[0] == '[')
+    {
+        size_t end = host_header.find(']');
+        if (end != StringView::npos)
+            size = end + 1;
+    }
+    else
+    {
+        size_t colon = host_header.find(':');
+        if (colon != StringView::npos)
+            size = colon;
+    }
+
+    // A fully qualified name may end with a dot.
+    if (size > 0 && name[size - 1] == '.')
+        size--;
+
+    long index = m_names.find(name, size);
+    if (index == -1)
+        return default_host();
+    return m_hosts[index];
+}
@@ -1,22 +1,51 @@
 #pragma once
 
 #include <iostream>
-#include <map>
+#include <openssl/ssl.h>
+#include <vector>
 
 #include "config/config.hpp"
+#include "host_table.hpp"
 #include "router.hpp"
+#include "string.hpp"
 
 class Host
 {
 public:
-    Host()
+    Host() : m_ssl_ctx(NULL)
     {
     }
 
-    Host(ServerConfig config) : m_config(config), m_router(config)
+    /*
+        The host takes ownership of `ssl_ctx`, which is `NULL` unless it listens with `ssl`.
+     */
+    Host(ServerConfig config, SSL_CTX *ssl_ctx) : m_config(config), m_router(config), m_ssl_ctx(ssl_ctx)
     {
     }
 
+    Host(const Host& other) : m_config(other.m_config), m_router(other.m_router), m_ssl_ctx(other.m_ssl_ctx)
+    {
+        if (m_ssl_ctx)
+            SSL_CTX_up_ref(m_ssl_ctx);
+    }
+
+    ~Host()
+    {
+        SSL_CTX_free(m_ssl_ctx);
+    }
+
+    Host& operator=(const Host& other)
+    {
+        if (other.m_ssl_ctx)
+            SSL_CTX_up_ref(other.m_ssl_ctx);
+        SSL_CTX_free(m_ssl_ctx);
+
+        m_config = other.m_config;
+        m_router = other.m_router;
+        m_ssl_ctx = other.m_ssl_ctx;
+        return *this;
+    }
+
     ServerConfig& config()
     {
         return m_config;
@@ -27,16 +56,25 @@ public:
         return m_router;
     }
 
+    /*
+        Context holding the certificate of the host.
+     */
+    SSL_CTX *ssl_ctx()
+    {
+        return m_ssl_ctx;
+    }
+
 private:
     ServerConfig m_config;
     Router m_router;
+    SSL_CTX *m_ssl_ctx;
 };
 
 class Server
 {
 public:
     Server();
-    Server(struct sockaddr_in addr);
+    Server(struct sockaddr_in addr, bool ssl);
     ~Server();
 
     int sock_fd();
@@ -46,28 +84,41 @@ public:
         return m_addr;
     }
 
-    bool has_host(std::string& host)
-    {
-        return m_hosts.count(host) > 0;
-    }
-
+    /*
+        Returns the host explicitly marked as `default_server`, or the first one declared.
+     */
     Host& default_host()
     {
-        return m_hosts.begin()->second;
+        return m_hosts[m_default];
     }
 
-    Host& host(std::string host)
+    /*
+        Whether connections start with a TLS handshake.
+     */
+    bool ssl() const
     {
-        return m_hosts[host];
+        return m_ssl;
     }
 
-    void add_host(std::string host, ServerConfig config)
-    {
-        m_hosts[host] = Host(config);
-    }
+    /*
+        Register a new host for this listener, returns `false` if its name is already taken. The
+        host takes ownership of `ssl_ctx`.
+     */
+    bool add_host(std::string name, ServerConfig config, SSL_CTX *ssl_ctx);
+
+    /*
+        Find the host matching the value of a `Host` header, the port is ignored. Falls back to the
+        default host when nothing matches.
+     */
+    Host& resolve(StringView host_header);
 
 public:
     int m_sock_fd;
     struct sockaddr_in m_addr;
-    std::map<std::string, Host> m_hosts;
+    bool m_ssl;
+
+    std::vector<Host> m_hosts;
+    HostTable m_names;
+    size_t m_default;
+    bool m_has_explicit_default;
 };
@@ -0,0 +1,92 @@
+#include "sse.hpp"
+
+SseHub g_sse_hub;
+
+SseChannel::SseChannel(const std::string& name) : m_name(name), m_next_id(1), m_backlog(SSE_BACKLOG)
+{
+}
+
+SharedBuffer SseChannel::publish(StringView type, StringView data)
+{
+    uint64_t id = m_next_id++;
+
+    std::string event;
+    event.reserve(data.size() + type.size() + 32);
+    event += "id: " + to_string(id) + "\n";
+    if (!type.empty())
+    {
+        event += "event: ";
+        event.append(type.data(), type.size());
+        event += '\n';
+    }
+
+    // Each line of the data is a `data` field, the client joins them back with `\n`.
+    size_t pos = 0;
+    while (true)
+    {
+        size_t end = pos;
+        while (end < data.size() && data[end] != '\r' && data[end] != '\n')
+            end++;
+
+        event += "data: ";
+        event.append(data.data() + pos, end - pos);
+        event += '\n';
+
+        if (end == data.size())
+            break;
+        if (data[end] == '\r' && end + 1 < data.size() && data[end + 1] == '\n')
+            end++;
+        pos = end + 1;
+    }
+    event += '\n';
+
+    SharedBuffer buffer(event);
+    m_backlog[id % SSE_BACKLOG] = buffer;
+    return buffer;
+}
+
+void SseChannel::replay(uint64_t last_id, OutputQueue& out) const
+{
+    uint64_t id = m_next_id > SSE_BACKLOG ? m_next_id - SSE_BACKLOG : 1;
+    if (last_id >= id)
+        id = last_id + 1;
+
+    for (; id < m_next_id; id++)
+        out.push(m_backlog[id % SSE_BACKLOG]);
+}
+
+SseHub::SseHub()
+{
+}
+
+SseHub::~SseHub()
+{
+    for (std::map<std::string, SseChannel *>::iterator it = m_channels.begin(); it != m_channels.end(); it++)
+        delete it->second;
+}
+
+void SseHub::build(Config& config)
+{
+    std::vector<ServerConfig>& servers = config.servers();
+
+    for (size_t i = 0; i < servers.size(); i++)
+    {
+        std::vector<Location>& locations = servers[i].locations();
+
+        for (size_t j = 0; j < locations.size(); j++)
+        {
+            if (locations[j].sse_channel().is_none())
+                continue;
+
+            const std::string& name = locations[j].sse_channel().unwrap();
+            if (!m_channels.count(name))
+                m_channels[name] = new SseChannel(name);
+        }
+    }
+}
+
+SseChannel *SseHub::find(const std::string& name)
+{
+    std::map<std::string, SseChannel *>::iterator it = m_channels.find(name);
+    return it == m_channels.end() ? NULL : it->second;
+}
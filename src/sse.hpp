@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+#include "config/config.hpp"
+#include "output_queue.hpp"
+#include "string.hpp"
+
+/* Events kept by a channel for the subscribers which reconnect with a `Last-Event-ID`. */
+#define SSE_BACKLOG 64
+
+class Connection;
+
+/*
+    A stream of Server-Sent Events (`sse_channel`), published with `POST` and sent to every connection
+    which subscribed with `GET`.
+
+    Each event is encoded once, and the same buffer is queued to the output of every subscriber, so it
+    is shared instead of copied. Events get increasing ids, and the last `SSE_BACKLOG` ones are sent
+    again to a client reconnecting with the id of the last event it received.
+ */
+class SseChannel
+{
+public:
+    SseChannel(const std::string& name);
+
+    const std::string& name() const
+    {
+        return m_name;
+    }
+
+    /*
+        Encode an event of type `type`, the default one if it is empty, with `data` as its lines.
+     */
+    SharedBuffer publish(StringView type, StringView data);
+
+    /*
+        Queue the events published after the one with id `last_id` which are still in the backlog.
+     */
+    void replay(uint64_t last_id, OutputQueue& out) const;
+
+    void subscribe(Connection& conn)
+    {
+        m_subscribers.insert(&conn);
+    }
+
+    void unsubscribe(Connection& conn)
+    {
+        m_subscribers.erase(&conn);
+    }
+
+    const std::set<Connection *>& subscribers() const
+    {
+        return m_subscribers;
+    }
+
+private:
+    std::string m_name;
+    uint64_t m_next_id;
+    /* The last events, the one with id `i` is at `i % SSE_BACKLOG`. */
+    std::vector<SharedBuffer> m_backlog;
+    std::set<Connection *> m_subscribers;
+
+    SseChannel(const SseChannel& other);
+    SseChannel& operator=(const SseChannel& other);
+};
+
+/*
+    All the channels named by `sse_channel` locations.
+ */
+class SseHub
+{
+public:
+    SseHub();
+    ~SseHub();
+
+    void build(Config& config);
+
+    /*
+        Returns the channel `name`, which exists for every `sse_channel` of the configuration.
+     */
+    SseChannel *find(const std::string& name);
+
+private:
+    std::map<std::string, SseChannel *> m_channels;
+
+    SseHub(const SseHub& other);
+    SseHub& operator=(const SseHub& other);
+};
+
+extern SseHub g_sse_hub;
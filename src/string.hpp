@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cctype>
+#include <cstring>
 #include <ios>
 #include <netinet/in.h>
 #include <ostream>
@@ -85,3 +87,132 @@ inline void replace_all(std::string& src, std::string from, std::string to)
     while ((i = src.find(from)) != std::string::npos)
         src.replace(i, from.size(), to);
 }
+
+/*
+    Non-owning view of a sequence of characters, similar to C++17's `std::string_view`. The viewed
+    memory must outlive the view.
+ */
+class StringView
+{
+public:
+    static const size_t npos = (size_t)-1;
+
+    StringView() : m_data(""), m_size(0)
+    {
+    }
+
+    StringView(const char *data, size_t size) : m_data(data), m_size(size)
+    {
+    }
+
+    StringView(const char *s) : m_data(s), m_size(std::strlen(s))
+    {
+    }
+
+    StringView(const std::string& s) : m_data(s.data()), m_size(s.size())
+    {
+    }
+
+    const char *data() const
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    char operator[](size_t i) const
+    {
+        return m_data[i];
+    }
+
+    std::string str() const
+    {
+        return std::string(m_data, m_size);
+    }
+
+    StringView substr(size_t pos, size_t n = npos) const
+    {
+        if (pos > m_size)
+            pos = m_size;
+        if (n > m_size - pos)
+            n = m_size - pos;
+        return StringView(m_data + pos, n);
+    }
+
+    size_t find(char c, size_t pos = 0) const
+    {
+        if (pos >= m_size)
+            return npos;
+
+        const void *p = std::memchr(m_data + pos, c, m_size - pos);
+        return p ? (const char *)p - m_data : npos;
+    }
+
+    size_t find(StringView s, size_t pos = 0) const
+    {
+        if (s.m_size == 0)
+            return pos <= m_size ? pos : npos;
+
+        while (pos + s.m_size <= m_size)
+        {
+            pos = find(s.m_data[0], pos);
+            if (pos == npos || pos + s.m_size > m_size)
+                return npos;
+            if (std::memcmp(m_data + pos, s.m_data, s.m_size) == 0)
+                return pos;
+            pos++;
+        }
+        return npos;
+    }
+
+    size_t rfind(char c) const
+    {
+        for (size_t i = m_size; i > 0; i--)
+            if (m_data[i - 1] == c)
+                return i - 1;
+        return npos;
+    }
+
+    bool starts_with(StringView s) const
+    {
+        return m_size >= s.m_size && std::memcmp(m_data, s.m_data, s.m_size) == 0;
+    }
+
+    bool equals_ignore_case(StringView other) const
+    {
+        if (m_size != other.m_size)
+            return false;
+
+        for (size_t i = 0; i < m_size; i++)
+            if (std::tolower((unsigned char)m_data[i]) != std::tolower((unsigned char)other.m_data[i]))
+                return false;
+        return true;
+    }
+
+    bool operator==(StringView other) const
+    {
+        return m_size == other.m_size && std::memcmp(m_data, other.m_data, m_size) == 0;
+    }
+
+    bool operator!=(StringView other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    const char *m_data;
+    size_t m_size;
+};
+
+inline std::ostream& operator<<(std::ostream& os, StringView const& s)
+{
+    return os.write(s.data(), s.size());
+}
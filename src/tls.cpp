@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <openssl/err.h>
+#include <openssl/rand.h>
+
+#include "logger.hpp"
+#include "server.hpp"
+#include "tls.hpp"
+
+static unsigned char g_ticket_keys[TLS_TICKET_KEYS_SIZE];
+
+/*
+    Returns the errors queued by OpenSSL, oldest first.
+ */
+static std::string _errors()
+{
+    std::string errors;
+    unsigned long code;
+
+    while ((code = ERR_get_error()) != 0)
+    {
+        char buf[256];
+        ERR_error_string_n(code, buf, sizeof(buf));
+        errors += errors.empty() ? "" : ", ";
+        errors += buf;
+    }
+    return errors.empty() ? "unknown error" : errors;
+}
+
+/*
+    Present the certificate of the host the client asked for, the request itself is still routed
+    with its `Host` header.
+ */
+static int _on_servername(SSL *ssl, int *alert, void *arg)
+{
+    (void)alert;
+    (void)arg;
+
+    const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!name)
+        return SSL_TLSEXT_ERR_OK;
+
+    Server *server = (Server *)SSL_get_app_data(ssl);
+    SSL_CTX *ctx = server->resolve(name).ssl_ctx();
+
+    if (ctx && ctx != SSL_get_SSL_CTX(ssl))
+        SSL_set_SSL_CTX(ssl, ctx);
+    return SSL_TLSEXT_ERR_OK;
+}
+
+/*
+    Prefer HTTP/2 when the client supports it, unless the host has `proxy_pass` or `sse_channel` locations
+    which are not served over HTTP/2.
+ */
+static int _on_alpn(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in,
+                    unsigned int inlen, void *arg)
+{
+    static const unsigned char h2[] = "\x02h2\x08http/1.1";
+    static const unsigned char http11[] = "\x08http/1.1";
+
+    (void)arg;
+
+    const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    Server *server = (Server *)SSL_get_app_data(ssl);
+    Host& host = name ? server->resolve(name) : server->default_host();
+
+    bool http1 = host.config().http1_only();
+    const unsigned char *protocols = http1 ? http11 : h2;
+    unsigned int size = http1 ? sizeof(http11) - 1 : sizeof(h2) - 1;
+
+    if (SSL_select_next_proto((unsigned char **)out, outlen, protocols, size, in, inlen) !=
+        OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+void Tls::_build_ticket_keys()
+{
+    if (RAND_bytes(g_ticket_keys, sizeof(g_ticket_keys)) != 1)
+        ws::log << ws::warn << "cannot generate the session ticket keys: " << _errors() << "\n";
+}
+
+SSL_CTX *Tls::create_context(const std::string& certificate, const std::string& key)
+{
+    static const unsigned char session_id_context[] = "webserv";
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+    {
+        ws::log << ws::err << "cannot create a TLS context: " << _errors() << "\n";
+        return NULL;
+    }
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, certificate.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key.c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1)
+    {
+        ws::log << ws::err << "cannot load the certificate `" << certificate << "` and key `" << key
+                << "`: " << _errors() << "\n";
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    // Writes are retried with the output queue they came from, which may have grown in the meantime.
+    // Idle keep-alive connections give their record buffers back.
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                              SSL_MODE_RELEASE_BUFFERS);
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_IGNORE_UNEXPECTED_EOF | SSL_OP_NO_RENEGOTIATION |
+                                 SSL_OP_CIPHER_SERVER_PREFERENCE);
+
+    // Sessions started with any context can be resumed with any other, by ticket or by id.
+    SSL_CTX_set_session_id_context(ctx, session_id_context, sizeof(session_id_context) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_tlsext_ticket_keys(ctx, g_ticket_keys, sizeof(g_ticket_keys));
+
+    SSL_CTX_set_tlsext_servername_callback(ctx, _on_servername);
+    SSL_CTX_set_alpn_select_cb(ctx, _on_alpn, NULL);
+    return ctx;
+}
+
+Tls *Tls::accept(Server& server, int fd)
+{
+    SSL *ssl = SSL_new(server.default_host().ssl_ctx());
+    if (!ssl || SSL_set_fd(ssl, fd) != 1)
+    {
+        ws::log << ws::err << "cannot start a TLS connection: " << _errors() << "\n";
+        SSL_free(ssl);
+        return NULL;
+    }
+
+    SSL_set_accept_state(ssl);
+    SSL_set_app_data(ssl, &server);
+    return new Tls(ssl);
+}
+
+Tls::Tls(SSL *ssl) : m_ssl(ssl), m_established(false), m_ktls(false), m_failed(false)
+{
+}
+
+Tls::~Tls()
+{
+    SSL_free(m_ssl);
+}
+
+HandshakeStatus Tls::handshake()
+{
+    ERR_clear_error();
+    int ret = SSL_do_handshake(m_ssl);
+
+    if (ret == 1)
+    {
+        m_established = true;
+        m_ktls = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+        return HANDSHAKE_DONE;
+    }
+
+    switch (SSL_get_error(m_ssl, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+        return HANDSHAKE_WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+        return HANDSHAKE_WANT_WRITE;
+    default:
+        // Scanners and clients which do not trust the certificate end up here, it is not our error.
+        ws::log << ws::dbg << "TLS handshake failed: " << _errors() << "\n";
+        m_failed = true;
+        return HANDSHAKE_ERROR;
+    }
+}
+
+StringView Tls::alpn() const
+{
+    const unsigned char *protocol;
+    unsigned int size;
+
+    SSL_get0_alpn_selected(m_ssl, &protocol, &size);
+    return StringView((const char *)protocol, size);
+}
+
+ssize_t Tls::read(char *data, size_t size)
+{
+    size_t total = 0;
+
+    // Without read-ahead, OpenSSL only takes the next record from the socket. Since a whole record always
+    // fits, nothing is left inside OpenSSL where `epoll` would not see it.
+    while (size - total >= TLS_RECORD_SIZE)
+    {
+        ERR_clear_error();
+        int n = SSL_read(m_ssl, data + total, (int)std::min(size - total, (size_t)INT_MAX));
+
+        if (n <= 0)
+            return total > 0 ? (ssize_t)total : _fail(n);
+        total += n;
+    }
+    return total;
+}
+
+ssize_t Tls::write(const char *data, size_t size)
+{
+    ERR_clear_error();
+    int n = SSL_write(m_ssl, data, (int)std::min(size, (size_t)INT_MAX));
+    return n > 0 ? n : _fail(n);
+}
+
+ssize_t Tls::sendfile(int fd, off_t offset, size_t size)
+{
+    ERR_clear_error();
+    ossl_ssize_t n = SSL_sendfile(m_ssl, fd, offset, size, 0);
+    return n >= 0 ? n : _fail(n);
+}
+
+void Tls::shutdown()
+{
+    // OpenSSL must not send anything more after a fatal error.
+    if (!m_established || m_failed)
+        return;
+
+    ERR_clear_error();
+    SSL_shutdown(m_ssl);
+}
+
+ssize_t Tls::_fail(int ret)
+{
+    switch (SSL_get_error(m_ssl, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+
+    case SSL_ERROR_SYSCALL:
+        m_failed = true;
+        if (errno == 0)
+            errno = EPIPE;
+        return -1;
+
+    default:
+        ws::log << ws::dbg << "TLS error: " << _errors() << "\n";
+        m_failed = true;
+        errno = EPROTO;
+        return -1;
+    }
+}
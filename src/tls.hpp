@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <openssl/ssl.h>
+#include <string>
+#include <sys/types.h>
+
+#include "string.hpp"
+
+/* Largest plaintext carried by a TLS record. */
+#define TLS_RECORD_SIZE 16384
+/* Size of the keys protecting session tickets: name, HMAC secret and AES key. */
+#define TLS_TICKET_KEYS_SIZE 80
+
+class Server;
+
+enum HandshakeStatus
+{
+    HANDSHAKE_DONE,
+    HANDSHAKE_WANT_READ,
+    HANDSHAKE_WANT_WRITE,
+    HANDSHAKE_ERROR,
+};
+
+/*
+    Server side of a TLS connection on a non-blocking socket.
+
+    `read`, `write` and `sendfile` behave like their system call counterparts: they return `-1` with
+    `errno` set to `EAGAIN` when the socket is not ready, and `read` returns `0` once the peer closed
+    the connection.
+ */
+class Tls
+{
+public:
+    ~Tls();
+
+    /*
+        Generate the keys protecting session tickets. They are shared by all contexts, so a session
+        can be resumed on any listener and host.
+     */
+    static void _build_ticket_keys();
+
+    /*
+        Create the context of a certificate, errors are logged and `NULL` is returned.
+     */
+    static SSL_CTX *create_context(const std::string& certificate, const std::string& key);
+
+    /*
+        Start the handshake of a connection accepted by `server`. The certificate of the default host
+        is presented unless the client asks for another host with SNI.
+     */
+    static Tls *accept(Server& server, int fd);
+
+    HandshakeStatus handshake();
+
+    bool established() const
+    {
+        return m_established;
+    }
+
+    /*
+        Whether records are encrypted by the kernel, files can then be sent with `sendfile`.
+     */
+    bool ktls() const
+    {
+        return m_ktls;
+    }
+
+    /*
+        Protocol agreed on with ALPN, empty if the client did not ask for one.
+     */
+    StringView alpn() const;
+
+    /*
+        Read as many records as fit in `size` bytes, which must be at least `TLS_RECORD_SIZE`. Records
+        are read from the socket one at a time, so nothing is left buffered once the space is used.
+     */
+    ssize_t read(char *data, size_t size);
+
+    ssize_t write(const char *data, size_t size);
+    ssize_t sendfile(int fd, off_t offset, size_t size);
+
+    /*
+        Send a `close_notify` if the socket accepts it, the connection is closed anyway.
+     */
+    void shutdown();
+
+private:
+    SSL *m_ssl;
+    bool m_established;
+    bool m_ktls;
+    /* Set after a fatal error, nothing can be sent anymore. */
+    bool m_failed;
+
+    Tls(SSL *ssl);
+
+    ssize_t _fail(int ret);
+
+    Tls(const Tls& other);
+    Tls& operator=(const Tls& other);
+};
@@ -0,0 +1,201 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "connection.hpp"
+#include "logger.hpp"
+#include "tunnel.hpp"
+
+Tunnel::Tunnel(Upstream& upstream, Backend& backend, int fd)
+    : m_upstream(&upstream), m_backend(&backend), m_fd(fd), m_events((uint32_t)-1), m_up_size(0), m_down_size(0),
+      m_up_offset(0), m_client_closed(false), m_server_closed(false), m_up_total(0), m_down_total(0)
+{
+    m_up[0] = m_up[1] = -1;
+    m_down[0] = m_down[1] = -1;
+}
+
+Tunnel::~Tunnel()
+{
+    ws::log << ws::dbg << "tunnel to upstream `" << server() << "` closed after " << m_up_total << " bytes sent and "
+            << m_down_total << " received\n";
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        if (m_up[i] != -1)
+            close(m_up[i]);
+        if (m_down[i] != -1)
+            close(m_down[i]);
+    }
+    close(m_fd);
+    m_upstream->finish(*m_backend);
+}
+
+bool Tunnel::init(bool tls)
+{
+    if (tls)
+    {
+        m_up_buffer.resize(TUNNEL_PIPE_SIZE);
+        m_down_buffer.resize(TUNNEL_PIPE_SIZE);
+        return true;
+    }
+
+    if (pipe(m_up) == -1 || pipe(m_down) == -1)
+    {
+        ws::log << ws::err << "pipe() failed: " << strerror(errno) << "\n";
+        return false;
+    }
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        fcntl(m_up[i], F_SETFD, FD_CLOEXEC);
+        fcntl(m_down[i], F_SETFD, FD_CLOEXEC);
+    }
+    fcntl(m_up[1], F_SETPIPE_SZ, TUNNEL_PIPE_SIZE);
+    fcntl(m_down[1], F_SETPIPE_SZ, TUNNEL_PIPE_SIZE);
+    return true;
+}
+
+/*
+    Move at most `size` bytes from the pipe to the socket `to`. Returns `false` on error, a full socket is
+    not one.
+ */
+static bool _drain(int pipe, int to, size_t& size, uint64_t& total)
+{
+    ssize_t n = splice(pipe, NULL, to, NULL, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n == -1)
+        return errno == EAGAIN;
+
+    size -= n;
+    total += n;
+    return true;
+}
+
+/*
+    Pass what the socket `from` sent on to the socket `to` through `pipe`, which holds `size` bytes not
+    written yet. `closed` is set once `from` closed the connection.
+ */
+static bool _splice(int from, int pipe[2], int to, size_t& size, bool& closed, uint64_t& total)
+{
+    // What was read before goes first, the side is not read again until the other one took all of it.
+    if (size > 0 && !_drain(pipe[0], to, size, total))
+        return false;
+    if (size > 0 || closed)
+        return true;
+
+    ssize_t n = splice(from, NULL, pipe[1], NULL, TUNNEL_PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n == -1)
+        return errno == EAGAIN;
+    if (n == 0)
+    {
+        closed = true;
+        return true;
+    }
+
+    size = n;
+    return _drain(pipe[0], to, size, total);
+}
+
+TunnelStatus Tunnel::relay(Connection& conn)
+{
+    // The response switching protocols, and what the server sent right after it, reach the client before
+    // anything else the server sends.
+    FlushStatus status = conn.output().empty() ? FLUSH_DONE : conn.flush();
+    if (status == FLUSH_ERROR)
+        return TUNNEL_ERROR;
+
+    bool ok;
+    if (conn.tls())
+        ok = (status == FLUSH_AGAIN || _copy_down(conn)) && _copy_up(conn);
+    else
+        ok = (status == FLUSH_AGAIN || _splice(m_fd, m_down, conn.fd(), m_down_size, m_server_closed, m_down_total)) &&
+             _splice(conn.fd(), m_up, m_fd, m_up_size, m_client_closed, m_up_total);
+    if (!ok)
+        return TUNNEL_ERROR;
+
+    if ((m_server_closed && m_down_size == 0 && conn.output().empty()) || (m_client_closed && m_up_size == 0))
+        return TUNNEL_DONE;
+    return TUNNEL_AGAIN;
+}
+
+/*
+    Write what the client sent and the server did not take yet.
+ */
+bool Tunnel::_send_up()
+{
+    ssize_t n = send(m_fd, &m_up_buffer[m_up_offset], m_up_size, MSG_NOSIGNAL);
+    if (n == -1)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+
+    m_up_offset += n;
+    m_up_size -= n;
+    m_up_total += n;
+    return true;
+}
+
+bool Tunnel::_copy_up(Connection& conn)
+{
+    if (m_up_size > 0 && !_send_up())
+        return false;
+    if (m_up_size > 0 || m_client_closed)
+        return true;
+
+    ssize_t n = conn.receive(&m_up_buffer[0], m_up_buffer.size());
+    if (n == -1)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (n == 0)
+    {
+        m_client_closed = true;
+        return true;
+    }
+
+    m_up_offset = 0;
+    m_up_size = n;
+    return _send_up();
+}
+
+bool Tunnel::_copy_down(Connection& conn)
+{
+    if (m_server_closed)
+        return true;
+
+    ssize_t n = recv(m_fd, &m_down_buffer[0], m_down_buffer.size(), 0);
+    if (n == -1)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (n == 0)
+    {
+        m_server_closed = true;
+        return true;
+    }
+
+    m_down_total += n;
+    conn.output().push(SharedBuffer(std::string(&m_down_buffer[0], n)));
+    return conn.flush() != FLUSH_ERROR;
+}
+
+bool Tunnel::watch(Poller& poller, Connection& conn)
+{
+    bool writing = m_down_size > 0 || !conn.output().empty();
+    uint32_t client = 0;
+    uint32_t upstream = 0;
+
+    if (m_up_size == 0 && !m_client_closed)
+        client |= EPOLLIN;
+    if (writing)
+        client |= EPOLLOUT;
+    if (!writing && !m_server_closed)
+        upstream |= EPOLLIN;
+    if (m_up_size > 0)
+        upstream |= EPOLLOUT;
+
+    if (!conn.watch(poller, client))
+        return false;
+    if (upstream == m_events)
+        return true;
+
+    if (!poller.modify(m_fd, upstream))
+        return false;
+    m_events = upstream;
+    return true;
+}
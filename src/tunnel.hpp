@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "poller.hpp"
+#include "upstream.hpp"
+
+/* Size requested for each pipe of a tunnel, and most bytes moved at once in each direction. */
+#define TUNNEL_PIPE_SIZE (64 * 1024)
+
+class Connection;
+
+enum TunnelStatus
+{
+    TUNNEL_AGAIN,
+    /* One side closed the connection and what it sent before was passed on. */
+    TUNNEL_DONE,
+    TUNNEL_ERROR,
+};
+
+/*
+    Bytes relayed both ways between a client and an upstream server, once the server accepted to switch
+    the connection to another protocol (`Upgrade: websocket`). The frames are not looked at, each side
+    reads what the other sent as if they were connected directly.
+
+    On plain connections the bytes go from one socket to the other with `splice` through a pipe for each
+    direction, and are never copied to user space. A TLS connection has to be decrypted first, so what
+    the client sends is read into a buffer, and what the server sends is queued in the output of the
+    connection.
+
+    A side is not read while what it sent before waits for the other one to take it. The tunnel ends
+    once either side closed the connection, like nginx does, since WebSocket peers close both ways.
+ */
+class Tunnel
+{
+public:
+    /*
+        The tunnel takes ownership of `fd`, connected to `backend` of `upstream`, which stays counted as
+        busy until the tunnel is destroyed.
+     */
+    Tunnel(Upstream& upstream, Backend& backend, int fd);
+    ~Tunnel();
+
+    /*
+        Create the pipes, unless `tls` is set. Returns `false` if they cannot be created.
+     */
+    bool init(bool tls);
+
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    const std::string& server() const
+    {
+        return m_backend->server.name;
+    }
+
+    /*
+        Move what both sides are ready for. The output of `conn` is written first, it starts with the
+        response switching protocols.
+     */
+    TunnelStatus relay(Connection& conn);
+
+    /*
+        Wait for what each side has to do next: being read unless what it sent before is still waiting,
+        and being written while something is waiting for it.
+     */
+    bool watch(Poller& poller, Connection& conn);
+
+private:
+    Upstream *m_upstream;
+    Backend *m_backend;
+    int m_fd;
+    /* Events the upstream socket is registered for, `(uint32_t)-1` before the first `watch`. */
+    uint32_t m_events;
+
+    /* Pipes from the client to the server and back, `-1` on TLS connections. */
+    int m_up[2];
+    int m_down[2];
+    /* Bytes read from one side and not written to the other yet, in a pipe or `m_up_buffer`. On TLS
+       connections what the server sent waits in the output of the connection instead. */
+    size_t m_up_size;
+    size_t m_down_size;
+    std::vector<char> m_up_buffer;
+    size_t m_up_offset;
+    std::vector<char> m_down_buffer;
+
+    bool m_client_closed;
+    bool m_server_closed;
+    /* Bytes relayed each way, for the log. */
+    uint64_t m_up_total;
+    uint64_t m_down_total;
+
+    bool _send_up();
+    bool _copy_up(Connection& conn);
+    bool _copy_down(Connection& conn);
+
+    Tunnel(const Tunnel& other);
+    Tunnel& operator=(const Tunnel& other);
+};
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <limits>
+
+#include "logger.hpp"
+#include "upstream.hpp"
+#include "webserv.hpp"
+
+Upstreams g_upstreams;
+
+/*
+    FNV-1a, with its bits mixed so the top ones used on the ring depend on the whole key.
+ */
+static uint64_t _hash(const char *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+Upstream::Upstream(const UpstreamConfig& config) : m_config(config), m_next(0)
+{
+    for (size_t i = 0; i < config.servers().size(); i++)
+    {
+        Backend backend = {};
+        backend.server = config.servers()[i];
+        m_backends.push_back(backend);
+    }
+
+    if (config.balance() != BALANCE_HASH)
+        return;
+
+    // The points of a server only depend on its address, so adding or removing a server only moves the
+    // keys next to its points.
+    for (size_t i = 0; i < m_backends.size(); i++)
+    {
+        for (size_t j = 0; j < UPSTREAM_RING_POINTS; j++)
+        {
+            std::string point = m_backends[i].server.name + "#" + to_string(j);
+            m_ring.push_back(std::make_pair((uint32_t)(_hash(point.data(), point.size()) >> 32), i));
+        }
+    }
+    std::sort(m_ring.begin(), m_ring.end());
+}
+
+uint64_t Upstream::hash(const Request& req, const struct sockaddr_in& client) const
+{
+    if (m_config.balance() != BALANCE_HASH)
+        return 0;
+
+    switch (m_config.hash_key())
+    {
+    case HASH_CLIENT_IP:
+        return _hash((const char *)&client.sin_addr, sizeof(client.sin_addr));
+    case HASH_PATH:
+        return _hash(req.path().data(), req.path().size());
+    case HASH_HEADER: {
+        StringView value = req.get_param(m_config.hash_header());
+        return _hash(value.data(), value.size());
+    }
+    }
+    return 0;
+}
+
+bool Upstream::_usable(size_t i, const std::vector<Backend *>& tried, int64_t now) const
+{
+    if (m_backends[i].down_until > now)
+        return false;
+    return std::find(tried.begin(), tried.end(), &m_backends[i]) == tried.end();
+}
+
+Backend *Upstream::pick(uint64_t hash, const std::vector<Backend *>& tried)
+{
+    Backend *backend = _pick(hash, tried, time());
+
+    // All the servers left are ejected, one of them may have recovered in the meantime.
+    if (!backend)
+        backend = _pick(hash, tried, std::numeric_limits<int64_t>::max());
+
+    if (backend)
+    {
+        backend->active++;
+        backend->requests++;
+    }
+    return backend;
+}
+
+Backend *Upstream::_pick(uint64_t hash, const std::vector<Backend *>& tried, int64_t now)
+{
+    size_t count = m_backends.size();
+
+    if (m_config.balance() == BALANCE_HASH)
+    {
+        std::vector<std::pair<uint32_t, size_t> >::iterator it =
+            std::lower_bound(m_ring.begin(), m_ring.end(), std::make_pair((uint32_t)(hash >> 32), (size_t)0));
+
+        // Servers which cannot be used pass their keys to the next one on the ring.
+        for (size_t i = 0; i < m_ring.size(); i++, it++)
+        {
+            if (it == m_ring.end())
+                it = m_ring.begin();
+            if (_usable(it->second, tried, now))
+                return &m_backends[it->second];
+        }
+        return NULL;
+    }
+
+    size_t best = count;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t index = (m_next + i) % count;
+        if (!_usable(index, tried, now))
+            continue;
+
+        if (m_config.balance() == BALANCE_ROUND_ROBIN)
+        {
+            best = index;
+            break;
+        }
+        if (best == count || m_backends[index].active < m_backends[best].active)
+            best = index;
+    }
+
+    if (best == count)
+        return NULL;
+    m_next = best + 1;
+    return &m_backends[best];
+}
+
+void Upstream::finish(Backend& backend)
+{
+    backend.active--;
+}
+
+void Upstream::succeed(Backend& backend, int64_t latency)
+{
+    backend.fails = 0;
+    backend.responses++;
+    backend.latency_total += latency;
+    backend.latency_max = std::max(backend.latency_max, latency);
+}
+
+void Upstream::fail(Backend& backend, bool timeout)
+{
+    if (timeout)
+        backend.timeouts++;
+    else
+        backend.errors++;
+
+    backend.fails++;
+    if (m_config.max_fails() == 0 || backend.fails < m_config.max_fails() || m_backends.size() < 2)
+        return;
+
+    backend.fails = 0;
+    backend.down_until = time() + m_config.fail_timeout();
+    ws::log << ws::warn << "server `" << backend.server.name << "` of upstream `" << m_config.name()
+            << "` is ejected for " << m_config.fail_timeout() << " ms\n";
+}
+
+void Upstream::report()
+{
+    int64_t now = time();
+
+    for (size_t i = 0; i < m_backends.size(); i++)
+    {
+        Backend& backend = m_backends[i];
+        uint64_t average = backend.responses ? backend.latency_total / backend.responses : 0;
+
+        ws::log << ws::info << "upstream `" << m_config.name() << "`";
+        if (backend.server.name != m_config.name())
+            ws::log << " server `" << backend.server.name << "`";
+        ws::log << ": " << backend.requests << " requests, " << backend.errors << " errors, " << backend.timeouts
+                << " timeouts, latency " << average << " ms average, " << backend.latency_max << " ms max"
+                << (backend.down_until > now ? " (ejected)" : "") << "\n";
+    }
+}
+
+Upstreams::Upstreams()
+{
+}
+
+Upstreams::~Upstreams()
+{
+    for (std::map<std::string, Upstream *>::iterator it = m_upstreams.begin(); it != m_upstreams.end(); it++)
+        delete it->second;
+}
+
+void Upstreams::build(Config& config)
+{
+    std::map<std::string, UpstreamConfig>& upstreams = config.upstreams();
+
+    for (std::map<std::string, UpstreamConfig>::iterator it = upstreams.begin(); it != upstreams.end(); it++)
+        m_upstreams[it->first] = new Upstream(it->second);
+}
+
+Upstream *Upstreams::find(const std::string& name)
+{
+    std::map<std::string, Upstream *>::iterator it = m_upstreams.find(name);
+    return it == m_upstreams.end() ? NULL : it->second;
+}
+
+void Upstreams::report()
+{
+    for (std::map<std::string, Upstream *>::iterator it = m_upstreams.begin(); it != m_upstreams.end(); it++)
+        it->second->report();
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <map>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "config/config.hpp"
+#include "http/request.hpp"
+
+/* Points of each server on the hash ring of a `balance hash` group, more points spread the keys more evenly. */
+#define UPSTREAM_RING_POINTS 160
+
+/*
+    State of a server of an `upstream` group, shared by all the requests sent to it.
+ */
+struct Backend
+{
+    UpstreamServer server;
+    /* Exchanges in progress. */
+    size_t active;
+    /* Failures since the server last responded. */
+    size_t fails;
+    /* The server is ejected, and only picked if all the others are, until this time. */
+    int64_t down_until;
+
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t timeouts;
+    /* Responses received, with the total and largest time until their headers in milliseconds. */
+    uint64_t responses;
+    uint64_t latency_total;
+    int64_t latency_max;
+};
+
+/*
+    An `upstream` group: picks the server of each request and keeps track of the failing ones.
+
+    Health checks are passive, a server is ejected for `fail_timeout` after `max_fails` failures in a
+    row (errors or timeouts while connecting, sending the request or reading the response). A group with
+    a single server never ejects it, there would be nothing else to try.
+ */
+class Upstream
+{
+public:
+    Upstream(const UpstreamConfig& config);
+
+    const UpstreamConfig& config() const
+    {
+        return m_config;
+    }
+
+    /*
+        Hash of the key of a request for `balance hash`, `0` with other methods.
+     */
+    uint64_t hash(const Request& req, const struct sockaddr_in& client) const;
+
+    /*
+        Pick the server of a request whose key has `hash`, among the ones not in `tried`. Returns `NULL`
+        if all of them were tried. The exchange counts as in progress until `finish`.
+     */
+    Backend *pick(uint64_t hash, const std::vector<Backend *>& tried);
+    void finish(Backend& backend);
+
+    /*
+        The server sent the headers of a response `latency` milliseconds after the request started.
+     */
+    void succeed(Backend& backend, int64_t latency);
+    void fail(Backend& backend, bool timeout);
+
+    /*
+        Log the counters of each server.
+     */
+    void report();
+
+private:
+    UpstreamConfig m_config;
+    std::vector<Backend> m_backends;
+    /* Where round-robin, and least-connections on ties, start looking for the next server. */
+    size_t m_next;
+    /* Points of the servers on the hash ring, sorted. */
+    std::vector<std::pair<uint32_t, size_t> > m_ring;
+
+    bool _usable(size_t i, const std::vector<Backend *>& tried, int64_t now) const;
+    Backend *_pick(uint64_t hash, const std::vector<Backend *>& tried, int64_t now);
+
+    Upstream(const Upstream& other);
+    Upstream& operator=(const Upstream& other);
+};
+
+/*
+    All `upstream` groups of the configuration, by name.
+ */
+class Upstreams
+{
+public:
+    Upstreams();
+    ~Upstreams();
+
+    void build(Config& config);
+
+    /*
+        Returns the group `name`, which exists for every `proxy_pass` target of the configuration.
+     */
+    Upstream *find(const std::string& name);
+
+    void report();
+
+private:
+    std::map<std::string, Upstream *> m_upstreams;
+
+    Upstreams(const Upstreams& other);
+    Upstreams& operator=(const Upstreams& other);
+};
+
+extern Upstreams g_upstreams;
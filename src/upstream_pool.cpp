@@ -0,0 +1,109 @@
+#include <cerrno>
+#include <cstring>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+#include "upstream_pool.hpp"
+#include "webserv.hpp"
+
+UpstreamPool g_upstream_pool;
+
+UpstreamPool::UpstreamPool()
+{
+}
+
+UpstreamPool::~UpstreamPool()
+{
+    clear();
+}
+
+uint64_t UpstreamPool::_key(const struct sockaddr_in& addr)
+{
+    return (uint64_t)addr.sin_addr.s_addr << 16 | addr.sin_port;
+}
+
+int UpstreamPool::acquire(const struct sockaddr_in& addr, bool& reused)
+{
+    std::vector<Idle>& idle = m_idle[_key(addr)];
+    int64_t now = time();
+
+    while (!idle.empty())
+    {
+        Idle connection = idle.back();
+        idle.pop_back();
+
+        // Connections are used most recent first, so all the others are older.
+        if (now - connection.since > UPSTREAM_IDLE_TIMEOUT)
+        {
+            close(connection.fd);
+            while (!idle.empty())
+            {
+                close(idle.back().fd);
+                idle.pop_back();
+            }
+            break;
+        }
+
+        // An idle connection has nothing to read, unless the server closed it or sent garbage.
+        char byte;
+        if (recv(connection.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == -1 && errno == EAGAIN)
+        {
+            reused = true;
+            return connection.fd;
+        }
+        close(connection.fd);
+    }
+
+    reused = false;
+    return connect(addr);
+}
+
+int UpstreamPool::connect(const struct sockaddr_in& addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        ws::log << ws::err << "socket() failed: " << strerror(errno) << "\n";
+        return -1;
+    }
+
+    // Requests are written in one go, there is nothing to gain from delaying small ones.
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS)
+    {
+        ws::log << ws::err << "connect() to an upstream failed: " << strerror(errno) << "\n";
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void UpstreamPool::release(const struct sockaddr_in& addr, int fd)
+{
+    std::vector<Idle>& idle = m_idle[_key(addr)];
+
+    if (idle.size() >= UPSTREAM_KEEPALIVE)
+    {
+        close(fd);
+        return;
+    }
+
+    Idle connection;
+    connection.fd = fd;
+    connection.since = time();
+    idle.push_back(connection);
+}
+
+void UpstreamPool::clear()
+{
+    for (std::map<uint64_t, std::vector<Idle> >::iterator it = m_idle.begin(); it != m_idle.end(); it++)
+    {
+        for (size_t i = 0; i < it->second.size(); i++)
+            close(it->second[i].fd);
+    }
+    m_idle.clear();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <map>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <vector>
+
+/* Maximum number of idle connections kept open to each upstream server. */
+#define UPSTREAM_KEEPALIVE 32
+/* How long an idle connection is kept, in milliseconds. Servers usually close theirs after a few seconds, a
+   connection is better dropped by us than reused while the server closes it. */
+#define UPSTREAM_IDLE_TIMEOUT 4000
+
+/*
+    Keep-alive connections to the upstream servers of `proxy_pass` locations, shared by all client
+    connections.
+
+    Idle connections are not watched by the event loop. One the server closed in the meantime is
+    recognized when it is taken out of the pool, by peeking at the socket.
+ */
+class UpstreamPool
+{
+public:
+    UpstreamPool();
+    ~UpstreamPool();
+
+    /*
+        Returns an idle connection to `addr`, or a new one if there is none. `reused` tells which, the
+        `connect` of a new connection may still be in progress. Returns `-1` on error.
+     */
+    int acquire(const struct sockaddr_in& addr, bool& reused);
+
+    /*
+        Open a new non-blocking connection to `addr`, without looking at the pool.
+     */
+    static int connect(const struct sockaddr_in& addr);
+
+    /*
+        Give back a connection which can carry another request.
+     */
+    void release(const struct sockaddr_in& addr, int fd);
+
+    /*
+        Close all idle connections.
+     */
+    void clear();
+
+private:
+    struct Idle
+    {
+        int fd;
+        int64_t since;
+    };
+
+    /* Idle connections of each server, the most recently used last. */
+    std::map<uint64_t, std::vector<Idle> > m_idle;
+
+    static uint64_t _key(const struct sockaddr_in& addr);
+
+    UpstreamPool(const UpstreamPool& other);
+    UpstreamPool& operator=(const UpstreamPool& other);
+};
+
+extern UpstreamPool g_upstream_pool;
@@ -0,0 +1,384 @@
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+#include "uring_poller.hpp"
+
+/* `user_data` of requests whose completion is not reported, such as cancellations. */
+#define URING_IGNORE ((uint64_t)-1)
+/* `user_data` of the timer ending a wait. */
+#define URING_TIMER ((uint64_t)-2)
+
+static inline uint64_t _user_data(int fd, uint32_t generation)
+{
+    return (uint64_t)generation << 32 | (uint32_t)fd;
+}
+
+UringPoller::UringPoller()
+    : m_fd(-1), m_sq_ring(MAP_FAILED), m_sq_ring_size(0), m_sqes(NULL), m_sqes_size(0), m_cq_ring(MAP_FAILED),
+      m_cq_ring_size(0), m_pending(0), m_multishot_accept(true), m_timer_armed(false)
+{
+}
+
+UringPoller::~UringPoller()
+{
+    if (m_sqes)
+        munmap(m_sqes, m_sqes_size);
+    if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+        munmap(m_cq_ring, m_cq_ring_size);
+    if (m_sq_ring != MAP_FAILED)
+        munmap(m_sq_ring, m_sq_ring_size);
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+bool UringPoller::init()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = URING_CQ_ENTRIES;
+
+    m_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (m_fd == -1 && errno == EINVAL)
+    {
+        // Older kernels do not know about the flags.
+        memset(&params, 0, sizeof(params));
+        m_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+    if (m_fd == -1)
+    {
+        ws::log << ws::warn << "io_uring_setup() failed: " << strerror(errno) << "\n";
+        return false;
+    }
+
+    // Completions cannot be lost when the completion queue overflows.
+    if (!(params.features & IORING_FEAT_NODROP))
+    {
+        ws::log << ws::warn << "io_uring does not support IORING_FEAT_NODROP\n";
+        return false;
+    }
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // Both rings share the same mapping on recent kernels.
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (m_cq_ring_size > m_sq_ring_size)
+            m_sq_ring_size = m_cq_ring_size;
+        m_cq_ring_size = m_sq_ring_size;
+    }
+
+    m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ring == MAP_FAILED)
+    {
+        ws::log << ws::warn << "mmap() failed: " << strerror(errno) << "\n";
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        m_cq_ring = m_sq_ring;
+    else
+    {
+        m_cq_ring =
+            mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ring == MAP_FAILED)
+        {
+            ws::log << ws::warn << "mmap() failed: " << strerror(errno) << "\n";
+            return false;
+        }
+    }
+
+    m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        ws::log << ws::warn << "mmap() failed: " << strerror(errno) << "\n";
+        return false;
+    }
+    m_sqes = (struct io_uring_sqe *)sqes;
+
+    char *sq = (char *)m_sq_ring;
+    m_sq_head = (unsigned *)(sq + params.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    m_sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    m_sq_entries = params.sq_entries;
+
+    // Submission queue entries are always used in order.
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < m_sq_entries; i++)
+        array[i] = i;
+
+    char *cq = (char *)m_cq_ring;
+    m_cq_head = (unsigned *)(cq + params.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    m_cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+bool UringPoller::listen(int sock)
+{
+    Watch& watch = _watch(sock);
+    watch.events = EPOLLIN;
+    watch.active = true;
+    watch.listening = true;
+    m_rearm.push_back(sock);
+    return true;
+}
+
+bool UringPoller::add(int fd, uint32_t events)
+{
+    Watch& watch = _watch(fd);
+    watch.events = events;
+    watch.active = true;
+    watch.listening = false;
+    m_rearm.push_back(fd);
+    return true;
+}
+
+bool UringPoller::modify(int fd, uint32_t events)
+{
+    Watch& watch = _watch(fd);
+    if (!watch.active)
+        return false;
+
+    watch.events = events;
+
+    // A pending poll still waits for the previous events. This does not happen when the events are
+    // changed while handling the completion of the file descriptor.
+    if (watch.armed)
+    {
+        _cancel(fd);
+        m_rearm.push_back(fd);
+    }
+    return true;
+}
+
+bool UringPoller::remove(int fd)
+{
+    Watch& watch = _watch(fd);
+    if (!watch.active)
+        return false;
+
+    if (watch.armed)
+        _cancel(fd);
+    watch.active = false;
+    watch.generation++;
+    return true;
+}
+
+int UringPoller::wait(PollEvent *events, int max_events, int timeout)
+{
+    for (size_t i = 0; i < m_rearm.size(); i++)
+    {
+        Watch& watch = m_watches[m_rearm[i]];
+        if (watch.active && !watch.armed)
+            _arm(m_rearm[i]);
+    }
+    m_rearm.clear();
+
+    // Completions left from the last call are reported first, new requests are submitted with the
+    // next wait.
+    int count = _reap(events, max_events);
+    if (count > 0)
+        return count;
+
+    // A timer left by an earlier wait is kept, the wait can then end a little after `timeout`.
+    if (timeout >= 0 && !m_timer_armed)
+        _arm_timer(timeout);
+
+    if (_enter(1, IORING_ENTER_GETEVENTS) == -1)
+    {
+        if (errno != EINTR)
+            ws::log << ws::err << "io_uring_enter() failed: " << strerror(errno) << "\n";
+        return -1;
+    }
+
+    return _reap(events, max_events);
+}
+
+UringPoller::Watch& UringPoller::_watch(int fd)
+{
+    if ((size_t)fd >= m_watches.size())
+    {
+        Watch watch;
+        memset(&watch, 0, sizeof(watch));
+        m_watches.resize(fd + 1, watch);
+    }
+    return m_watches[fd];
+}
+
+struct io_uring_sqe *UringPoller::_get_sqe()
+{
+    unsigned tail = *m_sq_tail;
+
+    if (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+    {
+        // The queue is full, submit it without waiting for completions.
+        if (_enter(0, 0) == -1 || tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+            return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &m_sqes[tail & m_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+
+    __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    m_pending++;
+    return sqe;
+}
+
+void UringPoller::_arm(int fd)
+{
+    Watch& watch = m_watches[fd];
+
+    struct io_uring_sqe *sqe = _get_sqe();
+    if (!sqe)
+    {
+        ws::log << ws::err << "io_uring submission queue is full\n";
+        return;
+    }
+
+    sqe->fd = fd;
+    sqe->user_data = _user_data(fd, watch.generation);
+
+    if (watch.listening && m_multishot_accept)
+    {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = watch.events;
+    }
+
+    watch.armed = true;
+}
+
+/*
+    Cancel the pending request of `fd`, its completion is ignored.
+ */
+void UringPoller::_cancel(int fd)
+{
+    Watch& watch = m_watches[fd];
+
+    struct io_uring_sqe *sqe = _get_sqe();
+    if (sqe)
+    {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = _user_data(fd, watch.generation);
+        sqe->user_data = URING_IGNORE;
+    }
+
+    watch.armed = false;
+    watch.generation++;
+}
+
+/*
+    Add a timer which completes after `timeout` milliseconds, so the wait for completions ends.
+ */
+void UringPoller::_arm_timer(int timeout)
+{
+    struct io_uring_sqe *sqe = _get_sqe();
+    if (!sqe)
+        return;
+
+    m_timeout.tv_sec = timeout / 1000;
+    m_timeout.tv_nsec = (long long)(timeout % 1000) * 1000000;
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&m_timeout;
+    sqe->len = 1;
+    sqe->user_data = URING_TIMER;
+    m_timer_armed = true;
+}
+
+int UringPoller::_enter(unsigned min_complete, unsigned flags)
+{
+    int n = syscall(__NR_io_uring_enter, m_fd, m_pending, min_complete, flags, NULL, 0);
+    if (n == -1)
+        return -1;
+
+    m_pending -= n;
+    return n;
+}
+
+int UringPoller::_reap(PollEvent *events, int max_events)
+{
+    unsigned head = *m_cq_head;
+    unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    int count = 0;
+
+    for (; head != tail && count < max_events; head++)
+    {
+        struct io_uring_cqe *cqe = &m_cqes[head & m_cq_mask];
+
+        if (cqe->user_data == URING_IGNORE)
+            continue;
+        if (cqe->user_data == URING_TIMER)
+        {
+            m_timer_armed = false;
+            continue;
+        }
+
+        int fd = (int)(uint32_t)cqe->user_data;
+        uint32_t generation = cqe->user_data >> 32;
+
+        if ((size_t)fd >= m_watches.size())
+            continue;
+
+        Watch& watch = m_watches[fd];
+        if (!watch.active || watch.generation != generation)
+            continue;
+
+        // One-shot polls, and multishot requests which stopped, are armed again by the next wait.
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+        {
+            watch.armed = false;
+            m_rearm.push_back(fd);
+        }
+
+        if (cqe->res == -ECANCELED)
+            continue;
+
+        if (watch.listening && m_multishot_accept)
+        {
+            if (cqe->res == -EINVAL)
+            {
+                // Multishot accept needs Linux 5.19, accept new connections after polling instead.
+                ws::log << ws::warn << "io_uring does not support multishot accept\n";
+                m_multishot_accept = false;
+                continue;
+            }
+            if (cqe->res < 0)
+            {
+                ws::log << ws::err << "accept() failed: " << strerror(-cqe->res) << "\n";
+                continue;
+            }
+
+            events[count].fd = fd;
+            events[count].events = EPOLLIN;
+            events[count].accepted = cqe->res;
+            count++;
+            continue;
+        }
+
+        events[count].fd = fd;
+        events[count].events = cqe->res < 0 ? (uint32_t)EPOLLERR : (uint32_t)cqe->res;
+        events[count].accepted = -1;
+        count++;
+    }
+
+    __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <vector>
+
+#include "poller.hpp"
+
+/* Number of submission queue entries. */
+#define URING_ENTRIES 256
+/* Number of completion queue entries, at most one poll is pending per connection. */
+#define URING_CQ_ENTRIES 4096
+
+/*
+    Event loop backend built on io_uring, driven through the raw system calls.
+
+    Listening sockets use a multishot accept, so new connections arrive as completions without
+    being polled and accepted separately. Other file descriptors use one-shot polls which are armed
+    again by the next `wait`: the re-arming requests are submitted by the same `io_uring_enter`
+    which waits for completions, so watching a socket or changing its events costs no system call,
+    where epoll needs an `epoll_ctl` each time. One-shot polls also keep the level-triggered
+    behaviour of epoll, which the connection handlers rely on since they do a single read per event.
+ */
+class UringPoller : public Poller
+{
+public:
+    UringPoller();
+    virtual ~UringPoller();
+
+    bool init();
+
+    virtual const char *name() const
+    {
+        return "io_uring";
+    }
+
+    virtual bool listen(int sock);
+    virtual bool add(int fd, uint32_t events);
+    virtual bool modify(int fd, uint32_t events);
+    virtual bool remove(int fd);
+    virtual int wait(PollEvent *events, int max_events, int timeout);
+
+private:
+    struct Watch
+    {
+        uint32_t events;
+        /* Incremented when the watch is cancelled, completions of older requests are ignored. */
+        uint32_t generation;
+        bool active;
+        /* Whether a request is pending in the kernel. */
+        bool armed;
+        bool listening;
+    };
+
+    int m_fd;
+
+    void *m_sq_ring;
+    size_t m_sq_ring_size;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    struct io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+
+    void *m_cq_ring;
+    size_t m_cq_ring_size;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    /* Entries added to the submission queue but not submitted yet. */
+    unsigned m_pending;
+    bool m_multishot_accept;
+
+    /* Timeout of the pending timer which ends a wait, a single one is pending at a time. */
+    struct __kernel_timespec m_timeout;
+    bool m_timer_armed;
+
+    std::vector<Watch> m_watches;
+    /* File descriptors whose request completed and must be armed again. */
+    std::vector<int> m_rearm;
+
+    Watch& _watch(int fd);
+    struct io_uring_sqe *_get_sqe();
+    void _arm(int fd);
+    void _cancel(int fd);
+    void _arm_timer(int timeout);
+    int _enter(unsigned min_complete, unsigned flags);
+    int _reap(PollEvent *events, int max_events);
+
+    UringPoller(const UringPoller& other);
+    UringPoller& operator=(const UringPoller& other);
+};
@@ -0,0 +1,92 @@
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+#include "watcher.hpp"
+
+#define WATCHER_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB)
+
+Watcher::Watcher() : m_fd(-1)
+{
+}
+
+Watcher::~Watcher()
+{
+}
+
+bool Watcher::init()
+{
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd == -1)
+    {
+        ws::log << ws::warn << "inotify_init1() failed: " << strerror(errno) << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool Watcher::watch_dir(const std::string& dir, WatchListener *listener)
+{
+    if (m_fd == -1)
+        return false;
+
+    int wd = inotify_add_watch(m_fd, dir.c_str(), WATCHER_MASK | IN_ONLYDIR);
+    if (wd == -1)
+    {
+        ws::log << ws::warn << "Cannot watch `" << dir << "`: " << strerror(errno) << "\n";
+        return false;
+    }
+
+    Watch& watch = m_watches[wd];
+    watch.dir = dir;
+
+    for (size_t i = 0; i < watch.listeners.size(); i++)
+        if (watch.listeners[i] == listener)
+            return true;
+    watch.listeners.push_back(listener);
+    return true;
+}
+
+bool Watcher::watch_file(const std::string& path, WatchListener *listener)
+{
+    size_t slash = path.rfind('/');
+
+    if (slash == std::string::npos)
+        return watch_dir(".", listener);
+    else if (slash == 0)
+        return watch_dir("/", listener);
+    return watch_dir(path.substr(0, slash), listener);
+}
+
+void Watcher::dispatch()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+
+    while ((n = read(m_fd, buf, sizeof(buf))) > 0)
+    {
+        for (char *ptr = buf; ptr < buf + n;)
+        {
+            struct inotify_event *event = (struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            std::map<int, Watch>::iterator it = m_watches.find(event->wd);
+            if (it == m_watches.end())
+                continue;
+
+            if (event->mask & IN_IGNORED)
+            {
+                m_watches.erase(it);
+                continue;
+            }
+
+            std::string name = event->len > 0 ? event->name : "";
+            Watch& watch = it->second;
+
+            for (size_t i = 0; i < watch.listeners.size(); i++)
+                watch.listeners[i]->on_change(watch.dir, name);
+        }
+    }
+}
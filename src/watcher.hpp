@@ -0,0 +1,63 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+    Receives notifications from a `Watcher`.
+ */
+class WatchListener
+{
+public:
+    virtual ~WatchListener()
+    {
+    }
+
+    /*
+        Called when the entry `name` of the watched directory `dir` was created, modified, moved or
+        deleted.
+     */
+    virtual void on_change(const std::string& dir, const std::string& name) = 0;
+};
+
+/*
+    Thin wrapper around inotify. The file descriptor is registered in the event loop and `dispatch`
+    is called when it becomes readable.
+ */
+class Watcher
+{
+public:
+    Watcher();
+    ~Watcher();
+
+    bool init();
+
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    /*
+        Watch the directory `dir` and notify `listener` of any change to its entries.
+     */
+    bool watch_dir(const std::string& dir, WatchListener *listener);
+
+    /*
+        Watch the parent directory of `path`, this also catches files replaced by a rename.
+     */
+    bool watch_file(const std::string& path, WatchListener *listener);
+
+    void dispatch();
+
+private:
+    int m_fd;
+
+    struct Watch
+    {
+        std::string dir;
+        std::vector<WatchListener *> listeners;
+    };
+
+    std::map<int, Watch> m_watches;
+};
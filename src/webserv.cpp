@@ -1,10 +1,22 @@
 #include "webserv.hpp"
 #include "config/config.hpp"
 #include "connection.hpp"
+#include "http/error_pages.hpp"
 #include "http/request.hpp"
 #include "http/response.hpp"
+#include "http/scan.hpp"
+#include "http2/session.hpp"
 #include "logger.hpp"
+#include "negative_cache.hpp"
+#include "proxy.hpp"
+#include "proxy_cache.hpp"
 #include "server.hpp"
+#include "sse.hpp"
+#include "tunnel.hpp"
+#include "upstream.hpp"
+#include "upstream_pool.hpp"
+#include <algorithm>
+#include <cctype>
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
@@ -13,18 +25,21 @@
 #include <netinet/in.h>
 #include <unistd.h>
 
-Webserv::Webserv() : m_running(true)
+Webserv::Webserv()
+    : m_poller(NULL), m_running(true), m_report(false), m_last_timeout_check(0), m_last_client_check(0),
+      m_connection_count(0),
+      m_reused_count(0), m_request_count(0)
 {
 }
 
-int Webserv::getEpollFd() const
+void Webserv::quit()
 {
-    return m_epollFd;
+    m_running = false;
 }
 
-void Webserv::quit()
+void Webserv::report()
 {
-    m_running = false;
+    m_report = true;
 }
 
 int Webserv::initialize(std::string config_path)
@@ -43,38 +58,62 @@ int Webserv::initialize(std::string config_path)
         return -1;
     }
 
-    m_epollFd = epoll_create1(0);
-    if (m_epollFd == -1)
-    {
-        ws::log << ws::err << ": epoll_create1() failed: " << strerror(errno) << RESET << "\n";
+    ws::log.set_blocking(m_config.log_overflow() == LOG_OVERFLOW_BLOCK);
+
+    m_poller = Poller::create(m_config.event_backend());
+    if (!m_poller)
         return -1;
-    }
+    ws::log << ws::info << "Using the " << m_poller->name() << " event backend\n";
+
+    // Changes to files loaded in memory (such as custom error pages) are picked up through inotify.
+    if (m_watcher.init())
+        m_poller->add(m_watcher.fd(), EPOLLIN);
+
+    g_error_pages.build(m_config, m_watcher);
+    g_negative_cache.build(m_config, m_watcher);
+    g_upstreams.build(m_config);
+    if (!g_proxy_cache.build(m_config))
+        return -1;
+    g_sse_hub.build(m_config);
 
     return 0;
 }
 
-Result<Connection, int> Webserv::acceptConnection(int sock_fd)
+Result<Connection *, int> Webserv::acceptConnection(int sock_fd, int conn)
 {
     socklen_t addrLen = sizeof(struct sockaddr_in);
     struct sockaddr_in addr = {};
 
-    int conn = accept(sock_fd, (struct sockaddr *)&addr, &addrLen);
+    // Responses are written without blocking, what does not fit in the socket buffer is sent on `EPOLLOUT`.
+    if (conn == -1)
+        conn = accept4(sock_fd, (struct sockaddr *)&addr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (conn == -1)
     {
         std::cerr << NRED << strerror(errno) << RED << ": accept() failed." << RESET << std::endl;
         return -1;
     }
 
-    struct epoll_event event;
-    event.events = EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR;
-    event.data.fd = conn;
+    // Connections accepted by the poller come without the address of the client.
+    if (addr.sin_family == 0)
+        getpeername(conn, (struct sockaddr *)&addr, &addrLen);
+
+    Tls *tls = NULL;
+    if (m_servers[sock_fd].ssl() && !(tls = Tls::accept(m_servers[sock_fd], conn)))
+    {
+        close(conn);
+        return -1;
+    }
 
-    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, conn, &event) == -1)
+    if (!m_poller->add(conn, EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
     {
-        std::cerr << NRED << strerror(errno) << RED << ": epoll_ctl() failed." << RESET << std::endl;
-        close(m_epollFd);
+        delete tls;
+        close(conn);
+        return -1;
     }
-    return Connection(conn, sock_fd, addr);
+
+    Connection *connection = new Connection(conn, sock_fd, addr);
+    connection->set_tls(tls);
+    return connection;
 }
 
 void Webserv::eventLoop()
@@ -97,48 +136,61 @@ void Webserv::eventLoop()
 
         std::string host = config.server_name().unwrap();
 
+        SSL_CTX *ssl_ctx = NULL;
+        if (config.ssl())
+        {
+            if (config.ssl_certificate().is_none() || config.ssl_key().is_none())
+            {
+                ws::log << ws::err << "Missing `ssl_certificate` or `ssl_key` for " << host << "\n";
+                continue;
+            }
+
+            ssl_ctx = Tls::create_context(config.ssl_certificate().unwrap(), config.ssl_key().unwrap());
+            if (!ssl_ctx)
+                continue;
+        }
+
         if (has_server(config.listen_addr().unwrap()))
         {
             Server& server = get_server(config.listen_addr().unwrap());
-            std::string host = config.server_name().unwrap();
 
-            if (server.has_host(host))
+            if (server.ssl() != config.ssl())
             {
-                ws::log << ws::err << "Duplicated server hostname " << host << "\n";
+                ws::log << ws::err << "Host " << host << " must use `ssl` like the other hosts on its address\n";
+                SSL_CTX_free(ssl_ctx);
                 continue;
             }
 
-            server.add_host(host, config);
+            if (!server.add_host(host, config, ssl_ctx))
+            {
+                ws::log << ws::err << "Duplicated server hostname " << host << "\n";
+                continue;
+            }
         }
         else
         {
-            Server server(config.listen_addr().unwrap());
-            server.add_host(host, config);
+            Server server(config.listen_addr().unwrap(), config.ssl());
+            server.add_host(host, config, ssl_ctx);
 
             if (server.sock_fd() == -1)
                 continue;
 
-            struct epoll_event socket_event;
-            socket_event.events = EPOLLIN;
-            socket_event.data.fd = server.sock_fd();
-
-            if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, server.sock_fd(), &socket_event) == -1)
-            {
-                std::cerr << NRED << strerror(errno) << RED << ": epoll_ctl() failed." << RESET << std::endl;
+            if (!m_poller->listen(server.sock_fd()))
                 continue;
-            }
 
             m_servers[server.sock_fd()] = server;
         }
 
         struct sockaddr_in addr = config.listen_addr().unwrap();
-        ws::log << ws::info << "Host " BIWHITE << host << RESET " listening on " << addr << "\n";
+        ws::log << ws::info << "Host " BIWHITE << host << RESET " listening on " << addr << (config.ssl() ? " (TLS)" : "")
+                << "\n";
     }
 
     if (m_servers.empty())
     {
         ws::log << ws::err << "No servers running, stopping now...\n";
-        close(m_epollFd);
+        delete m_poller;
+        m_poller = NULL;
         return;
     }
 
@@ -147,6 +199,11 @@ void Webserv::eventLoop()
         poll_events();
     }
 
+    ws::log << ws::info << "Shutdown...\n";
+    ws::log << ws::info << "Served " << m_request_count << " requests on " << m_connection_count << " connections, "
+            << m_reused_count << " of them reused\n";
+    g_upstreams.report();
+
     closeFds();
 }
 
@@ -156,183 +213,1066 @@ void Webserv::closeFds()
     for (std::map<int, Server>::iterator it = m_servers.begin(); it != m_servers.end(); it++)
         close(it->second.sock_fd());
 
+    if (m_watcher.fd() != -1)
+        close(m_watcher.fd());
+
     // Close all remaining connections.
-    for (std::map<int, Connection>::iterator it = m_connections.begin(); it != m_connections.end(); it++)
-        close(it->second.fd());
+    for (std::map<int, Connection *>::iterator it = m_connections.begin(); it != m_connections.end(); it++)
+        close(it->second->fd());
+    for (std::map<int, Connection *>::iterator it = m_upstreams.begin(); it != m_upstreams.end(); it++)
+        close(it->first);
+    for (std::map<int, Connection *>::iterator it = m_tunnels.begin(); it != m_tunnels.end(); it++)
+        close(it->first);
+    g_upstream_pool.clear();
 
-    close(m_epollFd);
+    delete m_poller;
+    m_poller = NULL;
 }
 
-void Webserv::poll_events()
+/*
+    Answer `status` to a request which cannot be processed and close the connection without reading
+    the rest of the request.
+ */
+void Webserv::_reject(Connection& conn, ServerConfig& config, HttpStatus status)
 {
-    int eventCount = 0;
-    struct epoll_event events[MAX_EVENTS];
+    Response response = HTTP_ERROR(status, config);
+    response.set_keep_alive(false);
 
-    eventCount = epoll_wait(m_epollFd, events, MAX_EVENTS, -1);
-    for (int i = 0; i < eventCount; i++)
+    ws::log << ws::info << "request rejected -> " << NRED << status.code() << " " << status << RESET << "\n";
+
+    response.enqueue(conn.output(), config, conn.arena());
+    conn.set_keep_alive(false);
+    _flush(conn);
+}
+
+/*
+    Write as much of the pending output as the socket accepts. The connection only waits for `EPOLLOUT`
+    when the socket buffer is full, otherwise it keeps waiting for the next request.
+    Returns `false` if the connection was closed.
+ */
+bool Webserv::_flush(Connection& conn)
+{
+    if (conn.proxy())
+        return _flush_proxy(conn);
+    if (conn.channel())
+        return _flush_events(conn);
+
+    Http2Session *h2 = conn.h2();
+
+    // HTTP/2 response data is only produced as the socket accepts it, so large responses do not pile up
+    // in memory.
+    if (h2)
+        h2->produce(conn.output());
+
+    FlushStatus status = conn.flush();
+    while (h2 && status == FLUSH_DONE && h2->produce(conn.output()))
+        status = conn.flush();
+
+    if (h2 && h2->closing())
+        conn.set_keep_alive(false);
+
+    if (status == FLUSH_AGAIN)
+    {
+        if (conn.set_epollout(*m_poller))
+            return true;
+    }
+    else if (status == FLUSH_DONE && conn.keep_alive())
     {
-        if (m_servers.count(events[i].data.fd) > 0)
+        if (!h2 && !conn.has_req())
         {
-            Result<Connection, int> res = acceptConnection(events[i].data.fd);
-            if (res.is_err())
-                continue;
+            // The header of the response was written from the arena, whose memory goes back to the pool until
+            // the next request.
+            conn.arena().release();
 
-            Connection conn = res.unwrap();
-            conn.set_last_event(time());
-            m_connections[conn.fd()] = conn;
-            continue;
+            // The socket does not tell about requests which were already read.
+            if (!conn.recv_buffer().empty())
+                m_pipelined.push_back(conn.fd());
         }
+        if (conn.set_epollin(*m_poller))
+            return true;
+    }
+    else if (status == FLUSH_ERROR)
+        ws::log << ws::err << "sending response failed: " << strerror(errno) << "\n";
 
-        if ((events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+    closeConnection(conn);
+    return false;
+}
+
+/*
+    Check the opening handshake of a WebSocket client (RFC 6455 section 4.2.1), before it is forwarded.
+    Returns `426` if the client speaks another version of the protocol.
+ */
+static HttpStatus _check_websocket(Request& req)
+{
+    if (req.method() != GET || req.protocol() != "HTTP/1.1" || !req.has_header(HEADER_HOST) ||
+        req.has_header(HEADER_CONTENT_LENGTH) || req.is_chunked())
+        return 400; // Bad Request
+    if (req.header(HEADER_SEC_WEBSOCKET_VERSION) != "13")
+        return 426; // Upgrade Required
+
+    // The key is 16 random bytes in base64.
+    StringView key = req.header(HEADER_SEC_WEBSOCKET_KEY);
+    if (key.size() != 24 || key[22] != '=' || key[23] != '=')
+        return 400;
+    for (size_t i = 0; i < 22; i++)
+    {
+        if (!std::isalnum((unsigned char)key[i]) && key[i] != '+' && key[i] != '/')
+            return 400;
+    }
+    return 200;
+}
+
+/*
+    Value of the argument `name` of a query such as `event=status&from=cron`, empty if there is none.
+ */
+static StringView _query_arg(StringView query, StringView name)
+{
+    while (!query.empty())
+    {
+        size_t end = query.find('&');
+        StringView arg = query.substr(0, end);
+
+        if (arg.size() > name.size() && arg.starts_with(name) && arg[name.size()] == '=')
+            return arg.substr(name.size() + 1);
+        query = end == StringView::npos ? StringView() : query.substr(end + 1);
+    }
+    return StringView();
+}
+
+/*
+    Answer the request once its body was received. The response is written right away.
+ */
+void Webserv::_respond(Connection& conn)
+{
+    Request& req = conn.req();
+
+    // Requests with a body are answered on HTTP/1.1, the upgrade is optional for the server. TLS
+    // connections pick HTTP/2 with ALPN instead.
+    if (req.header(HEADER_UPGRADE).equals_ignore_case("h2c") && req.has_header(HEADER_HTTP2_SETTINGS) &&
+        req.has_connection_option("upgrade") && req.protocol() == "HTTP/1.1" &&
+        !req.has_header(HEADER_CONTENT_LENGTH) && !req.is_chunked() && !conn.tls())
+        return _upgrade_h2(conn);
+
+    Server& server = m_servers[conn.sock_fd()];
+    Host& host = server.resolve(req.header(HEADER_HOST));
+
+    Result<int, HttpStatus> upload = conn.is_uploading() ? conn.finish_upload() : Result<int, HttpStatus>(0);
+
+    Response response;
+    // In our case only `POST` and `PUT` requests have a body. Other requests will not set a
+    // `Content-Length`.
+    if ((req.method() == POST || req.method() == PUT) && !req.has_header(HEADER_CONTENT_LENGTH) && !req.is_chunked())
+    {
+        response = HTTP_ERROR(411, host.config()); // Length required
+    }
+    else if (host.config().max_content_length() > 0 && req.body_size() > host.config().max_content_length())
+    {
+        response = HTTP_ERROR(413, host.config()); // Payload Too Large
+    }
+    else if (upload.is_err())
+    {
+        response = HTTP_ERROR(upload.unwrap_err(), host.config());
+    }
+    else if (conn.put())
+    {
+        HttpStatus status = conn.put()->finish();
+        if (status.is_error())
+            response = HTTP_ERROR(status, host.config());
+        else
+            response = Response::ok(status, File::memory("", ""));
+    }
+    else
+    {
+        Location *loc = host.router().match(req.path());
+        if (loc && loc->sse_channel().is_some() && loc->allows(req.method()) && loc->redirect().is_none())
         {
-            Connection& conn = m_connections[events[i].data.fd];
+            SseChannel& channel = *g_sse_hub.find(loc->sse_channel().unwrap());
+            if (req.method() == GET)
+                return _subscribe(conn, host, *loc, channel);
+
+            // Events are small, they are not read back from a file.
+            if (req.method() != POST)
+                response = HTTP_ERROR(405, host.config()); // Method not allowed
+            else if (req.body_in_file())
+                response = HTTP_ERROR(413, host.config()); // Payload Too Large
+            else
+            {
+                _publish(channel, _query_arg(req.query(), "event"), req.body());
+                response = Response::ok(204, File::memory("", ""));
+            }
+        }
+        else if (loc && loc->proxy_pass().is_some() && loc->allows(req.method()) && loc->redirect().is_none() &&
+                 req.is_websocket())
+        {
+            HttpStatus status = _check_websocket(req);
+            if (!status.is_error())
+                return _start_proxy(conn, *loc, NULL);
+
+            response = HTTP_ERROR(status, host.config());
+            if (status.code() == 426)
+            {
+                response.add_param("Upgrade", "websocket");
+                response.add_param("Sec-WebSocket-Version", "13");
+            }
+        }
+        else if (loc && loc->proxy_pass().is_some() && loc->allows(req.method()) && loc->redirect().is_none())
+        {
+            // A stored response is sent from its file, the upstream server is only asked on a miss.
+            CacheZone *zone = loc->proxy_cache().is_some() ? g_proxy_cache.find(loc->proxy_cache().unwrap()) : NULL;
+            CacheWriter *cache = NULL;
+            if (!zone || zone->lookup(req, response, cache) != CACHE_HIT)
+                return _start_proxy(conn, *loc, cache);
+        }
+        else
+            response = host.router().route(req, conn.arena());
+    }
+
+    _send(conn, host, response);
+}
+
+/*
+    Account for the response to the current request and log it. Returns whether the connection can be
+    kept open afterwards, which `keep_alive` can forbid.
+ */
+bool Webserv::_count_request(Connection& conn, Host& host, HttpStatus status, bool keep_alive)
+{
+    Request& req = conn.req();
+
+    // The connection can only be reused if the request was read up to its end, otherwise
+    // the rest of its body would be taken for the next request.
+    size_t max_requests = host.config().keepalive_requests();
+    conn.count_request();
+
+    keep_alive = keep_alive && req.is_keep_alive() && conn.at_request_end() &&
+                 (max_requests == 0 || conn.requests() < max_requests);
+
+    m_request_count++;
+    if (conn.requests() == 2)
+        m_reused_count++;
+
+    if (!status.is_error())
+        ws::log << ws::info << strmethod(req.method()) << " `" << req.path() << "` -> " << NGREEN << status.code()
+                << " " << status << RESET << "\n";
+    else
+        ws::log << ws::info << strmethod(req.method()) << " `" << req.path() << "` -> " << NRED << status.code()
+                << " " << status << RESET << "\n";
+
+    return keep_alive;
+}
+
+/*
+    Queue the response to the current request and write it right away.
+ */
+void Webserv::_send(Connection& conn, Host& host, Response& response)
+{
+    bool keep_alive = _count_request(conn, host, response.status(), response.keep_alive());
+    response.set_keep_alive(keep_alive);
+
+    // Close the connection if the client close the connection, we don't want to keep it alive or
+    // the response could not be made.
+    if (!response.enqueue(conn.output(), host.config(), conn.arena()))
+        keep_alive = false;
+    conn.set_keep_alive(keep_alive);
+
+    if (!conn.finish_request())
+        conn.set_keep_alive(false);
+
+    _flush(conn);
+}
+
+/*
+    Carry on the TLS handshake of a connection, it then reads requests like any other connection.
+ */
+void Webserv::_handshake(Connection& conn)
+{
+    switch (conn.tls()->handshake())
+    {
+    case HANDSHAKE_WANT_READ:
+        if (!conn.set_epollin(*m_poller))
             closeConnection(conn);
-            continue;
+        return;
+
+    case HANDSHAKE_WANT_WRITE:
+        if (!conn.set_epollout(*m_poller))
+            closeConnection(conn);
+        return;
+
+    case HANDSHAKE_ERROR:
+        closeConnection(conn);
+        return;
+
+    case HANDSHAKE_DONE:
+        break;
+    }
+
+    if (conn.tls()->alpn() == "h2")
+    {
+        conn.start_h2(m_servers[conn.sock_fd()]);
+        _flush(conn);
+    }
+    else if (!conn.set_epollin(*m_poller))
+        closeConnection(conn);
+}
+
+/*
+    Switch the connection to HTTP/2 after a request with `Upgrade: h2c`, the request is answered as
+    stream `1` (RFC 7540 section 3.2).
+ */
+void Webserv::_upgrade_h2(Connection& conn)
+{
+    static const SharedBuffer switching("HTTP/1.1 101 Switching Protocols" SEP "Connection: Upgrade" SEP
+                                        "Upgrade: h2c" SEP SEP);
+
+    Request& req = conn.req();
+    RecvBuffer& recv_buffer = conn.recv_buffer();
+
+    conn.output().push(switching);
+    Http2Session& h2 = conn.start_h2(m_servers[conn.sock_fd()]);
+    h2.upgrade(StringView(recv_buffer.data(), req.header_size()), req.header(HEADER_HTTP2_SETTINGS));
+
+    m_request_count += h2.requests();
+    conn.set_keep_alive(true);
+
+    // What follows the request is the client connection preface.
+    if (!conn.finish_request())
+        return closeConnection(conn);
+
+    _serve_h2(conn);
+}
+
+/*
+    Process the frames received on an HTTP/2 connection, what is left in the receive buffer is an
+    incomplete frame.
+ */
+void Webserv::_serve_h2(Connection& conn)
+{
+    Http2Session& h2 = *conn.h2();
+    RecvBuffer& recv_buffer = conn.recv_buffer();
+    size_t requests = h2.requests();
+
+    recv_buffer.erase(0, h2.receive(recv_buffer.data(), recv_buffer.size()));
+    if (recv_buffer.empty())
+        recv_buffer.clear();
+
+    m_request_count += h2.requests() - requests;
+    if (requests < 2 && h2.requests() >= 2)
+        m_reused_count++;
+
+    _flush(conn);
+}
+
+/*
+    Forward the current request to the upstream server of `loc`. The client connection is not read until
+    the response is complete, its pipelined requests wait in the socket. `cache` stores the response if
+    it is not `NULL`.
+ */
+void Webserv::_start_proxy(Connection& conn, Location& loc, CacheWriter *cache)
+{
+    ProxyTarget target = loc.proxy_pass().unwrap();
+    Proxy& proxy = conn.start_proxy(*g_upstreams.find(target.upstream), target);
+    proxy.set_cache(cache);
+    proxy.prepare(conn.req(), loc.route(), conn.addr(), conn.tls() != NULL);
+
+    if (!proxy.connect() || !m_poller->add(proxy.fd(), EPOLLOUT))
+        return _fail_proxy(conn);
+    m_upstreams[proxy.fd()] = &conn;
+
+    if (!conn.set_idle(*m_poller))
+        return closeConnection(conn);
+
+    // A pooled connection can take the request right away.
+    if (proxy.reused())
+        _on_upstream(conn);
+}
+
+/*
+    Carry on the exchange with the upstream server of a connection once its socket is ready.
+ */
+void Webserv::_on_upstream(Connection& conn)
+{
+    Proxy& proxy = *conn.proxy();
+
+    if (proxy.sending())
+    {
+        FlushStatus status = proxy.send();
+
+        if (status == FLUSH_ERROR)
+        {
+            ws::log << ws::err << "sending a request to upstream `" << proxy.server() << "` failed: " << strerror(errno)
+                    << "\n";
+            _fail_proxy(conn);
         }
+        else if (status == FLUSH_DONE && !m_poller->modify(proxy.fd(), EPOLLIN))
+            _fail_proxy(conn);
+        return;
+    }
 
-        else if (events[i].events & EPOLLIN)
+    ProxyStatus status = proxy.receive(conn.output());
+
+    if (status == PROXY_HEADER && proxy.upgraded())
+        return _start_tunnel(conn);
+
+    if (status == PROXY_HEADER)
+    {
+        Host& host = m_servers[conn.sock_fd()].resolve(conn.req().header(HEADER_HOST));
+        bool keep_alive = _count_request(conn, host, proxy.status(), !proxy.close_delimited());
+
+        conn.set_keep_alive(keep_alive);
+        status = proxy.respond(conn.output(), keep_alive);
+    }
+
+    if (status == PROXY_ERROR)
+        _fail_proxy(conn);
+    else if (status == PROXY_DONE)
+        _finish_proxy(conn);
+    else if (proxy.responding())
+        _flush_proxy(conn);
+}
+
+/*
+    Write the part of a proxied response queued so far. The upstream server is not read while the client
+    is slow to take what was already queued, and read again once the client took all of it.
+    Returns `false` if the connection was closed.
+ */
+bool Webserv::_flush_proxy(Connection& conn)
+{
+    Proxy& proxy = *conn.proxy();
+    FlushStatus status = conn.flush();
+
+    if (status == FLUSH_ERROR)
+    {
+        ws::log << ws::err << "sending response failed: " << strerror(errno) << "\n";
+        closeConnection(conn);
+        return false;
+    }
+
+    bool paused = proxy.paused() ? status != FLUSH_DONE : conn.output().size() >= PROXY_HIGH_WATER;
+    if (paused != proxy.paused())
+    {
+        if (!m_poller->modify(proxy.fd(), paused ? 0 : (uint32_t)EPOLLIN))
         {
-            int n;
-            char buf[READ_SIZE];
+            closeConnection(conn);
+            return false;
+        }
+        proxy.set_paused(paused);
+    }
 
-            Connection& conn = m_connections[events[i].data.fd];
-            std::string& req_str = conn.req_str();
+    if (status == FLUSH_AGAIN ? conn.set_epollout(*m_poller) : conn.set_idle(*m_poller))
+        return true;
 
-            n = recv(events[i].data.fd, buf, READ_SIZE, 0);
+    closeConnection(conn);
+    return false;
+}
 
-            conn.set_last_event(time());
+/*
+    The whole response was queued, the connection goes back to reading requests once it is written.
+ */
+void Webserv::_finish_proxy(Connection& conn)
+{
+    _end_proxy(conn);
 
-            if (n == -1 || n == 0)
+    if (!conn.finish_request())
+        conn.set_keep_alive(false);
+
+    _flush(conn);
+}
+
+/*
+    Give up on the upstream server after an error, or after it did not answer in time if `timeout` is set.
+    The request goes to the next server of the group if possible. Otherwise the client gets a `502` (or a
+    `504` after a timeout) if the response did not start yet, or its connection is closed since the
+    response cannot be completed.
+ */
+void Webserv::_fail_proxy(Connection& conn, bool timeout)
+{
+    Proxy& proxy = *conn.proxy();
+
+    if (m_upstreams.erase(proxy.fd()))
+        m_poller->remove(proxy.fd());
+
+    // The server closed a pooled connection before we used it, it is worth another try and does not
+    // count as a failure of the server.
+    if (!timeout && proxy.retryable())
+    {
+        if (proxy.retry() && m_poller->add(proxy.fd(), EPOLLOUT))
+        {
+            m_upstreams[proxy.fd()] = &conn;
+            return;
+        }
+    }
+
+    proxy.fail(timeout);
+    if (proxy.can_try_next() && proxy.next())
+    {
+        if (m_poller->add(proxy.fd(), EPOLLOUT))
+        {
+            m_upstreams[proxy.fd()] = &conn;
+            if (proxy.reused())
+                _on_upstream(conn);
+            return;
+        }
+    }
+
+    bool responding = proxy.responding();
+    _end_proxy(conn);
+
+    if (responding)
+        return closeConnection(conn);
+
+    Host& host = m_servers[conn.sock_fd()].resolve(conn.req().header(HEADER_HOST));
+    Response response = HTTP_ERROR(timeout ? 504 : 502, host.config()); // Gateway Timeout, Bad Gateway
+    _send(conn, host, response);
+}
+
+/*
+    Give up on the upstream servers which did not answer in time. Exchanges paused because the client is
+    slow are not limited.
+ */
+void Webserv::_check_timeouts()
+{
+    int64_t now = time();
+    if (now - m_last_timeout_check < TIMEOUT_CHECK_INTERVAL)
+        return;
+    m_last_timeout_check = now;
+
+    std::vector<Connection *> expired;
+    for (std::map<int, Connection *>::iterator it = m_upstreams.begin(); it != m_upstreams.end(); it++)
+    {
+        Proxy& proxy = *it->second->proxy();
+        if (!proxy.paused() && proxy.deadline() <= now)
+            expired.push_back(it->second);
+    }
+
+    for (size_t i = 0; i < expired.size(); i++)
+    {
+        ws::log << ws::err << "upstream `" << expired[i]->proxy()->server() << "` timed out "
+                << (expired[i]->proxy()->responding() ? "in the middle of the response" : "before responding") << "\n";
+        _fail_proxy(*expired[i], true);
+    }
+}
+
+/*
+    Close the client connections which stayed silent for too long: `keepalive_timeout` between requests,
+    `client_timeout` while a request is received or its response is written. Connections waiting for an
+    upstream server, relayed through a tunnel or subscribed to an event channel are left alone, they are
+    expected to stay quiet.
+ */
+void Webserv::_check_client_timeouts()
+{
+    int64_t now = time();
+    if (now - m_last_client_check < CLIENT_TIMEOUT_CHECK_INTERVAL)
+        return;
+    m_last_client_check = now;
+
+    std::vector<Connection *> expired;
+    for (std::map<int, Connection *>::iterator it = m_connections.begin(); it != m_connections.end(); it++)
+    {
+        Connection& conn = *it->second;
+        if (conn.proxy() || conn.tunnel() || conn.channel())
+            continue;
+
+        // The first request of a connection is waited for like the rest of a request.
+        ServerConfig& config = m_servers[conn.sock_fd()].default_host().config();
+        bool idle = conn.output().empty() &&
+                    (conn.h2() ? conn.h2()->idle() : !conn.has_req() && conn.recv_buffer().size() == 0);
+        size_t timeout = idle && conn.requests() > 0 ? config.keepalive_timeout() : config.client_timeout();
+
+        if (timeout > 0 && now - conn.get_last_event() > (int64_t)timeout)
+            expired.push_back(&conn);
+    }
+
+    for (size_t i = 0; i < expired.size(); i++)
+    {
+        ws::log << ws::dbg << "Connection " << expired[i]->addr() << " timed out\n";
+        closeConnection(*expired[i]);
+    }
+}
+
+/*
+    Stop watching the upstream connection, which goes back to the pool if it can carry another request.
+ */
+void Webserv::_end_proxy(Connection& conn)
+{
+    Proxy& proxy = *conn.proxy();
+
+    if (m_upstreams.erase(proxy.fd()))
+        m_poller->remove(proxy.fd());
+    proxy.release();
+    conn.end_proxy();
+}
+
+/*
+    Answer a `GET` on an `sse_channel` location: the response stays open and the events of the channel are
+    written to it as they are published, starting with the ones after the `Last-Event-ID` of the client.
+ */
+void Webserv::_subscribe(Connection& conn, Host& host, Location& loc, SseChannel& channel)
+{
+    static const SharedBuffer head("HTTP/1.1 200 OK" SEP "Content-Type: text/event-stream" SEP
+                                   "Cache-Control: no-cache" SEP "Connection: close" SEP SEP);
+    Request& req = conn.req();
+
+    _count_request(conn, host, 200, false);
+    conn.set_keep_alive(false);
+    conn.output().push(head);
+
+    StringView last_id = req.header(HEADER_LAST_EVENT_ID);
+    if (!last_id.empty() && last_id.size() <= 18)
+    {
+        uint64_t id = 0;
+        size_t i = 0;
+        while (i < last_id.size() && std::isdigit((unsigned char)last_id[i]))
+            id = id * 10 + (last_id[i++] - '0');
+        if (i == last_id.size())
+            channel.replay(id, conn.output());
+    }
+
+    conn.recv_buffer().clear();
+    conn.clearReq();
+    conn.arena().release();
+
+    conn.subscribe(channel, loc.sse_max_queue());
+    _flush_events(conn);
+}
+
+/*
+    Queue an event to every subscriber of `channel` and write it right away. The event is encoded once,
+    all the queues share its buffer.
+ */
+void Webserv::_publish(SseChannel& channel, StringView type, StringView data)
+{
+    SharedBuffer event = channel.publish(type, data);
+
+    // Subscribers which are dropped leave the channel.
+    std::vector<Connection *> subscribers(channel.subscribers().begin(), channel.subscribers().end());
+    for (size_t i = 0; i < subscribers.size(); i++)
+    {
+        subscribers[i]->output().push(event);
+        _flush_events(*subscribers[i]);
+    }
+
+    ws::log << ws::dbg << "event published to " << subscribers.size() << " subscribers of `" << channel.name()
+            << "`\n";
+}
+
+/*
+    Write the events queued for a subscriber. A subscriber which does not keep up, and has more than its
+    `sse_max_queue` still waiting, is dropped. Returns `false` if the connection was closed.
+ */
+bool Webserv::_flush_events(Connection& conn)
+{
+    FlushStatus status = conn.flush();
+
+    if (status == FLUSH_ERROR)
+        ws::log << ws::err << "sending events failed: " << strerror(errno) << "\n";
+    else if (conn.output().size() > conn.max_queue())
+        ws::log << ws::warn << "dropping a slow subscriber of `" << conn.channel()->name() << "`, "
+                << conn.output().size() << " bytes are waiting\n";
+    else if (status == FLUSH_AGAIN ? conn.set_epollout(*m_poller) : conn.set_idle(*m_poller))
+        return true;
+
+    closeConnection(conn);
+    return false;
+}
+
+/*
+    The upstream server switched to the WebSocket protocol: its response is passed on, and from then on the
+    connection relays both ways between the client and the server until either of them closes it.
+ */
+void Webserv::_start_tunnel(Connection& conn)
+{
+    Proxy& proxy = *conn.proxy();
+    Host& host = m_servers[conn.sock_fd()].resolve(conn.req().header(HEADER_HOST));
+
+    _count_request(conn, host, proxy.status(), false);
+    proxy.respond(conn.output(), false);
+
+    // The socket of the server stays registered, it is now watched for the tunnel.
+    m_upstreams.erase(proxy.fd());
+    Tunnel *tunnel = proxy.switch_protocols();
+    conn.end_proxy();
+    conn.start_tunnel(tunnel);
+    m_tunnels[tunnel->fd()] = &conn;
+
+    conn.recv_buffer().clear();
+    conn.clearReq();
+    conn.arena().release();
+
+    if (!tunnel->init(conn.tls() != NULL))
+        return closeConnection(conn);
+    _on_tunnel(conn);
+}
+
+/*
+    Relay what the client and the server of a tunnel are ready for.
+ */
+void Webserv::_on_tunnel(Connection& conn)
+{
+    Tunnel& tunnel = *conn.tunnel();
+    TunnelStatus status = tunnel.relay(conn);
+
+    if (status == TUNNEL_ERROR)
+        ws::log << ws::err << "tunnel to upstream `" << tunnel.server() << "` failed: " << strerror(errno) << "\n";
+    if (status != TUNNEL_AGAIN || !tunnel.watch(*m_poller, conn))
+        closeConnection(conn);
+}
+
+void Webserv::_end_tunnel(Connection& conn)
+{
+    if (m_tunnels.erase(conn.tunnel()->fd()))
+        m_poller->remove(conn.tunnel()->fd());
+    conn.end_tunnel();
+}
+
+/*
+    Called once the headers of a request are parsed, before its body is received. Requests which
+    would be refused anyway are answered right away so the client does not send a body for nothing.
+    Returns `false` if the connection was closed.
+ */
+bool Webserv::_start_request(Connection& conn)
+{
+    Request& req = conn.req();
+    Server& server = m_servers[conn.sock_fd()];
+    ServerConfig& limits = server.default_host().config();
+
+    if (req.header_size() > limits.max_header_size() || req.header_count() > limits.max_headers())
+    {
+        _reject(conn, limits, 431); // Request Header Fields Too Large
+        return false;
+    }
+
+    Host& host = server.resolve(req.header(HEADER_HOST));
+    ServerConfig& config = host.config();
+
+    if (config.max_content_length() > 0 && req.has_header(HEADER_CONTENT_LENGTH) &&
+        req.content_length() > config.max_content_length())
+    {
+        _reject(conn, config, 413); // Payload Too Large
+        return false;
+    }
+
+    // HTTP/1.0 clients do not know about `Expect`, RFC 9110 says to ignore it.
+    bool expect_continue = false;
+    if (req.has_header(HEADER_EXPECT) && req.protocol() != "HTTP/1.0")
+    {
+        if (!req.header(HEADER_EXPECT).equals_ignore_case("100-continue"))
+        {
+            _reject(conn, config, 417); // Expectation Failed
+            return false;
+        }
+        expect_continue = true;
+    }
+
+    if (req.is_chunked())
+        conn.start_chunked(config.max_content_length());
+
+    // Files sent to an upload location are written while the body arrives.
+    Location *loc = host.router().match(req.path());
+
+    if (req.method() == POST && req.content_type().starts_with("multipart/form-data"))
+    {
+        if (loc && loc->allows(POST) && loc->redirect().is_none() && loc->root().is_some() &&
+            loc->upload_dir().is_some() && loc->proxy_pass().is_none())
+            conn.start_upload(req.content_type(), loc->upload_dir().unwrap());
+    }
+    else if (req.method() == PUT && (req.has_header(HEADER_CONTENT_LENGTH) || req.is_chunked()))
+    {
+        if (loc && loc->allows(PUT) && loc->redirect().is_none() && loc->upload_dir().is_some() &&
+            loc->proxy_pass().is_none())
+            conn.start_put(loc->upload_dir().unwrap(), req.path().substr(loc->route().size()));
+    }
+
+    // The client waits for this before sending the body.
+    if (expect_continue && !(conn.put() && conn.put()->failed()) &&
+        (!req.has_header(HEADER_CONTENT_LENGTH) || req.body_size() < req.content_length()))
+    {
+        static const SharedBuffer continue_line("HTTP/1.1 100 Continue" SEP SEP);
+        conn.output().push(continue_line);
+        if (!_flush(conn))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+    Process what was received on a connection, the bytes from offset `previous_size` of the receive buffer
+    are new.
+ */
+void Webserv::_on_receive(Connection& conn, size_t previous_size)
+{
+    RecvBuffer& recv_buffer = conn.recv_buffer();
+
+    if (conn.h2())
+    {
+        _serve_h2(conn);
+        return;
+    }
+
+    if (!conn.has_req())
+    {
+        ServerConfig& limits = m_servers[conn.sock_fd()].default_host().config();
+
+        // Clients which know we speak HTTP/2 start the connection with its preface instead of a
+        // request.
+        size_t preface_size = std::min(recv_buffer.size(), (size_t)H2_PREFACE_SIZE);
+        if (conn.requests() == 0 && std::memcmp(recv_buffer.data(), H2_PREFACE, preface_size) == 0)
+        {
+            if (preface_size == H2_PREFACE_SIZE)
             {
-                ws::log << ws::err << "recv() failed: " << strerror(errno) << "\n";
-                closeConnection(conn);
-                continue;
+                conn.start_h2(m_servers[conn.sock_fd()]);
+                _serve_h2(conn);
             }
+            return;
+        }
 
-            req_str.append(buf, n);
+        // Only scan the new data, plus the 3 bytes before it in case the `\r\n\r\n` is split
+        // between two reads.
+        size_t from = previous_size >= 3 ? previous_size - 3 : 0;
+        if (scan_header_end(recv_buffer.data(), recv_buffer.size(), from) == (size_t)-1)
+        {
+            if (recv_buffer.size() > limits.max_header_size())
+                _reject(conn, limits, 431); // Request Header Fields Too Large
+            return;
+        }
 
-            if (conn.req().is_some() || req_str.find(SEP SEP) != std::string::npos)
-            {
-                Request req;
+        // The client send us a invalid HTTP request.
+        Result<int, HttpStatus> res = conn.parse_req();
+        if (res.is_err())
+        {
+            _reject(conn, limits, res.unwrap_err());
+            return;
+        }
 
-                if (conn.req().is_some())
-                {
-                    req = conn.req().unwrap();
-                }
-                else
-                {
-                    std::string header = req_str.substr(0, req_str.find(SEP SEP) + 4);
-                    Result<Request, int> res = Request::parse(header);
-
-                    // The client send us a invalid HTTP request.
-                    if (res.is_err())
-                    {
-                        closeConnection(conn);
-                        continue;
-                    }
-
-                    conn.setReq(res.unwrap());
-                    req = conn.req().unwrap();
-                }
+        if (!_start_request(conn))
+            return;
+    }
 
-                size_t contentLength = req.content_length();
+    Request& req = conn.req();
+    bool has_body = req.method() == POST || req.method() == PUT;
 
-                if (req.method() != POST || conn.req_str().size() - req.header_size() >= contentLength)
-                {
-                    if (!conn.set_epollout(m_epollFd))
-                        closeConnection(conn);
-                }
-            }
+    conn.keep_pipelined();
+
+    if (conn.chunked() && !conn.decode_body(previous_size))
+    {
+        ServerConfig& config = m_servers[conn.sock_fd()].resolve(req.header(HEADER_HOST)).config();
+        _reject(conn, config, conn.chunked()->error());
+        return;
+    }
+
+    if (conn.put() && !conn.put()->failed())
+    {
+        if (!conn.put_body())
+        {
+            closeConnection(conn);
+            return;
         }
+    }
+    else if (conn.is_uploading())
+        conn.upload_body();
+    else if (has_body)
+    {
+        // Large bodies are moved to a temporary file so they do not stay in memory.
+        ServerConfig& config = m_servers[conn.sock_fd()].resolve(req.header(HEADER_HOST)).config();
+        if (!conn.store_body(config.client_body_buffer_size(), config.client_body_temp_path()))
+        {
+            closeConnection(conn);
+            return;
+        }
+    }
 
-        else if ((events[i].events & EPOLLOUT))
+    // Wait for the rest of the body, unless the request cannot be processed anyway.
+    if (!has_body || conn.body_received() || (conn.put() && conn.put()->failed()))
+        _respond(conn);
+}
+
+void Webserv::poll_events()
+{
+    int eventCount = 0;
+    PollEvent events[MAX_EVENTS];
+
+    // Upstream servers which stop answering, and silent clients, are only noticed by checking their deadlines.
+    int timeout = -1;
+    if (!m_upstreams.empty())
+        timeout = TIMEOUT_CHECK_INTERVAL;
+    else if (!m_connections.empty())
+        timeout = CLIENT_TIMEOUT_CHECK_INTERVAL;
+    eventCount = m_poller->wait(events, MAX_EVENTS, timeout);
+    for (int i = 0; i < eventCount; i++)
+    {
+        if (events[i].fd == m_watcher.fd())
         {
-            Connection& conn = m_connections[events[i].data.fd];
-            Result<Request, int> res = Request::parse(conn.req_str());
+            m_watcher.dispatch();
+            continue;
+        }
 
+        if (m_servers.count(events[i].fd) > 0)
+        {
+            Result<Connection *, int> res = acceptConnection(events[i].fd, events[i].accepted);
             if (res.is_err())
-            {
-                closeConnection(conn);
                 continue;
-            }
-
-            Request req = res.unwrap();
 
-            Host& host = m_servers[conn.sock_fd()].default_host();
+            Connection *conn = res.unwrap();
+            conn->set_last_event(time());
+            m_connections[conn->fd()] = conn;
+            m_connection_count++;
+            continue;
+        }
 
-            if (req.has_param("Host"))
+        std::map<int, Connection *>::iterator it = m_connections.find(events[i].fd);
+        if (it == m_connections.end())
+        {
+            std::map<int, Connection *>::iterator upstream = m_upstreams.find(events[i].fd);
+            if (upstream != m_upstreams.end())
             {
-                std::string hostString = req.get_param("Host").substr(0, req.get_param("Host").find(':'));
-                if (m_servers[conn.sock_fd()].has_host(hostString))
-                    host = m_servers[conn.sock_fd()].host(hostString);
+                upstream->second->set_last_event(time());
+                _on_upstream(*upstream->second);
             }
-
-            Response response;
-            // In our case only `POST` requests have a body. Other requests will not set a `Content-Length`.
-            if (req.method() == POST && !req.has_param("Content-Length"))
+            else if ((upstream = m_tunnels.find(events[i].fd)) != m_tunnels.end())
             {
-                response = HTTP_ERROR(411, host.config()); // Length required
+                upstream->second->set_last_event(time());
+                _on_tunnel(*upstream->second);
             }
-            else if (host.config().max_content_length() > 0 &&
-                     conn.req_str().size() - conn.req().unwrap().header_size() > host.config().max_content_length())
+            continue;
+        }
+        Connection& conn = *it->second;
+
+        // A client closing its side ends the tunnel, once what it sent before is passed on.
+        if (conn.tunnel())
+        {
+            conn.set_last_event(time());
+            _on_tunnel(conn);
+            continue;
+        }
+
+        if ((events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+        {
+            closeConnection(conn);
+            continue;
+        }
+
+        else if (conn.tls() && !conn.tls()->established())
+        {
+            conn.set_last_event(time());
+            _handshake(conn);
+        }
+
+        else if (events[i].events & EPOLLIN)
+        {
+            // The rest of a `PUT` body goes from the socket to its file without being read, unless it
+            // has to be decrypted first.
+            if (conn.put() && !conn.put()->failed() && !conn.chunked() && !conn.tls())
             {
-                response = HTTP_ERROR(413, host.config()); // Payload Too Large
+                Request& req = conn.req();
+                ssize_t n = conn.splice_body(req.content_length() - req.body_size());
+
+                conn.set_last_event(time());
+
+                if (n == -1 && errno == EAGAIN)
+                    continue;
+                if (n == -1 || n == 0)
+                {
+                    ws::log << ws::err << "splice() failed: " << strerror(errno) << "\n";
+                    closeConnection(conn);
+                    continue;
+                }
+
+                if (req.body_size() >= req.content_length())
+                    _respond(conn);
+                continue;
             }
-            else
+
+            RecvBuffer& recv_buffer = conn.recv_buffer();
+
+            // Read as much as the free space left in the buffer. Once we know how large the body
+            // is, read it in larger steps so uploads do not go through many small reads.
+            size_t read_size = recv_buffer.capacity() - recv_buffer.size();
+            if (conn.has_req())
             {
-                response = host.router().route(req);
+                Request& req = conn.req();
+                size_t expected = req.header_size() + req.content_length();
+                size_t received = req.header_size() + req.body_size();
+                if ((req.method() == POST || req.method() == PUT) && req.has_header(HEADER_CONTENT_LENGTH) &&
+                    expected > received)
+                    read_size = std::min(expected - received, (size_t)MAX_READ_SIZE);
             }
+            if (read_size < READ_SIZE)
+                read_size = READ_SIZE;
+            if (conn.tls() && read_size < TLS_RECORD_SIZE)
+                read_size = TLS_RECORD_SIZE;
 
-            conn.req_str().clear();
-            conn.clearReq();
+            char *buf = recv_buffer.reserve(read_size);
+            if (!buf)
+            {
+                ws::log << ws::err << "cannot allocate a receive buffer of " << read_size << " bytes\n";
+                closeConnection(conn);
+                continue;
+            }
 
-            if (req.is_keep_alive())
-                response.add_param("Connection", "keep-alive");
+            ssize_t n = conn.receive(buf, read_size);
 
-            if (!response.status().is_error())
-                ws::log << ws::info << strmethod(req.method()) << " `" << req.path() << "` -> " << NGREEN
-                        << response.status().code() << " " << response.status() << RESET << "\n";
-            else
-                ws::log << ws::info << strmethod(req.method()) << " `" << req.path() << "` -> " << NRED
-                        << response.status().code() << " " << response.status() << RESET << "\n";
+            conn.set_last_event(time());
 
-            // Close the connection if the client close the connection, we don't want to keep
-            // it alive or there was an error while sending the response.
-            if (!response.send(events[i].data.fd, host.config()) || !req.is_keep_alive() || req.is_closed() ||
-                response.get_param("Connection") == "close" || !conn.set_epollin(m_epollFd))
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                continue;
+            if (n == -1 || n == 0)
+            {
+                ws::log << ws::err << "recv() failed: " << strerror(errno) << "\n";
                 closeConnection(conn);
+                continue;
+            }
+
+            size_t previous_size = recv_buffer.size();
+            recv_buffer.commit(n);
+            _on_receive(conn, previous_size);
+        }
+
+        else if ((events[i].events & EPOLLOUT))
+        {
+            conn.set_last_event(time());
+            _flush(conn);
         }
     }
 
-    // #define TIMEOUT 1000
+    // Answering a pipelined request may queue the next one of the same connection.
+    while (!m_pipelined.empty())
+    {
+        std::vector<int> pipelined;
+        pipelined.swap(m_pipelined);
 
-    //     while (1)
-    //     {
-    //         size_t n = 0;
+        for (size_t i = 0; i < pipelined.size(); i++)
+        {
+            std::map<int, Connection *>::iterator it = m_connections.find(pipelined[i]);
+            if (it != m_connections.end() && !it->second->has_req() && !it->second->recv_buffer().empty())
+                _on_receive(*it->second, 0);
+        }
+    }
 
-    //         for (std::map<int, Connection>::iterator it = m_connections.begin(); it != m_connections.end(); it++)
-    //         {
-    //             Connection& conn = it->second;
-    //             if (conn.get_last_event() - time() > TIMEOUT)
-    //             {
-    //                 closeConnection(conn);
-    //                 ws::log << ws::dbg << "Connection " << conn.addr() << " timed out\n";
-    //                 break;
-    //             }
-    //             n++;
-    //         }
+    if (!m_upstreams.empty())
+        _check_timeouts();
+    if (!m_connections.empty())
+        _check_client_timeouts();
 
-    //         if (n == m_connections.size())
-    //             break;
-    //     }
+    if (m_report)
+    {
+        m_report = false;
+        g_upstreams.report();
+    }
 }
 
 void Webserv::closeConnection(Connection& conn)
 {
-    if (epoll_ctl(m_epollFd, EPOLL_CTL_DEL, conn.fd(), NULL) == -1)
-        ws::log << ws::err << FILE_INFO << "epoll_ctl(EPOLL_CTL_DEL) failed: " << strerror(errno) << "\n";
+    if (conn.proxy())
+        _end_proxy(conn);
+    if (conn.tunnel())
+        _end_tunnel(conn);
+
+    if (conn.tls())
+        conn.tls()->shutdown();
+
+    m_poller->remove(conn.fd());
     close(conn.fd());
     m_connections.erase(m_connections.find(conn.fd()));
+    delete &conn;
 }
 
 bool Webserv::has_server(struct sockaddr_in addr)
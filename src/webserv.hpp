@@ -7,7 +7,6 @@
 #include <map>
 #include <netinet/in.h>
 #include <string>
-#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -15,10 +14,20 @@
 
 #include "config/config.hpp"
 #include "connection.hpp"
+#include "poller.hpp"
 #include "server.hpp"
+#include "tls.hpp"
+#include "watcher.hpp"
 
 #define MAX_EVENTS 128
+/* Minimum number of bytes read from a socket at once. */
 #define READ_SIZE 4096
+/* Maximum number of bytes read from a socket at once when receiving a large body. */
+#define MAX_READ_SIZE (1024 * 1024)
+/* How often the deadlines of upstream servers are checked, in milliseconds. */
+#define TIMEOUT_CHECK_INTERVAL 100
+/* How often client connections are checked for `keepalive_timeout` and `client_timeout`, in milliseconds. */
+#define CLIENT_TIMEOUT_CHECK_INTERVAL 1000
 
 extern char **g_envp;
 
@@ -27,28 +36,79 @@ class Webserv
 public:
     Webserv();
 
-    int getEpollFd() const;
-
-    Result<Connection, int> acceptConnection(int sock_fd);
+    /*
+        Register a new connection of the listening socket `sock_fd`. `conn` is the connection if it was
+        already accepted by the poller, otherwise `-1`.
+     */
+    Result<Connection *, int> acceptConnection(int sock_fd, int conn);
 
     int initialize(std::string config_path);
     void eventLoop();
 
     void quit();
 
+    /*
+        Log the counters of the upstream servers at the next iteration of the event loop.
+     */
+    void report();
+
     void closeConnection(Connection& conn);
     void closeFds();
 
 private:
-    int m_epollFd;
-    std::map<int, Connection> m_connections;
+    Poller *m_poller;
+    std::map<int, Connection *> m_connections;
+    /* Connections waiting for an upstream server, by the socket of the upstream connection. */
+    std::map<int, Connection *> m_upstreams;
+    /* Connections relayed to an upstream server after switching protocols, by the socket of the server. */
+    std::map<int, Connection *> m_tunnels;
 
     bool m_running;
+    bool m_report;
+    int64_t m_last_timeout_check;
+    int64_t m_last_client_check;
 
     Config m_config;
     std::map<int, Server> m_servers;
 
+    Watcher m_watcher;
+
+    /* Connections whose receive buffer holds requests pipelined behind the ones answered, by socket. */
+    std::vector<int> m_pipelined;
+
+    /* Connections accepted, connections which served more than one request and requests served. */
+    size_t m_connection_count;
+    size_t m_reused_count;
+    size_t m_request_count;
+
     void poll_events();
+    void _on_receive(Connection& conn, size_t previous_size);
+    void _reject(Connection& conn, ServerConfig& config, HttpStatus status);
+    bool _start_request(Connection& conn);
+    void _respond(Connection& conn);
+    void _send(Connection& conn, Host& host, Response& response);
+    bool _count_request(Connection& conn, Host& host, HttpStatus status, bool keep_alive);
+    bool _flush(Connection& conn);
+    void _handshake(Connection& conn);
+    void _upgrade_h2(Connection& conn);
+    void _serve_h2(Connection& conn);
+
+    void _start_proxy(Connection& conn, Location& loc, CacheWriter *cache);
+    void _on_upstream(Connection& conn);
+    bool _flush_proxy(Connection& conn);
+    void _finish_proxy(Connection& conn);
+    void _fail_proxy(Connection& conn, bool timeout = false);
+    void _check_timeouts();
+    void _check_client_timeouts();
+    void _end_proxy(Connection& conn);
+
+    void _subscribe(Connection& conn, Host& host, Location& loc, SseChannel& channel);
+    void _publish(SseChannel& channel, StringView type, StringView data);
+    bool _flush_events(Connection& conn);
+
+    void _start_tunnel(Connection& conn);
+    void _on_tunnel(Connection& conn);
+    void _end_tunnel(Connection& conn);
 
     bool has_server(struct sockaddr_in addr);
     Server& get_server(struct sockaddr_in addr);
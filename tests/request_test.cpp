@@ -0,0 +1,133 @@
+#include <cstring>
+#include <string>
+
+#include "http/request.hpp"
+#include "support.hpp"
+
+// clang-format off
+/* What a browser sends for a page, about 600 bytes. */
+static const std::string browser_request =
+    "GET /docs/index.html?lang=en&page=2 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Referer: https://www.example.com/docs/\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=8f2a6c1e9b7d4e3f; theme=dark; consent=1\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "If-Modified-Since: Tue, 15 Oct 2024 08:12:31 GMT\r\n"
+    "If-None-Match: \"5f3a-61c2b9e4d1f80\"\r\n"
+    "Priority: u=0, i\r\n"
+    "\r\n";
+// clang-format on
+
+static HttpStatus parse_status(const std::string& text)
+{
+    Request req;
+    Result<int, HttpStatus> res = req.parse(text.data(), text.size());
+    return res.is_ok() ? HttpStatus(200) : res.unwrap_err();
+}
+
+/*
+    Parsing keeps views into the receive buffer, a typical request does not allocate at all.
+ */
+static void test_zero_allocations()
+{
+    const char *data = browser_request.data();
+    size_t before = allocations();
+
+    Request req;
+    bool ok = req.parse(data, browser_request.size()).is_ok();
+    StringView host = req.header(HEADER_HOST);
+    StringView etag = req.get_param("if-none-match");
+    bool keep_alive = req.is_keep_alive();
+
+    CHECK(allocations() == before);
+
+    CHECK(ok);
+    CHECK(browser_request.size() >= 550 && browser_request.size() <= 700);
+    CHECK(req.method() == GET);
+    CHECK(req.path() == "/docs/index.html");
+    CHECK(req.query() == "lang=en&page=2");
+    CHECK(host == "www.example.com");
+    CHECK(etag == "\"5f3a-61c2b9e4d1f80\"");
+    CHECK(keep_alive);
+    CHECK(req.path().data() >= data && req.path().data() < data + browser_request.size());
+    CHECK(req.header_size() == browser_request.size());
+}
+
+/*
+    Headers past the inline ones are found again in the buffer, parsing still does not allocate.
+ */
+static void test_many_headers()
+{
+    std::string text = "GET / HTTP/1.1\r\nHost: a\r\n";
+    for (int i = 0; i < REQUEST_INLINE_HEADERS + 8; i++)
+        text += "X-Header-" + std::string(1, 'a' + i) + ": value\r\n";
+    text += "X-Spaces: \t spaced out \t\r\n";
+    text += "\r\n";
+
+    std::string first = "x-header-a";
+    std::string last = "X-Header-" + std::string(1, 'a' + REQUEST_INLINE_HEADERS + 7);
+    size_t before = allocations();
+
+    Request req;
+    bool ok = req.parse(text.data(), text.size()).is_ok();
+    StringView a = req.get_param(first);
+    StringView z = req.get_param(last);
+    StringView spaces = req.get_param("x-spaces");
+    bool missing = req.has_param("X-Missing");
+
+    CHECK(allocations() == before);
+    CHECK(ok);
+    CHECK(a == "value");
+    CHECK(z == "value");
+    CHECK(spaces == "spaced out");
+    CHECK(!missing);
+}
+
+static void test_versions()
+{
+    CHECK(parse_status("GET / HTTP/1.1\r\nHost: a\r\n\r\n").code() == 200);
+    CHECK(parse_status("GET / HTTP/1.0\r\n\r\n").code() == 200);
+    CHECK(parse_status("GET / HTTP/1.2\r\nHost: a\r\n\r\n").code() == 200);
+    CHECK(parse_status("GET / HTTP/2.0\r\nHost: a\r\n\r\n").code() == 505);
+    CHECK(parse_status("GET / HTTP/0.9\r\nHost: a\r\n\r\n").code() == 505);
+    CHECK(parse_status("GET / HTTP/1\r\nHost: a\r\n\r\n").code() == 400);
+    CHECK(parse_status("GET / http/1.1\r\nHost: a\r\n\r\n").code() == 400);
+    CHECK(parse_status("GET / HTTP/1.10\r\nHost: a\r\n\r\n").code() == 400);
+
+    Request req;
+    std::string http10 = "GET / HTTP/1.0\r\n\r\n";
+    CHECK(req.parse(http10.data(), http10.size()).is_ok());
+    CHECK(!req.is_keep_alive());
+}
+
+static void test_malformed()
+{
+    CHECK(parse_status("GET / HTTP/1.1\r\nHost: a\r\n").code() == 400);
+    CHECK(parse_status("GET  / HTTP/1.1\r\nHost: a\r\n\r\n").code() == 400);
+    CHECK(parse_status("G(T / HTTP/1.1\r\nHost: a\r\n\r\n").code() == 400);
+    CHECK(parse_status("GET / HTTP/1.1\r\nBad Name: a\r\n\r\n").code() == 400);
+    CHECK(parse_status("GET / HTTP/1.1\r\nHost: a\r\nHost: b\r\n\r\n").code() == 400);
+    CHECK(parse_status("POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n").code() == 400);
+}
+
+int main()
+{
+    init_tables();
+
+    test_zero_allocations();
+    test_many_headers();
+    test_versions();
+    test_malformed();
+
+    std::cout << "request_test: " << (g_failures ? "FAILED" : "ok") << "\n";
+    return g_failures != 0;
+}
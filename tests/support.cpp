@@ -0,0 +1,77 @@
+#include <cstdlib>
+#include <time.h>
+
+#include "file.hpp"
+#include "http/request.hpp"
+#include "http/scan.hpp"
+#include "http2/hpack.hpp"
+#include "support.hpp"
+#include "webserv.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+Webserv g_webserv;
+char **g_envp;
+
+int g_failures = 0;
+
+static size_t g_allocations = 0;
+
+// The allocator of the libc is wrapped to count the calls, `operator new` goes through `malloc`.
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+
+    void *malloc(size_t size) throw()
+    {
+        g_allocations++;
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size) throw()
+    {
+        g_allocations++;
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *ptr, size_t size) throw()
+    {
+        g_allocations++;
+        return __libc_realloc(ptr, size);
+    }
+}
+
+void init_tables()
+{
+    File::_build_mime_table();
+    Request::_build_header_table();
+    _init_scanners();
+    HpackDecoder::_build_huffman_tree();
+}
+
+size_t allocations()
+{
+    return g_allocations;
+}
+
+uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+double seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <stdint.h>
+
+/*
+    Helpers shared by the tests and the benchmarks. They are linked with every object of the server but
+    `main.o`, so this also defines the globals of `main.cpp`.
+ */
+
+extern int g_failures;
+
+#define CHECK(COND)                                                                                                    \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (!(COND))                                                                                                   \
+        {                                                                                                              \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #COND "\n";                                 \
+            g_failures++;                                                                                              \
+        }                                                                                                              \
+    } while (0)
+
+/*
+    Build the tables `main` builds before the server starts.
+ */
+void init_tables();
+
+/*
+    Number of calls to `malloc`, `calloc` and `realloc` since the program started, `operator new` included.
+ */
+size_t allocations();
+
+/*
+    Time stamp counter on x86, nanoseconds elsewhere.
+ */
+uint64_t cycles();
+
+/*
+    Monotonic time in seconds.
+ */
+double seconds();
@@ -0,0 +1,132 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#include "arena.hpp"
+#include "http/error_pages.hpp"
+#include "http/multipart.hpp"
+#include "http/put_upload.hpp"
+#include "negative_cache.hpp"
+#include "router.hpp"
+#include "support.hpp"
+#include "watcher.hpp"
+
+/* Directory served and written by the location `/files`, removed at the end. */
+static std::string g_dir;
+
+static int get_status(Router& router, const std::string& path)
+{
+    std::string text = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    Request req;
+    Arena arena;
+
+    if (req.parse(text.data(), text.size()).is_err())
+        return 0;
+    return router.route(req, arena).status().code();
+}
+
+static std::string read_file(const std::string& path)
+{
+    std::ifstream file(path.c_str());
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
+
+static std::string part(const std::string& name, const std::string& content)
+{
+    return "--XyZ\r\nContent-Disposition: form-data; name=\"file\"; filename=\"" + name + "\"\r\n\r\n" + content +
+           "\r\n";
+}
+
+static int multipart_upload(const std::string& parts)
+{
+    std::string body = parts + "--XyZ--\r\n";
+    MultipartParser parser("multipart/form-data; boundary=XyZ", g_dir);
+
+    CHECK(parser.feed(body.data(), body.size()) == body.size());
+    Result<int, HttpStatus> res = parser.finish();
+    return res.is_ok() ? 200 : res.unwrap_err().code();
+}
+
+/*
+    A path answered `404` is remembered by the negative cache, an upload to it must be served right away
+    rather than once the entry expires.
+ */
+static void test_get_after_upload(Router& router)
+{
+    CHECK(get_status(router, "/files/put.txt") == 404);
+    PutUpload put(g_dir, "put.txt");
+    CHECK(put.write("hello", 5));
+    CHECK(put.finish().code() == 201);
+    CHECK(get_status(router, "/files/put.txt") == 200);
+
+    CHECK(get_status(router, "/files/part.txt") == 404);
+    CHECK(multipart_upload(part("part.txt", "hello")) == 200);
+    CHECK(get_status(router, "/files/part.txt") == 200);
+}
+
+/*
+    An upload never replaces an existing file, the part is discarded and reported with `409`, while the
+    other parts of the body are still written.
+ */
+static void test_no_clobber(Router& router)
+{
+    CHECK(multipart_upload(part("kept.txt", "first")) == 200);
+    CHECK(multipart_upload(part("kept.txt", "second") + part("other.txt", "other")) == 409);
+    CHECK(read_file(g_dir + "/kept.txt") == "first");
+    CHECK(read_file(g_dir + "/other.txt") == "other");
+    CHECK(get_status(router, "/files/other.txt") == 200);
+}
+
+static bool load_router(Config& config)
+{
+    char path[] = "/tmp/webserv-upload-test-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return false;
+    close(fd);
+
+    std::ofstream file(path);
+    file << "server {\n    server_name \"localhost\"\n    listen \"127.0.0.1:9999\"\n";
+    file << "    location \"/files\" {\n        methods GET,POST,PUT\n";
+    file << "        root \"" << g_dir << "\"\n        upload_dir \"" << g_dir << "\"\n    }\n}\n";
+    file.close();
+
+    bool ok = config.load_from_file(path).is_ok() && !config.servers().empty();
+    unlink(path);
+    return ok;
+}
+
+int main()
+{
+    init_tables();
+
+    char dir[] = "/tmp/webserv-upload-XXXXXX";
+    if (!mkdtemp(dir))
+        return 1;
+    g_dir = dir;
+
+    Config config;
+    Watcher watcher;
+    CHECK(load_router(config));
+    if (g_failures == 0)
+    {
+        // As `Webserv::init` does, the root is watched but events are not read here.
+        watcher.init();
+        g_error_pages.build(config, watcher);
+        g_negative_cache.build(config, watcher);
+
+        Router router(config.servers()[0]);
+        test_get_after_upload(router);
+        test_no_clobber(router);
+    }
+
+    std::string cleanup = "rm -rf '" + g_dir + "'";
+    CHECK(std::system(cleanup.c_str()) == 0);
+
+    std::cout << "upload_test: " << (g_failures ? "FAILED" : "ok") << "\n";
+    return g_failures != 0;
+}